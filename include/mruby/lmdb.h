@@ -26,4 +26,19 @@ MRB_API void      mrb_lmdb_put(mrb_state *mrb, MDB_txn *txn, MDB_dbi dbi,
 MRB_API mrb_bool  mrb_lmdb_del(mrb_state *mrb, MDB_txn *txn, MDB_dbi dbi,
                                 const void *key, size_t key_len);
 
+/* Raw handles behind MDB::Env, MDB::Txn and MDB::Database objects.
+ * Raise if the object is closed or of the wrong type. */
+MRB_API MDB_env  *mrb_lmdb_env_ptr(mrb_state *mrb, mrb_value env);
+MRB_API MDB_txn  *mrb_lmdb_txn_ptr(mrb_state *mrb, mrb_value txn);
+MRB_API MDB_dbi   mrb_lmdb_dbi(mrb_state *mrb, mrb_value database);
+
+/* Hand back the read txn MDB::Env parks for one-shot reads (see
+ * Env#max_staleness). LMDB allows one read txn per thread, so call this
+ * before mdb_txn_begin or mdb_txn_renew on an env from mrb_lmdb_env_ptr.
+ * A no-op for envs the gem did not open. Never raises. */
+MRB_API void      mrb_lmdb_env_release(MDB_env *env);
+
+/* Raises the MDB::Error subclass for an LMDB return code. */
+MRB_API mrb_noreturn void mrb_lmdb_raise(mrb_state *mrb, int rc, const char *func);
+
 MRB_END_DECL
\ No newline at end of file
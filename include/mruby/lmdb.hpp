@@ -0,0 +1,401 @@
+#pragma once
+
+/*
+ * mruby-lmdb C++ API
+ *
+ * Header-only RAII wrappers for native gems that want to read and write
+ * LMDB without allocating mruby objects. Values come back as
+ * std::string_view pointing into the memory map; they are valid until the
+ * owning transaction ends, or in a write transaction until the next write.
+ *
+ * LMDB failures are thrown as mrb_lmdb::error so destructors run. Convert
+ * them into MDB::Error exceptions at the mruby method boundary with
+ * mrb_lmdb::protect(). mruby exceptions raised inside protect() still
+ * longjmp past C++ frames unless mruby is built with MRB_USE_CXX_EXCEPTION.
+ */
+
+#include <mruby/lmdb.h>
+
+#include <cstddef>
+#include <cstring>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+namespace mrb_lmdb {
+
+/* ── Errors ─────────────────────────────────────────────────────────────── */
+
+class error : public std::runtime_error {
+ public:
+  error(int rc, const char *func)
+    : std::runtime_error(mdb_strerror(rc)), rc_(rc), func_(func) {}
+
+  int         code() const noexcept { return rc_; }
+  const char *func() const noexcept { return func_; }
+
+ private:
+  int         rc_;
+  const char *func_;
+};
+
+inline void
+check(int rc, const char *func)
+{
+  if (rc != MDB_SUCCESS)
+    throw error(rc, func);
+}
+
+/* Run fn, turning a thrown mrb_lmdb::error into the matching MDB::Error. */
+template <typename F>
+auto
+protect(mrb_state *mrb, F &&fn) -> decltype(fn())
+{
+  int rc;
+  const char *func;
+  try {
+    return std::forward<F>(fn)();
+  } catch (const error &e) {
+    rc   = e.code();
+    func = e.func();
+  }
+  mrb_lmdb_raise(mrb, rc, func);
+}
+
+/* ── MDB_val helpers ────────────────────────────────────────────────────── */
+
+inline MDB_val
+to_val(std::string_view s) noexcept
+{
+  return MDB_val{ s.size(), const_cast<char *>(s.data()) };
+}
+
+inline std::string_view
+to_view(const MDB_val &v) noexcept
+{
+  return std::string_view(static_cast<const char *>(v.mv_data), v.mv_size);
+}
+
+/* ── Codecs ─────────────────────────────────────────────────────────────── */
+
+/*
+ * codec<T>::encode(const T &) -> MDB_val   (may point into the argument)
+ * codec<T>::decode(const MDB_val &) -> T
+ *
+ * Specialize codec<T> for your own key/value types.
+ */
+template <typename T, typename = void>
+struct codec;
+
+template <>
+struct codec<std::string_view> {
+  static MDB_val          encode(std::string_view v) noexcept { return to_val(v); }
+  static std::string_view decode(const MDB_val &v) noexcept { return to_view(v); }
+};
+
+template <>
+struct codec<std::string> {
+  static MDB_val     encode(const std::string &v) noexcept { return to_val(v); }
+  static std::string decode(const MDB_val &v) { return std::string(to_view(v)); }
+};
+
+/* Fixed-width native-endian scalars: same layout as Integer#to_bin and
+ * MDB_INTEGERKEY / MDB_INTEGERDUP. */
+template <typename T>
+struct codec<T, std::enable_if_t<std::is_arithmetic_v<T>>> {
+  static MDB_val encode(const T &v) noexcept
+  {
+    return MDB_val{ sizeof(T), const_cast<T *>(&v) };
+  }
+  static T decode(const MDB_val &v)
+  {
+    if (v.mv_size != sizeof(T))
+      throw error(MDB_BAD_VALSIZE, "codec::decode");
+    T out;
+    std::memcpy(&out, v.mv_data, sizeof(T));
+    return out;
+  }
+};
+
+/* C strings and string literals are encoded as string_view. */
+template <typename T> struct codec_for               { using type = T; };
+template <>           struct codec_for<char *>       { using type = std::string_view; };
+template <>           struct codec_for<const char *> { using type = std::string_view; };
+
+template <typename T>
+using codec_t = codec<typename codec_for<std::decay_t<T>>::type>;
+
+/* ── Transactions ───────────────────────────────────────────────────────── */
+
+/* Non-owning transaction handle; also wraps an MDB::Txn from Ruby. */
+class txn_ref {
+ public:
+  explicit txn_ref(MDB_txn *txn) noexcept : txn_(txn) {}
+  txn_ref(mrb_state *mrb, mrb_value txn_obj) : txn_(mrb_lmdb_txn_ptr(mrb, txn_obj)) {}
+
+  MDB_txn *handle() const noexcept { return txn_; }
+
+  MDB_dbi
+  open(const char *name = nullptr, unsigned int flags = 0) const
+  {
+    MDB_dbi dbi;
+    check(mdb_dbi_open(txn_, name, flags, &dbi), "mdb_dbi_open");
+    return dbi;
+  }
+
+  /* Zero-copy lookup; std::nullopt when the key is absent. */
+  template <typename K>
+  std::optional<std::string_view>
+  get(MDB_dbi dbi, const K &key) const
+  {
+    MDB_val k = codec_t<K>::encode(key), v;
+    int rc = mdb_get(txn_, dbi, &k, &v);
+    if (rc == MDB_NOTFOUND)
+      return std::nullopt;
+    check(rc, "mdb_get");
+    return to_view(v);
+  }
+
+  template <typename V, typename K>
+  std::optional<V>
+  get_as(MDB_dbi dbi, const K &key) const
+  {
+    MDB_val k = codec_t<K>::encode(key), v;
+    int rc = mdb_get(txn_, dbi, &k, &v);
+    if (rc == MDB_NOTFOUND)
+      return std::nullopt;
+    check(rc, "mdb_get");
+    return codec<V>::decode(v);
+  }
+
+  template <typename K, typename V>
+  void
+  put(MDB_dbi dbi, const K &key, const V &val, unsigned int flags = 0) const
+  {
+    MDB_val k = codec_t<K>::encode(key), v = codec_t<V>::encode(val);
+    check(mdb_put(txn_, dbi, &k, &v, flags), "mdb_put");
+  }
+
+  /* Returns false if the key was not found. */
+  template <typename K>
+  bool
+  del(MDB_dbi dbi, const K &key) const
+  {
+    MDB_val k = codec_t<K>::encode(key);
+    int rc = mdb_del(txn_, dbi, &k, nullptr);
+    if (rc == MDB_NOTFOUND)
+      return false;
+    check(rc, "mdb_del");
+    return true;
+  }
+
+ protected:
+  MDB_txn *txn_;
+};
+
+/*
+ * Owning transaction: aborted on destruction unless committed. Beginning
+ * or renewing one hands back the Env's parked read txn first.
+ */
+class txn : public txn_ref {
+ public:
+  explicit txn(MDB_env *env, unsigned int flags = 0, MDB_txn *parent = nullptr)
+    : txn_ref(nullptr)
+  {
+    mrb_lmdb_env_release(env);
+    check(mdb_txn_begin(env, parent, flags, &txn_), "mdb_txn_begin");
+  }
+
+  txn(const txn &) = delete;
+  txn &operator=(const txn &) = delete;
+  txn(txn &&o) noexcept : txn_ref(std::exchange(o.txn_, nullptr)) {}
+  txn &operator=(txn &&o) noexcept
+  {
+    if (this != &o) {
+      abort();
+      txn_ = std::exchange(o.txn_, nullptr);
+    }
+    return *this;
+  }
+
+  ~txn() { abort(); }
+
+  void
+  commit()
+  {
+    /* mdb_txn_commit frees the handle regardless of the result. */
+    check(mdb_txn_commit(std::exchange(txn_, nullptr)), "mdb_txn_commit");
+  }
+
+  void
+  abort() noexcept
+  {
+    if (txn_)
+      mdb_txn_abort(std::exchange(txn_, nullptr));
+  }
+
+  void reset() noexcept { mdb_txn_reset(txn_); }
+  void
+  renew()
+  {
+    mrb_lmdb_env_release(mdb_txn_env(txn_));
+    check(mdb_txn_renew(txn_), "mdb_txn_renew");
+  }
+};
+
+/* ── Cursors ────────────────────────────────────────────────────────────── */
+
+class cursor {
+ public:
+  cursor(const txn_ref &t, MDB_dbi dbi)
+  {
+    check(mdb_cursor_open(t.handle(), dbi, &cur_), "mdb_cursor_open");
+  }
+
+  cursor(const cursor &) = delete;
+  cursor &operator=(const cursor &) = delete;
+  cursor(cursor &&o) noexcept : cur_(std::exchange(o.cur_, nullptr)) {}
+  cursor &operator=(cursor &&o) noexcept
+  {
+    if (this != &o) {
+      close();
+      cur_ = std::exchange(o.cur_, nullptr);
+    }
+    return *this;
+  }
+
+  ~cursor() { close(); }
+
+  void
+  close() noexcept
+  {
+    if (cur_)
+      mdb_cursor_close(std::exchange(cur_, nullptr));
+  }
+
+  MDB_cursor *handle() const noexcept { return cur_; }
+
+  /* Returns false on MDB_NOTFOUND; key/val are in/out like mdb_cursor_get. */
+  bool
+  get(MDB_val &key, MDB_val &val, MDB_cursor_op op)
+  {
+    int rc = mdb_cursor_get(cur_, &key, &val, op);
+    if (rc == MDB_NOTFOUND)
+      return false;
+    check(rc, "mdb_cursor_get");
+    return true;
+  }
+
+  bool
+  get(std::string_view &key, std::string_view &val, MDB_cursor_op op)
+  {
+    MDB_val k = to_val(key), v = to_val(val);
+    if (!get(k, v, op))
+      return false;
+    key = to_view(k);
+    val = to_view(v);
+    return true;
+  }
+
+  void
+  put(std::string_view key, std::string_view val, unsigned int flags = 0)
+  {
+    MDB_val k = to_val(key), v = to_val(val);
+    check(mdb_cursor_put(cur_, &k, &v, flags), "mdb_cursor_put");
+  }
+
+  void del(unsigned int flags = 0) { check(mdb_cursor_del(cur_, flags), "mdb_cursor_del"); }
+
+  size_t
+  count()
+  {
+    size_t n;
+    check(mdb_cursor_count(cur_, &n), "mdb_cursor_count");
+    return n;
+  }
+
+ private:
+  MDB_cursor *cur_ = nullptr;
+};
+
+/* ── Range iteration ────────────────────────────────────────────────────── */
+
+namespace detail {
+
+/* Invoke fn(key, val); a callback returning bool stops the scan on false. */
+template <typename K, typename V, typename F>
+bool
+visit(F &fn, const MDB_val &k, const MDB_val &v)
+{
+  if constexpr (std::is_same_v<std::invoke_result_t<F &, K, V>, bool>) {
+    return fn(codec<K>::decode(k), codec<V>::decode(v));
+  } else {
+    fn(codec<K>::decode(k), codec<V>::decode(v));
+    return true;
+  }
+}
+
+} // namespace detail
+
+/* Visit every record in key order. Returns the number of records visited. */
+template <typename K = std::string_view, typename V = std::string_view, typename F>
+size_t
+for_each(const txn_ref &t, MDB_dbi dbi, F &&fn)
+{
+  cursor c(t, dbi);
+  MDB_val k, v;
+  size_t n = 0;
+  for (bool ok = c.get(k, v, MDB_FIRST); ok; ok = c.get(k, v, MDB_NEXT)) {
+    n++;
+    if (!detail::visit<K, V>(fn, k, v))
+      break;
+  }
+  return n;
+}
+
+/* Visit every record whose key starts with prefix (memcmp order). */
+template <typename V = std::string_view, typename F>
+size_t
+for_each_prefix(const txn_ref &t, MDB_dbi dbi, std::string_view prefix, F &&fn)
+{
+  cursor c(t, dbi);
+  MDB_val k = to_val(prefix), v;
+  size_t n = 0;
+  for (bool ok = c.get(k, v, MDB_SET_RANGE); ok; ok = c.get(k, v, MDB_NEXT)) {
+    if (k.mv_size < prefix.size() || std::memcmp(k.mv_data, prefix.data(), prefix.size()) != 0)
+      break;
+    n++;
+    if (!detail::visit<std::string_view, V>(fn, k, v))
+      break;
+  }
+  return n;
+}
+
+/*
+ * Visit records with from <= key < to, compared with the database's own
+ * comparator (so INTEGERKEY and custom orderings work).
+ */
+template <typename K = std::string_view, typename V = std::string_view, typename F>
+size_t
+for_each_range(const txn_ref &t, MDB_dbi dbi,
+               const typename codec_for<K>::type &from,
+               const typename codec_for<K>::type &to, F &&fn)
+{
+  cursor c(t, dbi);
+  MDB_val k = codec<K>::encode(from), v;
+  const MDB_val end = codec<K>::encode(to);
+  size_t n = 0;
+  for (bool ok = c.get(k, v, MDB_SET_RANGE); ok; ok = c.get(k, v, MDB_NEXT)) {
+    if (mdb_cmp(t.handle(), dbi, &k, &end) >= 0)
+      break;
+    n++;
+    if (!detail::visit<K, V>(fn, k, v))
+      break;
+  }
+  return n;
+}
+
+} // namespace mrb_lmdb
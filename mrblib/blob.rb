@@ -0,0 +1,250 @@
+module MDB
+  # A large value stored as fixed-size chunks under MDB::Key.pack(name, i),
+  # with its length and chunk size under MDB::Key.pack(name, nil), behind an
+  # IO-like object. Writes buffer at most one chunk and store it together
+  # with the header in one txn; a read takes all its chunks from one read
+  # txn and copies only the requested bytes of each out of the map
+  # (Database#read_at).
+  class Blob
+    SEEK_SET = 0
+    SEEK_CUR = 1
+    SEEK_END = 2
+    DEFAULT_CHUNK_SIZE = 1 << 20
+    HEADER_BYTES = 18 # Key.pack(size, chunk_size)
+
+    attr_reader :db, :name, :chunk_size, :size, :pos
+
+    # Blob.open(db, name, mode = "r", chunk_size: ...) { |blob| ... }
+    # closes (and so flushes) the blob when the block returns.
+    def self.open(db, name, mode = "r", opts = {})
+      blob = new(db, name, mode, opts)
+      return blob unless block_given?
+      begin
+        yield blob
+      ensure
+        blob.close
+      end
+    end
+
+    def self.exist?(db, name)
+      db.key?(Key.pack(name.to_s, nil))
+    end
+
+    # Remove the blob's header and chunks in one write txn; false if there is none.
+    def self.delete(db, name)
+      found = false
+      db.transaction { |txn, dbi| found = delete_in(db, txn, dbi, name.to_s) }
+      found
+    end
+
+    # Blob.delete inside a write txn the caller owns. The header goes
+    # through db, which may have compressed it; chunks are only deleted.
+    def self.delete_in(db, txn, dbi, name)
+      hdr_key = Key.pack(name, nil)
+      hdr = db.read_at(hdr_key, 0, HEADER_BYTES, txn)
+      return false unless hdr
+      size, chunk_size = Key.unpack(hdr)
+      MDB.del(txn, dbi, hdr_key)
+      ((size + chunk_size - 1) / chunk_size).times { |i| MDB.del(txn, dbi, Key.pack(name, i)) }
+      true
+    end
+
+    # Modes as for File: "r" and "r+" need an existing blob, "w" / "w+"
+    # replace it, "a" / "a+" always write at the end. chunk_size: only
+    # applies to a new blob. The database must not use codec: :native,
+    # DUPSORT, indexes or a Bloom filter: replacing and deleting a blob are
+    # raw writes that would go around them.
+    def initialize(db, name, mode = "r", opts = {})
+      raise ArgumentError, "MDB::Blob needs a database without codec: :native" if db.codec == :native
+      raise ArgumentError, "MDB::Blob needs a database without DUPSORT" if db.flags & MDB::DUPSORT != 0
+      indexes = db.instance_variable_get(:@indexes)
+      raise ArgumentError, "MDB::Blob needs a database without indexes" if indexes && !indexes.empty?
+      raise ArgumentError, "MDB::Blob needs a database without a Bloom filter" if db.bloom_stats
+      @db = db
+      @name = name.to_s
+      @hdr_key = Key.pack(@name, nil)
+      hdr = @db[@hdr_key]
+      case mode
+      when "r", "r+"
+        raise KeyError, "no blob #{@name.inspect}" unless hdr
+        @size, @chunk_size = Key.unpack(hdr)
+      when "w", "w+", "a", "a+"
+        if hdr && (mode == "a" || mode == "a+")
+          @size, @chunk_size = Key.unpack(hdr)
+        else
+          @size = 0
+          @chunk_size = opts[:chunk_size] || DEFAULT_CHUNK_SIZE
+          raise ArgumentError, "chunk_size must be positive" unless @chunk_size > 0
+          # The old blob and the new empty one swap in a single txn.
+          @db.transaction do |txn, dbi|
+            Blob.delete_in(@db, txn, dbi, @name)
+            MDB.put(txn, dbi, @hdr_key, Key.pack(@size, @chunk_size))
+          end
+        end
+      else
+        raise ArgumentError, "invalid mode #{mode.inspect}"
+      end
+      @readable = mode != "w" && mode != "a"
+      @writable = mode != "r"
+      @append = mode == "a" || mode == "a+"
+      @pos = @append ? @size : 0
+      @stored_size = @size
+      @buf = nil
+      @buf_index = nil
+      @dirty = false
+      @closed = false
+    end
+
+    # read(length = nil) -> String, or nil at the end when length > 0.
+    # Bytes never written (after a seek past the end) read as "\0". Raises
+    # MDB::NOTFOUND if the blob has been deleted and MDB::CORRUPTED if a
+    # chunk its header covers is missing.
+    def read(length = nil)
+      check_open(@readable, "not opened for reading")
+      flush
+      remaining = @size - @pos
+      if length.nil?
+        length = remaining > 0 ? remaining : 0
+      else
+        raise ArgumentError, "negative length #{length} given" if length < 0
+        return "" if length == 0
+        return nil if remaining <= 0
+        length = remaining if length > remaining
+      end
+
+      out = ""
+      pos = @pos
+      @db.transaction(MDB::RDONLY) do |txn, _dbi|
+        hdr = @db.read_at(@hdr_key, 0, HEADER_BYTES, txn)
+        raise MDB::NOTFOUND, "blob #{@name.inspect} has been deleted" unless hdr
+        stored, = Key.unpack(hdr)
+        while length > 0
+          idx = pos / @chunk_size
+          off = pos % @chunk_size
+          take = @chunk_size - off
+          take = length if take > length
+          part = @db.read_at(Key.pack(@name, idx), off, take, txn)
+          if part.nil? && idx * @chunk_size < stored
+            raise MDB::CORRUPTED, "blob #{@name.inspect} is missing chunk #{idx}"
+          end
+          out << part if part
+          got = part ? part.bytesize : 0
+          out << "\0" * (take - got) if got < take
+          pos += take
+          length -= take
+        end
+      end
+      @pos = pos
+      out
+    end
+
+    # write(str, ...) -> bytes written
+    def write(*strs)
+      check_open(@writable, "not opened for writing")
+      @pos = @size if @append
+      written = 0
+      strs.each do |str|
+        str = str.to_s
+        len = str.bytesize
+        off = 0
+        while off < len
+          idx = @pos / @chunk_size
+          coff = @pos % @chunk_size
+          take = @chunk_size - coff
+          take = len - off if take > len - off
+          load_chunk(idx) unless @buf_index == idx
+          piece = take == len ? str : str.byteslice(off, take)
+          @buf << "\0" * (coff - @buf.bytesize) if coff > @buf.bytesize
+          if coff == @buf.bytesize
+            @buf << piece
+          else
+            @buf = @buf.byteslice(0, coff) + piece + (@buf.byteslice(coff + take, @chunk_size) || "")
+          end
+          @dirty = true
+          @pos += take
+          @size = @pos if @pos > @size
+          off += take
+          written += take
+        end
+      end
+      written
+    end
+
+    def <<(str)
+      write(str)
+      self
+    end
+
+    def seek(offset, whence = SEEK_SET)
+      check_open(true, nil)
+      base = case whence
+             when SEEK_SET then 0
+             when SEEK_CUR then @pos
+             when SEEK_END then @size
+             else raise ArgumentError, "invalid whence #{whence.inspect}"
+             end
+      raise ArgumentError, "negative position" if base + offset < 0
+      @pos = base + offset
+      0
+    end
+
+    def pos=(offset)
+      seek(offset)
+      @pos
+    end
+
+    def tell
+      @pos
+    end
+
+    def rewind
+      seek(0)
+    end
+
+    def eof?
+      @pos >= @size
+    end
+
+    # Store the chunk being written and the new length, with an empty chunk
+    # for each one a seek past the end skipped, so that every chunk the
+    # header covers exists.
+    def flush
+      check_open(true, nil)
+      if @dirty
+        pairs = []
+        ((@stored_size + @chunk_size - 1) / @chunk_size).upto(@buf_index - 1) { |i| pairs << [Key.pack(@name, i), ""] }
+        pairs << [Key.pack(@name, @buf_index), @buf] << [@hdr_key, Key.pack(@size, @chunk_size)]
+        @db.batch_put(pairs)
+        @stored_size = @size
+        @dirty = false
+      end
+      self
+    end
+
+    def close
+      return nil if @closed
+      flush
+      @closed = true
+      @buf = nil
+      nil
+    end
+
+    def closed?
+      @closed
+    end
+
+    private
+
+    def check_open(allowed, message)
+      raise IOError, "closed blob" if @closed
+      raise IOError, message unless allowed
+    end
+
+    def load_chunk(idx)
+      flush
+      @buf_index = idx
+      buf = idx * @chunk_size < @size ? @db[Key.pack(@name, idx)] : nil
+      @buf = buf.nil? ? "" : buf.frozen? ? buf.dup : buf
+    end
+  end
+end
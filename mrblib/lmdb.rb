@@ -13,8 +13,42 @@ module MDB
     include Enumerable
   end
 
+  class Index
+    attr_reader :primary, :database
+
+    def each(ikey, &block)
+      entries(ikey).each(&block)
+      self
+    end
+  end
+
+  class Loader
+    # Loader.open(db, memory: ..., txn_size: ..., tmpdir: ...) { |l| ... }
+    # finishes on success and discards the spilled runs on exception.
+    def self.open(db, opts = {})
+      loader = new(db, opts)
+      begin
+        yield loader
+      rescue Exception
+        loader.close
+        raise
+      end
+      loader.finish
+    end
+
+    def <<(pair)
+      add(pair[0], pair[1])
+    end
+
+    def concat(pairs)
+      pairs.each { |k, v| add(k, v) }
+      self
+    end
+  end
+
   class Cursor
     Ops.keys.each do |m|
+      next if method_defined?(m) # native versions (e.g. get_multiple)
       define_method(m) do |key = nil, data = nil|
         get(Ops[m], key, data)
       end
@@ -103,764 +103,4366 @@ mrb_bin2fix_m(mrb_state *mrb, mrb_value self)
 }
 
 /* ========================================================================
- * mrb_protect_error callbacks — named C functions, no C++ lambdas
+ * MDB::Key — order-preserving tuple codec
  *
- * yield1: yield(blk, arg)        — transaction, cursor
- * yield2: yield(blk, arg1, arg2) — batch, database transaction, database cursor
+ * MDB::Key.pack(*parts) encodes a tuple so that memcmp order of the bytes
+ * equals element-wise tuple order, which lets the default comparator
+ * range-scan composite keys. Each part is a tag byte plus payload:
+ *
+ *   nil     0x00
+ *   false   0x01
+ *   true    0x02
+ *   Integer 0x10 + 8 bytes big-endian, sign bit flipped
+ *   Float   0x20 + 8 bytes big-endian IEEE 754; positives get the sign
+ *                  bit set, negatives have every bit inverted
+ *   String  0x30 + bytes with 0x00 written as 0x00 0xFF, then 0x00 0x01
+ *
+ * Parts of different types order by tag, so Integer and Float do not
+ * compare numerically with each other. The two-byte string terminator
+ * keeps a packed String from being a prefix of a longer one ("a" vs
+ * "a\0"), so a packed tuple is a byte prefix of exactly the tuples that
+ * start with the same parts and can be passed to each_prefix directly.
  * ======================================================================== */
 
-typedef struct { mrb_value blk; mrb_value arg; }                   mrb_lmdb_yield1_ctx;
-typedef struct { mrb_value blk; mrb_value arg1; mrb_value arg2; }  mrb_lmdb_yield2_ctx;
+#define MRB_MDB_KEY_NIL    0x00
+#define MRB_MDB_KEY_FALSE  0x01
+#define MRB_MDB_KEY_TRUE   0x02
+#define MRB_MDB_KEY_INT    0x10
+#define MRB_MDB_KEY_FLOAT  0x20
+#define MRB_MDB_KEY_STRING 0x30
 
-static mrb_value
-mrb_lmdb_yield1_cb(mrb_state *mrb, void *ud)
+static void
+mrb_mdb_key_put_u64(mrb_state *mrb, mrb_value out, uint8_t tag, uint64_t u)
 {
-  mrb_lmdb_yield1_ctx *ctx = (mrb_lmdb_yield1_ctx *)ud;
-  return mrb_yield(mrb, ctx->blk, ctx->arg);
+  uint8_t b[9];
+  b[0] = tag;
+  for (int i = 0; i < 8; i++)
+    b[1 + i] = (uint8_t)(u >> (56 - 8 * i));
+  mrb_str_cat(mrb, out, (const char *)b, sizeof(b));
 }
 
-static mrb_value
-mrb_lmdb_yield2_cb(mrb_state *mrb, void *ud)
+static uint64_t
+mrb_mdb_key_get_u64(const uint8_t *p)
 {
-  mrb_lmdb_yield2_ctx *ctx = (mrb_lmdb_yield2_ctx *)ud;
-  mrb_value argv[2] = { ctx->arg1, ctx->arg2 };
-  return mrb_yield_argv(mrb, ctx->blk, 2, argv);
+  uint64_t u = 0;
+  for (int i = 0; i < 8; i++)
+    u = (u << 8) | p[i];
+  return u;
 }
 
-/* ========================================================================
- * MDB::Env
- * ======================================================================== */
-
-static mrb_value
-mrb_mdb_env_init(mrb_state *mrb, mrb_value self)
+static void
+mrb_mdb_key_pack_part(mrb_state *mrb, mrb_value out, mrb_value part)
 {
-  mrb_value opts = mrb_nil_value();
-  mrb_get_args(mrb, "|H", &opts);
-
-  MDB_env *env;
-  int rc = mdb_env_create(&env);
-  if (unlikely(rc != MDB_SUCCESS))
-    mrb_mdb_raise(mrb, rc, "mdb_env_create");
-  mrb_data_init(self, env, &mdb_env_type);
-
-  if (!mrb_nil_p(opts)) {
-    mrb_value keys = mrb_hash_keys(mrb, opts);
-    mrb_int n = RARRAY_LEN(keys);
-    for (mrb_int i = 0; i < n; i++) {
-      mrb_value k = mrb_ary_entry(keys, i);
-      mrb_value v = mrb_hash_get(mrb, opts, k);
-
-      if (!mrb_symbol_p(k))
-        mrb_raisef(mrb, E_ARGUMENT_ERROR, "unknown option %v", k);
-
-      mrb_sym sym = mrb_symbol(k);
-      if (sym == MRB_SYM(mapsize)) {
-        mrb_int size = mrb_integer(mrb_to_int(mrb, v));
-        if (size < 0)
-          mrb_raise(mrb, E_RANGE_ERROR, "mapsize must be non-negative");
-        rc = mdb_env_set_mapsize(env, (size_t)size);
-        if (unlikely(rc != MDB_SUCCESS))
-          mrb_mdb_raise(mrb, rc, "mdb_env_set_mapsize");
-      } else if (sym == MRB_SYM(maxreaders)) {
-        mrb_int readers = mrb_integer(mrb_to_int(mrb, v));
-        if (readers < 0 || (uint64_t)readers > UINT_MAX)
-          mrb_raise(mrb, E_RANGE_ERROR, "maxreaders out of range");
-        rc = mdb_env_set_maxreaders(env, (unsigned int)readers);
-        if (unlikely(rc != MDB_SUCCESS))
-          mrb_mdb_raise(mrb, rc, "mdb_env_set_maxreaders");
-      } else if (sym == MRB_SYM(maxdbs)) {
-        mrb_int dbs = mrb_integer(mrb_to_int(mrb, v));
-        if (dbs < 0 || (uint64_t)dbs > UINT_MAX)
-          mrb_raise(mrb, E_RANGE_ERROR, "maxdbs out of range");
-        rc = mdb_env_set_maxdbs(env, (MDB_dbi)dbs);
-        if (unlikely(rc != MDB_SUCCESS))
-          mrb_mdb_raise(mrb, rc, "mdb_env_set_maxdbs");
-      } else {
-        mrb_raisef(mrb, E_ARGUMENT_ERROR, "unknown option %v", k);
+  switch (mrb_type(part)) {
+  case MRB_TT_FALSE:
+    mrb_str_cat(mrb, out, mrb_nil_p(part) ? "\x00" : "\x01", 1);
+    break;
+  case MRB_TT_TRUE:
+    mrb_str_cat_lit(mrb, out, "\x02");
+    break;
+  case MRB_TT_INTEGER:
+    mrb_mdb_key_put_u64(mrb, out, MRB_MDB_KEY_INT,
+      (uint64_t)(int64_t)mrb_integer(part) ^ ((uint64_t)1 << 63));
+    break;
+  case MRB_TT_FLOAT: {
+    double d = (double)mrb_float(part);
+    uint64_t u;
+    memcpy(&u, &d, sizeof(u));
+    u = (u >> 63) ? ~u : u | ((uint64_t)1 << 63);
+    mrb_mdb_key_put_u64(mrb, out, MRB_MDB_KEY_FLOAT, u);
+    break;
+  }
+  case MRB_TT_STRING: {
+    const char *p = RSTRING_PTR(part);
+    mrb_int len = RSTRING_LEN(part), start = 0;
+    mrb_str_cat_lit(mrb, out, "\x30");
+    for (mrb_int i = 0; i < len; i++) {
+      if (p[i] == '\0') {
+        mrb_str_cat(mrb, out, p + start, (size_t)(i - start));
+        mrb_str_cat(mrb, out, "\x00\xff", 2);
+        start = i + 1;
       }
     }
+    mrb_str_cat(mrb, out, p + start, (size_t)(len - start));
+    mrb_str_cat(mrb, out, "\x00\x01", 2);
+    break;
+  }
+  default:
+    mrb_raisef(mrb, E_TYPE_ERROR, "cannot pack %T into MDB::Key", part);
   }
-  return self;
 }
 
+/* MDB::Key.pack(*parts) -> String */
 static mrb_value
-mrb_mdb_env_open(mrb_state *mrb, mrb_value self)
+mrb_mdb_key_pack_m(mrb_state *mrb, mrb_value self)
 {
-  MDB_env *env = mrb_mdb_env_get(mrb, self);
-  const char *path;
-  mrb_int flags = 0, mode = 0600;
-  mrb_get_args(mrb, "z|ii", &path, &flags, &mode);
-  int rc = mdb_env_open(env, path, mrb_mdb_flags(mrb, flags), (mdb_mode_t)mode);
-  if (likely(rc == MDB_SUCCESS))
-    return self;
-  mrb_mdb_raise(mrb, rc, "mdb_env_open");
+  const mrb_value *argv;
+  mrb_int argc;
+  mrb_get_args(mrb, "*", &argv, &argc);
+
+  mrb_value out = mrb_str_new_capa(mrb, (size_t)argc * 9);
+  for (mrb_int i = 0; i < argc; i++)
+    mrb_mdb_key_pack_part(mrb, out, argv[i]);
+  return out;
 }
 
-static mrb_value
-mrb_mdb_env_copy_m(mrb_state *mrb, mrb_value self)
+mrb_noreturn static void
+mrb_mdb_key_invalid(mrb_state *mrb)
 {
-  MDB_env *env = mrb_mdb_env_get(mrb, self);
-  const char *path;
-  mrb_int flags = 0;
-  mrb_get_args(mrb, "z|i", &path, &flags);
-  int rc = flags != 0
-    ? mdb_env_copy2(env, path, mrb_mdb_flags(mrb, flags))
-    : mdb_env_copy(env, path);
-  if (likely(rc == MDB_SUCCESS))
-    return self;
-  mrb_mdb_raise(mrb, rc, "mdb_env_copy");
+  mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid MDB::Key encoding");
 }
 
-static mrb_value
-mrb_mdb_env_stat_m(mrb_state *mrb, mrb_value self)
+/* End of the part starting at p, or NULL if it is malformed. */
+static const uint8_t *
+mrb_mdb_key_skip(const uint8_t *p, const uint8_t *end)
 {
-  MDB_env *env = mrb_mdb_env_get(mrb, self);
-  MDB_stat stat;
-  int rc = mdb_env_stat(env, &stat);
-  if (likely(rc == MDB_SUCCESS))
-    return mrb_mdb_stat_to_value(mrb, &stat);
-  mrb_mdb_raise(mrb, rc, "mdb_env_stat");
+  switch (*p++) {
+  case MRB_MDB_KEY_NIL:
+  case MRB_MDB_KEY_FALSE:
+  case MRB_MDB_KEY_TRUE:
+    return p;
+  case MRB_MDB_KEY_INT:
+  case MRB_MDB_KEY_FLOAT:
+    return end - p >= 8 ? p + 8 : NULL;
+  case MRB_MDB_KEY_STRING:
+    for (;;) {
+      const uint8_t *z = (const uint8_t *)memchr(p, 0, (size_t)(end - p));
+      if (!z)
+        return NULL;
+      p = z + 1;
+      if (p == end)
+        return NULL;
+      if (*p++ == 0x01)
+        return p;
+      if (p[-1] != 0xff)
+        return NULL;
+    }
+  default:
+    return NULL;
+  }
 }
 
+/* MDB::Key.unpack(str) -> Array */
 static mrb_value
-mrb_mdb_env_info_m(mrb_state *mrb, mrb_value self)
+mrb_mdb_key_unpack_m(mrb_state *mrb, mrb_value self)
 {
-  MDB_env *env = mrb_mdb_env_get(mrb, self);
-  MDB_envinfo info;
-  int rc = mdb_env_info(env, &info);
-  if (likely(rc == MDB_SUCCESS)) {
-    mrb_value args[6] = {
-      info.me_mapaddr ? mrb_cptr_value(mrb, info.me_mapaddr) : mrb_nil_value(),
-      mrb_convert_size_t(mrb, info.me_mapsize),
-      mrb_convert_size_t(mrb, info.me_last_pgno),
-      mrb_convert_size_t(mrb, info.me_last_txnid),
-      mrb_convert_uint(mrb, info.me_maxreaders),
-      mrb_convert_uint(mrb, info.me_numreaders),
-    };
-    struct RClass *env_cls  = mrb_class_get_under_id(mrb, mrb_module_get_id(mrb, MRB_SYM(MDB)), MRB_SYM(Env));
-    struct RClass *info_cls = mrb_class_get_under_id(mrb, env_cls, MRB_SYM(Info));
-    return mrb_obj_new(mrb, info_cls, 6, args);
+  mrb_value str;
+  mrb_get_args(mrb, "S", &str);
+
+  const uint8_t *p = (const uint8_t *)RSTRING_PTR(str);
+  const uint8_t *end = p + RSTRING_LEN(str);
+  mrb_value parts = mrb_ary_new(mrb);
+  int ai = mrb_gc_arena_save(mrb);
+
+  while (p < end) {
+    uint8_t tag = *p++;
+    mrb_value part;
+    switch (tag) {
+    case MRB_MDB_KEY_NIL:   part = mrb_nil_value();   break;
+    case MRB_MDB_KEY_FALSE: part = mrb_false_value(); break;
+    case MRB_MDB_KEY_TRUE:  part = mrb_true_value();  break;
+    case MRB_MDB_KEY_INT: {
+      if (end - p < 8)
+        mrb_mdb_key_invalid(mrb);
+      int64_t v = (int64_t)(mrb_mdb_key_get_u64(p) ^ ((uint64_t)1 << 63));
+      p += 8;
+      if (v < MRB_INT_MIN || v > MRB_INT_MAX)
+        mrb_raise(mrb, E_RANGE_ERROR, "packed Integer out of range");
+      part = mrb_int_value(mrb, (mrb_int)v);
+      break;
+    }
+    case MRB_MDB_KEY_FLOAT: {
+      if (end - p < 8)
+        mrb_mdb_key_invalid(mrb);
+      uint64_t u = mrb_mdb_key_get_u64(p);
+      p += 8;
+      u = (u >> 63) ? u & ~((uint64_t)1 << 63) : ~u;
+      double d;
+      memcpy(&d, &u, sizeof(d));
+      part = mrb_float_value(mrb, (mrb_float)d);
+      break;
+    }
+    case MRB_MDB_KEY_STRING: {
+      part = mrb_str_new(mrb, NULL, 0);
+      for (;;) {
+        const uint8_t *z = (const uint8_t *)memchr(p, 0, (size_t)(end - p));
+        if (!z)
+          mrb_mdb_key_invalid(mrb);
+        mrb_str_cat(mrb, part, (const char *)p, (size_t)(z - p));
+        p = z + 1;
+        if (p == end)
+          mrb_mdb_key_invalid(mrb);
+        if (*p++ == 0x01)
+          break;
+        if (p[-1] != 0xff)
+          mrb_mdb_key_invalid(mrb);
+        mrb_str_cat(mrb, part, "\x00", 1);
+      }
+      break;
+    }
+    default:
+      mrb_mdb_key_invalid(mrb);
+    }
+    mrb_ary_push(mrb, parts, part);
+    mrb_gc_arena_restore(mrb, ai);
   }
-  mrb_mdb_raise(mrb, rc, "mdb_env_info");
+  return parts;
 }
 
-static mrb_value
-mrb_mdb_env_sync_m(mrb_state *mrb, mrb_value self)
+/* ========================================================================
+ * Main-DB meta keys
+ *
+ * Per-database settings and sidecars (comparators, dictionaries, Bloom
+ * filters) live in the main DB under "\0mrb-lmdb-<what>\0<name>", which
+ * sorts before any named database.
+ * ======================================================================== */
+
+#define MRB_MDB_DICT_KEY_MAX    511  /* LMDB's default maximum key size */
+
+/*
+ * Main-DB meta key prefix + the database name into buf, followed by "\0"
+ * and n as big-endian uint32 when numbered is TRUE. Returns the length, 0
+ * if the name is too long for a key.
+ */
+static size_t
+mrb_mdb_meta_key(const char *prefix, size_t prefix_len, const char *name,
+                 mrb_bool numbered, uint32_t n, char buf[MRB_MDB_DICT_KEY_MAX])
 {
-  MDB_env *env = mrb_mdb_env_get(mrb, self);
-  mrb_bool force = FALSE;
-  mrb_get_args(mrb, "|b", &force);
-  int rc = mdb_env_sync(env, (int)force);
-  if (likely(rc == MDB_SUCCESS))
-    return self;
-  mrb_mdb_raise(mrb, rc, "mdb_env_sync");
+  size_t name_len = name ? strlen(name) : 0;
+  size_t len = prefix_len + name_len + (numbered ? 5 : 0);
+  if (len > MRB_MDB_DICT_KEY_MAX)
+    return 0;
+  memcpy(buf, prefix, prefix_len);
+  if (name_len)
+    memcpy(buf + prefix_len, name, name_len);
+  if (numbered) {
+    uint8_t *p = (uint8_t *)buf + prefix_len + name_len;
+    p[0] = 0;
+    p[1] = (uint8_t)(n >> 24);
+    p[2] = (uint8_t)(n >> 16);
+    p[3] = (uint8_t)(n >> 8);
+    p[4] = (uint8_t)n;
+  }
+  return len;
 }
 
-static mrb_value
-mrb_mdb_env_close_m(mrb_state *mrb, mrb_value self)
+/* Delete name's record under prefix and every numbered record next to it. */
+static int
+mrb_mdb_meta_del(MDB_txn *txn, const char *prefix, size_t prefix_len, const char *name)
 {
-  MDB_env *env = (MDB_env *)mrb_data_check_get_ptr(mrb, self, &mdb_env_type);
-  if (env) {
-    mdb_env_close(env);
-    mrb_data_init(self, NULL, NULL);
-    return mrb_true_value();
+  char kbuf[MRB_MDB_DICT_KEY_MAX];
+  size_t len = mrb_mdb_meta_key(prefix, prefix_len, name, FALSE, 0, kbuf);
+  MDB_dbi main_dbi;
+  MDB_cursor *cursor;
+  if (len == 0)
+    return MDB_SUCCESS;
+  int rc = mdb_dbi_open(txn, NULL, 0, &main_dbi);
+  if (rc == MDB_SUCCESS)
+    rc = mdb_cursor_open(txn, main_dbi, &cursor);
+  if (rc != MDB_SUCCESS)
+    return rc;
+  MDB_val key = { len, kbuf }, data;
+  for (rc = mdb_cursor_get(cursor, &key, &data, MDB_SET_RANGE); rc == MDB_SUCCESS;
+       rc = mdb_cursor_get(cursor, &key, &data, MDB_NEXT)) {
+    const char *k = (const char *)key.mv_data;
+    if (key.mv_size < len || memcmp(k, kbuf, len) != 0)
+      break;
+    /* Skip longer names that share this one as a prefix. */
+    if (key.mv_size == len || (key.mv_size == len + 5 && k[len] == '\0'))
+      rc = mdb_cursor_del(cursor, 0);
+    if (rc != MDB_SUCCESS)
+      break;
   }
-  return mrb_false_value();
+  mdb_cursor_close(cursor);
+  return rc == MDB_NOTFOUND ? MDB_SUCCESS : rc;
 }
 
-static mrb_value
-mrb_mdb_env_set_flags_m(mrb_state *mrb, mrb_value self)
+/* ========================================================================
+ * Native comparators
+ *
+ * Selected by symbol when a database is opened (compare:, dupsort_compare:)
+ * and installed with mdb_set_compare / mdb_set_dupsort. LMDB does not store
+ * comparators in the file, so a named database's non-default choice is
+ * recorded in the main DB under "\0mrb-lmdb-cmp\0<name>" (key id, dup id)
+ * and the resolved choice per dbi on the Env; both are re-applied when the
+ * database is opened without the option. The fixed-width orderings sort
+ * keys of any other size by length first.
+ *
+ *   :uint64_be  8-byte big-endian unsigned integers
+ *   :int64_be   8-byte big-endian signed integers
+ *   :double     8-byte native-endian IEEE 754 doubles (Array#pack("d"))
+ *   :reverse    descending memcmp order
+ *   :length     shorter keys first, then memcmp
+ * ======================================================================== */
+
+enum {
+  MRB_MDB_CMP_DEFAULT = 0,
+  MRB_MDB_CMP_UINT64_BE,
+  MRB_MDB_CMP_INT64_BE,
+  MRB_MDB_CMP_DOUBLE,
+  MRB_MDB_CMP_REVERSE,
+  MRB_MDB_CMP_LENGTH,
+  MRB_MDB_CMP_UNSET = -1
+};
+
+static int
+mrb_mdb_cmp_size(const MDB_val *a, const MDB_val *b)
 {
-  MDB_env *env = mrb_mdb_env_get(mrb, self);
-  mrb_int flags = 0;
-  mrb_bool onoff = TRUE;
-  mrb_get_args(mrb, "|ib", &flags, &onoff);
-  int rc = mdb_env_set_flags(env, mrb_mdb_flags(mrb, flags), (int)onoff);
-  if (likely(rc == MDB_SUCCESS))
-    return self;
-  mrb_mdb_raise(mrb, rc, "mdb_env_set_flags");
+  return a->mv_size < b->mv_size ? -1 : a->mv_size > b->mv_size;
 }
 
-static mrb_value
-mrb_mdb_env_get_flags_m(mrb_state *mrb, mrb_value self)
+static int
+mrb_mdb_cmp_u64(uint64_t x, uint64_t y)
 {
-  MDB_env *env = mrb_mdb_env_get(mrb, self);
-  unsigned int flags;
-  int rc = mdb_env_get_flags(env, &flags);
-  if (likely(rc == MDB_SUCCESS))
-    return mrb_convert_uint(mrb, flags);
-  mrb_mdb_raise(mrb, rc, "mdb_env_get_flags");
+  return x < y ? -1 : x > y;
 }
 
-static mrb_value
-mrb_mdb_env_get_path_m(mrb_state *mrb, mrb_value self)
+static int
+mrb_mdb_cmp_length(const MDB_val *a, const MDB_val *b)
 {
-  MDB_env *env = mrb_mdb_env_get(mrb, self);
-  const char *path;
-  int rc = mdb_env_get_path(env, &path);
-  if (likely(rc == MDB_SUCCESS))
-    return mrb_str_new_cstr(mrb, path);
-  mrb_mdb_raise(mrb, rc, "mdb_env_get_path");
+  int r = mrb_mdb_cmp_size(a, b);
+  return r ? r : memcmp(a->mv_data, b->mv_data, a->mv_size);
 }
 
-static mrb_value
-mrb_mdb_env_set_mapsize_m(mrb_state *mrb, mrb_value self)
+static int
+mrb_mdb_cmp_uint64_be(const MDB_val *a, const MDB_val *b)
 {
-  MDB_env *env = mrb_mdb_env_get(mrb, self);
-  mrb_int size;
-  mrb_get_args(mrb, "i", &size);
-  if (size < 0)
-    mrb_raise(mrb, E_RANGE_ERROR, "mapsize must be non-negative");
-  int rc = mdb_env_set_mapsize(env, (size_t)size);
-  if (likely(rc == MDB_SUCCESS))
-    return self;
-  mrb_mdb_raise(mrb, rc, "mdb_env_set_mapsize");
+  if (a->mv_size != 8 || b->mv_size != 8)
+    return mrb_mdb_cmp_length(a, b);
+  return mrb_mdb_cmp_u64(mrb_mdb_key_get_u64((const uint8_t *)a->mv_data),
+                         mrb_mdb_key_get_u64((const uint8_t *)b->mv_data));
 }
 
-static mrb_value
-mrb_mdb_env_set_maxreaders_m(mrb_state *mrb, mrb_value self)
+static int
+mrb_mdb_cmp_int64_be(const MDB_val *a, const MDB_val *b)
 {
-  MDB_env *env = mrb_mdb_env_get(mrb, self);
-  mrb_int readers;
-  mrb_get_args(mrb, "i", &readers);
-  if (readers < 0 || (uint64_t)readers > UINT_MAX)
-    mrb_raise(mrb, E_RANGE_ERROR, "maxreaders out of range");
-  int rc = mdb_env_set_maxreaders(env, (unsigned int)readers);
-  if (likely(rc == MDB_SUCCESS))
-    return self;
-  mrb_mdb_raise(mrb, rc, "mdb_env_set_maxreaders");
+  if (a->mv_size != 8 || b->mv_size != 8)
+    return mrb_mdb_cmp_length(a, b);
+  const uint64_t sign = (uint64_t)1 << 63;
+  return mrb_mdb_cmp_u64(mrb_mdb_key_get_u64((const uint8_t *)a->mv_data) ^ sign,
+                         mrb_mdb_key_get_u64((const uint8_t *)b->mv_data) ^ sign);
 }
 
-static mrb_value
-mrb_mdb_env_get_maxreaders_m(mrb_state *mrb, mrb_value self)
+/* Same total order as MDB::Key floats, so NaNs sort consistently. */
+static uint64_t
+mrb_mdb_cmp_double_bits(const MDB_val *v)
 {
-  MDB_env *env = mrb_mdb_env_get(mrb, self);
-  unsigned int readers;
-  int rc = mdb_env_get_maxreaders(env, &readers);
-  if (likely(rc == MDB_SUCCESS))
-    return mrb_convert_uint(mrb, readers);
-  mrb_mdb_raise(mrb, rc, "mdb_env_get_maxreaders");
+  uint64_t u;
+  memcpy(&u, v->mv_data, sizeof(u));
+  return (u >> 63) ? ~u : u | ((uint64_t)1 << 63);
 }
 
-static mrb_value
-mrb_mdb_env_set_maxdbs_m(mrb_state *mrb, mrb_value self)
+static int
+mrb_mdb_cmp_double(const MDB_val *a, const MDB_val *b)
 {
-  MDB_env *env = mrb_mdb_env_get(mrb, self);
-  mrb_int dbs;
-  mrb_get_args(mrb, "i", &dbs);
-  if (dbs < 0 || (uint64_t)dbs > UINT_MAX)
-    mrb_raise(mrb, E_RANGE_ERROR, "maxdbs out of range");
-  int rc = mdb_env_set_maxdbs(env, (MDB_dbi)dbs);
-  if (likely(rc == MDB_SUCCESS))
-    return self;
-  mrb_mdb_raise(mrb, rc, "mdb_env_set_maxdbs");
+  if (a->mv_size != sizeof(double) || b->mv_size != sizeof(double))
+    return mrb_mdb_cmp_length(a, b);
+  return mrb_mdb_cmp_u64(mrb_mdb_cmp_double_bits(a), mrb_mdb_cmp_double_bits(b));
 }
 
-static mrb_value
-mrb_mdb_env_get_maxkeysize_m(mrb_state *mrb, mrb_value self)
+static int
+mrb_mdb_cmp_reverse(const MDB_val *a, const MDB_val *b)
 {
-  MDB_env *env = mrb_mdb_env_get(mrb, self);
-  return mrb_convert_int(mrb, mdb_env_get_maxkeysize(env));
+  size_t n = a->mv_size < b->mv_size ? a->mv_size : b->mv_size;
+  int r = memcmp(a->mv_data, b->mv_data, n);
+  if (r == 0)
+    r = mrb_mdb_cmp_size(a, b);
+  return r < 0 ? 1 : r > 0 ? -1 : 0;
 }
 
-static mrb_value
-mrb_mdb_reader_check_m(mrb_state *mrb, mrb_value self)
+static MDB_cmp_func *const mrb_mdb_cmp_funcs[] = {
+  NULL,
+  mrb_mdb_cmp_uint64_be,
+  mrb_mdb_cmp_int64_be,
+  mrb_mdb_cmp_double,
+  mrb_mdb_cmp_reverse,
+  mrb_mdb_cmp_length,
+};
+
+static int
+mrb_mdb_cmp_id(mrb_state *mrb, mrb_value v)
 {
-  MDB_env *env = mrb_mdb_env_get(mrb, self);
-  int dead = 0;
-  int rc = mdb_reader_check(env, &dead);
-  if (likely(rc == MDB_SUCCESS))
-    return mrb_convert_int(mrb, dead);
-  mrb_mdb_raise(mrb, rc, "mdb_reader_check");
+  if (mrb_nil_p(v))
+    return MRB_MDB_CMP_UNSET;
+  if (mrb_symbol_p(v)) {
+    mrb_sym sym = mrb_symbol(v);
+    if (sym == MRB_SYM(default))   return MRB_MDB_CMP_DEFAULT;
+    if (sym == MRB_SYM(uint64_be)) return MRB_MDB_CMP_UINT64_BE;
+    if (sym == MRB_SYM(int64_be))  return MRB_MDB_CMP_INT64_BE;
+    if (sym == MRB_SYM(double))    return MRB_MDB_CMP_DOUBLE;
+    if (sym == MRB_SYM(reverse))   return MRB_MDB_CMP_REVERSE;
+    if (sym == MRB_SYM(length))    return MRB_MDB_CMP_LENGTH;
+  }
+  mrb_raisef(mrb, E_ARGUMENT_ERROR, "unknown comparator %v", v);
 }
 
 /*
- * Env#transaction([flags]) { |txn| ... }
+ * Options for opening a database. The comparators apply to Dbi.open too;
+ * codec:, compress: and cache: only to MDB::Database and are left as given
+ * (undef if absent for codec: and compress:, nil for cache:).
  */
-static mrb_value
-mrb_mdb_env_transaction_m(mrb_state *mrb, mrb_value self)
+typedef struct {
+  int       key_cmp;
+  int       dup_cmp;
+  mrb_value codec;
+  mrb_value compress;
+  mrb_value cache;
+} mrb_mdb_open_opts;
+
+static void
+mrb_mdb_open_opts_parse(mrb_state *mrb, mrb_value opts, mrb_bool database, mrb_mdb_open_opts *o)
 {
-  mrb_value blk;
-  mrb_int flags = 0;
-  mrb_get_args(mrb, "|i&!", &flags, &blk);
-  if (mrb_nil_p(blk))
-    mrb_raise(mrb, E_ARGUMENT_ERROR, "no block given");
+  o->key_cmp = o->dup_cmp = MRB_MDB_CMP_UNSET;
+  o->codec = o->compress = mrb_undef_value();
+  o->cache = mrb_nil_value();
+  if (mrb_nil_p(opts))
+    return;
 
-  struct RClass *txn_class = mrb_class_get_under_id(mrb,
-    mrb_module_get_id(mrb, MRB_SYM(MDB)), MRB_SYM(Txn));
-  mrb_value argv[2] = { self, mrb_int_value(mrb, flags) };
-  mrb_value txn_obj = mrb_obj_new(mrb, txn_class, 2, argv);
-  mrb_gc_protect(mrb, txn_obj);
+  mrb_value keys = mrb_hash_keys(mrb, opts);
+  for (mrb_int i = 0; i < RARRAY_LEN(keys); i++) {
+    mrb_value k = mrb_ary_entry(keys, i);
+    mrb_value v = mrb_hash_get(mrb, opts, k);
+    mrb_sym sym = mrb_symbol_p(k) ? mrb_symbol(k) : 0;
+    if (sym == MRB_SYM(compare))
+      o->key_cmp = mrb_mdb_cmp_id(mrb, v);
+    else if (sym == MRB_SYM(dupsort_compare))
+      o->dup_cmp = mrb_mdb_cmp_id(mrb, v);
+    else if (database && sym == MRB_SYM(codec))
+      o->codec = v;
+    else if (database && sym == MRB_SYM(compress))
+      o->compress = v;
+    else if (database && sym == MRB_SYM(cache))
+      o->cache = v;
+    else
+      mrb_raisef(mrb, E_ARGUMENT_ERROR, "unknown option %v", k);
+  }
+}
 
-  mrb_lmdb_yield1_ctx ctx1 = { blk, txn_obj };
-  mrb_bool exc = FALSE;
-  mrb_value result = mrb_protect_error(mrb, mrb_lmdb_yield1_cb, &ctx1, &exc);
+/* Split a trailing options Hash off argv; returns it or nil. */
+static mrb_value
+mrb_mdb_pop_opts(mrb_int *argc, const mrb_value *argv)
+{
+  if (*argc > 0 && mrb_hash_p(argv[*argc - 1]))
+    return argv[--*argc];
+  return mrb_nil_value();
+}
 
-  MDB_txn *txn = (MDB_txn *)mrb_data_check_get_ptr(mrb, txn_obj, &mdb_txn_type);
-  if (txn) {
-    mrb_data_init(txn_obj, NULL, NULL);
-    if (!exc) {
-      int rc = mdb_txn_commit(txn);
-      if (unlikely(rc != MDB_SUCCESS))
-        mrb_mdb_raise(mrb, rc, "mdb_txn_commit");
-    } else {
-      mdb_txn_abort(txn);
+#define MRB_MDB_CMP_PREFIX     "\0mrb-lmdb-cmp\0"
+#define MRB_MDB_CMP_PREFIX_LEN (sizeof(MRB_MDB_CMP_PREFIX) - 1)
+
+/*
+ * Install the comparators for dbi (opened as name, NULL for the main DB)
+ * inside txn. UNSET ids reuse the recorded choice: this Env's for the dbi,
+ * else the one stored in the file, else the default order. Asking for a
+ * different one is MDB_INCOMPATIBLE when this Env already installed one, or
+ * when the database holds records sorted by another order; an empty
+ * database takes the new choice. The Env slot stores id + 1 per nibble so
+ * 0 means "never opened". Never raises, so it can run inside a write txn;
+ * in a read-only txn the file record is only checked, not written.
+ */
+static int
+mrb_mdb_dbi_set_compare(mrb_state *mrb, MDB_txn *txn, MDB_dbi dbi, const char *name,
+                        int key_id, int dup_id)
+{
+  mrb_mdb_env *e = (mrb_mdb_env *)mdb_env_get_userctx(mdb_txn_env(txn));
+  if (!e)
+    return MDB_SUCCESS;
+
+  int rc = MDB_SUCCESS;
+  int rec_key = MRB_MDB_CMP_UNSET, rec_dup = MRB_MDB_CMP_UNSET;
+  mrb_bool in_env = dbi < e->cmp_len && e->cmp[dbi] != 0;
+  if (in_env) {
+    rec_key = (e->cmp[dbi] & 0x0f) - 1;
+    rec_dup = (e->cmp[dbi] >> 4) - 1;
+  }
+
+  char kbuf[MRB_MDB_DICT_KEY_MAX];
+  MDB_val mkey = { name ? mrb_mdb_meta_key(MRB_MDB_CMP_PREFIX, MRB_MDB_CMP_PREFIX_LEN, name, FALSE, 0, kbuf) : 0, kbuf };
+  MDB_val mdata;
+  MDB_dbi main_dbi = 0;
+  mrb_bool in_file = FALSE;
+  if (mkey.mv_size > 0) {
+    rc = mdb_dbi_open(txn, NULL, 0, &main_dbi);
+    if (rc == MDB_SUCCESS)
+      rc = mdb_get(txn, main_dbi, &mkey, &mdata);
+    if (rc == MDB_SUCCESS) {
+      const uint8_t *p = (const uint8_t *)mdata.mv_data;
+      if (mdata.mv_size != 2 || p[0] > MRB_MDB_CMP_LENGTH || p[1] > MRB_MDB_CMP_LENGTH)
+        return MDB_INCOMPATIBLE;
+      in_file = TRUE;
+      if (!in_env) {
+        rec_key = p[0];
+        rec_dup = p[1];
+      }
     }
+    else if (rc == MDB_NOTFOUND)
+      rc = MDB_SUCCESS;
+    else
+      return rc;
   }
-  if (exc) mrb_exc_raise(mrb, result);
-  return result;
+
+  MDB_stat st;
+  if ((rc = mdb_stat(txn, dbi, &st)) != MDB_SUCCESS)
+    return rc;
+  if (rec_key == MRB_MDB_CMP_UNSET && st.ms_entries > 0) {
+    /* Records written without any recorded choice are in the default order. */
+    rec_key = rec_dup = MRB_MDB_CMP_DEFAULT;
+  }
+  if (key_id == MRB_MDB_CMP_UNSET)
+    key_id = rec_key == MRB_MDB_CMP_UNSET ? MRB_MDB_CMP_DEFAULT : rec_key;
+  if (dup_id == MRB_MDB_CMP_UNSET)
+    dup_id = rec_dup == MRB_MDB_CMP_UNSET ? MRB_MDB_CMP_DEFAULT : rec_dup;
+  if (rec_key != MRB_MDB_CMP_UNSET && (key_id != rec_key || dup_id != rec_dup) &&
+      (in_env || st.ms_entries > 0))
+    return MDB_INCOMPATIBLE;
+
+  if (dbi >= e->cmp_len) {
+    size_t len = (size_t)dbi + 8;
+    uint8_t *p = (uint8_t *)mrb_realloc_simple(mrb, e->cmp, len);
+    if (!p)
+      return ENOMEM;
+    memset(p + e->cmp_len, 0, len - e->cmp_len);
+    e->cmp = p;
+    e->cmp_len = len;
+  }
+
+  if (key_id != MRB_MDB_CMP_DEFAULT)
+    rc = mdb_set_compare(txn, dbi, mrb_mdb_cmp_funcs[key_id]);
+  if (rc == MDB_SUCCESS && dup_id != MRB_MDB_CMP_DEFAULT)
+    rc = mdb_set_dupsort(txn, dbi, mrb_mdb_cmp_funcs[dup_id]);
+
+  /* Record non-default choices in the file; EACCES is a read-only txn. */
+  if (rc == MDB_SUCCESS && mkey.mv_size > 0) {
+    mrb_bool custom = key_id != MRB_MDB_CMP_DEFAULT || dup_id != MRB_MDB_CMP_DEFAULT;
+    if (custom && (!in_file || ((const uint8_t *)mdata.mv_data)[0] != key_id ||
+                   ((const uint8_t *)mdata.mv_data)[1] != dup_id)) {
+      uint8_t ids[2] = { (uint8_t)key_id, (uint8_t)dup_id };
+      MDB_val data = { sizeof(ids), ids };
+      rc = mdb_put(txn, main_dbi, &mkey, &data, 0);
+    }
+    else if (!custom && in_file)
+      rc = mdb_del(txn, main_dbi, &mkey, NULL);
+    if (rc == EACCES)
+      rc = MDB_SUCCESS;
+  }
+  if (rc == MDB_SUCCESS)
+    e->cmp[dbi] = (uint8_t)((key_id + 1) | ((dup_id + 1) << 4));
+  return rc;
 }
 
 /*
- * Env#database([flags[, name]]) -> MDB::Database
- *
- * Opens (or creates) a database and returns a Database object.
- * The MDB::Env object (self) is stored as @env on the Database instance
- * to prevent the GC from collecting the Env while the Database is live.
+ * After mdb_drop(delete) the handle is closed: forget dbi's comparators on
+ * the Env and drop the file record for name (not NULL) in txn.
  */
-static mrb_value
-mrb_mdb_env_database_m(mrb_state *mrb, mrb_value self)
+static int
+mrb_mdb_dbi_forget_compare(MDB_txn *txn, MDB_dbi dbi, const char *name)
 {
-  mrb_int flags = 0;
-  const char *name = NULL;
-  mrb_get_args(mrb, "|iz!", &flags, &name);
-
-  struct RClass *db_class = mrb_class_get_under_id(mrb,
-    mrb_module_get_id(mrb, MRB_SYM(MDB)), MRB_SYM(Database));
-
-  mrb_value argv[3] = { self, mrb_int_value(mrb, flags), name ? mrb_str_new_cstr(mrb, name) : mrb_nil_value() };
-  return mrb_obj_new(mrb, db_class, name ? 3 : 2, argv);
+  mrb_mdb_env *e = (mrb_mdb_env *)mdb_env_get_userctx(mdb_txn_env(txn));
+  if (e && dbi < e->cmp_len)
+    e->cmp[dbi] = 0;
+
+  char kbuf[MRB_MDB_DICT_KEY_MAX];
+  MDB_val mkey = { name ? mrb_mdb_meta_key(MRB_MDB_CMP_PREFIX, MRB_MDB_CMP_PREFIX_LEN, name, FALSE, 0, kbuf) : 0, kbuf };
+  MDB_dbi main_dbi;
+  if (mkey.mv_size == 0)
+    return MDB_SUCCESS;
+  int rc = mdb_dbi_open(txn, NULL, 0, &main_dbi);
+  if (rc == MDB_SUCCESS)
+    rc = mdb_del(txn, main_dbi, &mkey, NULL);
+  return rc == MDB_NOTFOUND ? MDB_SUCCESS : rc;
 }
 
 /* ========================================================================
- * MDB::Txn
+ * Native value codec
+ *
+ * A Database opened with codec: :native stores mruby values in a compact
+ * binary form instead of raw Strings. Writes size the value first, reserve
+ * that many bytes with MDB_RESERVE and encode straight into the page; reads
+ * decode straight from the MDB_val. Encoded values start with the marker
+ * byte 0xC1 (never valid UTF-8); anything else, or anything malformed,
+ * reads back as the raw String, so existing data stays readable.
+ *
+ *   0x00 nil  0x01 false  0x02 true
+ *   0x03 Integer  zigzag varint
+ *   0x04 Float    8 bytes little-endian IEEE 754
+ *   0x05 String   varint length + bytes
+ *   0x06 Symbol   varint length + name
+ *   0x07 Array    varint count + elements
+ *   0x08 Hash     varint count + key, value pairs
  * ======================================================================== */
 
-static mrb_value
-mrb_mdb_txn_init(mrb_state *mrb, mrb_value self)
-{
-  mrb_value env_v;
-  mrb_int flags = 0;
-  mrb_value parent_v = mrb_nil_value();
-  mrb_get_args(mrb, "o|io", &env_v, &flags, &parent_v);
+#define MRB_MDB_CODEC_RAW    0
+#define MRB_MDB_CODEC_NATIVE 1
 
-  MDB_env *env = mrb_mdb_env_get(mrb, env_v);
-  MDB_txn *parent = NULL;
-  if (!mrb_nil_p(parent_v))
-    parent = mrb_mdb_txn_get(mrb, parent_v);
+#define MRB_MDB_CODEC_MARK      0xC1
+#define MRB_MDB_CODEC_MAX_DEPTH 64
 
-  MDB_txn *txn;
-  int rc = mdb_txn_begin(env, parent, mrb_mdb_flags(mrb, flags), &txn);
-  if (likely(rc == MDB_SUCCESS)) {
-    mrb_data_init(self, txn, &mdb_txn_type);
-    return self;
-  }
-  mrb_mdb_raise(mrb, rc, "mdb_txn_begin");
-}
+enum {
+  MRB_MDB_CODEC_T_NIL = 0,
+  MRB_MDB_CODEC_T_FALSE,
+  MRB_MDB_CODEC_T_TRUE,
+  MRB_MDB_CODEC_T_INT,
+  MRB_MDB_CODEC_T_FLOAT,
+  MRB_MDB_CODEC_T_STRING,
+  MRB_MDB_CODEC_T_SYMBOL,
+  MRB_MDB_CODEC_T_ARRAY,
+  MRB_MDB_CODEC_T_HASH
+};
 
-static mrb_value
-mrb_mdb_txn_commit_m(mrb_state *mrb, mrb_value self)
+static size_t
+mrb_mdb_varint_len(uint64_t u)
 {
-  MDB_txn *txn = mrb_mdb_txn_get(mrb, self);
-  int rc = mdb_txn_commit(txn);
-  mrb_data_init(self, NULL, NULL); /* commit consumes the txn handle */
-  if (likely(rc == MDB_SUCCESS))
-    return mrb_true_value();
-  mrb_mdb_raise(mrb, rc, "mdb_txn_commit");
+  size_t n = 1;
+  while (u >= 0x80) {
+    u >>= 7;
+    n++;
+  }
+  return n;
 }
 
-static mrb_value
-mrb_mdb_txn_abort_m(mrb_state *mrb, mrb_value self)
+static uint8_t *
+mrb_mdb_varint_put(uint8_t *p, uint64_t u)
 {
-  MDB_txn *txn = (MDB_txn *)mrb_data_check_get_ptr(mrb, self, &mdb_txn_type);
-  if (txn) {
-    mdb_txn_abort(txn);
-    mrb_data_init(self, NULL, NULL);
-    return mrb_true_value();
+  while (u >= 0x80) {
+    *p++ = (uint8_t)(u | 0x80);
+    u >>= 7;
   }
-  return mrb_false_value();
+  *p++ = (uint8_t)u;
+  return p;
 }
 
-static mrb_value
-mrb_mdb_txn_reset_m(mrb_state *mrb, mrb_value self)
+static mrb_bool
+mrb_mdb_varint_get(const uint8_t **pp, const uint8_t *end, uint64_t *out)
 {
-  MDB_txn *txn = mrb_mdb_txn_get(mrb, self);
-  mdb_txn_reset(txn);
-  return self;
+  const uint8_t *p = *pp;
+  uint64_t u = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (p == end)
+      return FALSE;
+    uint8_t b = *p++;
+    u |= (uint64_t)(b & 0x7f) << shift;
+    if (!(b & 0x80)) {
+      *pp = p;
+      *out = u;
+      return TRUE;
+    }
+  }
+  return FALSE;
 }
 
-static mrb_value
-mrb_mdb_txn_renew_m(mrb_state *mrb, mrb_value self)
+static uint64_t
+mrb_mdb_zigzag(mrb_int i)
 {
-  MDB_txn *txn = mrb_mdb_txn_get(mrb, self);
-  int rc = mdb_txn_renew(txn);
-  if (likely(rc == MDB_SUCCESS))
-    return self;
-  mrb_mdb_raise(mrb, rc, "mdb_txn_renew");
+  int64_t v = (int64_t)i;
+  return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
 }
 
-/* ========================================================================
- * MDB::Dbi (module functions)
- * ======================================================================== */
+static size_t mrb_mdb_codec_size(mrb_state *mrb, mrb_value v, int depth);
 
-static mrb_value
-mrb_mdb_dbi_open_m(mrb_state *mrb, mrb_value self)
-{
-  mrb_value txn_v;
-  mrb_int flags = 0;
-  const char *name = NULL;
-  mrb_get_args(mrb, "o|iz!", &txn_v, &flags, &name);
+typedef struct {
+  size_t size;
+  int    depth;
+} mrb_mdb_codec_size_ctx;
 
-  MDB_txn *txn = mrb_mdb_txn_get(mrb, txn_v);
-  MDB_dbi dbi;
-  int rc = mdb_dbi_open(txn, name, mrb_mdb_flags(mrb, flags), &dbi);
-  if (likely(rc == MDB_SUCCESS))
-    return mrb_convert_uint(mrb, dbi);
-  mrb_mdb_raise(mrb, rc, "mdb_dbi_open");
+static int
+mrb_mdb_codec_size_pair(mrb_state *mrb, mrb_value k, mrb_value v, void *ud)
+{
+  mrb_mdb_codec_size_ctx *ctx = (mrb_mdb_codec_size_ctx *)ud;
+  ctx->size += mrb_mdb_codec_size(mrb, k, ctx->depth) + mrb_mdb_codec_size(mrb, v, ctx->depth);
+  return 0;
 }
 
-static mrb_value
-mrb_mdb_dbi_flags_m(mrb_state *mrb, mrb_value self)
+/* Encoded size of v; raises for values the codec cannot represent. */
+static size_t
+mrb_mdb_codec_size(mrb_state *mrb, mrb_value v, int depth)
 {
-  mrb_value txn_v;
-  mrb_int dbi;
-  mrb_get_args(mrb, "oi", &txn_v, &dbi);
-
-  MDB_txn *txn = mrb_mdb_txn_get(mrb, txn_v);
-  unsigned int flags;
-  int rc = mdb_dbi_flags(txn, mrb_mdb_dbi(mrb, dbi), &flags);
-  if (likely(rc == MDB_SUCCESS))
-    return mrb_convert_uint(mrb, flags);
-  mrb_mdb_raise(mrb, rc, "mdb_dbi_flags");
+  if (depth > MRB_MDB_CODEC_MAX_DEPTH)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "value nested too deeply for the MDB codec");
+
+  switch (mrb_type(v)) {
+  case MRB_TT_FALSE:
+  case MRB_TT_TRUE:
+    return 1;
+  case MRB_TT_INTEGER:
+    return 1 + mrb_mdb_varint_len(mrb_mdb_zigzag(mrb_integer(v)));
+  case MRB_TT_FLOAT:
+    return 9;
+  case MRB_TT_STRING:
+    return 1 + mrb_mdb_varint_len((uint64_t)RSTRING_LEN(v)) + (size_t)RSTRING_LEN(v);
+  case MRB_TT_SYMBOL: {
+    mrb_int len;
+    mrb_sym_name_len(mrb, mrb_symbol(v), &len);
+    return 1 + mrb_mdb_varint_len((uint64_t)len) + (size_t)len;
+  }
+  case MRB_TT_ARRAY: {
+    size_t size = 1 + mrb_mdb_varint_len((uint64_t)RARRAY_LEN(v));
+    for (mrb_int i = 0; i < RARRAY_LEN(v); i++)
+      size += mrb_mdb_codec_size(mrb, RARRAY_PTR(v)[i], depth + 1);
+    return size;
+  }
+  case MRB_TT_HASH: {
+    mrb_mdb_codec_size_ctx ctx = { 1 + mrb_mdb_varint_len((uint64_t)mrb_hash_size(mrb, v)), depth + 1 };
+    mrb_hash_foreach(mrb, mrb_hash_ptr(v), mrb_mdb_codec_size_pair, &ctx);
+    return ctx.size;
+  }
+  default:
+    mrb_raisef(mrb, E_TYPE_ERROR, "cannot encode %T with the MDB codec", v);
+  }
 }
 
-/* ========================================================================
- * MDB module functions: get, put, del, drop, stat
- * ======================================================================== */
+static uint8_t *mrb_mdb_codec_put_value(mrb_state *mrb, mrb_value v, uint8_t *p);
 
-static mrb_value
-mrb_mdb_get_m(mrb_state *mrb, mrb_value self)
+static int
+mrb_mdb_codec_put_pair(mrb_state *mrb, mrb_value k, mrb_value v, void *ud)
 {
-  mrb_value txn_v, key_obj;
-  mrb_int dbi;
-  mrb_get_args(mrb, "oio", &txn_v, &dbi, &key_obj);
+  uint8_t **pp = (uint8_t **)ud;
+  *pp = mrb_mdb_codec_put_value(mrb, k, *pp);
+  *pp = mrb_mdb_codec_put_value(mrb, v, *pp);
+  return 0;
+}
 
-  MDB_txn *txn = mrb_mdb_txn_get(mrb, txn_v);
-  key_obj = mrb_str_to_str(mrb, key_obj);
-  MDB_val key  = { (size_t)RSTRING_LEN(key_obj), RSTRING_PTR(key_obj) };
-  MDB_val data;
-  int rc = mdb_get(txn, mrb_mdb_dbi(mrb, dbi), &key, &data);
-  if (likely(rc == MDB_SUCCESS))
-    return mrb_mdb_val_to_str(mrb, &data);
-  if (rc == MDB_NOTFOUND)
-    return mrb_nil_value();
-  mrb_mdb_raise(mrb, rc, "mdb_get");
+/* Encode v at p (sized by mrb_mdb_codec_size, so this never raises). */
+static uint8_t *
+mrb_mdb_codec_put_value(mrb_state *mrb, mrb_value v, uint8_t *p)
+{
+  switch (mrb_type(v)) {
+  case MRB_TT_FALSE:
+    *p++ = mrb_nil_p(v) ? MRB_MDB_CODEC_T_NIL : MRB_MDB_CODEC_T_FALSE;
+    return p;
+  case MRB_TT_TRUE:
+    *p++ = MRB_MDB_CODEC_T_TRUE;
+    return p;
+  case MRB_TT_INTEGER:
+    *p++ = MRB_MDB_CODEC_T_INT;
+    return mrb_mdb_varint_put(p, mrb_mdb_zigzag(mrb_integer(v)));
+  case MRB_TT_FLOAT: {
+    double d = (double)mrb_float(v);
+    uint64_t u;
+    memcpy(&u, &d, sizeof(u));
+    *p++ = MRB_MDB_CODEC_T_FLOAT;
+    for (int i = 0; i < 8; i++)
+      *p++ = (uint8_t)(u >> (8 * i));
+    return p;
+  }
+  case MRB_TT_STRING:
+    *p++ = MRB_MDB_CODEC_T_STRING;
+    p = mrb_mdb_varint_put(p, (uint64_t)RSTRING_LEN(v));
+    memcpy(p, RSTRING_PTR(v), (size_t)RSTRING_LEN(v));
+    return p + RSTRING_LEN(v);
+  case MRB_TT_SYMBOL: {
+    mrb_int len;
+    const char *name = mrb_sym_name_len(mrb, mrb_symbol(v), &len);
+    *p++ = MRB_MDB_CODEC_T_SYMBOL;
+    p = mrb_mdb_varint_put(p, (uint64_t)len);
+    memcpy(p, name, (size_t)len);
+    return p + len;
+  }
+  case MRB_TT_ARRAY:
+    *p++ = MRB_MDB_CODEC_T_ARRAY;
+    p = mrb_mdb_varint_put(p, (uint64_t)RARRAY_LEN(v));
+    for (mrb_int i = 0; i < RARRAY_LEN(v); i++)
+      p = mrb_mdb_codec_put_value(mrb, RARRAY_PTR(v)[i], p);
+    return p;
+  case MRB_TT_HASH:
+    *p++ = MRB_MDB_CODEC_T_HASH;
+    p = mrb_mdb_varint_put(p, (uint64_t)mrb_hash_size(mrb, v));
+    mrb_hash_foreach(mrb, mrb_hash_ptr(v), mrb_mdb_codec_put_pair, &p);
+    return p;
+  default:
+    return p;
+  }
 }
 
-static mrb_value
-mrb_mdb_put_m(mrb_state *mrb, mrb_value self)
+/* Encoded size of obj as a stored value, marker byte included. */
+static size_t
+mrb_mdb_codec_value_size(mrb_state *mrb, mrb_value obj)
 {
-  mrb_value txn_v, key_obj, data_obj;
-  mrb_int dbi, flags = 0;
-  mrb_get_args(mrb, "oioo|i", &txn_v, &dbi, &key_obj, &data_obj, &flags);
+  return 1 + mrb_mdb_codec_size(mrb, obj, 0);
+}
 
-  MDB_txn *txn = mrb_mdb_txn_get(mrb, txn_v);
-  key_obj  = mrb_str_to_str(mrb, key_obj);
-  data_obj = mrb_str_to_str(mrb, data_obj);
-  MDB_val key  = { (size_t)RSTRING_LEN(key_obj),  RSTRING_PTR(key_obj) };
-  MDB_val data = { (size_t)RSTRING_LEN(data_obj), RSTRING_PTR(data_obj) };
-  int rc = mdb_put(txn, mrb_mdb_dbi(mrb, dbi), &key, &data, mrb_mdb_flags(mrb, flags));
-  if (likely(rc == MDB_SUCCESS))
-    return self;
-  mrb_mdb_raise(mrb, rc, "mdb_put");
+/* mdb_put obj (already sized) with MDB_RESERVE and encode it in place. */
+static int
+mrb_mdb_codec_put(mrb_state *mrb, MDB_txn *txn, MDB_dbi dbi, MDB_val *key,
+                  mrb_value obj, size_t size, unsigned int flags)
+{
+  MDB_val data = { size, NULL };
+  int rc = mdb_put(txn, dbi, key, &data, flags | MDB_RESERVE);
+  if (likely(rc == MDB_SUCCESS)) {
+    uint8_t *p = (uint8_t *)data.mv_data;
+    *p++ = MRB_MDB_CODEC_MARK;
+    mrb_mdb_codec_put_value(mrb, obj, p);
+  }
+  return rc;
 }
 
-static mrb_value
-mrb_mdb_del_m(mrb_state *mrb, mrb_value self)
+typedef struct {
+  const uint8_t *p, *end;
+} mrb_mdb_codec_reader;
+
+/* Decode one value; FALSE if the bytes are malformed. */
+static mrb_bool
+mrb_mdb_codec_get_value(mrb_state *mrb, mrb_mdb_codec_reader *rd, int depth, mrb_value *out)
 {
-  mrb_value txn_v, key_obj, data_obj = mrb_nil_value();
-  mrb_int dbi;
-  mrb_get_args(mrb, "oio|o", &txn_v, &dbi, &key_obj, &data_obj);
+  if (rd->p == rd->end || depth > MRB_MDB_CODEC_MAX_DEPTH)
+    return FALSE;
 
-  MDB_txn *txn = mrb_mdb_txn_get(mrb, txn_v);
-  key_obj = mrb_str_to_str(mrb, key_obj);
-  MDB_val key = { (size_t)RSTRING_LEN(key_obj), RSTRING_PTR(key_obj) };
-  MDB_val dv, *dvp = NULL;
-  if (!mrb_nil_p(data_obj)) {
-    data_obj = mrb_str_to_str(mrb, data_obj);
-    dv.mv_size = (size_t)RSTRING_LEN(data_obj);
-    dv.mv_data = RSTRING_PTR(data_obj);
-    dvp = &dv;
+  uint64_t u;
+  switch (*rd->p++) {
+  case MRB_MDB_CODEC_T_NIL:   *out = mrb_nil_value();   return TRUE;
+  case MRB_MDB_CODEC_T_FALSE: *out = mrb_false_value(); return TRUE;
+  case MRB_MDB_CODEC_T_TRUE:  *out = mrb_true_value();  return TRUE;
+  case MRB_MDB_CODEC_T_INT: {
+    if (!mrb_mdb_varint_get(&rd->p, rd->end, &u))
+      return FALSE;
+    int64_t v = (int64_t)(u >> 1) ^ -(int64_t)(u & 1);
+    if (v < MRB_INT_MIN || v > MRB_INT_MAX)
+      return FALSE;
+    *out = mrb_int_value(mrb, (mrb_int)v);
+    return TRUE;
+  }
+  case MRB_MDB_CODEC_T_FLOAT: {
+    if (rd->end - rd->p < 8)
+      return FALSE;
+    u = 0;
+    for (int i = 7; i >= 0; i--)
+      u = (u << 8) | rd->p[i];
+    rd->p += 8;
+    double d;
+    memcpy(&d, &u, sizeof(d));
+    *out = mrb_float_value(mrb, (mrb_float)d);
+    return TRUE;
+  }
+  case MRB_MDB_CODEC_T_STRING:
+  case MRB_MDB_CODEC_T_SYMBOL: {
+    uint8_t tag = rd->p[-1];
+    if (!mrb_mdb_varint_get(&rd->p, rd->end, &u) || u > (uint64_t)(rd->end - rd->p))
+      return FALSE;
+    *out = tag == MRB_MDB_CODEC_T_STRING
+      ? mrb_str_new(mrb, (const char *)rd->p, (mrb_int)u)
+      : mrb_symbol_value(mrb_intern(mrb, (const char *)rd->p, (size_t)u));
+    rd->p += u;
+    return TRUE;
+  }
+  case MRB_MDB_CODEC_T_ARRAY: {
+    /* Every element takes at least one byte, which bounds the capacity. */
+    if (!mrb_mdb_varint_get(&rd->p, rd->end, &u) || u > (uint64_t)(rd->end - rd->p))
+      return FALSE;
+    mrb_value ary = mrb_ary_new_capa(mrb, (mrb_int)u);
+    int ai = mrb_gc_arena_save(mrb);
+    for (uint64_t i = 0; i < u; i++) {
+      mrb_value e;
+      if (!mrb_mdb_codec_get_value(mrb, rd, depth + 1, &e))
+        return FALSE;
+      mrb_ary_push(mrb, ary, e);
+      mrb_gc_arena_restore(mrb, ai);
+    }
+    *out = ary;
+    return TRUE;
+  }
+  case MRB_MDB_CODEC_T_HASH: {
+    if (!mrb_mdb_varint_get(&rd->p, rd->end, &u) || u > (uint64_t)(rd->end - rd->p) / 2)
+      return FALSE;
+    mrb_value hash = mrb_hash_new_capa(mrb, (mrb_int)u);
+    int ai = mrb_gc_arena_save(mrb);
+    for (uint64_t i = 0; i < u; i++) {
+      mrb_value k, v;
+      if (!mrb_mdb_codec_get_value(mrb, rd, depth + 1, &k) ||
+          !mrb_mdb_codec_get_value(mrb, rd, depth + 1, &v))
+        return FALSE;
+      mrb_hash_set(mrb, hash, k, v);
+      mrb_gc_arena_restore(mrb, ai);
+    }
+    *out = hash;
+    return TRUE;
+  }
+  default:
+    return FALSE;
   }
-  int rc = mdb_del(txn, mrb_mdb_dbi(mrb, dbi), &key, dvp);
-  if (likely(rc == MDB_SUCCESS))
-    return mrb_true_value();
-  if (rc == MDB_NOTFOUND)
-    return mrb_nil_value();
-  mrb_mdb_raise(mrb, rc, "mdb_del");
 }
 
+/* Decode a stored value; unmarked or malformed bytes come back as a String. */
 static mrb_value
-mrb_mdb_drop_m(mrb_state *mrb, mrb_value self)
+mrb_mdb_codec_decode(mrb_state *mrb, const MDB_val *val)
 {
-  mrb_value txn_v;
-  mrb_int dbi;
-  mrb_bool del = FALSE;
-  mrb_get_args(mrb, "oi|b", &txn_v, &dbi, &del);
+  const uint8_t *p = (const uint8_t *)val->mv_data;
+  if (val->mv_size > 1 && p[0] == MRB_MDB_CODEC_MARK) {
+    mrb_mdb_codec_reader rd = { p + 1, p + val->mv_size };
+    mrb_value out;
+    if (mrb_mdb_codec_get_value(mrb, &rd, 0, &out) && rd.p == rd.end)
+      return out;
+  }
+  return mrb_mdb_val_to_str(mrb, val);
+}
 
-  MDB_txn *txn = mrb_mdb_txn_get(mrb, txn_v);
-  int rc = mdb_drop(txn, mrb_mdb_dbi(mrb, dbi), (int)del);
-  if (likely(rc == MDB_SUCCESS))
-    return self;
-  mrb_mdb_raise(mrb, rc, "mdb_drop");
+static int
+mrb_mdb_codec_id(mrb_state *mrb, mrb_value v)
+{
+  if (mrb_symbol_p(v) && mrb_symbol(v) == MRB_SYM(native))
+    return MRB_MDB_CODEC_NATIVE;
+  if (mrb_nil_p(v) || (mrb_symbol_p(v) && mrb_symbol(v) == MRB_SYM(raw)))
+    return MRB_MDB_CODEC_RAW;
+  mrb_raisef(mrb, E_ARGUMENT_ERROR, "unknown codec %v", v);
 }
 
+/* obj encoded into a new String (for paths that cannot reserve). */
 static mrb_value
-mrb_mdb_stat_m(mrb_state *mrb, mrb_value self)
+mrb_mdb_codec_encode(mrb_state *mrb, mrb_value obj)
 {
-  mrb_value txn_v;
-  mrb_int dbi;
-  mrb_get_args(mrb, "oi", &txn_v, &dbi);
-
-  MDB_txn *txn = mrb_mdb_txn_get(mrb, txn_v);
-  MDB_stat stat;
-  int rc = mdb_stat(txn, mrb_mdb_dbi(mrb, dbi), &stat);
-  if (likely(rc == MDB_SUCCESS))
-    return mrb_mdb_stat_to_value(mrb, &stat);
-  mrb_mdb_raise(mrb, rc, "mdb_stat");
+  size_t size = mrb_mdb_codec_value_size(mrb, obj);
+  mrb_value str = mrb_str_new(mrb, NULL, (mrb_int)size);
+  uint8_t *p = (uint8_t *)RSTRING_PTR(str);
+  *p++ = MRB_MDB_CODEC_MARK;
+  mrb_mdb_codec_put_value(mrb, obj, p);
+  return str;
 }
 
 /* ========================================================================
- * MDB::Cursor
+ * Value compression
+ *
+ * A Database opened with compress: :lz4 stores values as LZ4 blocks
+ * (src/mrb_lmdb_lz4.c) behind a short header:
+ *
+ *   0xC2 'L' varint raw length, LZ4 block
+ *   0xC2 'D' varint dictionary version, varint raw length, LZ4 block
+ *            compressed against that trained dictionary
+ *   0xC2 'S' raw bytes (only for values that start with 0xC2 themselves)
+ *
+ * Values that are too short or do not shrink are stored as they are.
+ * Anything without a well-formed header reads back unchanged, so data
+ * written before compression was enabled stays readable.
+ *
+ * Dictionaries (Database#train_dictionary) live in the main DB under
+ * "\0mrb-lmdb-dict\0<name>\0" + 4-byte big-endian version; the bare
+ * "\0mrb-lmdb-dict\0<name>" key holds the current version. Old versions
+ * are kept, so values compressed against them stay readable.
  * ======================================================================== */
 
-static mrb_value
-mrb_mdb_cursor_init(mrb_state *mrb, mrb_value self)
+#define MRB_MDB_COMPRESS_NONE 0
+#define MRB_MDB_COMPRESS_LZ4  1
+
+#define MRB_MDB_PACK_MARK   0xC2
+#define MRB_MDB_PACK_LZ4    'L'
+#define MRB_MDB_PACK_DICT   'D'
+#define MRB_MDB_PACK_STORED 'S'
+#define MRB_MDB_PACK_MIN      64  /* without a dictionary */
+#define MRB_MDB_PACK_DICT_MIN 16
+
+#define MRB_MDB_DICT_PREFIX     "\0mrb-lmdb-dict\0"
+#define MRB_MDB_DICT_PREFIX_LEN (sizeof(MRB_MDB_DICT_PREFIX) - 1)
+/*
+ * Meta key for db's dictionaries into buf: the current-version pointer
+ * when current is TRUE, else the entry for version.
+ */
+static size_t
+mrb_mdb_dict_key(const mrb_mdb_database *db, mrb_bool current, uint32_t version,
+                 char buf[MRB_MDB_DICT_KEY_MAX])
 {
-  mrb_value txn_v;
-  mrb_int dbi;
-  mrb_get_args(mrb, "oi", &txn_v, &dbi);
+  return mrb_mdb_meta_key(MRB_MDB_DICT_PREFIX, MRB_MDB_DICT_PREFIX_LEN, db->name, !current, version, buf);
+}
 
-  MDB_txn *txn = mrb_mdb_txn_get(mrb, txn_v);
-  MDB_cursor *cursor;
-  int rc = mdb_cursor_open(txn, mrb_mdb_dbi(mrb, dbi), &cursor);
-  if (likely(rc == MDB_SUCCESS)) {
-    mrb_data_init(self, cursor, &mdb_cursor_type);
-    return self;
+/* Look up (or load through txn and cache) dictionary version; NULL if unavailable. */
+static mrb_mdb_dict *
+mrb_mdb_dict_get(mrb_state *mrb, MDB_txn *txn, mrb_mdb_database *db, uint32_t version)
+{
+  for (size_t i = 0; i < db->ndicts; i++) {
+    if (db->dicts[i]->version == version)
+      return db->dicts[i];
   }
-  mrb_mdb_raise(mrb, rc, "mdb_cursor_open");
+
+  char kbuf[MRB_MDB_DICT_KEY_MAX];
+  MDB_val key = { mrb_mdb_dict_key(db, FALSE, version, kbuf), kbuf }, data;
+  MDB_dbi main_dbi;
+  if (key.mv_size == 0 ||
+      mdb_dbi_open(txn, NULL, 0, &main_dbi) != MDB_SUCCESS ||
+      mdb_get(txn, main_dbi, &key, &data) != MDB_SUCCESS || data.mv_size == 0)
+    return NULL;
+
+  /* Non-raising allocations: this runs inside read and write txns. */
+  mrb_mdb_dict *d = (mrb_mdb_dict *)mrb_malloc_simple(mrb, sizeof(mrb_mdb_dict));
+  uint8_t *bytes = (uint8_t *)mrb_malloc_simple(mrb, data.mv_size);
+  mrb_mdb_dict **dicts = (mrb_mdb_dict **)mrb_realloc_simple(mrb, db->dicts,
+                                                             (db->ndicts + 1) * sizeof(*dicts));
+  if (dicts)
+    db->dicts = dicts;
+  if (!d || !bytes || !dicts) {
+    mrb_free(mrb, d);
+    mrb_free(mrb, bytes);
+    return NULL;
+  }
+  memcpy(bytes, data.mv_data, data.mv_size);
+  d->version = version;
+  d->data = bytes;
+  mrb_mdb_lz4_dict_init(&d->lz, bytes, data.mv_size);
+  db->dicts[db->ndicts++] = d;
+  return d;
 }
 
-static mrb_value
-mrb_mdb_cursor_close_m(mrb_state *mrb, mrb_value self)
+/* Current dictionary version recorded for db (0: none), read through txn. */
+static uint32_t
+mrb_mdb_dict_current_version(MDB_txn *txn, const mrb_mdb_database *db)
 {
-  MDB_cursor *cursor = (MDB_cursor *)mrb_data_check_get_ptr(mrb, self, &mdb_cursor_type);
-  if (cursor) {
-    mdb_cursor_close(cursor);
-    mrb_data_init(self, NULL, NULL);
-    return mrb_true_value();
-  }
-  return mrb_false_value();
+  char kbuf[MRB_MDB_DICT_KEY_MAX];
+  MDB_val key = { mrb_mdb_dict_key(db, TRUE, 0, kbuf), kbuf }, data;
+  MDB_dbi main_dbi;
+  if (key.mv_size == 0 ||
+      mdb_dbi_open(txn, NULL, 0, &main_dbi) != MDB_SUCCESS ||
+      mdb_get(txn, main_dbi, &key, &data) != MDB_SUCCESS || data.mv_size != 4)
+    return 0;
+  const uint8_t *p = (const uint8_t *)data.mv_data;
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
 }
 
-static mrb_value
-mrb_mdb_cursor_renew_m(mrb_state *mrb, mrb_value self)
+/* Point db->dict at the current dictionary, if there is one. */
+static void
+mrb_mdb_dict_refresh(mrb_state *mrb, MDB_txn *txn, mrb_mdb_database *db)
 {
-  MDB_cursor *cursor = mrb_mdb_cursor_get(mrb, self);
-  mrb_value txn_v;
-  mrb_get_args(mrb, "o", &txn_v);
-  MDB_txn *txn = mrb_mdb_txn_get(mrb, txn_v);
-  int rc = mdb_cursor_renew(txn, cursor);
-  if (likely(rc == MDB_SUCCESS))
-    return self;
-  mrb_mdb_raise(mrb, rc, "mdb_cursor_renew");
+  uint32_t version = mrb_mdb_dict_current_version(txn, db);
+  db->dict = version ? mrb_mdb_dict_get(mrb, txn, db, version) : NULL;
 }
 
+/* Stored form of the String str, compressed against db->dict when set. */
 static mrb_value
-mrb_mdb_cursor_get_m(mrb_state *mrb, mrb_value self)
+mrb_mdb_pack(mrb_state *mrb, const mrb_mdb_database *db, mrb_value str)
 {
-  MDB_cursor *cursor = mrb_mdb_cursor_get(mrb, self);
-  mrb_int cursor_op;
-  mrb_value key_obj = mrb_nil_value(), data_obj = mrb_nil_value();
-  mrb_get_args(mrb, "i|oo", &cursor_op, &key_obj, &data_obj);
+  const uint8_t *src = (const uint8_t *)RSTRING_PTR(str);
+  size_t n = (size_t)RSTRING_LEN(str);
+  const mrb_mdb_dict *d = db->dict;
+
+  if (n >= (d ? MRB_MDB_PACK_DICT_MIN : MRB_MDB_PACK_MIN) && n <= MRB_MDB_LZ4_MAX_INPUT) {
+    size_t head = 2 + (d ? mrb_mdb_varint_len(d->version) : 0) + mrb_mdb_varint_len((uint64_t)n);
+    mrb_value out = mrb_str_new(mrb, NULL, (mrb_int)(head + MRB_MDB_LZ4_BOUND(n)));
+    uint8_t *p = (uint8_t *)RSTRING_PTR(out);
+    size_t clen = d
+      ? mrb_mdb_lz4_compress_dict(&d->lz, src, n, p + head, MRB_MDB_LZ4_BOUND(n))
+      : mrb_mdb_lz4_compress(src, n, p + head, MRB_MDB_LZ4_BOUND(n));
+    if (clen > 0 && head + clen < n) {
+      p[0] = MRB_MDB_PACK_MARK;
+      p[1] = d ? MRB_MDB_PACK_DICT : MRB_MDB_PACK_LZ4;
+      uint8_t *q = p + 2;
+      if (d)
+        q = mrb_mdb_varint_put(q, d->version);
+      mrb_mdb_varint_put(q, (uint64_t)n);
+      return mrb_str_resize(mrb, out, (mrb_int)(head + clen));
+    }
+  }
+  if (n > 0 && src[0] == MRB_MDB_PACK_MARK) {
+    mrb_value out = mrb_str_new(mrb, NULL, (mrb_int)(n + 2));
+    uint8_t *p = (uint8_t *)RSTRING_PTR(out);
+    p[0] = MRB_MDB_PACK_MARK;
+    p[1] = MRB_MDB_PACK_STORED;
+    memcpy(p + 2, src, n);
+    return out;
+  }
+  return str;
+}
 
-  MDB_val key = { 0, NULL }, data = { 0, NULL };
-  if (!mrb_nil_p(key_obj)) {
-    key_obj = mrb_str_to_str(mrb, key_obj);
-    key.mv_size = (size_t)RSTRING_LEN(key_obj);
-    key.mv_data = RSTRING_PTR(key_obj);
+/*
+ * The bytes behind a stored value, or at least their first limit bytes
+ * (a compressed value is only decompressed that far). A decompressed
+ * value lands in a new String returned through *holder (left nil
+ * otherwise); out then points into it. Raises MDB::CORRUPTED when a
+ * compressed header or block is malformed or names a dictionary that is
+ * gone, so callers run it only where a
+ * raise gives the txn back: mrb_mdb_env_read bodies and the protected
+ * write-txn callbacks (indexed writes, Index#rebuild).
+ */
+static void
+mrb_mdb_unpack_prefix(mrb_state *mrb, MDB_txn *txn, mrb_mdb_database *db, const MDB_val *val,
+                      size_t limit, MDB_val *out, mrb_value *holder)
+{
+  const uint8_t *p = (const uint8_t *)val->mv_data;
+  *out = *val;
+  *holder = mrb_nil_value();
+  if (val->mv_size < 2 || p[0] != MRB_MDB_PACK_MARK)
+    return;
+
+  if (p[1] == MRB_MDB_PACK_STORED) {
+    out->mv_size = val->mv_size - 2;
+    out->mv_data = (void *)(p + 2);
+    return;
   }
-  if (!mrb_nil_p(data_obj)) {
-    data_obj = mrb_str_to_str(mrb, data_obj);
-    data.mv_size = (size_t)RSTRING_LEN(data_obj);
-    data.mv_data = RSTRING_PTR(data_obj);
+  if (p[1] != MRB_MDB_PACK_LZ4 && p[1] != MRB_MDB_PACK_DICT)
+    return;
+
+  const uint8_t *q = p + 2, *end = p + val->mv_size;
+  const mrb_mdb_dict *d = NULL;
+  uint64_t n;
+  if (p[1] == MRB_MDB_PACK_DICT) {
+    uint64_t version;
+    if (!mrb_mdb_varint_get(&q, end, &version) || version == 0 || version > UINT32_MAX)
+      mrb_mdb_raise(mrb, MDB_CORRUPTED, "mrb_mdb_unpack");
+    /* A well-formed header whose dictionary is gone cannot be read back. */
+    if (!(d = mrb_mdb_dict_get(mrb, txn, db, (uint32_t)version)))
+      mrb_mdb_raise(mrb, MDB_CORRUPTED, "mrb_mdb_dict_get");
   }
-  int rc = mdb_cursor_get(cursor, &key, &data, mrb_mdb_cursor_op(mrb, cursor_op));
-  if (likely(rc == MDB_SUCCESS))
-    return mrb_assoc_new(mrb, mrb_mdb_val_to_str(mrb, &key), mrb_mdb_val_to_str(mrb, &data));
-  if (rc == MDB_NOTFOUND)
+  /* LZ4 cannot expand a block by more than 255x, so this bounds a corrupt length. */
+  if (!mrb_mdb_varint_get(&q, end, &n) || n > MRB_MDB_LZ4_MAX_INPUT ||
+      n > (uint64_t)(end - q) * 255 + 16)
+    mrb_mdb_raise(mrb, MDB_CORRUPTED, "mrb_mdb_unpack");
+  mrb_bool partial = limit < n;
+  if (partial)
+    n = limit;
+  mrb_value str = mrb_str_new(mrb, NULL, (mrb_int)n);
+  size_t len;
+  if (!(partial ? mrb_mdb_lz4_decompress_prefix : mrb_mdb_lz4_decompress_dict)(
+        d ? d->data : NULL, d ? d->lz.len : 0, q, (size_t)(end - q),
+        (uint8_t *)RSTRING_PTR(str), (size_t)n, &len) ||
+      len != n)
+    mrb_mdb_raise(mrb, MDB_CORRUPTED, "mrb_mdb_unpack");
+  out->mv_size = (size_t)n;
+  out->mv_data = RSTRING_PTR(str);
+  *holder = str;
+}
+
+/* The whole value behind a stored one; see mrb_mdb_unpack_prefix. */
+static void
+mrb_mdb_unpack(mrb_state *mrb, MDB_txn *txn, mrb_mdb_database *db, const MDB_val *val,
+               MDB_val *out, mrb_value *holder)
+{
+  mrb_mdb_unpack_prefix(mrb, txn, db, val, SIZE_MAX, out, holder);
+}
+
+/*
+ * Dictionary training: pick the 32-byte segments of the samples whose
+ * 8-byte substrings occur in the most samples, greedily, discounting
+ * substrings already covered. The best segment goes last, nearest to the
+ * data and so cheapest to reference.
+ */
+#define MRB_MDB_DICT_GRAM      8
+#define MRB_MDB_DICT_SEG       32
+#define MRB_MDB_DICT_HASH_LOG  16
+#define MRB_MDB_DICT_DEFAULT   16384
+
+typedef struct {
+  uint32_t off;
+  uint32_t score;
+} mrb_mdb_dict_cand;
+
+static uint32_t
+mrb_mdb_dict_gram(const uint8_t *p)
+{
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return (uint32_t)((v * 0x9E3779B97F4A7C15ull) >> (64 - MRB_MDB_DICT_HASH_LOG));
+}
+
+/* Grams seen in fewer than two samples do not help. */
+static uint32_t
+mrb_mdb_dict_seg_score(const uint8_t *p, const uint32_t *counts)
+{
+  uint32_t score = 0;
+  for (size_t j = 0; j + MRB_MDB_DICT_GRAM <= MRB_MDB_DICT_SEG; j++) {
+    uint32_t c = counts[mrb_mdb_dict_gram(p + j)];
+    if (c >= 2)
+      score += c;
+  }
+  return score;
+}
+
+static int
+mrb_mdb_dict_cand_cmp(const void *a, const void *b)
+{
+  const mrb_mdb_dict_cand *x = (const mrb_mdb_dict_cand *)a, *y = (const mrb_mdb_dict_cand *)b;
+  if (x->score != y->score)
+    return x->score < y->score ? 1 : -1;
+  return x->off < y->off ? -1 : x->off > y->off;
+}
+
+/* Train from n samples laid out back to back in buf; nil if nothing repeats. */
+static mrb_value
+mrb_mdb_dict_train(mrb_state *mrb, const uint8_t *buf, const uint32_t *lens, size_t n, size_t cap)
+{
+  /* Scratch lives in Strings so a failed allocation cannot leak it. */
+  size_t slots = (size_t)1 << MRB_MDB_DICT_HASH_LOG;
+  mrb_value scratch = mrb_str_new(mrb, NULL, (mrb_int)(2 * slots * sizeof(uint32_t)));
+  uint32_t *counts = (uint32_t *)RSTRING_PTR(scratch), *stamp = counts + slots;
+  memset(counts, 0, 2 * slots * sizeof(uint32_t));
+
+  size_t ncand = 0, pos = 0;
+  for (size_t s = 0; s < n; pos += lens[s], s++) {
+    for (size_t j = 0; j + MRB_MDB_DICT_GRAM <= lens[s]; j++) {
+      uint32_t h = mrb_mdb_dict_gram(buf + pos + j);
+      if (stamp[h] != s + 1) {
+        stamp[h] = (uint32_t)(s + 1);
+        counts[h]++;
+      }
+    }
+    if (lens[s] >= MRB_MDB_DICT_SEG)
+      ncand += (lens[s] - MRB_MDB_DICT_SEG) / 4 + 1;
+  }
+  if (ncand == 0)
     return mrb_nil_value();
-  mrb_mdb_raise(mrb, rc, "mdb_cursor_get");
+
+  mrb_value cand_str = mrb_str_new(mrb, NULL, (mrb_int)(ncand * sizeof(mrb_mdb_dict_cand)));
+  mrb_mdb_dict_cand *cands = (mrb_mdb_dict_cand *)RSTRING_PTR(cand_str);
+  size_t k = 0;
+  pos = 0;
+  for (size_t s = 0; s < n; pos += lens[s], s++) {
+    for (size_t j = 0; j + MRB_MDB_DICT_SEG <= lens[s]; j += 4) {
+      cands[k].off   = (uint32_t)(pos + j);
+      cands[k].score = mrb_mdb_dict_seg_score(buf + pos + j, counts);
+      k++;
+    }
+  }
+  qsort(cands, ncand, sizeof(*cands), mrb_mdb_dict_cand_cmp);
+
+  /* Accepted segments reuse the front of cands (never ahead of the scan). */
+  size_t npick = 0;
+  for (size_t i = 0; i < ncand && (npick + 1) * MRB_MDB_DICT_SEG <= cap; i++) {
+    if (cands[i].score == 0)
+      break;
+    const uint8_t *seg = buf + cands[i].off;
+    uint32_t now = mrb_mdb_dict_seg_score(seg, counts);
+    if (now == 0 || now * 2 < cands[i].score)
+      continue;
+    for (size_t j = 0; j + MRB_MDB_DICT_GRAM <= MRB_MDB_DICT_SEG; j++)
+      counts[mrb_mdb_dict_gram(seg + j)] = 0;
+    cands[npick++].off = cands[i].off;
+  }
+  if (npick == 0)
+    return mrb_nil_value();
+
+  mrb_value dict = mrb_str_new(mrb, NULL, (mrb_int)(npick * MRB_MDB_DICT_SEG));
+  uint8_t *out = (uint8_t *)RSTRING_PTR(dict) + npick * MRB_MDB_DICT_SEG;
+  for (size_t i = 0; i < npick; i++) {
+    out -= MRB_MDB_DICT_SEG;
+    memcpy(out, buf + cands[i].off, MRB_MDB_DICT_SEG);
+  }
+  return dict;
+}
+
+static int
+mrb_mdb_compress_id(mrb_state *mrb, mrb_value v)
+{
+  if (mrb_symbol_p(v) && mrb_symbol(v) == MRB_SYM(lz4))
+    return MRB_MDB_COMPRESS_LZ4;
+  if (!mrb_test(v) || (mrb_symbol_p(v) && mrb_symbol(v) == MRB_SYM(none)))
+    return MRB_MDB_COMPRESS_NONE;
+  mrb_raisef(mrb, E_ARGUMENT_ERROR, "unknown compression %v", v);
 }
 
+/* ========================================================================
+ * Database value pipeline: codec, then compression
+ * ======================================================================== */
+
+/* A value read from db through txn: decompressed, then decoded under codec: :native. */
 static mrb_value
-mrb_mdb_cursor_put_m(mrb_state *mrb, mrb_value self)
+mrb_mdb_db_value(mrb_state *mrb, MDB_txn *txn, mrb_mdb_database *db, const MDB_val *val)
 {
-  MDB_cursor *cursor = mrb_mdb_cursor_get(mrb, self);
-  mrb_value key_obj, data_obj;
-  mrb_int flags = 0;
-  mrb_get_args(mrb, "oo|i", &key_obj, &data_obj, &flags);
+  MDB_val raw = *val;
+  mrb_value holder = mrb_nil_value();
+  if (db->compress != MRB_MDB_COMPRESS_NONE)
+    mrb_mdb_unpack(mrb, txn, db, val, &raw, &holder);
+  if (db->codec == MRB_MDB_CODEC_NATIVE)
+    return mrb_mdb_codec_decode(mrb, &raw);
+  return mrb_string_p(holder) ? holder : mrb_mdb_val_to_str(mrb, &raw);
+}
 
-  key_obj  = mrb_str_to_str(mrb, key_obj);
-  data_obj = mrb_str_to_str(mrb, data_obj);
-  MDB_val key  = { (size_t)RSTRING_LEN(key_obj),  RSTRING_PTR(key_obj) };
-  MDB_val data = { (size_t)RSTRING_LEN(data_obj), RSTRING_PTR(data_obj) };
-  int rc = mdb_cursor_put(cursor, &key, &data, mrb_mdb_flags(mrb, flags));
-  if (likely(rc == MDB_SUCCESS))
-    return self;
-  mrb_mdb_raise(mrb, rc, "mdb_cursor_put");
+/*
+ * Length of the bytes a stored value decodes from: for a compressed value
+ * the raw length recorded in its header, so nothing is decompressed.
+ */
+static size_t
+mrb_mdb_db_value_size(const mrb_mdb_database *db, const MDB_val *val)
+{
+  const uint8_t *p = (const uint8_t *)val->mv_data;
+  if (db->compress == MRB_MDB_COMPRESS_NONE || val->mv_size < 2 || p[0] != MRB_MDB_PACK_MARK)
+    return val->mv_size;
+  if (p[1] == MRB_MDB_PACK_STORED)
+    return val->mv_size - 2;
+  if (p[1] != MRB_MDB_PACK_LZ4 && p[1] != MRB_MDB_PACK_DICT)
+    return val->mv_size;
+
+  const uint8_t *q = p + 2, *end = p + val->mv_size;
+  uint64_t version, n;
+  if ((p[1] == MRB_MDB_PACK_DICT && !mrb_mdb_varint_get(&q, end, &version)) ||
+      !mrb_mdb_varint_get(&q, end, &n) || n > MRB_MDB_LZ4_MAX_INPUT)
+    return val->mv_size;
+  return (size_t)n;
 }
 
+/* Check a value before a write txn opens: encodable for codec DBs, else a String. */
 static mrb_value
-mrb_mdb_cursor_del_m(mrb_state *mrb, mrb_value self)
+mrb_mdb_db_coerce(mrb_state *mrb, mrb_mdb_database *db, mrb_value obj)
 {
-  MDB_cursor *cursor = mrb_mdb_cursor_get(mrb, self);
-  mrb_int flags = 0;
-  mrb_get_args(mrb, "|i", &flags);
-  int rc = mdb_cursor_del(cursor, mrb_mdb_flags(mrb, flags));
-  if (likely(rc == MDB_SUCCESS))
-    return self;
-  mrb_mdb_raise(mrb, rc, "mdb_cursor_del");
+  if (db->codec == MRB_MDB_CODEC_NATIVE) {
+    mrb_mdb_codec_value_size(mrb, obj);
+    return obj;
+  }
+  return mrb_str_to_str(mrb, obj);
 }
 
+/*
+ * Coerced value -> what mrb_mdb_db_put takes: the compressed String for
+ * compress: DBs, obj unchanged otherwise (codec values are encoded later,
+ * in place).
+ */
 static mrb_value
-mrb_mdb_cursor_count_m(mrb_state *mrb, mrb_value self)
+mrb_mdb_db_pack(mrb_state *mrb, mrb_mdb_database *db, mrb_value obj)
 {
-  MDB_cursor *cursor = mrb_mdb_cursor_get(mrb, self);
-  size_t count;
-  int rc = mdb_cursor_count(cursor, &count);
-  if (likely(rc == MDB_SUCCESS))
-    return mrb_convert_size_t(mrb, count);
-  mrb_mdb_raise(mrb, rc, "mdb_cursor_count");
+  if (db->compress == MRB_MDB_COMPRESS_NONE)
+    return obj;
+  if (db->codec == MRB_MDB_CODEC_NATIVE)
+    obj = mrb_mdb_codec_encode(mrb, obj);
+  return mrb_mdb_pack(mrb, db, obj);
+}
+
+/* mdb_put for a value passed through mrb_mdb_db_pack. */
+static int
+mrb_mdb_db_put(mrb_state *mrb, MDB_txn *txn, mrb_mdb_database *db, MDB_val *key,
+               mrb_value obj, unsigned int flags)
+{
+  if (db->codec == MRB_MDB_CODEC_NATIVE && db->compress == MRB_MDB_COMPRESS_NONE)
+    return mrb_mdb_codec_put(mrb, txn, db->dbi, key, obj, mrb_mdb_codec_value_size(mrb, obj), flags);
+  MDB_val data = { (size_t)RSTRING_LEN(obj), RSTRING_PTR(obj) };
+  return mdb_put(txn, db->dbi, key, &data, flags);
+}
+
+/*
+ * Coerced value -> its stored bytes as a String, for writers that put
+ * borrowed bytes instead of going through mrb_mdb_db_put (bulk_load,
+ * MDB::Loader).
+ */
+static mrb_value
+mrb_mdb_db_stored(mrb_state *mrb, mrb_mdb_database *db, mrb_value obj)
+{
+  if (db->codec == MRB_MDB_CODEC_NATIVE && db->compress == MRB_MDB_COMPRESS_NONE)
+    return mrb_mdb_codec_encode(mrb, obj);
+  return mrb_mdb_db_pack(mrb, db, obj);
 }
 
 /* ========================================================================
- * MDB::Database — all instance methods
+ * Bloom filter sidecar
+ *
+ * An optional per-database Bloom filter that lets Database#[] and
+ * multi_get answer most lookups for absent keys without descending the
+ * database's tree. It lives in the main DB next to the dictionaries:
  *
- * The Database object stores a raw MDB_env* (fast path) plus a @env ivar
- * holding the MDB::Env Ruby object to prevent GC collection of the env
- * while the database is still live.
+ *   "\0mrb-lmdb-bloom\0<name>"                 header (mrb_mdb_bloom_hdr)
+ *   "\0mrb-lmdb-bloom\0<name>\0" BE32 segment  MRB_MDB_BLOOM_SEG bytes of bits
+ *
+ * A key sets all its bits in one 64-byte block of one segment, so a check
+ * reads the header and one small value from a tree that stays in cache.
+ * Filter and data are written in the same txn and read from the same
+ * snapshot. Bits are never cleared: deletes only count towards the
+ * false-positive rate until the next rebuild.
+ *
+ * Writes that go around the filter (raw MDB.put, Cursor#put, transaction
+ * blocks, the C and C++ APIs, other programs) cannot add their keys to it.
+ * So the header records the id of the last write txn that kept it, and
+ * the main DB holds one env-wide chain record under "\0mrb-lmdb-chain\0":
+ * the first and last id of an unbroken run of txns committed by the gem's
+ * own write paths, which keep every filter they write to. Lookups trust a
+ * filter only when their snapshot is the txn that stamped it or the chain
+ * covers every txn since. A kept write that finds neither marks the filter
+ * stale until rebuild_bloom. Txn ids only grow, so no mix of writes can
+ * fake either check. DUPSORT databases (index databases among them) take
+ * no filter, so writes to them never need one kept.
  * ======================================================================== */
 
-/* Database#initialize(env[, flags[, name]]) */
-static mrb_value
-mrb_mdb_database_init(mrb_state *mrb, mrb_value self)
+#define MRB_MDB_BLOOM_PREFIX     "\0mrb-lmdb-bloom\0"
+#define MRB_MDB_BLOOM_PREFIX_LEN (sizeof(MRB_MDB_BLOOM_PREFIX) - 1)
+#define MRB_MDB_BLOOM_SEG        1024  /* bytes: stays off overflow pages */
+#define MRB_MDB_BLOOM_BLOCK      64
+#define MRB_MDB_BLOOM_MAGIC      0x314D4C42u  /* "BLM1" */
+#define MRB_MDB_BLOOM_MAX_HASHES 16
+#define MRB_MDB_BLOOM_STALE      UINT64_MAX  /* hdr.txnid once a write bypassed it */
+#define MRB_MDB_CHAIN_PREFIX     "\0mrb-lmdb-chain\0"
+#define MRB_MDB_CHAIN_PREFIX_LEN (sizeof(MRB_MDB_CHAIN_PREFIX) - 1)
+
+/* Filter state for one write txn: the header is read once, written back at the end. */
+typedef struct {
+  MDB_dbi           main_dbi;
+  mrb_bool          on;
+  mrb_bool          dirty;
+  mrb_mdb_bloom_hdr hdr;
+} mrb_mdb_bloom_txn;
+
+static uint64_t
+mrb_mdb_bloom_hash(const void *p, size_t n)
 {
-  mrb_value env_v;
-  mrb_int flags = 0;
-  const char *name = NULL;
-  mrb_get_args(mrb, "o|iz!", &env_v, &flags, &name);
+  const uint8_t *s = (const uint8_t *)p;
+  uint64_t h = 0xcbf29ce484222325ull;
+  while (n--)
+    h = (h ^ *s++) * 0x100000001b3ull;
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdull;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ull;
+  return h ^ (h >> 33);
+}
 
-  MDB_env *env = mrb_mdb_env_get(mrb, env_v);
+/* Where key's bits live: segment, block offset in it, and double-hashing steps. */
+typedef struct {
+  uint32_t seg;
+  size_t   block;
+  uint32_t a, b;
+} mrb_mdb_bloom_pos;
 
-  MDB_txn *txn;
-  int rc = mdb_txn_begin(env, NULL, 0, &txn);
-  if (unlikely(rc != MDB_SUCCESS))
-    mrb_mdb_raise(mrb, rc, "mdb_txn_begin");
+static mrb_mdb_bloom_pos
+mrb_mdb_bloom_locate(const mrb_mdb_bloom_hdr *hdr, const MDB_val *key)
+{
+  uint64_t h = mrb_mdb_bloom_hash(key->mv_data, key->mv_size);
+  uint64_t h2 = h * 0x9e3779b97f4a7c15ull;
+  mrb_mdb_bloom_pos pos;
+  pos.seg   = (uint32_t)(((h >> 32) * hdr->nsegs) >> 32);
+  pos.block = (size_t)((h >> 28) & (MRB_MDB_BLOOM_SEG / MRB_MDB_BLOOM_BLOCK - 1)) * MRB_MDB_BLOOM_BLOCK;
+  pos.a     = (uint32_t)(h2 >> 32);
+  pos.b     = (uint32_t)h2 | 1;
+  return pos;
+}
 
-  MDB_dbi dbi;
-  rc = mdb_dbi_open(txn, name, mrb_mdb_flags(mrb, flags), &dbi);
-  if (unlikely(rc != MDB_SUCCESS)) {
-    mdb_txn_abort(txn);
-    mrb_mdb_raise(mrb, rc, "mdb_dbi_open");
+/* Check (set == FALSE) or set key's bits in seg; returns whether all were set before. */
+static mrb_bool
+mrb_mdb_bloom_bits(const mrb_mdb_bloom_hdr *hdr, const mrb_mdb_bloom_pos *pos,
+                   uint8_t *seg, mrb_bool set)
+{
+  mrb_bool all = TRUE;
+  uint8_t *block = seg + pos->block;
+  for (uint32_t i = 0; i < hdr->hashes; i++) {
+    uint32_t bit = (pos->a + i * pos->b) & (MRB_MDB_BLOOM_BLOCK * 8 - 1);
+    uint8_t mask = (uint8_t)(1u << (bit & 7));
+    if (!(block[bit >> 3] & mask)) {
+      all = FALSE;
+      if (!set)
+        break;
+      block[bit >> 3] |= mask;
+    }
   }
+  return all;
+}
 
-  /* mdb_txn_commit frees txn regardless of return value. */
-  rc = mdb_txn_commit(txn);
-  if (unlikely(rc != MDB_SUCCESS))
-    mrb_mdb_raise(mrb, rc, "mdb_txn_commit");
+/* db's filter header through txn; MDB_NOTFOUND if there is none (or it is unreadable). */
+static int
+mrb_mdb_bloom_hdr_get(MDB_txn *txn, MDB_dbi main_dbi, const mrb_mdb_database *db,
+                      mrb_mdb_bloom_hdr *hdr)
+{
+  char kbuf[MRB_MDB_DICT_KEY_MAX];
+  MDB_val key = { mrb_mdb_meta_key(MRB_MDB_BLOOM_PREFIX, MRB_MDB_BLOOM_PREFIX_LEN, db->name, FALSE, 0, kbuf), kbuf };
+  MDB_val data;
+  if (key.mv_size == 0 || mdb_get(txn, main_dbi, &key, &data) != MDB_SUCCESS ||
+      data.mv_size != sizeof(*hdr))
+    return MDB_NOTFOUND;
+  memcpy(hdr, data.mv_data, sizeof(*hdr));
+  if (hdr->magic != MRB_MDB_BLOOM_MAGIC || hdr->nsegs == 0 ||
+      hdr->hashes == 0 || hdr->hashes > MRB_MDB_BLOOM_MAX_HASHES)
+    return MDB_NOTFOUND;
+  return MDB_SUCCESS;
+}
 
-  mrb_iv_set(mrb, self, MRB_IVSYM(env), env_v);
-  mrb_iv_set(mrb, self, MRB_IVSYM(dbi), mrb_convert_uint(mrb, dbi));
+/* The env-wide chain, first and last txn id, through txn; FALSE if there is none. */
+static mrb_bool
+mrb_mdb_bloom_chain_get(MDB_txn *txn, MDB_dbi main_dbi, uint64_t chain[2])
+{
+  char kbuf[MRB_MDB_DICT_KEY_MAX];
+  MDB_val key = { mrb_mdb_meta_key(MRB_MDB_CHAIN_PREFIX, MRB_MDB_CHAIN_PREFIX_LEN, NULL, FALSE, 0, kbuf), kbuf };
+  MDB_val data;
+  if (mdb_get(txn, main_dbi, &key, &data) != MDB_SUCCESS || data.mv_size != 2 * sizeof(uint64_t))
+    return FALSE;
+  memcpy(chain, data.mv_data, 2 * sizeof(uint64_t));
+  return TRUE;
+}
 
-  return self;
+/*
+ * Whether hdr still covers every key of its database in a snapshot whose
+ * last committed txn is last: it was stamped there (or later, by the
+ * write txn asking), or every txn since its stamp is in the chain.
+ */
+static mrb_bool
+mrb_mdb_bloom_current(MDB_txn *txn, MDB_dbi main_dbi, const mrb_mdb_bloom_hdr *hdr, uint64_t last)
+{
+  uint64_t chain[2];
+  if (hdr->txnid == MRB_MDB_BLOOM_STALE)
+    return FALSE;
+  if (hdr->txnid >= last)
+    return TRUE;
+  return mrb_mdb_bloom_chain_get(txn, main_dbi, chain) &&
+         chain[0] <= hdr->txnid + 1 && chain[1] >= last;
 }
 
-/* Database#dbi -> Integer */
-static mrb_value
-mrb_mdb_database_dbi_m(mrb_state *mrb, mrb_value self)
+/*
+ * Add write txn to the chain, restarting it if some txn since its end
+ * went uncounted. Only gem write paths that keep every filter they write
+ * to call this. Without a chain record it does nothing unless create.
+ */
+static int
+mrb_mdb_bloom_seal(MDB_txn *txn, mrb_bool create)
 {
-  return mrb_iv_get(mrb, self, MRB_IVSYM(dbi));
+  char kbuf[MRB_MDB_DICT_KEY_MAX];
+  MDB_val key = { mrb_mdb_meta_key(MRB_MDB_CHAIN_PREFIX, MRB_MDB_CHAIN_PREFIX_LEN, NULL, FALSE, 0, kbuf), kbuf };
+  uint64_t chain[2], id = mdb_txn_id(txn);
+  MDB_dbi main_dbi;
+  int rc = mdb_dbi_open(txn, NULL, 0, &main_dbi);
+  if (rc != MDB_SUCCESS)
+    return rc;
+  if (!mrb_mdb_bloom_chain_get(txn, main_dbi, chain)) {
+    if (!create)
+      return MDB_SUCCESS;
+    chain[0] = id;
+  }
+  else if (chain[1] == id)
+    return MDB_SUCCESS;
+  else if (chain[1] + 1 != id)
+    chain[0] = id;
+  chain[1] = id;
+  MDB_val data = { sizeof(chain), chain };
+  return mdb_put(txn, main_dbi, &key, &data, 0);
 }
 
-/* Database#[] */
-static mrb_value
-mrb_mdb_database_aref_m(mrb_state *mrb, mrb_value self)
+/* Segment n of db's filter through txn, or NULL if missing. */
+static const uint8_t *
+mrb_mdb_bloom_seg_get(MDB_txn *txn, MDB_dbi main_dbi, const mrb_mdb_database *db, uint32_t n)
 {
-  mrb_value key_obj;
-  mrb_get_args(mrb, "o", &key_obj);
+  char kbuf[MRB_MDB_DICT_KEY_MAX];
+  MDB_val key = { mrb_mdb_meta_key(MRB_MDB_BLOOM_PREFIX, MRB_MDB_BLOOM_PREFIX_LEN, db->name, TRUE, n, kbuf), kbuf };
+  MDB_val data;
+  if (mdb_get(txn, main_dbi, &key, &data) != MDB_SUCCESS || data.mv_size != MRB_MDB_BLOOM_SEG)
+    return NULL;
+  return (const uint8_t *)data.mv_data;
+}
 
-  key_obj = mrb_str_to_str(mrb, key_obj);
+/*
+ * mdb_get on db in a read txn, answering MDB_NOTFOUND straight from the
+ * filter when it rules the key out. Any trouble reading the filter, or a
+ * filter that a write has gone around, just falls through. The header and
+ * the verdict on it are fixed for a snapshot, so they are looked up once
+ * per snapshot and kept in db.
+ */
+static int
+mrb_mdb_db_get(MDB_txn *txn, mrb_mdb_database *db, MDB_val *key, MDB_val *data)
+{
+  if (!db->bloom)
+    return mdb_get(txn, db->dbi, key, data);
+
+  size_t snapshot = mdb_txn_id(txn);
+  MDB_dbi main_dbi;
+  if (mdb_dbi_open(txn, NULL, 0, &main_dbi) != MDB_SUCCESS)
+    return mdb_get(txn, db->dbi, key, data);
+  if (db->bloom_txnid != snapshot) {
+    db->bloom_txnid = snapshot;
+    db->bloom_usable = mrb_mdb_bloom_hdr_get(txn, main_dbi, db, &db->bloom_hdr) == MDB_SUCCESS &&
+                       mrb_mdb_bloom_current(txn, main_dbi, &db->bloom_hdr, snapshot);
+  }
+  if (!db->bloom_usable)
+    return mdb_get(txn, db->dbi, key, data);
+
+  mrb_mdb_bloom_pos pos = mrb_mdb_bloom_locate(&db->bloom_hdr, key);
+  const uint8_t *seg = mrb_mdb_bloom_seg_get(txn, main_dbi, db, pos.seg);
+  if (!seg)
+    return mdb_get(txn, db->dbi, key, data);
+  if (!mrb_mdb_bloom_bits(&db->bloom_hdr, &pos, (uint8_t *)seg, FALSE)) {
+    db->bloom_negatives++;
+    return MDB_NOTFOUND;
+  }
+  int rc = mdb_get(txn, db->dbi, key, data);
+  if (rc == MDB_NOTFOUND)
+    db->bloom_false++;
+  return rc;
+}
 
-  MDB_txn *txn;
-  int rc = mdb_txn_begin(mrb_mdb_database_env(mrb, self), NULL, MDB_RDONLY, &txn);
-  if (unlikely(rc != MDB_SUCCESS))
-    mrb_mdb_raise(mrb, rc, "mdb_txn_begin");
+/*
+ * Start filter maintenance for a write txn on db. Always looks for the
+ * header, so writes keep a filter built by another handle or process
+ * correct; db->bloom follows what is found. A filter some write may have
+ * gone around since it was last kept is marked stale here.
+ */
+static void
+mrb_mdb_bloom_begin(MDB_txn *txn, mrb_mdb_database *db, mrb_mdb_bloom_txn *bt)
+{
+  bt->dirty = FALSE;
+  bt->on = mdb_dbi_open(txn, NULL, 0, &bt->main_dbi) == MDB_SUCCESS &&
+           mrb_mdb_bloom_hdr_get(txn, bt->main_dbi, db, &bt->hdr) == MDB_SUCCESS;
+  db->bloom = bt->on;
+  if (bt->on && bt->hdr.txnid != MRB_MDB_BLOOM_STALE &&
+      !mrb_mdb_bloom_current(txn, bt->main_dbi, &bt->hdr, mdb_txn_id(txn) - 1)) {
+    bt->hdr.txnid = MRB_MDB_BLOOM_STALE;
+    bt->dirty = TRUE;
+  }
+}
 
-  MDB_val key  = { (size_t)RSTRING_LEN(key_obj), RSTRING_PTR(key_obj) };
-  MDB_val data;
-  rc = mdb_get(txn, mrb_mdb_database_dbi(mrb, self), &key, &data);
-  mrb_value result = (rc == MDB_SUCCESS) ? mrb_mdb_val_to_str(mrb, &data) : mrb_nil_value();
-  mdb_txn_abort(txn);
+/* Record a put of key (bt may be NULL: no filter). */
+static int
+mrb_mdb_bloom_add(MDB_txn *txn, const mrb_mdb_database *db, mrb_mdb_bloom_txn *bt, const MDB_val *key)
+{
+  if (!bt || !bt->on)
+    return MDB_SUCCESS;
+  mrb_mdb_bloom_pos pos = mrb_mdb_bloom_locate(&bt->hdr, key);
+  const uint8_t *old = mrb_mdb_bloom_seg_get(txn, bt->main_dbi, db, pos.seg);
+  if (!old)
+    return MDB_CORRUPTED;
+  uint8_t seg[MRB_MDB_BLOOM_SEG];
+  memcpy(seg, old, sizeof(seg));
+  if (mrb_mdb_bloom_bits(&bt->hdr, &pos, seg, TRUE))
+    return MDB_SUCCESS;
+
+  char kbuf[MRB_MDB_DICT_KEY_MAX];
+  MDB_val skey = { mrb_mdb_meta_key(MRB_MDB_BLOOM_PREFIX, MRB_MDB_BLOOM_PREFIX_LEN, db->name, TRUE, pos.seg, kbuf), kbuf };
+  MDB_val sval = { sizeof(seg), seg };
+  bt->hdr.keys++;
+  bt->dirty = TRUE;
+  return mdb_put(txn, bt->main_dbi, &skey, &sval, 0);
+}
 
-  if (rc == MDB_SUCCESS || rc == MDB_NOTFOUND)
-    return result;
-  mrb_mdb_raise(mrb, rc, "mdb_get");
+/* Record a delete (the key's bits stay set). */
+static void
+mrb_mdb_bloom_del(mrb_mdb_bloom_txn *bt)
+{
+  if (bt->on) {
+    bt->hdr.deletes++;
+    bt->dirty = TRUE;
+  }
 }
 
-/* Database#[]= */
-static mrb_value
-mrb_mdb_database_aset_m(mrb_state *mrb, mrb_value self)
+/* Stamp the header with txn, write it back, and add txn to the chain. */
+static int
+mrb_mdb_bloom_end(MDB_txn *txn, const mrb_mdb_database *db, mrb_mdb_bloom_txn *bt)
 {
-  mrb_value key_obj, data_obj;
-  mrb_get_args(mrb, "oo", &key_obj, &data_obj);
+  uint64_t id = mdb_txn_id(txn);
+  if (bt->on && bt->hdr.txnid != MRB_MDB_BLOOM_STALE && bt->hdr.txnid != id) {
+    bt->hdr.txnid = id;
+    bt->dirty = TRUE;
+  }
+  if (bt->dirty) {
+    char kbuf[MRB_MDB_DICT_KEY_MAX];
+    MDB_val key = { mrb_mdb_meta_key(MRB_MDB_BLOOM_PREFIX, MRB_MDB_BLOOM_PREFIX_LEN, db->name, FALSE, 0, kbuf), kbuf };
+    MDB_val data = { sizeof(bt->hdr), &bt->hdr };
+    bt->dirty = FALSE;
+    int rc = mdb_put(txn, bt->main_dbi, &key, &data, 0);
+    if (rc != MDB_SUCCESS)
+      return rc;
+  }
+  return mrb_mdb_bloom_seal(txn, FALSE);
+}
 
-  key_obj  = mrb_str_to_str(mrb, key_obj);
-  data_obj = mrb_str_to_str(mrb, data_obj);
+/* One put (del == FALSE) or delete of key, start to end. */
+static int
+mrb_mdb_bloom_note(MDB_txn *txn, mrb_mdb_database *db, const MDB_val *key, mrb_bool del)
+{
+  mrb_mdb_bloom_txn bt;
+  mrb_mdb_bloom_begin(txn, db, &bt);
+  int rc = MDB_SUCCESS;
+  if (del)
+    mrb_mdb_bloom_del(&bt);
+  else
+    rc = mrb_mdb_bloom_add(txn, db, &bt, key);
+  return rc == MDB_SUCCESS ? mrb_mdb_bloom_end(txn, db, &bt) : rc;
+}
 
-  MDB_txn *txn;
-  int rc = mdb_txn_begin(mrb_mdb_database_env(mrb, self), NULL, 0, &txn);
-  if (unlikely(rc != MDB_SUCCESS))
-    mrb_mdb_raise(mrb, rc, "mdb_txn_begin");
+/* ========================================================================
+ * mrb_protect_error callbacks — named C functions, no C++ lambdas
+ *
+ * yield1: yield(blk, arg)        — transaction, cursor
+ * yield2: yield(blk, arg1, arg2) — batch, database transaction, database cursor
+ * ======================================================================== */
 
-  MDB_val key  = { (size_t)RSTRING_LEN(key_obj),  RSTRING_PTR(key_obj) };
-  MDB_val data = { (size_t)RSTRING_LEN(data_obj), RSTRING_PTR(data_obj) };
-  rc = mdb_put(txn, mrb_mdb_database_dbi(mrb, self), &key, &data, 0);
-  if (unlikely(rc != MDB_SUCCESS)) {
-    mdb_txn_abort(txn);
-    mrb_mdb_raise(mrb, rc, "mdb_put");
-  }
-  rc = mdb_txn_commit(txn);
-  if (unlikely(rc != MDB_SUCCESS))
-    mrb_mdb_raise(mrb, rc, "mdb_txn_commit");
-  return data_obj;
+typedef struct { mrb_value blk; mrb_value arg; }                   mrb_lmdb_yield1_ctx;
+typedef struct { mrb_value blk; mrb_value arg1; mrb_value arg2; }  mrb_lmdb_yield2_ctx;
+
+static mrb_value
+mrb_lmdb_yield1_cb(mrb_state *mrb, void *ud)
+{
+  mrb_lmdb_yield1_ctx *ctx = (mrb_lmdb_yield1_ctx *)ud;
+  return mrb_yield(mrb, ctx->blk, ctx->arg);
 }
 
-/* Database#del(key[, data]) */
 static mrb_value
-mrb_mdb_database_del_m(mrb_state *mrb, mrb_value self)
+mrb_lmdb_yield2_cb(mrb_state *mrb, void *ud)
 {
-  mrb_value key_obj, data_obj = mrb_nil_value();
-  mrb_get_args(mrb, "o|o", &key_obj, &data_obj);
+  mrb_lmdb_yield2_ctx *ctx = (mrb_lmdb_yield2_ctx *)ud;
+  mrb_value argv[2] = { ctx->arg1, ctx->arg2 };
+  return mrb_yield_argv(mrb, ctx->blk, 2, argv);
+}
 
-  key_obj = mrb_str_to_str(mrb, key_obj);
+/* ========================================================================
+ * MDB::Env
+ * ======================================================================== */
 
-  MDB_txn *txn;
-  int rc = mdb_txn_begin(mrb_mdb_database_env(mrb, self), NULL, 0, &txn);
-  if (unlikely(rc != MDB_SUCCESS))
-    mrb_mdb_raise(mrb, rc, "mdb_txn_begin");
+static mrb_value
+mrb_mdb_env_init(mrb_state *mrb, mrb_value self)
+{
+  mrb_value opts = mrb_nil_value();
+  mrb_get_args(mrb, "|H", &opts);
 
-  MDB_val key = { (size_t)RSTRING_LEN(key_obj), RSTRING_PTR(key_obj) };
+  mrb_mdb_env *e = (mrb_mdb_env *)mrb_calloc(mrb, 1, sizeof(mrb_mdb_env));
+  int rc = mdb_env_create(&e->env);
+  if (unlikely(rc != MDB_SUCCESS)) {
+    mrb_free(mrb, e);
+    mrb_mdb_raise(mrb, rc, "mdb_env_create");
+  }
+  mrb_data_init(self, e, &mdb_env_type);
+  MDB_env *env = e->env;
+  mdb_env_set_userctx(env, e);
+
+  if (!mrb_nil_p(opts)) {
+    mrb_value keys = mrb_hash_keys(mrb, opts);
+    mrb_int n = RARRAY_LEN(keys);
+    for (mrb_int i = 0; i < n; i++) {
+      mrb_value k = mrb_ary_entry(keys, i);
+      mrb_value v = mrb_hash_get(mrb, opts, k);
+
+      if (!mrb_symbol_p(k))
+        mrb_raisef(mrb, E_ARGUMENT_ERROR, "unknown option %v", k);
+
+      mrb_sym sym = mrb_symbol(k);
+      if (sym == MRB_SYM(mapsize)) {
+        mrb_int size = mrb_integer(mrb_to_int(mrb, v));
+        if (size < 0)
+          mrb_raise(mrb, E_RANGE_ERROR, "mapsize must be non-negative");
+        rc = mdb_env_set_mapsize(env, (size_t)size);
+        if (unlikely(rc != MDB_SUCCESS))
+          mrb_mdb_raise(mrb, rc, "mdb_env_set_mapsize");
+      } else if (sym == MRB_SYM(maxreaders)) {
+        mrb_int readers = mrb_integer(mrb_to_int(mrb, v));
+        if (readers < 0 || (uint64_t)readers > UINT_MAX)
+          mrb_raise(mrb, E_RANGE_ERROR, "maxreaders out of range");
+        rc = mdb_env_set_maxreaders(env, (unsigned int)readers);
+        if (unlikely(rc != MDB_SUCCESS))
+          mrb_mdb_raise(mrb, rc, "mdb_env_set_maxreaders");
+      } else if (sym == MRB_SYM(maxdbs)) {
+        mrb_int dbs = mrb_integer(mrb_to_int(mrb, v));
+        if (dbs < 0 || (uint64_t)dbs > UINT_MAX)
+          mrb_raise(mrb, E_RANGE_ERROR, "maxdbs out of range");
+        rc = mdb_env_set_maxdbs(env, (MDB_dbi)dbs);
+        if (unlikely(rc != MDB_SUCCESS))
+          mrb_mdb_raise(mrb, rc, "mdb_env_set_maxdbs");
+      } else if (sym == MRB_SYM(max_staleness)) {
+        mrb_float secs = mrb_as_float(mrb, v);
+        if (!(secs >= 0))
+          mrb_raise(mrb, E_RANGE_ERROR, "max_staleness must be non-negative");
+        e->max_staleness = secs;
+      } else {
+        mrb_raisef(mrb, E_ARGUMENT_ERROR, "unknown option %v", k);
+      }
+    }
+  }
+  return self;
+}
+
+static mrb_value
+mrb_mdb_env_open(mrb_state *mrb, mrb_value self)
+{
+  MDB_env *env = mrb_mdb_env_get(mrb, self);
+  const char *path;
+  mrb_int flags = 0, mode = 0600;
+  mrb_get_args(mrb, "z|ii", &path, &flags, &mode);
+  int rc = mdb_env_open(env, path, mrb_mdb_flags(mrb, flags), (mdb_mode_t)mode);
+  if (likely(rc == MDB_SUCCESS))
+    return self;
+  mrb_mdb_raise(mrb, rc, "mdb_env_open");
+}
+
+static mrb_value
+mrb_mdb_env_copy_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_mdb_env *e = mrb_mdb_env_state_get(mrb, self);
+  const char *path;
+  mrb_int flags = 0;
+  mrb_get_args(mrb, "z|i", &path, &flags);
+  mrb_mdb_env_release_snapshot(e); /* the copy runs its own read txn */
+  int rc = flags != 0
+    ? mdb_env_copy2(e->env, path, mrb_mdb_flags(mrb, flags))
+    : mdb_env_copy(e->env, path);
+  if (likely(rc == MDB_SUCCESS))
+    return self;
+  mrb_mdb_raise(mrb, rc, "mdb_env_copy");
+}
+
+static mrb_value
+mrb_mdb_env_stat_m(mrb_state *mrb, mrb_value self)
+{
+  MDB_env *env = mrb_mdb_env_get(mrb, self);
+  MDB_stat stat;
+  int rc = mdb_env_stat(env, &stat);
+  if (likely(rc == MDB_SUCCESS))
+    return mrb_mdb_stat_to_value(mrb, &stat);
+  mrb_mdb_raise(mrb, rc, "mdb_env_stat");
+}
+
+static mrb_value
+mrb_mdb_env_info_m(mrb_state *mrb, mrb_value self)
+{
+  MDB_env *env = mrb_mdb_env_get(mrb, self);
+  MDB_envinfo info;
+  int rc = mdb_env_info(env, &info);
+  if (likely(rc == MDB_SUCCESS)) {
+    mrb_value args[6] = {
+      info.me_mapaddr ? mrb_cptr_value(mrb, info.me_mapaddr) : mrb_nil_value(),
+      mrb_convert_size_t(mrb, info.me_mapsize),
+      mrb_convert_size_t(mrb, info.me_last_pgno),
+      mrb_convert_size_t(mrb, info.me_last_txnid),
+      mrb_convert_uint(mrb, info.me_maxreaders),
+      mrb_convert_uint(mrb, info.me_numreaders),
+    };
+    return mrb_obj_new(mrb, mrb_mdb_info_class(mrb), 6, args);
+  }
+  mrb_mdb_raise(mrb, rc, "mdb_env_info");
+}
+
+static mrb_value
+mrb_mdb_env_sync_m(mrb_state *mrb, mrb_value self)
+{
+  MDB_env *env = mrb_mdb_env_get(mrb, self);
+  mrb_bool force = FALSE;
+  mrb_get_args(mrb, "|b", &force);
+  int rc = mdb_env_sync(env, (int)force);
+  if (likely(rc == MDB_SUCCESS))
+    return self;
+  mrb_mdb_raise(mrb, rc, "mdb_env_sync");
+}
+
+static mrb_value
+mrb_mdb_env_close_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_mdb_env *e = (mrb_mdb_env *)mrb_data_check_get_ptr(mrb, self, &mdb_env_type);
+  if (e && e->env) {
+    if (e->rtxn) {
+      mdb_txn_abort(e->rtxn);
+      e->rtxn = NULL;
+      e->rtxn_live = e->rtxn_busy = FALSE;
+    }
+    mdb_env_close(e->env);
+    e->env = NULL;
+    return mrb_true_value();
+  }
+  return mrb_false_value();
+}
+
+static mrb_value
+mrb_mdb_env_set_flags_m(mrb_state *mrb, mrb_value self)
+{
+  MDB_env *env = mrb_mdb_env_get(mrb, self);
+  mrb_int flags = 0;
+  mrb_bool onoff = TRUE;
+  mrb_get_args(mrb, "|ib", &flags, &onoff);
+  int rc = mdb_env_set_flags(env, mrb_mdb_flags(mrb, flags), (int)onoff);
+  if (likely(rc == MDB_SUCCESS))
+    return self;
+  mrb_mdb_raise(mrb, rc, "mdb_env_set_flags");
+}
+
+static mrb_value
+mrb_mdb_env_get_flags_m(mrb_state *mrb, mrb_value self)
+{
+  MDB_env *env = mrb_mdb_env_get(mrb, self);
+  unsigned int flags;
+  int rc = mdb_env_get_flags(env, &flags);
+  if (likely(rc == MDB_SUCCESS))
+    return mrb_convert_uint(mrb, flags);
+  mrb_mdb_raise(mrb, rc, "mdb_env_get_flags");
+}
+
+static mrb_value
+mrb_mdb_env_get_path_m(mrb_state *mrb, mrb_value self)
+{
+  MDB_env *env = mrb_mdb_env_get(mrb, self);
+  const char *path;
+  int rc = mdb_env_get_path(env, &path);
+  if (likely(rc == MDB_SUCCESS))
+    return mrb_str_new_cstr(mrb, path);
+  mrb_mdb_raise(mrb, rc, "mdb_env_get_path");
+}
+
+static mrb_value
+mrb_mdb_env_set_mapsize_m(mrb_state *mrb, mrb_value self)
+{
+  MDB_env *env = mrb_mdb_env_get(mrb, self);
+  mrb_int size;
+  mrb_get_args(mrb, "i", &size);
+  if (size < 0)
+    mrb_raise(mrb, E_RANGE_ERROR, "mapsize must be non-negative");
+  int rc = mdb_env_set_mapsize(env, (size_t)size);
+  if (likely(rc == MDB_SUCCESS))
+    return self;
+  mrb_mdb_raise(mrb, rc, "mdb_env_set_mapsize");
+}
+
+static mrb_value
+mrb_mdb_env_set_maxreaders_m(mrb_state *mrb, mrb_value self)
+{
+  MDB_env *env = mrb_mdb_env_get(mrb, self);
+  mrb_int readers;
+  mrb_get_args(mrb, "i", &readers);
+  if (readers < 0 || (uint64_t)readers > UINT_MAX)
+    mrb_raise(mrb, E_RANGE_ERROR, "maxreaders out of range");
+  int rc = mdb_env_set_maxreaders(env, (unsigned int)readers);
+  if (likely(rc == MDB_SUCCESS))
+    return self;
+  mrb_mdb_raise(mrb, rc, "mdb_env_set_maxreaders");
+}
+
+static mrb_value
+mrb_mdb_env_get_maxreaders_m(mrb_state *mrb, mrb_value self)
+{
+  MDB_env *env = mrb_mdb_env_get(mrb, self);
+  unsigned int readers;
+  int rc = mdb_env_get_maxreaders(env, &readers);
+  if (likely(rc == MDB_SUCCESS))
+    return mrb_convert_uint(mrb, readers);
+  mrb_mdb_raise(mrb, rc, "mdb_env_get_maxreaders");
+}
+
+static mrb_value
+mrb_mdb_env_set_maxdbs_m(mrb_state *mrb, mrb_value self)
+{
+  MDB_env *env = mrb_mdb_env_get(mrb, self);
+  mrb_int dbs;
+  mrb_get_args(mrb, "i", &dbs);
+  if (dbs < 0 || (uint64_t)dbs > UINT_MAX)
+    mrb_raise(mrb, E_RANGE_ERROR, "maxdbs out of range");
+  int rc = mdb_env_set_maxdbs(env, (MDB_dbi)dbs);
+  if (likely(rc == MDB_SUCCESS))
+    return self;
+  mrb_mdb_raise(mrb, rc, "mdb_env_set_maxdbs");
+}
+
+static mrb_value
+mrb_mdb_env_get_maxkeysize_m(mrb_state *mrb, mrb_value self)
+{
+  MDB_env *env = mrb_mdb_env_get(mrb, self);
+  return mrb_convert_int(mrb, mdb_env_get_maxkeysize(env));
+}
+
+static mrb_value
+mrb_mdb_reader_check_m(mrb_state *mrb, mrb_value self)
+{
+  MDB_env *env = mrb_mdb_env_get(mrb, self);
+  int dead = 0;
+  int rc = mdb_reader_check(env, &dead);
+  if (likely(rc == MDB_SUCCESS))
+    return mrb_convert_int(mrb, dead);
+  mrb_mdb_raise(mrb, rc, "mdb_reader_check");
+}
+
+/* Env#max_staleness -> Float (seconds a parked read snapshot may be reused) */
+static mrb_value
+mrb_mdb_env_get_max_staleness_m(mrb_state *mrb, mrb_value self)
+{
+  return mrb_float_value(mrb, mrb_mdb_env_state_get(mrb, self)->max_staleness);
+}
+
+/* Env#max_staleness = seconds */
+static mrb_value
+mrb_mdb_env_set_max_staleness_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_mdb_env *e = mrb_mdb_env_state_get(mrb, self);
+  mrb_float secs;
+  mrb_get_args(mrb, "f", &secs);
+  if (!(secs >= 0))
+    mrb_raise(mrb, E_RANGE_ERROR, "max_staleness must be non-negative");
+  e->max_staleness = secs;
+  mrb_mdb_env_release_snapshot(e);
+  return self;
+}
+
+/*
+ * Env#transaction([flags]) { |txn| ... }
+ */
+static mrb_value
+mrb_mdb_env_transaction_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_value blk;
+  mrb_int flags = 0;
+  mrb_get_args(mrb, "|i&!", &flags, &blk);
+  if (mrb_nil_p(blk))
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "no block given");
+
+  struct RClass *txn_class = mrb_mdb_gem_state_get(mrb)->txn_class;
+  mrb_value argv[2] = { self, mrb_int_value(mrb, flags) };
+  mrb_value txn_obj = mrb_obj_new(mrb, txn_class, 2, argv);
+  mrb_gc_protect(mrb, txn_obj);
+
+  mrb_lmdb_yield1_ctx ctx1 = { blk, txn_obj };
+  mrb_bool exc = FALSE;
+  mrb_value result = mrb_protect_error(mrb, mrb_lmdb_yield1_cb, &ctx1, &exc);
+
+  MDB_txn *txn = mrb_mdb_txn_detach(mrb, txn_obj);
+  if (txn) {
+    if (!exc) {
+      int rc = mdb_txn_commit(txn);
+      if (unlikely(rc != MDB_SUCCESS))
+        mrb_mdb_raise(mrb, rc, "mdb_txn_commit");
+    } else {
+      mdb_txn_abort(txn);
+    }
+  }
+  if (exc) mrb_exc_raise(mrb, result);
+  return result;
+}
+
+/*
+ * Env#database([flags[, name]], compare: nil, dupsort_compare: nil) -> MDB::Database
+ *
+ * Opens (or creates) a database and returns a Database object.
+ * The MDB::Env object (self) is stored as @env on the Database instance
+ * to prevent the GC from collecting the Env while the Database is live.
+ */
+static mrb_value
+mrb_mdb_env_database_m(mrb_state *mrb, mrb_value self)
+{
+  const mrb_value *argv;
+  mrb_int argc;
+  mrb_get_args(mrb, "*", &argv, &argc);
+  mrb_value opts = mrb_mdb_pop_opts(&argc, argv);
+  if (argc > 2)
+    mrb_argnum_error(mrb, argc, 0, 2);
+
+  struct RClass *db_class = mrb_mdb_gem_state_get(mrb)->database_class;
+
+  mrb_value args[4] = {
+    self,
+    argc > 0 ? argv[0] : mrb_int_value(mrb, 0),
+    argc > 1 ? argv[1] : mrb_nil_value(),
+    opts,
+  };
+  return mrb_obj_new(mrb, db_class, mrb_nil_p(opts) ? 3 : 4, args);
+}
+
+/* ========================================================================
+ * MDB::Txn
+ * ======================================================================== */
+
+static mrb_value
+mrb_mdb_txn_init(mrb_state *mrb, mrb_value self)
+{
+  mrb_value env_v;
+  mrb_int flags = 0;
+  mrb_value parent_v = mrb_nil_value();
+  mrb_get_args(mrb, "o|io", &env_v, &flags, &parent_v);
+
+  mrb_mdb_env *e = mrb_mdb_env_state_get(mrb, env_v);
+  MDB_txn *parent = NULL;
+  if (!mrb_nil_p(parent_v))
+    parent = mrb_mdb_txn_get(mrb, parent_v);
+
+  unsigned int real_flags = mrb_mdb_flags(mrb, flags);
+  mrb_mdb_txn *t = (mrb_mdb_txn *)mrb_malloc(mrb, sizeof(mrb_mdb_txn));
+  mrb_mdb_env_release_snapshot(e);
+  int rc = mdb_txn_begin(e->env, parent, real_flags, &t->txn);
+  if (likely(rc == MDB_SUCCESS)) {
+    t->flags      = real_flags;
+    t->generation = 0;
+    mrb_data_init(self, t, &mdb_txn_type);
+    return self;
+  }
+  mrb_free(mrb, t);
+  mrb_mdb_raise(mrb, rc, "mdb_txn_begin");
+}
+
+static mrb_value
+mrb_mdb_txn_commit_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_mdb_txn_get(mrb, self);
+  int rc = mdb_txn_commit(mrb_mdb_txn_detach(mrb, self)); /* commit consumes the txn handle */
+  if (likely(rc == MDB_SUCCESS))
+    return mrb_true_value();
+  mrb_mdb_raise(mrb, rc, "mdb_txn_commit");
+}
+
+static mrb_value
+mrb_mdb_txn_abort_m(mrb_state *mrb, mrb_value self)
+{
+  MDB_txn *txn = mrb_mdb_txn_detach(mrb, self);
+  if (txn) {
+    mdb_txn_abort(txn);
+    return mrb_true_value();
+  }
+  return mrb_false_value();
+}
+
+static mrb_value
+mrb_mdb_txn_reset_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_mdb_txn *t = mrb_mdb_txn_state_get(mrb, self);
+  mdb_txn_reset(t->txn);
+  t->generation++; /* invalidates every MDB::View taken from this snapshot */
+  return self;
+}
+
+static mrb_value
+mrb_mdb_txn_renew_m(mrb_state *mrb, mrb_value self)
+{
+  MDB_txn *txn = mrb_mdb_txn_get(mrb, self);
+  mrb_lmdb_env_release(mdb_txn_env(txn));
+  int rc = mdb_txn_renew(txn);
+  if (likely(rc == MDB_SUCCESS))
+    return self;
+  mrb_mdb_raise(mrb, rc, "mdb_txn_renew");
+}
+
+/* ========================================================================
+ * MDB::View — zero-copy value handle
+ *
+ * A View points directly at an MDB_val inside the memory map. It is only
+ * valid while the read-only MDB::Txn it came from is open and has not been
+ * reset; every accessor checks that and raises RuntimeError otherwise.
+ * Conversions to String (to_s, byteslice) copy; everything else does not.
+ * ======================================================================== */
+
+static mrb_mdb_txn *
+mrb_mdb_view_txn_check(mrb_state *mrb, mrb_value txn_obj)
+{
+  mrb_mdb_txn *t = mrb_mdb_txn_state_get(mrb, txn_obj);
+  if (likely(t->flags & MDB_RDONLY))
+    return t;
+  mrb_raise(mrb, E_ARGUMENT_ERROR, "MDB::View requires a read-only transaction");
+}
+
+static mrb_value
+mrb_mdb_view_new(mrb_state *mrb, mrb_value txn_obj, const mrb_mdb_txn *t, const MDB_val *val)
+{
+  struct RClass *view_class = mrb_mdb_gem_state_get(mrb)->view_class;
+  struct RData *d = mrb_data_object_alloc(mrb, view_class, NULL, &mdb_view_type);
+  mrb_mdb_view *v = (mrb_mdb_view *)mrb_malloc(mrb, sizeof(mrb_mdb_view));
+  v->ptr        = (const char *)val->mv_data;
+  v->len        = val->mv_size;
+  v->generation = t->generation;
+  d->data = v;
+  mrb_value self = mrb_obj_value(d);
+  mrb_iv_set(mrb, self, MRB_IVSYM(txn), txn_obj);
+  return self;
+}
+
+static mrb_bool
+mrb_mdb_view_valid(mrb_state *mrb, mrb_value self, const mrb_mdb_view *v)
+{
+  const mrb_mdb_txn *t = (const mrb_mdb_txn *)mrb_data_check_get_ptr(mrb,
+    mrb_iv_get(mrb, self, MRB_IVSYM(txn)), &mdb_txn_type);
+  return t && t->generation == v->generation;
+}
+
+static const mrb_mdb_view *
+mrb_mdb_view_get(mrb_state *mrb, mrb_value self)
+{
+  const mrb_mdb_view *v = (const mrb_mdb_view *)mrb_data_check_get_ptr(mrb, self, &mdb_view_type);
+  if (likely(v && mrb_mdb_view_valid(mrb, self, v)))
+    return v;
+  mrb_raise(mrb, E_RUNTIME_ERROR, "MDB::View used after its transaction ended");
+}
+
+/* View#valid? */
+static mrb_value
+mrb_mdb_view_valid_p_m(mrb_state *mrb, mrb_value self)
+{
+  const mrb_mdb_view *v = (const mrb_mdb_view *)mrb_data_check_get_ptr(mrb, self, &mdb_view_type);
+  return mrb_bool_value(v && mrb_mdb_view_valid(mrb, self, v));
+}
+
+/* View#bytesize / #size / #length */
+static mrb_value
+mrb_mdb_view_bytesize_m(mrb_state *mrb, mrb_value self)
+{
+  return mrb_convert_size_t(mrb, mrb_mdb_view_get(mrb, self)->len);
+}
+
+/* View#to_s / #to_str — copies the bytes into a new String */
+static mrb_value
+mrb_mdb_view_to_s_m(mrb_state *mrb, mrb_value self)
+{
+  const mrb_mdb_view *v = mrb_mdb_view_get(mrb, self);
+  return mrb_str_new(mrb, v->ptr, (mrb_int)v->len);
+}
+
+/* View#byteslice(offset[, length]) — copies only the requested range */
+static mrb_value
+mrb_mdb_view_byteslice_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_int off, n = 1;
+  mrb_get_args(mrb, "i|i", &off, &n);
+  const mrb_mdb_view *v = mrb_mdb_view_get(mrb, self);
+  mrb_int len = (mrb_int)v->len;
+
+  if (off < 0) off += len;
+  if (off < 0 || off > len || n < 0)
+    return mrb_nil_value();
+  if (n > len - off) n = len - off;
+  return mrb_str_new(mrb, v->ptr + off, n);
+}
+
+/* View#getbyte(index) */
+static mrb_value
+mrb_mdb_view_getbyte_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_int idx;
+  mrb_get_args(mrb, "i", &idx);
+  const mrb_mdb_view *v = mrb_mdb_view_get(mrb, self);
+  mrb_int len = (mrb_int)v->len;
+
+  if (idx < 0) idx += len;
+  if (idx < 0 || idx >= len)
+    return mrb_nil_value();
+  return mrb_int_value(mrb, (unsigned char)v->ptr[idx]);
+}
+
+/* View#start_with?(prefix) */
+static mrb_value
+mrb_mdb_view_start_with_p_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_value prefix;
+  mrb_get_args(mrb, "S", &prefix);
+  const mrb_mdb_view *v = mrb_mdb_view_get(mrb, self);
+  size_t plen = (size_t)RSTRING_LEN(prefix);
+  return mrb_bool_value(v->len >= plen && memcmp(v->ptr, RSTRING_PTR(prefix), plen) == 0);
+}
+
+/* View#==(other) — compares against a String or another View without copying */
+static mrb_value
+mrb_mdb_view_eq_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_value other;
+  mrb_get_args(mrb, "o", &other);
+  const mrb_mdb_view *v = mrb_mdb_view_get(mrb, self);
+  const char *optr;
+  size_t olen;
+
+  if (mrb_string_p(other)) {
+    optr = RSTRING_PTR(other);
+    olen = (size_t)RSTRING_LEN(other);
+  } else if (mrb_data_check_get_ptr(mrb, other, &mdb_view_type)) {
+    const mrb_mdb_view *o = mrb_mdb_view_get(mrb, other);
+    optr = o->ptr;
+    olen = o->len;
+  } else {
+    return mrb_false_value();
+  }
+  return mrb_bool_value(v->len == olen && memcmp(v->ptr, optr, olen) == 0);
+}
+
+/* View#to_fix — decodes an Integer#to_bin value in place */
+static mrb_value
+mrb_mdb_view_to_fix_m(mrb_state *mrb, mrb_value self)
+{
+  const mrb_mdb_view *v = mrb_mdb_view_get(mrb, self);
+  return mrb_int_value(mrb, mrb_lmdb_bin2fix(mrb, v->ptr, (mrb_int)v->len));
+}
+
+/* ========================================================================
+ * MDB::Buffer — MDB_RESERVE write target
+ *
+ * Database#reserve and MDB.reserve put a key with MDB_RESERVE and yield a
+ * Buffer over the reserved space in the map, so the value is written in
+ * place instead of being built as a String and copied. The space is zeroed
+ * before the block runs, since the map may hold stale bytes there. The
+ * Buffer is only usable inside the block; afterwards every accessor raises
+ * RuntimeError. MDB_RESERVE cannot be used on DUPSORT databases.
+ * ======================================================================== */
+
+static mrb_mdb_buffer *
+mrb_mdb_buffer_get(mrb_state *mrb, mrb_value self)
+{
+  mrb_mdb_buffer *b = (mrb_mdb_buffer *)mrb_data_check_get_ptr(mrb, self, &mdb_buffer_type);
+  if (likely(b && b->ptr))
+    return b;
+  mrb_raise(mrb, E_RUNTIME_ERROR, "MDB::Buffer used outside its reserve block");
+}
+
+static void
+mrb_mdb_buffer_write_at(mrb_state *mrb, mrb_mdb_buffer *b, mrb_int off, mrb_value str)
+{
+  str = mrb_str_to_str(mrb, str);
+  size_t n = (size_t)RSTRING_LEN(str);
+  if (off < 0 || (size_t)off > b->len || n > b->len - (size_t)off)
+    mrb_raise(mrb, E_RANGE_ERROR, "write past the end of MDB::Buffer");
+  memcpy(b->ptr + off, RSTRING_PTR(str), n);
+}
+
+/*
+ * mdb_put(key, size, flags|MDB_RESERVE) and yield a Buffer over the space.
+ * Returns the mdb_put result; *result / *exc are only set on success.
+ */
+static int
+mrb_mdb_reserve_yield(mrb_state *mrb, MDB_txn *txn, MDB_dbi dbi, mrb_value key_obj,
+                      size_t size, unsigned int flags, mrb_value blk,
+                      mrb_value *result, mrb_bool *exc)
+{
+  struct RClass *buffer_class = mrb_mdb_gem_state_get(mrb)->buffer_class;
+  mrb_mdb_buffer *b = (mrb_mdb_buffer *)mrb_calloc(mrb, 1, sizeof(mrb_mdb_buffer));
+  mrb_value buf = mrb_obj_value(mrb_data_object_alloc(mrb, buffer_class, b, &mdb_buffer_type));
+
+  MDB_val key  = { (size_t)RSTRING_LEN(key_obj), RSTRING_PTR(key_obj) };
+  MDB_val data = { size, NULL };
+  int rc = mdb_put(txn, dbi, &key, &data, flags | MDB_RESERVE);
+  if (unlikely(rc != MDB_SUCCESS))
+    return rc;
+
+  b->ptr = (char *)data.mv_data;
+  b->len = size;
+  memset(b->ptr, 0, size);
+  mrb_lmdb_yield1_ctx ctx1 = { blk, buf };
+  *result = mrb_protect_error(mrb, mrb_lmdb_yield1_cb, &ctx1, exc);
+  b->ptr = NULL;
+  return MDB_SUCCESS;
+}
+
+static size_t
+mrb_mdb_reserve_size(mrb_state *mrb, mrb_int size)
+{
+  if (likely(size >= 0))
+    return (size_t)size;
+  mrb_raise(mrb, E_RANGE_ERROR, "size must be non-negative");
+}
+
+/* LMDB documents that MDB_RESERVE must not be used with DUPSORT. */
+static void
+mrb_mdb_reserve_check(mrb_state *mrb, unsigned int db_flags)
+{
+  if (db_flags & MDB_DUPSORT)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "reserve is not supported on DUPSORT databases");
+}
+
+/*
+ * Database#reserve, #<< and #concat hand LMDB the caller's bytes as is, past
+ * the value pipeline and MDB::Index, so they only accept plain databases.
+ */
+static void
+mrb_mdb_plain_check(mrb_state *mrb, const mrb_mdb_database *db, const char *what)
+{
+  if (db->indexed)
+    mrb_raisef(mrb, E_ARGUMENT_ERROR, "%s is not supported on indexed databases", what);
+  if (db->codec != MRB_MDB_CODEC_RAW || db->compress != MRB_MDB_COMPRESS_NONE)
+    mrb_raisef(mrb, E_ARGUMENT_ERROR, "%s is not supported on codec: or compress: databases", what);
+}
+
+/* Buffer#valid? */
+static mrb_value
+mrb_mdb_buffer_valid_p_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_mdb_buffer *b = (mrb_mdb_buffer *)mrb_data_check_get_ptr(mrb, self, &mdb_buffer_type);
+  return mrb_bool_value(b && b->ptr);
+}
+
+/* Buffer#bytesize / #size / #length */
+static mrb_value
+mrb_mdb_buffer_bytesize_m(mrb_state *mrb, mrb_value self)
+{
+  return mrb_convert_size_t(mrb, mrb_mdb_buffer_get(mrb, self)->len);
+}
+
+/* Buffer#pos */
+static mrb_value
+mrb_mdb_buffer_pos_m(mrb_state *mrb, mrb_value self)
+{
+  return mrb_convert_size_t(mrb, mrb_mdb_buffer_get(mrb, self)->pos);
+}
+
+/* Buffer#pos=(off) */
+static mrb_value
+mrb_mdb_buffer_set_pos_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_int off;
+  mrb_get_args(mrb, "i", &off);
+  mrb_mdb_buffer *b = mrb_mdb_buffer_get(mrb, self);
+  if (off < 0 || (size_t)off > b->len)
+    mrb_raise(mrb, E_RANGE_ERROR, "position out of range");
+  b->pos = (size_t)off;
+  return mrb_int_value(mrb, off);
+}
+
+/* Buffer#write(str) -> bytes written, at pos */
+static mrb_value
+mrb_mdb_buffer_write_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_value str;
+  mrb_get_args(mrb, "S", &str);
+  mrb_mdb_buffer *b = mrb_mdb_buffer_get(mrb, self);
+  mrb_mdb_buffer_write_at(mrb, b, (mrb_int)b->pos, str);
+  b->pos += (size_t)RSTRING_LEN(str);
+  return mrb_int_value(mrb, RSTRING_LEN(str));
+}
+
+/* Buffer#<<(str) */
+static mrb_value
+mrb_mdb_buffer_append_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_mdb_buffer_write_m(mrb, self);
+  return self;
+}
+
+/* Buffer#[]=(offset, str) — does not move pos */
+static mrb_value
+mrb_mdb_buffer_aset_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_int off;
+  mrb_value str;
+  mrb_get_args(mrb, "iS", &off, &str);
+  mrb_mdb_buffer_write_at(mrb, mrb_mdb_buffer_get(mrb, self), off, str);
+  return str;
+}
+
+/* Buffer#setbyte(index, byte) */
+static mrb_value
+mrb_mdb_buffer_setbyte_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_int i, byte;
+  mrb_get_args(mrb, "ii", &i, &byte);
+  mrb_mdb_buffer *b = mrb_mdb_buffer_get(mrb, self);
+  if (i < 0 || (size_t)i >= b->len)
+    mrb_raise(mrb, E_RANGE_ERROR, "index out of range");
+  b->ptr[i] = (char)(byte & 0xff);
+  return mrb_int_value(mrb, byte);
+}
+
+/* Buffer#to_s — copies the whole reserved space */
+static mrb_value
+mrb_mdb_buffer_to_s_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_mdb_buffer *b = mrb_mdb_buffer_get(mrb, self);
+  return mrb_str_new(mrb, b->ptr, (mrb_int)b->len);
+}
+
+/* ========================================================================
+ * MDB::Dbi (module functions)
+ * ======================================================================== */
+
+static mrb_value
+mrb_mdb_dbi_open_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_value txn_v, opts = mrb_nil_value();
+  mrb_int flags = 0;
+  const char *name = NULL;
+  mrb_get_args(mrb, "o|iz!H", &txn_v, &flags, &name, &opts);
+  mrb_mdb_open_opts o;
+  mrb_mdb_open_opts_parse(mrb, opts, FALSE, &o);
+
+  MDB_txn *txn = mrb_mdb_txn_get(mrb, txn_v);
+  MDB_dbi dbi;
+  int rc = mdb_dbi_open(txn, name, mrb_mdb_flags(mrb, flags), &dbi);
+  if (likely(rc == MDB_SUCCESS))
+    rc = mrb_mdb_dbi_set_compare(mrb, txn, dbi, name, o.key_cmp, o.dup_cmp);
+  if (likely(rc == MDB_SUCCESS))
+    return mrb_convert_uint(mrb, dbi);
+  mrb_mdb_raise(mrb, rc, "mdb_dbi_open");
+}
+
+static mrb_value
+mrb_mdb_dbi_flags_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_value txn_v;
+  mrb_int dbi;
+  mrb_get_args(mrb, "oi", &txn_v, &dbi);
+
+  MDB_txn *txn = mrb_mdb_txn_get(mrb, txn_v);
+  unsigned int flags;
+  int rc = mdb_dbi_flags(txn, mrb_mdb_dbi(mrb, dbi), &flags);
+  if (likely(rc == MDB_SUCCESS))
+    return mrb_convert_uint(mrb, flags);
+  mrb_mdb_raise(mrb, rc, "mdb_dbi_flags");
+}
+
+/* ========================================================================
+ * MDB module functions: get, put, del, drop, stat
+ * ======================================================================== */
+
+static mrb_value
+mrb_mdb_get_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_value txn_v, key_obj;
+  mrb_int dbi;
+  mrb_get_args(mrb, "oio", &txn_v, &dbi, &key_obj);
+
+  MDB_txn *txn = mrb_mdb_txn_get(mrb, txn_v);
+  key_obj = mrb_str_to_str(mrb, key_obj);
+  MDB_val key  = { (size_t)RSTRING_LEN(key_obj), RSTRING_PTR(key_obj) };
+  MDB_val data;
+  int rc = mdb_get(txn, mrb_mdb_dbi(mrb, dbi), &key, &data);
+  if (likely(rc == MDB_SUCCESS))
+    return mrb_mdb_val_to_str(mrb, &data);
+  if (rc == MDB_NOTFOUND)
+    return mrb_nil_value();
+  mrb_mdb_raise(mrb, rc, "mdb_get");
+}
+
+/* MDB.exists?(txn, dbi, key) -> true / false (the value is not copied) */
+static mrb_value
+mrb_mdb_exists_p_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_value txn_v, key_obj;
+  mrb_int dbi;
+  mrb_get_args(mrb, "oio", &txn_v, &dbi, &key_obj);
+
+  MDB_txn *txn = mrb_mdb_txn_get(mrb, txn_v);
+  key_obj = mrb_str_to_str(mrb, key_obj);
+  MDB_val key  = { (size_t)RSTRING_LEN(key_obj), RSTRING_PTR(key_obj) };
+  MDB_val data;
+  int rc = mdb_get(txn, mrb_mdb_dbi(mrb, dbi), &key, &data);
+  if (rc == MDB_SUCCESS || rc == MDB_NOTFOUND)
+    return mrb_bool_value(rc == MDB_SUCCESS);
+  mrb_mdb_raise(mrb, rc, "mdb_get");
+}
+
+/* MDB.read_at(txn, dbi, key, offset, length) -> String or nil */
+static mrb_value
+mrb_mdb_read_at_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_value txn_v, key_obj;
+  mrb_int dbi, offset, length;
+  mrb_get_args(mrb, "oioii", &txn_v, &dbi, &key_obj, &offset, &length);
+  mrb_mdb_slice_check(mrb, offset, length);
+
+  MDB_txn *txn = mrb_mdb_txn_get(mrb, txn_v);
+  key_obj = mrb_str_to_str(mrb, key_obj);
+  MDB_val key  = { (size_t)RSTRING_LEN(key_obj), RSTRING_PTR(key_obj) };
+  MDB_val data;
+  int rc = mdb_get(txn, mrb_mdb_dbi(mrb, dbi), &key, &data);
+  if (likely(rc == MDB_SUCCESS))
+    return mrb_mdb_val_slice(mrb, &data, offset, length);
+  if (rc == MDB_NOTFOUND)
+    return mrb_nil_value();
+  mrb_mdb_raise(mrb, rc, "mdb_get");
+}
+
+/* MDB.get_view(txn, dbi, key) -> MDB::View or nil */
+static mrb_value
+mrb_mdb_get_view_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_value txn_v, key_obj;
+  mrb_int dbi;
+  mrb_get_args(mrb, "oio", &txn_v, &dbi, &key_obj);
+
+  mrb_mdb_txn *t = mrb_mdb_view_txn_check(mrb, txn_v);
+  key_obj = mrb_str_to_str(mrb, key_obj);
+  MDB_val key  = { (size_t)RSTRING_LEN(key_obj), RSTRING_PTR(key_obj) };
+  MDB_val data;
+  int rc = mdb_get(t->txn, mrb_mdb_dbi(mrb, dbi), &key, &data);
+  if (likely(rc == MDB_SUCCESS))
+    return mrb_mdb_view_new(mrb, txn_v, t, &data);
+  if (rc == MDB_NOTFOUND)
+    return mrb_nil_value();
+  mrb_mdb_raise(mrb, rc, "mdb_get");
+}
+
+static mrb_value
+mrb_mdb_put_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_value txn_v, key_obj, data_obj;
+  mrb_int dbi, flags = 0;
+  mrb_get_args(mrb, "oioo|i", &txn_v, &dbi, &key_obj, &data_obj, &flags);
+
+  MDB_txn *txn = mrb_mdb_txn_get(mrb, txn_v);
+  key_obj  = mrb_str_to_str(mrb, key_obj);
+  data_obj = mrb_str_to_str(mrb, data_obj);
+  MDB_val key  = { (size_t)RSTRING_LEN(key_obj),  RSTRING_PTR(key_obj) };
+  MDB_val data = { (size_t)RSTRING_LEN(data_obj), RSTRING_PTR(data_obj) };
+  int rc = mdb_put(txn, mrb_mdb_dbi(mrb, dbi), &key, &data, mrb_mdb_flags(mrb, flags));
+  if (likely(rc == MDB_SUCCESS))
+    return self;
+  mrb_mdb_raise(mrb, rc, "mdb_put");
+}
+
+static mrb_value
+mrb_mdb_del_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_value txn_v, key_obj, data_obj = mrb_nil_value();
+  mrb_int dbi;
+  mrb_get_args(mrb, "oio|o", &txn_v, &dbi, &key_obj, &data_obj);
+
+  MDB_txn *txn = mrb_mdb_txn_get(mrb, txn_v);
+  key_obj = mrb_str_to_str(mrb, key_obj);
+  MDB_val key = { (size_t)RSTRING_LEN(key_obj), RSTRING_PTR(key_obj) };
+  MDB_val dv, *dvp = NULL;
+  if (!mrb_nil_p(data_obj)) {
+    data_obj = mrb_str_to_str(mrb, data_obj);
+    dv.mv_size = (size_t)RSTRING_LEN(data_obj);
+    dv.mv_data = RSTRING_PTR(data_obj);
+    dvp = &dv;
+  }
+  int rc = mdb_del(txn, mrb_mdb_dbi(mrb, dbi), &key, dvp);
+  if (likely(rc == MDB_SUCCESS))
+    return mrb_true_value();
+  if (rc == MDB_NOTFOUND)
+    return mrb_nil_value();
+  mrb_mdb_raise(mrb, rc, "mdb_del");
+}
+
+static mrb_value
+mrb_mdb_drop_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_value txn_v;
+  mrb_int dbi;
+  mrb_bool del = FALSE;
+  mrb_get_args(mrb, "oi|b", &txn_v, &dbi, &del);
+
+  MDB_txn *txn = mrb_mdb_txn_get(mrb, txn_v);
+  int rc = mdb_drop(txn, mrb_mdb_dbi(mrb, dbi), (int)del);
+  if (likely(rc == MDB_SUCCESS) && del)
+    rc = mrb_mdb_dbi_forget_compare(txn, (MDB_dbi)dbi, NULL);
+  if (likely(rc == MDB_SUCCESS))
+    return self;
+  mrb_mdb_raise(mrb, rc, "mdb_drop");
+}
+
+static mrb_value
+mrb_mdb_stat_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_value txn_v;
+  mrb_int dbi;
+  mrb_get_args(mrb, "oi", &txn_v, &dbi);
+
+  MDB_txn *txn = mrb_mdb_txn_get(mrb, txn_v);
+  MDB_stat stat;
+  int rc = mdb_stat(txn, mrb_mdb_dbi(mrb, dbi), &stat);
+  if (likely(rc == MDB_SUCCESS))
+    return mrb_mdb_stat_to_value(mrb, &stat);
+  mrb_mdb_raise(mrb, rc, "mdb_stat");
+}
+
+/*
+ * MDB.reserve(txn, dbi, key, size, flags = 0) { |buf| ... } -> block result
+ *
+ * The txn is left open; an exception from the block propagates and the
+ * caller decides whether to abort.
+ */
+static mrb_value
+mrb_mdb_reserve_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_value txn_v, key_obj, blk, result;
+  mrb_int dbi, size, flags = 0;
+  mrb_get_args(mrb, "oioi|i&!", &txn_v, &dbi, &key_obj, &size, &flags, &blk);
+  if (mrb_nil_p(blk))
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "no block given");
+
+  MDB_txn *txn = mrb_mdb_txn_get(mrb, txn_v);
+  key_obj = mrb_str_to_str(mrb, key_obj);
+  unsigned int db_flags;
+  int rc = mdb_dbi_flags(txn, mrb_mdb_dbi(mrb, dbi), &db_flags);
+  if (unlikely(rc != MDB_SUCCESS))
+    mrb_mdb_raise(mrb, rc, "mdb_dbi_flags");
+  mrb_mdb_reserve_check(mrb, db_flags);
+  mrb_bool exc = FALSE;
+  rc = mrb_mdb_reserve_yield(mrb, txn, mrb_mdb_dbi(mrb, dbi), key_obj,
+    mrb_mdb_reserve_size(mrb, size), mrb_mdb_flags(mrb, flags), blk, &result, &exc);
+  if (unlikely(rc != MDB_SUCCESS))
+    mrb_mdb_raise(mrb, rc, "mdb_put");
+  if (exc)
+    mrb_exc_raise(mrb, result);
+  return result;
+}
+
+/* ========================================================================
+ * MDB::Cursor
+ * ======================================================================== */
+
+static mrb_value
+mrb_mdb_cursor_init(mrb_state *mrb, mrb_value self)
+{
+  mrb_value txn_v;
+  mrb_int dbi;
+  mrb_get_args(mrb, "oi", &txn_v, &dbi);
+
+  MDB_txn *txn = mrb_mdb_txn_get(mrb, txn_v);
+  MDB_cursor *cursor;
+  int rc = mdb_cursor_open(txn, mrb_mdb_dbi(mrb, dbi), &cursor);
+  if (likely(rc == MDB_SUCCESS)) {
+    mrb_data_init(self, cursor, &mdb_cursor_type);
+    mrb_iv_set(mrb, self, MRB_IVSYM(txn), txn_v);
+    return self;
+  }
+  mrb_mdb_raise(mrb, rc, "mdb_cursor_open");
+}
+
+static mrb_value
+mrb_mdb_cursor_close_m(mrb_state *mrb, mrb_value self)
+{
+  MDB_cursor *cursor = (MDB_cursor *)mrb_data_check_get_ptr(mrb, self, &mdb_cursor_type);
+  if (cursor) {
+    mdb_cursor_close(cursor);
+    mrb_data_init(self, NULL, NULL);
+    return mrb_true_value();
+  }
+  return mrb_false_value();
+}
+
+static mrb_value
+mrb_mdb_cursor_renew_m(mrb_state *mrb, mrb_value self)
+{
+  MDB_cursor *cursor = mrb_mdb_cursor_get(mrb, self);
+  mrb_value txn_v;
+  mrb_get_args(mrb, "o", &txn_v);
+  MDB_txn *txn = mrb_mdb_txn_get(mrb, txn_v);
+  int rc = mdb_cursor_renew(txn, cursor);
+  if (likely(rc == MDB_SUCCESS)) {
+    mrb_iv_set(mrb, self, MRB_IVSYM(txn), txn_v);
+    return self;
+  }
+  mrb_mdb_raise(mrb, rc, "mdb_cursor_renew");
+}
+
+static mrb_value
+mrb_mdb_cursor_get_m(mrb_state *mrb, mrb_value self)
+{
+  MDB_cursor *cursor = mrb_mdb_cursor_get(mrb, self);
+  mrb_int cursor_op;
+  mrb_value key_obj = mrb_nil_value(), data_obj = mrb_nil_value();
+  mrb_get_args(mrb, "i|oo", &cursor_op, &key_obj, &data_obj);
+
+  MDB_val key = { 0, NULL }, data = { 0, NULL };
+  if (!mrb_nil_p(key_obj)) {
+    key_obj = mrb_str_to_str(mrb, key_obj);
+    key.mv_size = (size_t)RSTRING_LEN(key_obj);
+    key.mv_data = RSTRING_PTR(key_obj);
+  }
+  if (!mrb_nil_p(data_obj)) {
+    data_obj = mrb_str_to_str(mrb, data_obj);
+    data.mv_size = (size_t)RSTRING_LEN(data_obj);
+    data.mv_data = RSTRING_PTR(data_obj);
+  }
+  int rc = mdb_cursor_get(cursor, &key, &data, mrb_mdb_cursor_op(mrb, cursor_op));
+  if (likely(rc == MDB_SUCCESS))
+    return mrb_assoc_new(mrb, mrb_mdb_val_to_str(mrb, &key), mrb_mdb_val_to_str(mrb, &data));
+  if (rc == MDB_NOTFOUND)
+    return mrb_nil_value();
+  mrb_mdb_raise(mrb, rc, "mdb_cursor_get");
+}
+
+/* Cursor#get_view(op[, key[, data]]) -> [key, MDB::View] or nil */
+static mrb_value
+mrb_mdb_cursor_get_view_m(mrb_state *mrb, mrb_value self)
+{
+  MDB_cursor *cursor = mrb_mdb_cursor_get(mrb, self);
+  mrb_int cursor_op;
+  mrb_value key_obj = mrb_nil_value(), data_obj = mrb_nil_value();
+  mrb_get_args(mrb, "i|oo", &cursor_op, &key_obj, &data_obj);
+
+  mrb_value txn_v = mrb_iv_get(mrb, self, MRB_IVSYM(txn));
+  mrb_mdb_txn *t = mrb_mdb_view_txn_check(mrb, txn_v);
+
+  MDB_val key = { 0, NULL }, data = { 0, NULL };
+  if (!mrb_nil_p(key_obj)) {
+    key_obj = mrb_str_to_str(mrb, key_obj);
+    key.mv_size = (size_t)RSTRING_LEN(key_obj);
+    key.mv_data = RSTRING_PTR(key_obj);
+  }
+  if (!mrb_nil_p(data_obj)) {
+    data_obj = mrb_str_to_str(mrb, data_obj);
+    data.mv_size = (size_t)RSTRING_LEN(data_obj);
+    data.mv_data = RSTRING_PTR(data_obj);
+  }
+  int rc = mdb_cursor_get(cursor, &key, &data, mrb_mdb_cursor_op(mrb, cursor_op));
+  if (likely(rc == MDB_SUCCESS))
+    return mrb_assoc_new(mrb, mrb_mdb_val_to_str(mrb, &key), mrb_mdb_view_new(mrb, txn_v, t, &data));
+  if (rc == MDB_NOTFOUND)
+    return mrb_nil_value();
+  mrb_mdb_raise(mrb, rc, "mdb_cursor_get");
+}
+
+static mrb_value
+mrb_mdb_cursor_put_m(mrb_state *mrb, mrb_value self)
+{
+  MDB_cursor *cursor = mrb_mdb_cursor_get(mrb, self);
+  mrb_value key_obj, data_obj;
+  mrb_int flags = 0;
+  mrb_get_args(mrb, "oo|i", &key_obj, &data_obj, &flags);
+
+  key_obj  = mrb_str_to_str(mrb, key_obj);
+  data_obj = mrb_str_to_str(mrb, data_obj);
+  MDB_val key  = { (size_t)RSTRING_LEN(key_obj),  RSTRING_PTR(key_obj) };
+  MDB_val data = { (size_t)RSTRING_LEN(data_obj), RSTRING_PTR(data_obj) };
+  int rc = mdb_cursor_put(cursor, &key, &data, mrb_mdb_flags(mrb, flags));
+  if (likely(rc == MDB_SUCCESS))
+    return self;
+  mrb_mdb_raise(mrb, rc, "mdb_cursor_put");
+}
+
+static mrb_value
+mrb_mdb_cursor_del_m(mrb_state *mrb, mrb_value self)
+{
+  MDB_cursor *cursor = mrb_mdb_cursor_get(mrb, self);
+  mrb_int flags = 0;
+  mrb_get_args(mrb, "|i", &flags);
+  int rc = mdb_cursor_del(cursor, mrb_mdb_flags(mrb, flags));
+  if (likely(rc == MDB_SUCCESS))
+    return self;
+  mrb_mdb_raise(mrb, rc, "mdb_cursor_del");
+}
+
+static mrb_value
+mrb_mdb_cursor_count_m(mrb_state *mrb, mrb_value self)
+{
+  MDB_cursor *cursor = mrb_mdb_cursor_get(mrb, self);
+  size_t count;
+  int rc = mdb_cursor_count(cursor, &count);
+  if (likely(rc == MDB_SUCCESS))
+    return mrb_convert_size_t(mrb, count);
+  mrb_mdb_raise(mrb, rc, "mdb_cursor_count");
+}
+
+/*
+ * DUPFIXED pages: GET_MULTIPLE / NEXT_MULTIPLE / PREV_MULTIPLE return a
+ * page of packed fixed-size duplicates. The element size is the size of
+ * the duplicate the cursor is left on. INTEGERDUP elements decode to
+ * Integers (same layout as Integer#to_bin), everything else to Strings.
+ */
+static mrb_value
+mrb_mdb_dup_page_to_ary(mrb_state *mrb, const MDB_val *page, size_t elem, unsigned int db_flags)
+{
+  size_t n = elem ? page->mv_size / elem : 0;
+  mrb_value ary = mrb_ary_new_capa(mrb, (mrb_int)n);
+  const char *p = (const char *)page->mv_data;
+  int ai = mrb_gc_arena_save(mrb);
+
+  for (size_t i = 0; i < n; i++, p += elem) {
+    if ((db_flags & MDB_INTEGERDUP) && elem == sizeof(mrb_int)) {
+      mrb_ary_push(mrb, ary, mrb_int_value(mrb, mrb_lmdb_bin2fix(mrb, p, (mrb_int)elem)));
+    } else if ((db_flags & MDB_INTEGERDUP) && elem == sizeof(unsigned int)) {
+      unsigned int u;
+      memcpy(&u, p, sizeof(u));
+      mrb_ary_push(mrb, ary, mrb_convert_uint(mrb, u));
+    } else {
+      mrb_ary_push(mrb, ary, mrb_str_new(mrb, p, (mrb_int)elem));
+    }
+    mrb_gc_arena_restore(mrb, ai);
+  }
+  return ary;
+}
+
+/* Run a *_MULTIPLE op; on success *out is [key, Array of duplicates]. */
+static int
+mrb_mdb_cursor_multiple(mrb_state *mrb, MDB_cursor *cursor, MDB_cursor_op op,
+                        unsigned int db_flags, mrb_value *out)
+{
+  MDB_val key, page, cur;
+  if (!(db_flags & MDB_DUPFIXED))
+    return MDB_INCOMPATIBLE;
+  int rc = mdb_cursor_get(cursor, &key, &page, op);
+  if (rc == MDB_SUCCESS)
+    rc = mdb_cursor_get(cursor, &key, &cur, MDB_GET_CURRENT);
+  if (rc == MDB_SUCCESS)
+    *out = mrb_assoc_new(mrb, mrb_mdb_val_to_str(mrb, &key),
+      mrb_mdb_dup_page_to_ary(mrb, &page, cur.mv_size, db_flags));
+  return rc;
+}
+
+static mrb_value
+mrb_mdb_cursor_multiple_m(mrb_state *mrb, mrb_value self, MDB_cursor_op op, mrb_value key_obj)
+{
+  MDB_cursor *cursor = mrb_mdb_cursor_get(mrb, self);
+  mrb_value out;
+
+  unsigned int db_flags;
+  int rc = mdb_dbi_flags(mdb_cursor_txn(cursor), mdb_cursor_dbi(cursor), &db_flags);
+  if (unlikely(rc != MDB_SUCCESS))
+    mrb_mdb_raise(mrb, rc, "mdb_dbi_flags");
+
+  if (!mrb_nil_p(key_obj)) {
+    key_obj = mrb_str_to_str(mrb, key_obj);
+    MDB_val key = { (size_t)RSTRING_LEN(key_obj), RSTRING_PTR(key_obj) }, data;
+    rc = mdb_cursor_get(cursor, &key, &data, MDB_SET_KEY);
+    if (rc == MDB_NOTFOUND)
+      return mrb_nil_value();
+    if (unlikely(rc != MDB_SUCCESS))
+      mrb_mdb_raise(mrb, rc, "mdb_cursor_get");
+  }
+
+  rc = mrb_mdb_cursor_multiple(mrb, cursor, op, db_flags, &out);
+  if (likely(rc == MDB_SUCCESS))
+    return out;
+  if (rc == MDB_NOTFOUND)
+    return mrb_nil_value();
+  mrb_mdb_raise(mrb, rc, "mdb_cursor_get");
+}
+
+/* Cursor#get_multiple([key]) -> [key, [dup, ...]] or nil — DUPFIXED */
+static mrb_value
+mrb_mdb_cursor_get_multiple_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_value key_obj = mrb_nil_value();
+  mrb_get_args(mrb, "|o", &key_obj);
+  return mrb_mdb_cursor_multiple_m(mrb, self, MDB_GET_MULTIPLE, key_obj);
+}
+
+/* Cursor#next_multiple -> [key, [dup, ...]] or nil — DUPFIXED */
+static mrb_value
+mrb_mdb_cursor_next_multiple_m(mrb_state *mrb, mrb_value self)
+{
+  return mrb_mdb_cursor_multiple_m(mrb, self, MDB_NEXT_MULTIPLE, mrb_nil_value());
+}
+
+/* Cursor#prev_multiple -> [key, [dup, ...]] or nil — DUPFIXED */
+static mrb_value
+mrb_mdb_cursor_prev_multiple_m(mrb_state *mrb, mrb_value self)
+{
+  return mrb_mdb_cursor_multiple_m(mrb, self, MDB_PREV_MULTIPLE, mrb_nil_value());
+}
+
+/* ========================================================================
+ * MDB::Index — secondary indexes
+ *
+ * An Index maps index keys to primary keys in a DUPSORT database. Once
+ * attached, Database#[]=, #del, #batch_put and #bulk_load on the primary
+ * read the old value, and update the index in the same write txn as the
+ * primary write. Writes through MDB.put, cursors and batch/transaction
+ * blocks bypass the index; call Index#rebuild after those. MDB::Loader,
+ * Database#reserve, #<< and #concat refuse indexed primaries.
+ * ======================================================================== */
+
+static mrb_mdb_index *
+mrb_mdb_index_get(mrb_state *mrb, mrb_value self)
+{
+  mrb_mdb_index *ix = (mrb_mdb_index *)mrb_data_get_ptr(mrb, self, &mdb_index_type);
+  if (likely(ix))
+    return ix;
+  mrb_raise(mrb, E_RUNTIME_ERROR, "uninitialized MDB::Index");
+}
+
+/*
+ * Index keys for one primary record, as an Array of Strings. field: takes
+ * the part of an MDB::Key-packed String as stored; for a decoded Array
+ * (element n) or Hash (key n) from a codec: :native primary it packs that
+ * element with MDB::Key, so both kinds are looked up by Key.pack(part).
+ */
+static mrb_value
+mrb_mdb_index_extract(mrb_state *mrb, mrb_value idx_obj, mrb_value key_obj, mrb_value val_obj)
+{
+  mrb_mdb_index *ix = mrb_mdb_index_get(mrb, idx_obj);
+  mrb_value out = mrb_ary_new(mrb);
+
+  if (ix->field >= 0 && (mrb_array_p(val_obj) || mrb_hash_p(val_obj))) {
+    mrb_value part;
+    if (mrb_array_p(val_obj)) {
+      if (ix->field >= RARRAY_LEN(val_obj))
+        return out;
+      part = RARRAY_PTR(val_obj)[ix->field];
+    }
+    else {
+      part = mrb_hash_fetch(mrb, val_obj, mrb_int_value(mrb, ix->field), mrb_undef_value());
+      if (mrb_undef_p(part))
+        return out;
+    }
+    mrb_value ikey = mrb_str_new_capa(mrb, 9);
+    mrb_mdb_key_pack_part(mrb, ikey, part);
+    mrb_ary_push(mrb, out, ikey);
+    return out;
+  }
+
+  if (ix->field >= 0) {
+    val_obj = mrb_str_to_str(mrb, val_obj);
+    const uint8_t *p = (const uint8_t *)RSTRING_PTR(val_obj);
+    const uint8_t *end = p + RSTRING_LEN(val_obj);
+    for (mrb_int i = 0; p < end; i++) {
+      const uint8_t *next = mrb_mdb_key_skip(p, end);
+      if (!next)
+        mrb_mdb_key_invalid(mrb);
+      if (i == ix->field) {
+        mrb_ary_push(mrb, out, mrb_str_new(mrb, (const char *)p, (mrb_int)(next - p)));
+        break;
+      }
+      p = next;
+    }
+    return out;
+  }
+
+  mrb_value r = mrb_funcall_id(mrb, mrb_iv_get(mrb, idx_obj, MRB_IVSYM(extract)),
+                               MRB_SYM(call), 2, key_obj, val_obj);
+  if (mrb_nil_p(r))
+    return out;
+  if (!mrb_array_p(r)) {
+    mrb_ary_push(mrb, out, mrb_str_to_str(mrb, r));
+    return out;
+  }
+  for (mrb_int i = 0; i < RARRAY_LEN(r); i++)
+    mrb_ary_push(mrb, out, mrb_str_to_str(mrb, mrb_ary_entry(r, i)));
+  return out;
+}
+
+/* Put (del = FALSE) or delete every (index key, primary key) pair. */
+static void
+mrb_mdb_index_apply(mrb_state *mrb, MDB_txn *txn, mrb_value idx_obj, mrb_value ikeys,
+                    const MDB_val *pkey, mrb_bool del)
+{
+  MDB_dbi dbi = mrb_mdb_index_get(mrb, idx_obj)->dbi;
+  for (mrb_int i = 0; i < RARRAY_LEN(ikeys); i++) {
+    mrb_value ik = mrb_ary_entry(ikeys, i);
+    MDB_val k = { (size_t)RSTRING_LEN(ik), RSTRING_PTR(ik) };
+    MDB_val d = *pkey;
+    int rc = del ? mdb_del(txn, dbi, &k, &d) : mdb_put(txn, dbi, &k, &d, 0);
+    if (unlikely(rc != MDB_SUCCESS && !(del && rc == MDB_NOTFOUND)))
+      mrb_mdb_raise(mrb, rc, del ? "mdb_del" : "mdb_put");
+  }
+}
+
+typedef struct {
+  mrb_value    self;
+  mrb_value    pairs;   /* [[key, value], ...]; [key] deletes */
+  MDB_txn     *txn;
+  unsigned int flags;
+} mrb_mdb_indexed_write_ctx;
+
+/* Runs under mrb_protect_error; the caller aborts txn if this raises. */
+static mrb_value
+mrb_mdb_indexed_write_cb(mrb_state *mrb, void *ud)
+{
+  mrb_mdb_indexed_write_ctx *ctx = (mrb_mdb_indexed_write_ctx *)ud;
+  mrb_mdb_database *db = mrb_mdb_database_get(mrb, ctx->self);
+  MDB_dbi dbi = db->dbi;
+  mrb_value indexes = mrb_iv_get(mrb, ctx->self, MRB_IVSYM(indexes));
+  mrb_mdb_bloom_txn bloom;
+  mrb_mdb_bloom_begin(ctx->txn, db, &bloom);
+  int ai = mrb_gc_arena_save(mrb);
+
+  for (mrb_int i = 0; i < RARRAY_LEN(ctx->pairs); i++) {
+    mrb_value pair    = mrb_ary_entry(ctx->pairs, i);
+    mrb_value key_obj = mrb_ary_entry(pair, 0);
+    mrb_bool  put     = RARRAY_LEN(pair) > 1;
+    mrb_value val_obj = mrb_ary_entry(pair, 1);
+    MDB_val key = { (size_t)RSTRING_LEN(key_obj), RSTRING_PTR(key_obj) };
+
+    /* Copy the old value out: the writes below may move its page. */
+    MDB_val old;
+    mrb_value old_obj = mrb_nil_value();
+    int rc = mdb_get(ctx->txn, dbi, &key, &old);
+    mrb_bool had_old = (rc == MDB_SUCCESS);
+    if (had_old)
+      old_obj = mrb_mdb_db_value(mrb, ctx->txn, db, &old);
+    else if (rc != MDB_NOTFOUND)
+      mrb_mdb_raise(mrb, rc, "mdb_get");
+
+    for (mrb_int j = 0; j < RARRAY_LEN(indexes); j++) {
+      mrb_value idx_obj = mrb_ary_entry(indexes, j);
+      if (had_old)
+        mrb_mdb_index_apply(mrb, ctx->txn, idx_obj,
+          mrb_mdb_index_extract(mrb, idx_obj, key_obj, old_obj), &key, TRUE);
+      if (put)
+        mrb_mdb_index_apply(mrb, ctx->txn, idx_obj,
+          mrb_mdb_index_extract(mrb, idx_obj, key_obj, val_obj), &key, FALSE);
+    }
+
+    if (!put) {
+      rc = mdb_del(ctx->txn, dbi, &key, NULL);
+      if (rc == MDB_SUCCESS)
+        mrb_mdb_bloom_del(&bloom);
+      else if (unlikely(rc != MDB_NOTFOUND))
+        mrb_mdb_raise(mrb, rc, "mdb_del");
+    }
+    else {
+      rc = mrb_mdb_db_put(mrb, ctx->txn, db, &key, mrb_mdb_db_pack(mrb, db, val_obj), ctx->flags);
+      if (likely(rc == MDB_SUCCESS))
+        rc = mrb_mdb_bloom_add(ctx->txn, db, &bloom, &key);
+      if (unlikely(rc != MDB_SUCCESS))
+        mrb_mdb_raise(mrb, rc, "mdb_put");
+    }
+    mrb_gc_arena_restore(mrb, ai);
+  }
+  int rc = mrb_mdb_bloom_end(ctx->txn, db, &bloom);
+  if (unlikely(rc != MDB_SUCCESS))
+    mrb_mdb_raise(mrb, rc, "mdb_put");
+  return mrb_nil_value();
+}
+
+/*
+ * Write pairs (already coerced with mrb_mdb_db_coerce; a bare [key] deletes)
+ * to an indexed primary in one write txn, keeping every attached index in step.
+ */
+static void
+mrb_mdb_indexed_write(mrb_state *mrb, mrb_value self, mrb_value pairs, unsigned int flags)
+{
+  mrb_mdb_indexed_write_ctx ctx = { self, pairs, NULL, flags };
+  ctx.txn = mrb_mdb_env_write_begin(mrb, mrb_mdb_database_env_state(mrb, self));
+
+  mrb_bool exc = FALSE;
+  mrb_value result = mrb_protect_error(mrb, mrb_mdb_indexed_write_cb, &ctx, &exc);
+  if (exc) {
+    mdb_txn_abort(ctx.txn);
+    mrb_exc_raise(mrb, result);
+  }
+  int rc = mdb_txn_commit(ctx.txn);
+  if (unlikely(rc != MDB_SUCCESS))
+    mrb_mdb_raise(mrb, rc, "mdb_txn_commit");
+}
+
+static mrb_value
+mrb_mdb_indexed_pair(mrb_state *mrb, mrb_value key_obj, mrb_value val_obj)
+{
+  mrb_value pair = mrb_ary_new_capa(mrb, 2);
+  mrb_ary_push(mrb, pair, key_obj);
+  if (!mrb_undef_p(val_obj))
+    mrb_ary_push(mrb, pair, val_obj);
+  return pair;
+}
+
+/* MDB::Index.new(primary, index_db, field: n) or { |key, value| ... } */
+static mrb_value
+mrb_mdb_index_init(mrb_state *mrb, mrb_value self)
+{
+  mrb_value primary_obj, index_obj, opts = mrb_nil_value(), blk;
+  mrb_get_args(mrb, "oo|H&", &primary_obj, &index_obj, &opts, &blk);
+  if (mrb_data_check_get_ptr(mrb, self, &mdb_index_type))
+    mrb_raise(mrb, E_RUNTIME_ERROR, "MDB::Index already initialized");
+
+  mrb_mdb_database *primary = mrb_mdb_database_get(mrb, primary_obj);
+  mrb_mdb_database *index   = mrb_mdb_database_get(mrb, index_obj);
+  if (primary->env != index->env)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "index must live in the primary's MDB::Env");
+  if (primary->flags & MDB_DUPSORT)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "primary database must not be DUPSORT");
+  if (!(index->flags & MDB_DUPSORT))
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "index database must be DUPSORT");
+
+  mrb_int field = -1;
+  if (!mrb_nil_p(opts)) {
+    mrb_value keys = mrb_hash_keys(mrb, opts);
+    for (mrb_int i = 0; i < RARRAY_LEN(keys); i++) {
+      mrb_value k = mrb_ary_entry(keys, i);
+      if (!mrb_symbol_p(k) || mrb_symbol(k) != MRB_SYM(field))
+        mrb_raisef(mrb, E_ARGUMENT_ERROR, "unknown option %v", k);
+      field = mrb_integer(mrb_to_int(mrb, mrb_hash_get(mrb, opts, k)));
+      if (field < 0)
+        mrb_raise(mrb, E_RANGE_ERROR, "field must be non-negative");
+    }
+  }
+  if ((field >= 0) == !mrb_nil_p(blk))
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "pass either field: or a block");
+
+  mrb_mdb_index *ix = (mrb_mdb_index *)mrb_malloc(mrb, sizeof(mrb_mdb_index));
+  ix->dbi   = index->dbi;
+  ix->field = field;
+  mrb_data_init(self, ix, &mdb_index_type);
+  mrb_iv_set(mrb, self, MRB_IVSYM(primary), primary_obj);
+  mrb_iv_set(mrb, self, MRB_IVSYM(database), index_obj);
+  mrb_iv_set(mrb, self, MRB_IVSYM(extract), blk);
+
+  mrb_value list = mrb_iv_get(mrb, primary_obj, MRB_IVSYM(indexes));
+  if (mrb_nil_p(list)) {
+    list = mrb_ary_new(mrb);
+    mrb_iv_set(mrb, primary_obj, MRB_IVSYM(indexes), list);
+  }
+  mrb_ary_push(mrb, list, self);
+  primary->indexed = TRUE;
+  return self;
+}
+
+typedef struct {
+  mrb_value         ikey;
+  MDB_dbi           idx_dbi;
+  mrb_mdb_database *db;
+  mrb_int           limit;
+  mrb_bool          want_key;
+  mrb_bool          want_value;
+} mrb_mdb_index_lookup_ctx;
+
+static mrb_value
+mrb_mdb_index_lookup_body(mrb_state *mrb, mrb_mdb_read *rd)
+{
+  mrb_mdb_index_lookup_ctx *c = (mrb_mdb_index_lookup_ctx *)rd->ud;
+  MDB_cursor *cursor = mrb_mdb_read_cursor(mrb, rd, c->idx_dbi);
+  mrb_value result = mrb_ary_new(mrb);
+  mrb_int limit = c->limit;
+  int rc;
+
+  int ai = mrb_gc_arena_save(mrb);
+  MDB_val ikey = { (size_t)RSTRING_LEN(c->ikey), RSTRING_PTR(c->ikey) }, pkey;
+  for (rc = mdb_cursor_get(cursor, &ikey, &pkey, MDB_SET_KEY);
+       rc == MDB_SUCCESS && limit != 0;
+       rc = mdb_cursor_get(cursor, &ikey, &pkey, MDB_NEXT_DUP)) {
+    MDB_val data;
+    int grc = mdb_get(rd->txn, c->db->dbi, &pkey, &data);
+    if (grc == MDB_NOTFOUND)
+      continue;
+    if (unlikely(grc != MDB_SUCCESS)) {
+      rc = grc;
+      break;
+    }
+    if (c->want_key && c->want_value)
+      mrb_ary_push(mrb, result, mrb_assoc_new(mrb, mrb_mdb_val_to_str(mrb, &pkey), mrb_mdb_db_value(mrb, rd->txn, c->db, &data)));
+    else if (c->want_key)
+      mrb_ary_push(mrb, result, mrb_mdb_val_to_str(mrb, &pkey));
+    else
+      mrb_ary_push(mrb, result, mrb_mdb_db_value(mrb, rd->txn, c->db, &data));
+    mrb_gc_arena_restore(mrb, ai);
+    if (limit > 0)
+      limit--;
+  }
+  if (unlikely(rc != MDB_SUCCESS && rc != MDB_NOTFOUND))
+    mrb_mdb_raise(mrb, rc, "mdb_cursor_get");
+  return result;
+}
+
+/*
+ * Look up ikey and return primary keys, values or [key, value] pairs.
+ *
+ * One read txn: walk the duplicates of ikey and fetch each primary record.
+ * Index entries whose primary record is gone are skipped.
+ */
+static mrb_value
+mrb_mdb_index_lookup(mrb_state *mrb, mrb_value self, mrb_value ikey_obj, mrb_int limit,
+                     mrb_bool want_key, mrb_bool want_value)
+{
+  mrb_value primary_obj = mrb_iv_get(mrb, self, MRB_IVSYM(primary));
+  mrb_mdb_index_lookup_ctx c = {
+    mrb_str_to_str(mrb, ikey_obj), mrb_mdb_index_get(mrb, self)->dbi,
+    mrb_mdb_database_get(mrb, primary_obj), limit, want_key, want_value
+  };
+  return mrb_mdb_env_read(mrb, mrb_mdb_database_env_state(mrb, primary_obj),
+                          mrb_mdb_index_lookup_body, &c);
+}
+
+/* Index#[](ikey) -> first primary value or nil */
+static mrb_value
+mrb_mdb_index_aref_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_value ikey;
+  mrb_get_args(mrb, "o", &ikey);
+  mrb_value r = mrb_mdb_index_lookup(mrb, self, ikey, 1, FALSE, TRUE);
+  return RARRAY_LEN(r) ? mrb_ary_entry(r, 0) : mrb_nil_value();
+}
+
+/* Index#entries(ikey, limit = nil) -> [[primary_key, value], ...] */
+static mrb_value
+mrb_mdb_index_entries_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_value ikey, limit = mrb_nil_value();
+  mrb_get_args(mrb, "o|o", &ikey, &limit);
+  return mrb_mdb_index_lookup(mrb, self, ikey,
+    mrb_nil_p(limit) ? -1 : mrb_integer(mrb_to_int(mrb, limit)), TRUE, TRUE);
+}
+
+/* Index#values(ikey) -> [value, ...] */
+static mrb_value
+mrb_mdb_index_values_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_value ikey;
+  mrb_get_args(mrb, "o", &ikey);
+  return mrb_mdb_index_lookup(mrb, self, ikey, -1, FALSE, TRUE);
+}
+
+/* Index#keys(ikey) -> [primary_key, ...] */
+static mrb_value
+mrb_mdb_index_keys_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_value ikey;
+  mrb_get_args(mrb, "o", &ikey);
+  return mrb_mdb_index_lookup(mrb, self, ikey, -1, TRUE, FALSE);
+}
+
+typedef struct {
+  mrb_value self;
+  MDB_txn  *txn;
+} mrb_mdb_index_rebuild_ctx;
+
+static mrb_value
+mrb_mdb_index_rebuild_cb(mrb_state *mrb, void *ud)
+{
+  mrb_mdb_index_rebuild_ctx *ctx = (mrb_mdb_index_rebuild_ctx *)ud;
+  mrb_value primary_obj = mrb_iv_get(mrb, ctx->self, MRB_IVSYM(primary));
+  int rc = mdb_drop(ctx->txn, mrb_mdb_index_get(mrb, ctx->self)->dbi, 0);
+  if (unlikely(rc != MDB_SUCCESS))
+    mrb_mdb_raise(mrb, rc, "mdb_drop");
+
+  /* Write-txn cursors are freed with the txn if anything below raises. */
+  mrb_mdb_database *db = mrb_mdb_database_get(mrb, primary_obj);
+  MDB_cursor *cursor;
+  rc = mdb_cursor_open(ctx->txn, db->dbi, &cursor);
+  if (unlikely(rc != MDB_SUCCESS))
+    mrb_mdb_raise(mrb, rc, "mdb_cursor_open");
+
+  int ai = mrb_gc_arena_save(mrb);
+  MDB_val key, data;
+  for (rc = mdb_cursor_get(cursor, &key, &data, MDB_FIRST);
+       rc == MDB_SUCCESS;
+       rc = mdb_cursor_get(cursor, &key, &data, MDB_NEXT)) {
+    mrb_value key_obj = mrb_mdb_val_to_str(mrb, &key);
+    mrb_value val_obj = mrb_mdb_db_value(mrb, ctx->txn, db, &data);
+    MDB_val pkey = { (size_t)RSTRING_LEN(key_obj), RSTRING_PTR(key_obj) };
+    mrb_mdb_index_apply(mrb, ctx->txn, ctx->self,
+      mrb_mdb_index_extract(mrb, ctx->self, key_obj, val_obj), &pkey, FALSE);
+    mrb_gc_arena_restore(mrb, ai);
+  }
+  mdb_cursor_close(cursor);
+  if (unlikely(rc != MDB_NOTFOUND))
+    mrb_mdb_raise(mrb, rc, "mdb_cursor_get");
+  /* Index databases are DUPSORT, so there is no filter to keep. */
+  rc = mrb_mdb_bloom_seal(ctx->txn, FALSE);
+  if (unlikely(rc != MDB_SUCCESS))
+    mrb_mdb_raise(mrb, rc, "mdb_put");
+  return mrb_nil_value();
+}
+
+/* Index#rebuild -> self: empty the index and re-extract every primary record */
+static mrb_value
+mrb_mdb_index_rebuild_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_value primary_obj = mrb_iv_get(mrb, self, MRB_IVSYM(primary));
+  mrb_mdb_index_rebuild_ctx ctx = { self, NULL };
+  ctx.txn = mrb_mdb_env_write_begin(mrb, mrb_mdb_database_env_state(mrb, primary_obj));
+
+  mrb_bool exc = FALSE;
+  mrb_value result = mrb_protect_error(mrb, mrb_mdb_index_rebuild_cb, &ctx, &exc);
+  if (exc) {
+    mdb_txn_abort(ctx.txn);
+    mrb_exc_raise(mrb, result);
+  }
+  int rc = mdb_txn_commit(ctx.txn);
+  if (unlikely(rc != MDB_SUCCESS))
+    mrb_mdb_raise(mrb, rc, "mdb_txn_commit");
+  return self;
+}
+
+/* ========================================================================
+ * Database read cache (cache: bytes)
+ *
+ * A Database#[] hit returns the frozen value remembered from an earlier
+ * read, without opening a txn or allocating. Entries are only valid for the
+ * last committed txn id (MDB_envinfo.me_last_txnid): any commit, from this
+ * process or another, moves it and the next lookup flushes the cache. A
+ * value read through a snapshot older than that id is returned but not
+ * cached.
+ * ======================================================================== */
+
+#define MRB_MDB_CACHE_ENTRY_COST 64
+#define MRB_MDB_CACHE_MIN_BUCKETS 64
+
+/* cache: option -> byte limit (0: disabled). */
+static size_t
+mrb_mdb_cache_limit(mrb_state *mrb, mrb_value v)
+{
+  if (mrb_nil_p(v) || mrb_false_p(v))
+    return 0;
+  mrb_int limit = mrb_as_int(mrb, v);
+  if (limit < 0)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "cache: must not be negative");
+  return (size_t)limit;
+}
+
+static uint32_t
+mrb_mdb_cache_hash(const char *p, size_t n)
+{
+  uint32_t h = 2166136261u;
+  while (n--)
+    h = (h ^ (uint8_t)*p++) * 16777619u;
+  return h;
+}
+
+static mrb_mdb_cache_entry *
+mrb_mdb_cache_find(mrb_mdb_cache *c, const char *key, size_t klen, uint32_t hash)
+{
+  for (mrb_mdb_cache_entry *e = c->buckets[hash & (c->nbuckets - 1)]; e; e = e->chain)
+    if (e->hash == hash && e->klen == klen && memcmp(e->key, key, klen) == 0)
+      return e;
+  return NULL;
+}
+
+static void
+mrb_mdb_cache_link_front(mrb_mdb_cache *c, mrb_mdb_cache_entry *e)
+{
+  e->prev = NULL;
+  e->next = c->head;
+  if (c->head)
+    c->head->prev = e;
+  else
+    c->tail = e;
+  c->head = e;
+}
+
+static void
+mrb_mdb_cache_unlink(mrb_mdb_cache *c, mrb_mdb_cache_entry *e)
+{
+  if (e->prev)
+    e->prev->next = e->next;
+  else
+    c->head = e->next;
+  if (e->next)
+    e->next->prev = e->prev;
+  else
+    c->tail = e->prev;
+}
+
+/* Drop the least recently used entry, releasing its value slot. */
+static void
+mrb_mdb_cache_evict(mrb_state *mrb, mrb_value self, mrb_mdb_cache *c)
+{
+  mrb_mdb_cache_entry *e = c->tail;
+  mrb_mdb_cache_entry **pp = &c->buckets[e->hash & (c->nbuckets - 1)];
+  while (*pp != e)
+    pp = &(*pp)->chain;
+  *pp = e->chain;
+  mrb_mdb_cache_unlink(c, e);
+
+  mrb_value values = mrb_iv_get(mrb, self, MRB_IVSYM(cache_values));
+  mrb_ary_set(mrb, values, e->slot, mrb_nil_value());
+  c->free_slots[c->nfree++] = e->slot;
+  c->bytes -= e->cost;
+  c->count--;
+  mrb_free(mrb, e);
+}
+
+/* Drop every entry and start a fresh slot Array. */
+static void
+mrb_mdb_cache_flush(mrb_state *mrb, mrb_value self, mrb_mdb_cache *c)
+{
+  mrb_mdb_cache_release(mrb, c);
+  mrb_iv_set(mrb, self, MRB_IVSYM(cache_values), mrb_ary_new(mrb));
+}
+
+static void
+mrb_mdb_cache_grow(mrb_state *mrb, mrb_mdb_cache *c)
+{
+  size_t n = c->nbuckets * 2;
+  mrb_mdb_cache_entry **buckets = (mrb_mdb_cache_entry **)mrb_calloc(mrb, n, sizeof(*buckets));
+  for (mrb_mdb_cache_entry *e = c->head; e; e = e->next) {
+    mrb_mdb_cache_entry **b = &buckets[e->hash & (n - 1)];
+    e->chain = *b;
+    *b = e;
+  }
+  mrb_free(mrb, c->buckets);
+  c->buckets = buckets;
+  c->nbuckets = n;
+}
+
+/* Approximate memory held by a decoded value. */
+static size_t
+mrb_mdb_cache_value_cost(mrb_state *mrb, mrb_value v)
+{
+  if (mrb_string_p(v))
+    return (size_t)RSTRING_LEN(v);
+  if (mrb_nil_p(v))
+    return 0;
+  return mrb_mdb_codec_size(mrb, v, 0);
+}
+
+/* Remember value (already frozen) for key, evicting to stay under the limit. */
+static void
+mrb_mdb_cache_insert(mrb_state *mrb, mrb_value self, mrb_mdb_cache *c,
+                     mrb_value key, uint32_t hash, mrb_value value)
+{
+  size_t klen = (size_t)RSTRING_LEN(key);
+  size_t cost = klen + mrb_mdb_cache_value_cost(mrb, value) + MRB_MDB_CACHE_ENTRY_COST;
+  if (cost > c->limit)
+    return;
+  while (c->bytes + cost > c->limit)
+    mrb_mdb_cache_evict(mrb, self, c);
+
+  mrb_value values = mrb_iv_get(mrb, self, MRB_IVSYM(cache_values));
+  mrb_int slot;
+  if (c->nfree > 0) {
+    slot = c->free_slots[--c->nfree];
+  } else {
+    slot = c->nslots++;
+    if ((size_t)c->nslots > c->free_cap) {
+      size_t cap = c->free_cap ? c->free_cap * 2 : MRB_MDB_CACHE_MIN_BUCKETS;
+      c->free_slots = (mrb_int *)mrb_realloc(mrb, c->free_slots, cap * sizeof(mrb_int));
+      c->free_cap = cap;
+    }
+  }
+  mrb_ary_set(mrb, values, slot, value);
+
+  if (c->count >= c->nbuckets)
+    mrb_mdb_cache_grow(mrb, c);
+  mrb_mdb_cache_entry *e = (mrb_mdb_cache_entry *)mrb_malloc(mrb, sizeof(*e) + klen);
+  memcpy(e->key, RSTRING_PTR(key), klen);
+  e->klen = klen;
+  e->hash = hash;
+  e->slot = slot;
+  e->cost = cost;
+  mrb_mdb_cache_entry **b = &c->buckets[hash & (c->nbuckets - 1)];
+  e->chain = *b;
+  *b = e;
+  mrb_mdb_cache_link_front(c, e);
+  c->bytes += cost;
+  c->count++;
+}
+
+static int mrb_mdb_deep_freeze_pair(mrb_state *mrb, mrb_value k, mrb_value v, void *ud);
+
+/* Freeze v and everything it contains, so cached values can be shared. */
+static void
+mrb_mdb_deep_freeze(mrb_state *mrb, mrb_value v)
+{
+  if (mrb_immediate_p(v) || MRB_FROZEN_P(mrb_basic_ptr(v)))
+    return;
+  mrb_obj_freeze(mrb, v);
+  if (mrb_array_p(v)) {
+    for (mrb_int i = 0; i < RARRAY_LEN(v); i++)
+      mrb_mdb_deep_freeze(mrb, RARRAY_PTR(v)[i]);
+  } else if (mrb_hash_p(v)) {
+    mrb_hash_foreach(mrb, mrb_hash_ptr(v), mrb_mdb_deep_freeze_pair, NULL);
+  }
+}
+
+static int
+mrb_mdb_deep_freeze_pair(mrb_state *mrb, mrb_value k, mrb_value v, void *ud)
+{
+  mrb_mdb_deep_freeze(mrb, k);
+  mrb_mdb_deep_freeze(mrb, v);
+  return 0;
+}
+
+/* Enable the cache with limit bytes, resize it, or (limit 0) drop it. */
+static void
+mrb_mdb_database_set_cache(mrb_state *mrb, mrb_value self, mrb_mdb_database *db, size_t limit)
+{
+  mrb_mdb_cache *c = db->cache;
+  if (limit == 0) {
+    if (c) {
+      mrb_mdb_cache_release(mrb, c);
+      mrb_free(mrb, c->buckets);
+      mrb_free(mrb, c->free_slots);
+      mrb_free(mrb, c);
+      db->cache = NULL;
+    }
+    mrb_iv_remove(mrb, self, MRB_IVSYM(cache_values));
+    return;
+  }
+  if (!c) {
+    c = (mrb_mdb_cache *)mrb_calloc(mrb, 1, sizeof(*c));
+    c->nbuckets = MRB_MDB_CACHE_MIN_BUCKETS;
+    c->buckets = (mrb_mdb_cache_entry **)mrb_calloc(mrb, c->nbuckets, sizeof(*c->buckets));
+    db->cache = c;
+    mrb_iv_set(mrb, self, MRB_IVSYM(cache_values), mrb_ary_new(mrb));
+  }
+  c->limit = limit;
+  while (c->bytes > c->limit)
+    mrb_mdb_cache_evict(mrb, self, c);
+}
+
+/* One-shot lookup of key for Database#[] and #fetch. */
+typedef struct {
+  mrb_mdb_database *db;
+  mrb_value         key;
+  mrb_bool          found;
+  size_t            snapshot;
+} mrb_mdb_get_ctx;
+
+static mrb_value
+mrb_mdb_database_get_body(mrb_state *mrb, mrb_mdb_read *rd)
+{
+  mrb_mdb_get_ctx *g = (mrb_mdb_get_ctx *)rd->ud;
+  MDB_val key = { (size_t)RSTRING_LEN(g->key), RSTRING_PTR(g->key) };
+  MDB_val data;
+  int rc = mrb_mdb_db_get(rd->txn, g->db, &key, &data);
+  g->snapshot = mdb_txn_id(rd->txn);
+  g->found = (rc == MDB_SUCCESS);
+  if (g->found)
+    return mrb_mdb_db_value(mrb, rd->txn, g->db, &data);
+  if (rc != MDB_NOTFOUND)
+    mrb_mdb_raise(mrb, rc, "mdb_get");
+  return mrb_nil_value();
+}
+
+/* Database#[] through the cache. */
+static mrb_value
+mrb_mdb_database_cached_get(mrb_state *mrb, mrb_value self, mrb_mdb_database *db, mrb_value key_obj)
+{
+  mrb_mdb_env *env = mrb_mdb_database_env_state(mrb, self);
+  mrb_mdb_cache *c = db->cache;
+  MDB_envinfo info;
+  int rc = mdb_env_info(env->env, &info);
+  if (unlikely(rc != MDB_SUCCESS))
+    mrb_mdb_raise(mrb, rc, "mdb_env_info");
+  if (info.me_last_txnid != c->txnid) {
+    mrb_mdb_cache_flush(mrb, self, c);
+    c->txnid = info.me_last_txnid;
+  }
+
+  uint32_t hash = mrb_mdb_cache_hash(RSTRING_PTR(key_obj), (size_t)RSTRING_LEN(key_obj));
+  mrb_mdb_cache_entry *e = mrb_mdb_cache_find(c, RSTRING_PTR(key_obj), (size_t)RSTRING_LEN(key_obj), hash);
+  if (e) {
+    c->hits++;
+    if (e != c->head) {
+      mrb_mdb_cache_unlink(c, e);
+      mrb_mdb_cache_link_front(c, e);
+    }
+    return mrb_ary_ref(mrb, mrb_iv_get(mrb, self, MRB_IVSYM(cache_values)), e->slot);
+  }
+  c->misses++;
+
+  mrb_mdb_get_ctx g = { db, key_obj, FALSE, 0 };
+  mrb_value result = mrb_mdb_env_read(mrb, env, mrb_mdb_database_get_body, &g);
+  mrb_mdb_deep_freeze(mrb, result);
+  if (g.snapshot == c->txnid)
+    mrb_mdb_cache_insert(mrb, self, c, key_obj, hash, result);
+  return result;
+}
+
+/* ========================================================================
+ * MDB::Database — all instance methods
+ *
+ * The Database object caches the Env's native state, the dbi and the DB
+ * flags in a mrb_mdb_database struct, plus a @env ivar holding the MDB::Env
+ * Ruby object to prevent GC collection of the env while the database is
+ * still live.
+ * ======================================================================== */
+
+static mrb_value
+mrb_mdb_database_load_dict_body(mrb_state *mrb, mrb_mdb_read *rd)
+{
+  mrb_mdb_dict_refresh(mrb, rd->txn, (mrb_mdb_database *)rd->ud);
+  return mrb_nil_value();
+}
+
+/* Pick up the current trained dictionary for new writes (no-op if none). */
+static void
+mrb_mdb_database_load_dict(mrb_state *mrb, mrb_mdb_database *db)
+{
+  mrb_mdb_env_read(mrb, db->env, mrb_mdb_database_load_dict_body, db);
+}
+
+/* Set db->bloom from whether a filter exists (Database#initialize). */
+static void
+mrb_mdb_database_load_bloom(mrb_state *mrb, mrb_mdb_database *db)
+{
+  MDB_txn *txn = mrb_mdb_env_read_begin(mrb, db->env);
+  MDB_dbi main_dbi;
+  mrb_mdb_bloom_hdr hdr;
+  db->bloom = mdb_dbi_open(txn, NULL, 0, &main_dbi) == MDB_SUCCESS &&
+              mrb_mdb_bloom_hdr_get(txn, main_dbi, db, &hdr) == MDB_SUCCESS;
+  mrb_mdb_env_read_end(db->env, txn);
+}
+
+/*
+ * codec: and compress: of a named database are recorded in the main DB
+ * under "\0mrb-lmdb-opts\0<name>" as (codec id, compress id), so opening it
+ * without the options decodes what was written with them.
+ */
+#define MRB_MDB_OPTS_PREFIX     "\0mrb-lmdb-opts\0"
+#define MRB_MDB_OPTS_PREFIX_LEN (sizeof(MRB_MDB_OPTS_PREFIX) - 1)
+
+/* Record codec and compress for name in txn; both defaults remove the record. */
+static int
+mrb_mdb_db_opts_put(MDB_txn *txn, const char *name, int codec, int compress)
+{
+  char kbuf[MRB_MDB_DICT_KEY_MAX];
+  MDB_val key = { mrb_mdb_meta_key(MRB_MDB_OPTS_PREFIX, MRB_MDB_OPTS_PREFIX_LEN, name, FALSE, 0, kbuf), kbuf };
+  MDB_dbi main_dbi;
+  if (key.mv_size == 0)
+    return MDB_SUCCESS;
+  int rc = mdb_dbi_open(txn, NULL, 0, &main_dbi);
+  if (rc != MDB_SUCCESS)
+    return rc;
+  if (codec == MRB_MDB_CODEC_RAW && compress == MRB_MDB_COMPRESS_NONE) {
+    rc = mdb_del(txn, main_dbi, &key, NULL);
+    return rc == MDB_NOTFOUND ? MDB_SUCCESS : rc;
+  }
+  uint8_t ids[2] = { (uint8_t)codec, (uint8_t)compress };
+  MDB_val data = { sizeof(ids), ids };
+  return mdb_put(txn, main_dbi, &key, &data, 0);
+}
+
+/* name's recorded codec and compress through txn; the defaults if there is no record. */
+static int
+mrb_mdb_db_opts_get(MDB_txn *txn, const char *name, int *codec, int *compress)
+{
+  char kbuf[MRB_MDB_DICT_KEY_MAX];
+  MDB_val key = { mrb_mdb_meta_key(MRB_MDB_OPTS_PREFIX, MRB_MDB_OPTS_PREFIX_LEN, name, FALSE, 0, kbuf), kbuf };
+  MDB_val data;
+  MDB_dbi main_dbi;
+  *codec = MRB_MDB_CODEC_RAW;
+  *compress = MRB_MDB_COMPRESS_NONE;
+  if (key.mv_size == 0)
+    return MDB_SUCCESS;
+  int rc = mdb_dbi_open(txn, NULL, 0, &main_dbi);
+  if (rc == MDB_SUCCESS)
+    rc = mdb_get(txn, main_dbi, &key, &data);
+  if (rc == MDB_NOTFOUND)
+    return MDB_SUCCESS;
+  if (rc != MDB_SUCCESS)
+    return rc;
+  const uint8_t *p = (const uint8_t *)data.mv_data;
+  if (data.mv_size != 2 || p[0] > MRB_MDB_CODEC_NATIVE || p[1] > MRB_MDB_COMPRESS_LZ4)
+    return MDB_INCOMPATIBLE;
+  *codec = p[0];
+  *compress = p[1];
+  return MDB_SUCCESS;
+}
+
+/*
+ * Resolve codec and compress (-1 when the option was not given) against
+ * name's record in txn. A missing option takes the recorded setting; a
+ * given :native / :lz4 is recorded; a given :raw / nil applies to this
+ * handle only, so a raw view of the stored bytes does not change what
+ * later opens see. Never raises.
+ */
+static int
+mrb_mdb_db_opts_resolve(MDB_txn *txn, const char *name, int *codec, int *compress)
+{
+  int rec_codec, rec_compress;
+  int rc = mrb_mdb_db_opts_get(txn, name, &rec_codec, &rec_compress);
+  if (rc != MDB_SUCCESS)
+    return rc;
+
+  int new_codec = rec_codec, new_compress = rec_compress;
+  if (*codec < 0)
+    *codec = rec_codec;
+  else if (*codec != MRB_MDB_CODEC_RAW)
+    new_codec = *codec;
+  if (*compress < 0)
+    *compress = rec_compress;
+  else if (*compress != MRB_MDB_COMPRESS_NONE)
+    new_compress = *compress;
+  if (new_codec == rec_codec && new_compress == rec_compress)
+    return MDB_SUCCESS;
+  return mrb_mdb_db_opts_put(txn, name, new_codec, new_compress);
+}
+
+/* Database#initialize(env[, flags[, name]], compare:, dupsort_compare:, codec:, compress:, cache:) */
+static mrb_value
+mrb_mdb_database_init(mrb_state *mrb, mrb_value self)
+{
+  mrb_value env_v, opts = mrb_nil_value();
+  mrb_int flags = 0;
+  const char *name = NULL;
+  mrb_get_args(mrb, "o|iz!H", &env_v, &flags, &name, &opts);
+  mrb_mdb_open_opts o;
+  mrb_mdb_open_opts_parse(mrb, opts, TRUE, &o);
+  int codec = mrb_undef_p(o.codec) ? -1 : mrb_mdb_codec_id(mrb, o.codec);
+  int compress = mrb_undef_p(o.compress) ? -1 : mrb_mdb_compress_id(mrb, o.compress);
+  size_t cache_limit = mrb_mdb_cache_limit(mrb, o.cache);
+
+  mrb_mdb_env *env = mrb_mdb_env_state_get(mrb, env_v);
+  unsigned int open_flags = mrb_mdb_flags(mrb, flags);
+  if (mrb_data_check_get_ptr(mrb, self, &mdb_database_type))
+    mrb_raise(mrb, E_RUNTIME_ERROR, "MDB::Database already initialized");
+
+  MDB_txn *txn = mrb_mdb_env_write_begin(mrb, env);
+
+  MDB_dbi dbi;
+  unsigned int db_flags;
+  int rc = mdb_dbi_open(txn, name, open_flags, &dbi);
+  if (likely(rc == MDB_SUCCESS))
+    rc = mrb_mdb_dbi_set_compare(mrb, txn, dbi, name, o.key_cmp, o.dup_cmp);
+  if (likely(rc == MDB_SUCCESS))
+    rc = mdb_dbi_flags(txn, dbi, &db_flags);
+  /* DUPSORT databases never take the options, so a record is never read. */
+  if (likely(rc == MDB_SUCCESS) && name && !(db_flags & MDB_DUPSORT))
+    rc = mrb_mdb_db_opts_resolve(txn, name, &codec, &compress);
+  if (likely(rc == MDB_SUCCESS))
+    rc = mrb_mdb_bloom_seal(txn, FALSE);
+  if (unlikely(rc != MDB_SUCCESS)) {
+    mdb_txn_abort(txn);
+    mrb_mdb_raise(mrb, rc, "mdb_dbi_open");
+  }
+  if (codec < 0)
+    codec = MRB_MDB_CODEC_RAW;
+  if (compress < 0)
+    compress = MRB_MDB_COMPRESS_NONE;
+
+  /* mdb_txn_commit frees txn regardless of return value. */
+  rc = mdb_txn_commit(txn);
+  if (unlikely(rc != MDB_SUCCESS))
+    mrb_mdb_raise(mrb, rc, "mdb_txn_commit");
+  if (codec != MRB_MDB_CODEC_RAW && (db_flags & MDB_DUPSORT))
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "codec: is not supported on DUPSORT databases");
+  if (compress != MRB_MDB_COMPRESS_NONE && (db_flags & MDB_DUPSORT))
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "compress: is not supported on DUPSORT databases");
+
+  mrb_mdb_database *db = (mrb_mdb_database *)mrb_calloc(mrb, 1, sizeof(mrb_mdb_database));
+  db->env   = env;
+  db->dbi   = dbi;
+  db->flags = db_flags;
+  db->indexed = FALSE;
+  db->codec = (uint8_t)codec;
+  db->compress = (uint8_t)compress;
+  mrb_data_init(self, db, &mdb_database_type);
+  mrb_iv_set(mrb, self, MRB_IVSYM(env), env_v);
+  if (name) {
+    size_t len = strlen(name);
+    db->name = (char *)mrb_malloc(mrb, len + 1);
+    memcpy(db->name, name, len + 1);
+  }
+  if (compress != MRB_MDB_COMPRESS_NONE)
+    mrb_mdb_database_load_dict(mrb, db);
+  if (cache_limit > 0)
+    mrb_mdb_database_set_cache(mrb, self, db, cache_limit);
+  mrb_mdb_database_load_bloom(mrb, db);
+
+  return self;
+}
+
+/* Database#dbi -> Integer */
+static mrb_value
+mrb_mdb_database_dbi_m(mrb_state *mrb, mrb_value self)
+{
+  return mrb_convert_uint(mrb, mrb_mdb_database_dbi(mrb, self));
+}
+
+/* Database#codec -> :raw or :native */
+static mrb_value
+mrb_mdb_database_codec_m(mrb_state *mrb, mrb_value self)
+{
+  return mrb_symbol_value(mrb_mdb_database_get(mrb, self)->codec == MRB_MDB_CODEC_NATIVE
+    ? MRB_SYM(native) : MRB_SYM(raw));
+}
+
+/*
+ * Record a codec (compress < 0) or compress (codec < 0) set on a named
+ * database in its own write txn, keeping the other recorded setting.
+ */
+static void
+mrb_mdb_database_store_opts(mrb_state *mrb, mrb_value self, mrb_mdb_database *db, int codec, int compress)
+{
+  if (!db->name)
+    return;
+  MDB_txn *txn = mrb_mdb_env_write_begin(mrb, mrb_mdb_database_env_state(mrb, self));
+  int rec_codec, rec_compress;
+  int rc = mrb_mdb_db_opts_get(txn, db->name, &rec_codec, &rec_compress);
+  if (rc == MDB_SUCCESS && (codec < 0 ? rec_compress != compress : rec_codec != codec))
+    rc = mrb_mdb_db_opts_put(txn, db->name, codec < 0 ? rec_codec : codec,
+                             compress < 0 ? rec_compress : compress);
+  if (rc == MDB_SUCCESS)
+    rc = mrb_mdb_bloom_seal(txn, FALSE);
+  if (rc == MDB_SUCCESS)
+    rc = mdb_txn_commit(txn);
+  else
+    mdb_txn_abort(txn);
+  if (unlikely(rc != MDB_SUCCESS))
+    mrb_mdb_raise(mrb, rc, "mdb_put");
+}
+
+/* Database#codec = :raw / :native (recorded for later opens) */
+static mrb_value
+mrb_mdb_database_set_codec_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_value v;
+  mrb_get_args(mrb, "o", &v);
+  mrb_mdb_database *db = mrb_mdb_database_get(mrb, self);
+  int codec = mrb_mdb_codec_id(mrb, v);
+  if (codec != MRB_MDB_CODEC_RAW && (db->flags & MDB_DUPSORT))
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "codec: is not supported on DUPSORT databases");
+  mrb_mdb_database_store_opts(mrb, self, db, codec, -1);
+  db->codec = (uint8_t)codec;
+  if (db->cache)
+    mrb_mdb_cache_flush(mrb, self, db->cache);
+  return v;
+}
+
+/* Database#compress -> :lz4 or nil */
+static mrb_value
+mrb_mdb_database_compress_m(mrb_state *mrb, mrb_value self)
+{
+  return mrb_mdb_database_get(mrb, self)->compress == MRB_MDB_COMPRESS_LZ4
+    ? mrb_symbol_value(MRB_SYM(lz4)) : mrb_nil_value();
+}
+
+/* Database#compress = :lz4 / nil (recorded for later opens; existing values are left as they are) */
+static mrb_value
+mrb_mdb_database_set_compress_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_value v;
+  mrb_get_args(mrb, "o", &v);
+  mrb_mdb_database *db = mrb_mdb_database_get(mrb, self);
+  int compress = mrb_mdb_compress_id(mrb, v);
+  if (compress != MRB_MDB_COMPRESS_NONE && (db->flags & MDB_DUPSORT))
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "compress: is not supported on DUPSORT databases");
+  mrb_mdb_database_store_opts(mrb, self, db, -1, compress);
+  db->compress = (uint8_t)compress;
+  if (compress != MRB_MDB_COMPRESS_NONE)
+    mrb_mdb_database_load_dict(mrb, db);
+  return v;
+}
+
+/* Database#cache -> byte limit, or nil when the read cache is off */
+static mrb_value
+mrb_mdb_database_cache_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_mdb_database *db = mrb_mdb_database_get(mrb, self);
+  return db->cache ? mrb_convert_size_t(mrb, db->cache->limit) : mrb_nil_value();
+}
+
+/* Database#cache = bytes / nil (shrinking evicts least recently used first) */
+static mrb_value
+mrb_mdb_database_set_cache_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_value v;
+  mrb_get_args(mrb, "o", &v);
+  mrb_mdb_database_set_cache(mrb, self, mrb_mdb_database_get(mrb, self), mrb_mdb_cache_limit(mrb, v));
+  return v;
+}
+
+/* Database#cache_stats -> { hits:, misses:, entries:, bytes:, limit: } or nil */
+static mrb_value
+mrb_mdb_database_cache_stats_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_mdb_cache *c = mrb_mdb_database_get(mrb, self)->cache;
+  if (!c)
+    return mrb_nil_value();
+  mrb_value h = mrb_hash_new_capa(mrb, 5);
+  mrb_hash_set(mrb, h, mrb_symbol_value(MRB_SYM(hits)),    mrb_convert_uint64(mrb, c->hits));
+  mrb_hash_set(mrb, h, mrb_symbol_value(MRB_SYM(misses)),  mrb_convert_uint64(mrb, c->misses));
+  mrb_hash_set(mrb, h, mrb_symbol_value(MRB_SYM(entries)), mrb_convert_size_t(mrb, c->count));
+  mrb_hash_set(mrb, h, mrb_symbol_value(MRB_SYM(bytes)),   mrb_convert_size_t(mrb, c->bytes));
+  mrb_hash_set(mrb, h, mrb_symbol_value(MRB_SYM(limit)),   mrb_convert_size_t(mrb, c->limit));
+  return h;
+}
+
+/* Database#cache_clear -> self (drops entries, keeps the counters) */
+static mrb_value
+mrb_mdb_database_cache_clear_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_mdb_database *db = mrb_mdb_database_get(mrb, self);
+  if (db->cache)
+    mrb_mdb_cache_flush(mrb, self, db->cache);
+  return self;
+}
+
+/* Delete segments [from, to) of db's filter. */
+static int
+mrb_mdb_bloom_del_segs(MDB_txn *txn, MDB_dbi main_dbi, const mrb_mdb_database *db,
+                       uint32_t from, uint32_t to)
+{
+  char kbuf[MRB_MDB_DICT_KEY_MAX];
+  for (uint32_t i = from; i < to; i++) {
+    MDB_val key = { mrb_mdb_meta_key(MRB_MDB_BLOOM_PREFIX, MRB_MDB_BLOOM_PREFIX_LEN, db->name, TRUE, i, kbuf), kbuf };
+    int rc = mdb_del(txn, main_dbi, &key, NULL);
+    if (rc != MDB_SUCCESS && rc != MDB_NOTFOUND)
+      return rc;
+  }
+  return MDB_SUCCESS;
+}
+
+/*
+ * Build a filter over every key of db into a fresh nsegs-segment bit array
+ * and replace the stored one with it, all in txn.
+ */
+static int
+mrb_mdb_bloom_build(mrb_state *mrb, MDB_txn *txn, const mrb_mdb_database *db,
+                    mrb_mdb_bloom_hdr *hdr, const char **func)
+{
+  MDB_dbi main_dbi;
+  mrb_mdb_bloom_hdr old;
+  *func = "mdb_dbi_open";
+  int rc = mdb_dbi_open(txn, NULL, 0, &main_dbi);
+  if (rc != MDB_SUCCESS)
+    return rc;
+  mrb_bool had_old = mrb_mdb_bloom_hdr_get(txn, main_dbi, db, &old) == MDB_SUCCESS;
+
+  *func = "malloc";
+  size_t size = (size_t)hdr->nsegs * MRB_MDB_BLOOM_SEG;
+  uint8_t *bits = (uint8_t *)mrb_malloc_simple(mrb, size);
+  if (!bits)
+    return ENOMEM;
+  memset(bits, 0, size);
+
+  MDB_cursor *cursor;
+  *func = "mdb_cursor_open";
+  rc = mdb_cursor_open(txn, db->dbi, &cursor);
+  if (rc == MDB_SUCCESS) {
+    MDB_val key, data;
+    *func = "mdb_cursor_get";
+    for (rc = mdb_cursor_get(cursor, &key, &data, MDB_FIRST); rc == MDB_SUCCESS;
+         rc = mdb_cursor_get(cursor, &key, &data, MDB_NEXT_NODUP)) {
+      mrb_mdb_bloom_pos pos = mrb_mdb_bloom_locate(hdr, &key);
+      if (!mrb_mdb_bloom_bits(hdr, &pos, bits + (size_t)pos.seg * MRB_MDB_BLOOM_SEG, TRUE))
+        hdr->keys++;
+    }
+    mdb_cursor_close(cursor);
+    if (rc == MDB_NOTFOUND)
+      rc = MDB_SUCCESS;
+  }
+
+  char kbuf[MRB_MDB_DICT_KEY_MAX];
+  *func = "mdb_put";
+  for (uint32_t i = 0; i < hdr->nsegs && rc == MDB_SUCCESS; i++) {
+    MDB_val key = { mrb_mdb_meta_key(MRB_MDB_BLOOM_PREFIX, MRB_MDB_BLOOM_PREFIX_LEN, db->name, TRUE, i, kbuf), kbuf };
+    MDB_val data = { MRB_MDB_BLOOM_SEG, bits + (size_t)i * MRB_MDB_BLOOM_SEG };
+    rc = mdb_put(txn, main_dbi, &key, &data, 0);
+  }
+  mrb_free(mrb, bits);
+  if (rc == MDB_SUCCESS && had_old && old.nsegs > hdr->nsegs) {
+    *func = "mdb_del";
+    rc = mrb_mdb_bloom_del_segs(txn, main_dbi, db, hdr->nsegs, old.nsegs);
+  }
+  if (rc == MDB_SUCCESS) {
+    MDB_val key = { mrb_mdb_meta_key(MRB_MDB_BLOOM_PREFIX, MRB_MDB_BLOOM_PREFIX_LEN, db->name, FALSE, 0, kbuf), kbuf };
+    MDB_val data = { sizeof(*hdr), hdr };
+    *func = "mdb_put";
+    rc = mdb_put(txn, main_dbi, &key, &data, 0);
+  }
+  return rc;
+}
+
+/*
+ * Database#rebuild_bloom(bits_per_key = 10, expected_keys = nil) -> Integer
+ *
+ * (Re)build the Bloom filter from the keys now in the database, sized for
+ * expected_keys or the current entry count, whichever is larger. Returns
+ * the number of distinct keys added. Clears the lookup counters.
+ */
+static mrb_value
+mrb_mdb_database_rebuild_bloom_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_int bits_per_key = 10;
+  mrb_value expected_obj = mrb_nil_value();
+  mrb_get_args(mrb, "|io", &bits_per_key, &expected_obj);
+  if (bits_per_key < 1 || bits_per_key > 64)
+    mrb_raise(mrb, E_RANGE_ERROR, "bits_per_key must be between 1 and 64");
+  mrb_int expected = mrb_nil_p(expected_obj) ? 0 : mrb_as_int(mrb, expected_obj);
+  if (expected < 0)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "expected_keys must not be negative");
+
+  mrb_mdb_database *db = mrb_mdb_database_get(mrb, self);
+  char kbuf[MRB_MDB_DICT_KEY_MAX];
+  if (!db->name)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "rebuild_bloom needs a named database");
+  if (db->flags & MDB_DUPSORT)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "rebuild_bloom is not supported on DUPSORT databases");
+  if (mrb_mdb_meta_key(MRB_MDB_BLOOM_PREFIX, MRB_MDB_BLOOM_PREFIX_LEN, db->name, TRUE, 0, kbuf) == 0)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "database name too long for a Bloom filter key");
+
+  MDB_txn *txn = mrb_mdb_env_write_begin(mrb, mrb_mdb_database_env_state(mrb, self));
+  MDB_stat st;
+  int rc = mdb_stat(txn, db->dbi, &st);
+  if (unlikely(rc != MDB_SUCCESS)) {
+    mdb_txn_abort(txn);
+    mrb_mdb_raise(mrb, rc, "mdb_stat");
+  }
+
+  uint64_t n = st.ms_entries > (size_t)expected ? st.ms_entries : (uint64_t)expected;
+  uint64_t nsegs = (n * (uint64_t)bits_per_key + MRB_MDB_BLOOM_SEG * 8 - 1) / (MRB_MDB_BLOOM_SEG * 8);
+  mrb_mdb_bloom_hdr hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.magic        = MRB_MDB_BLOOM_MAGIC;
+  hdr.nsegs        = nsegs == 0 ? 1 : nsegs > UINT32_MAX ? UINT32_MAX : (uint32_t)nsegs;
+  hdr.bits_per_key = (uint32_t)bits_per_key;
+  hdr.txnid        = mdb_txn_id(txn);
+  hdr.hashes       = (uint32_t)((bits_per_key * 693 + 500) / 1000);  /* k = ln 2 * m / n */
+  if (hdr.hashes < 1)
+    hdr.hashes = 1;
+  if (hdr.hashes > MRB_MDB_BLOOM_MAX_HASHES)
+    hdr.hashes = MRB_MDB_BLOOM_MAX_HASHES;
+
+  const char *func;
+  rc = mrb_mdb_bloom_build(mrb, txn, db, &hdr, &func);
+  if (rc == MDB_SUCCESS)
+    rc = mrb_mdb_bloom_seal(txn, TRUE);
+  if (unlikely(rc != MDB_SUCCESS)) {
+    mdb_txn_abort(txn);
+    mrb_mdb_raise(mrb, rc, func);
+  }
+  rc = mdb_txn_commit(txn);
+  if (unlikely(rc != MDB_SUCCESS))
+    mrb_mdb_raise(mrb, rc, "mdb_txn_commit");
+
+  db->bloom = TRUE;
+  db->bloom_negatives = db->bloom_false = 0;
+  return mrb_convert_uint64(mrb, hdr.keys);
+}
+
+/* Database#drop_bloom -> true if there was a filter to remove */
+static mrb_value
+mrb_mdb_database_drop_bloom_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_mdb_database *db = mrb_mdb_database_get(mrb, self);
+  MDB_txn *txn = mrb_mdb_env_write_begin(mrb, mrb_mdb_database_env_state(mrb, self));
+  MDB_dbi main_dbi;
+  mrb_mdb_bloom_hdr hdr;
+  int rc = mdb_dbi_open(txn, NULL, 0, &main_dbi);
+  mrb_bool found = rc == MDB_SUCCESS && mrb_mdb_bloom_hdr_get(txn, main_dbi, db, &hdr) == MDB_SUCCESS;
+  if (found) {
+    char kbuf[MRB_MDB_DICT_KEY_MAX];
+    MDB_val key = { mrb_mdb_meta_key(MRB_MDB_BLOOM_PREFIX, MRB_MDB_BLOOM_PREFIX_LEN, db->name, FALSE, 0, kbuf), kbuf };
+    rc = mdb_del(txn, main_dbi, &key, NULL);
+    if (rc == MDB_SUCCESS)
+      rc = mrb_mdb_bloom_del_segs(txn, main_dbi, db, 0, hdr.nsegs);
+  }
+  if (rc == MDB_SUCCESS)
+    rc = mrb_mdb_bloom_seal(txn, FALSE);
+  if (unlikely(rc != MDB_SUCCESS)) {
+    mdb_txn_abort(txn);
+    mrb_mdb_raise(mrb, rc, "mdb_del");
+  }
+  rc = mdb_txn_commit(txn);
+  if (unlikely(rc != MDB_SUCCESS))
+    mrb_mdb_raise(mrb, rc, "mdb_txn_commit");
+  db->bloom = FALSE;
+  return mrb_bool_value(found);
+}
+
+/*
+ * Database#bloom_stats -> Hash or nil
+ *
+ * The filter's shape (bits:, hashes:, bits_per_key:), keys: and deletes:
+ * since the last rebuild, fill: (fraction of bits set) and the
+ * false-positive rate it implies (estimated_fp:), whether a write went
+ * around it so lookups no longer use it (stale:), plus this handle's
+ * lookups the filter answered (negatives:) and let through for keys that
+ * turned out absent (false_positives:), with their ratio as observed_fp:.
+ */
+static mrb_value
+mrb_mdb_database_bloom_stats_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_mdb_database *db = mrb_mdb_database_get(mrb, self);
+  mrb_mdb_env *env = mrb_mdb_database_env_state(mrb, self);
+  MDB_txn *txn = mrb_mdb_env_read_begin(mrb, env);
+  MDB_dbi main_dbi;
+  mrb_mdb_bloom_hdr hdr;
+  db->bloom = mdb_dbi_open(txn, NULL, 0, &main_dbi) == MDB_SUCCESS &&
+              mrb_mdb_bloom_hdr_get(txn, main_dbi, db, &hdr) == MDB_SUCCESS;
+  if (!db->bloom) {
+    mrb_mdb_env_read_end(env, txn);
+    return mrb_nil_value();
+  }
+
+  mrb_bool stale = !mrb_mdb_bloom_current(txn, main_dbi, &hdr, mdb_txn_id(txn));
+  uint64_t set = 0;
+  for (uint32_t i = 0; i < hdr.nsegs; i++) {
+    const uint8_t *seg = mrb_mdb_bloom_seg_get(txn, main_dbi, db, i);
+    for (size_t j = 0; seg && j < MRB_MDB_BLOOM_SEG; j++) {
+      for (uint8_t b = seg[j]; b; b &= (uint8_t)(b - 1))
+        set++;
+    }
+  }
+  mrb_mdb_env_read_end(env, txn);
+
+  uint64_t bits = (uint64_t)hdr.nsegs * MRB_MDB_BLOOM_SEG * 8;
+  double fill = (double)set / (double)bits, fp = 1.0;
+  for (uint32_t i = 0; i < hdr.hashes; i++)
+    fp *= fill;
+  uint64_t absent = db->bloom_negatives + db->bloom_false;
+
+  mrb_value h = mrb_hash_new_capa(mrb, 11);
+  mrb_hash_set(mrb, h, mrb_symbol_value(MRB_SYM(bits)),            mrb_convert_uint64(mrb, bits));
+  mrb_hash_set(mrb, h, mrb_symbol_value(MRB_SYM(hashes)),          mrb_convert_uint32(mrb, hdr.hashes));
+  mrb_hash_set(mrb, h, mrb_symbol_value(MRB_SYM(bits_per_key)),    mrb_convert_uint32(mrb, hdr.bits_per_key));
+  mrb_hash_set(mrb, h, mrb_symbol_value(MRB_SYM(keys)),            mrb_convert_uint64(mrb, hdr.keys));
+  mrb_hash_set(mrb, h, mrb_symbol_value(MRB_SYM(deletes)),         mrb_convert_uint64(mrb, hdr.deletes));
+  mrb_hash_set(mrb, h, mrb_symbol_value(MRB_SYM(fill)),            mrb_float_value(mrb, (mrb_float)fill));
+  mrb_hash_set(mrb, h, mrb_symbol_value(MRB_SYM(estimated_fp)),    mrb_float_value(mrb, (mrb_float)fp));
+  mrb_hash_set(mrb, h, mrb_symbol_value(MRB_SYM(stale)),           mrb_bool_value(stale));
+  mrb_hash_set(mrb, h, mrb_symbol_value(MRB_SYM(negatives)),       mrb_convert_uint64(mrb, db->bloom_negatives));
+  mrb_hash_set(mrb, h, mrb_symbol_value(MRB_SYM(false_positives)), mrb_convert_uint64(mrb, db->bloom_false));
+  mrb_hash_set(mrb, h, mrb_symbol_value(MRB_SYM(observed_fp)),
+               absent ? mrb_float_value(mrb, (mrb_float)db->bloom_false / (mrb_float)absent) : mrb_nil_value());
+  return h;
+}
+
+/*
+ * Up to sample_size values spread evenly over db, as stored before
+ * compression (codec-encoded bytes for codec: :native), back to back in
+ * samples with their lengths as uint32_t in lens.
+ */
+typedef struct {
+  mrb_mdb_database *db;
+  mrb_int           sample_size;
+  mrb_value         samples;
+  mrb_value         lens;
+} mrb_mdb_dict_sample_ctx;
+
+static mrb_value
+mrb_mdb_dict_sample_body(mrb_state *mrb, mrb_mdb_read *rd)
+{
+  mrb_mdb_dict_sample_ctx *c = (mrb_mdb_dict_sample_ctx *)rd->ud;
+  mrb_mdb_database *db = c->db;
+  mrb_int sample_size = c->sample_size;
+  mrb_value samples = c->samples, lens = c->lens;
+  MDB_txn *txn = rd->txn;
+  MDB_stat st;
+  int rc = mdb_stat(txn, db->dbi, &st);
+  if (unlikely(rc != MDB_SUCCESS))
+    mrb_mdb_raise(mrb, rc, "mdb_stat");
+  MDB_cursor *cursor = mrb_mdb_read_cursor(mrb, rd, db->dbi);
+
+  size_t stride = st.ms_entries > (size_t)sample_size ? st.ms_entries / (size_t)sample_size : 1;
+  size_t i = 0, taken = 0;
+  int ai = mrb_gc_arena_save(mrb);
+  MDB_val key, data;
+  for (rc = mdb_cursor_get(cursor, &key, &data, MDB_FIRST);
+       rc == MDB_SUCCESS && taken < (size_t)sample_size && RSTRING_LEN(samples) < (64 << 20);
+       rc = mdb_cursor_get(cursor, &key, &data, MDB_NEXT), i++) {
+    if (i % stride != 0)
+      continue;
+    MDB_val raw;
+    mrb_value holder;
+    mrb_mdb_unpack(mrb, txn, db, &data, &raw, &holder);
+    if (raw.mv_size >= MRB_MDB_DICT_GRAM && raw.mv_size <= MRB_MDB_LZ4_MAX_DICT) {
+      uint32_t len = (uint32_t)raw.mv_size;
+      mrb_str_cat(mrb, samples, (const char *)raw.mv_data, raw.mv_size);
+      mrb_str_cat(mrb, lens, (const char *)&len, sizeof(len));
+      taken++;
+    }
+    mrb_gc_arena_restore(mrb, ai);
+  }
+  if (unlikely(rc != MDB_SUCCESS && rc != MDB_NOTFOUND))
+    mrb_mdb_raise(mrb, rc, "mdb_cursor_get");
+  return mrb_nil_value();
+}
+
+static void
+mrb_mdb_dict_sample(mrb_state *mrb, mrb_mdb_database *db, mrb_int sample_size,
+                    mrb_value samples, mrb_value lens)
+{
+  mrb_mdb_dict_sample_ctx c = { db, sample_size, samples, lens };
+  mrb_mdb_env_read(mrb, db->env, mrb_mdb_dict_sample_body, &c);
+}
+
+/*
+ * Database#train_dictionary(sample_size = 1000, dict_size = 16384) -> version
+ *
+ * Trains a dictionary from sampled values and stores it as the next
+ * version; later writes compress against it. Existing values are not
+ * rewritten.
+ */
+static mrb_value
+mrb_mdb_database_train_dictionary_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_int sample_size = 1000, dict_size = MRB_MDB_DICT_DEFAULT;
+  mrb_get_args(mrb, "|ii", &sample_size, &dict_size);
+  if (sample_size <= 0)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "sample_size must be positive");
+  if (dict_size < MRB_MDB_DICT_SEG || dict_size > MRB_MDB_LZ4_MAX_DICT)
+    mrb_raisef(mrb, E_RANGE_ERROR, "dict_size must be between %d and %d",
+               MRB_MDB_DICT_SEG, MRB_MDB_LZ4_MAX_DICT);
+
+  mrb_mdb_database *db = mrb_mdb_database_get(mrb, self);
+  char kbuf[MRB_MDB_DICT_KEY_MAX], vbuf[MRB_MDB_DICT_KEY_MAX];
+  if (!db->name)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "train_dictionary needs a named database");
+  if (mrb_mdb_dict_key(db, FALSE, 0, kbuf) == 0)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "database name too long for a dictionary key");
+
+  mrb_value samples = mrb_str_new(mrb, NULL, 0), lens = mrb_str_new(mrb, NULL, 0);
+  mrb_mdb_dict_sample(mrb, db, sample_size, samples, lens);
+  mrb_value dict = mrb_mdb_dict_train(mrb, (const uint8_t *)RSTRING_PTR(samples),
+                                      (const uint32_t *)RSTRING_PTR(lens),
+                                      (size_t)RSTRING_LEN(lens) / sizeof(uint32_t), (size_t)dict_size);
+  if (mrb_nil_p(dict))
+    mrb_raise(mrb, E_RUNTIME_ERROR, "not enough repeated data to train a dictionary");
+
+  MDB_txn *txn = mrb_mdb_env_write_begin(mrb, db->env);
+  MDB_dbi main_dbi;
+  int rc = mdb_dbi_open(txn, NULL, 0, &main_dbi);
+  uint32_t version = mrb_mdb_dict_current_version(txn, db) + 1;
+  uint8_t cur[4] = { (uint8_t)(version >> 24), (uint8_t)(version >> 16),
+                     (uint8_t)(version >> 8), (uint8_t)version };
+  MDB_val dkey = { mrb_mdb_dict_key(db, FALSE, version, kbuf), kbuf };
+  MDB_val dval = { (size_t)RSTRING_LEN(dict), RSTRING_PTR(dict) };
+  MDB_val ckey = { mrb_mdb_dict_key(db, TRUE, 0, vbuf), vbuf };
+  MDB_val cval = { sizeof(cur), cur };
+  if (likely(rc == MDB_SUCCESS))
+    rc = mdb_put(txn, main_dbi, &dkey, &dval, 0);
+  if (likely(rc == MDB_SUCCESS))
+    rc = mdb_put(txn, main_dbi, &ckey, &cval, 0);
+  if (likely(rc == MDB_SUCCESS))
+    rc = mrb_mdb_bloom_seal(txn, FALSE);
+  if (unlikely(rc != MDB_SUCCESS)) {
+    mdb_txn_abort(txn);
+    mrb_mdb_raise(mrb, rc, "mdb_put");
+  }
+  rc = mdb_txn_commit(txn);
+  if (unlikely(rc != MDB_SUCCESS))
+    mrb_mdb_raise(mrb, rc, "mdb_txn_commit");
+
+  mrb_mdb_database_load_dict(mrb, db);
+  return mrb_int_value(mrb, (mrb_int)version);
+}
+
+/* Database#dictionary_version -> Integer or nil (dictionary new writes use) */
+static mrb_value
+mrb_mdb_database_dictionary_version_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_mdb_database *db = mrb_mdb_database_get(mrb, self);
+  return db->dict ? mrb_int_value(mrb, (mrb_int)db->dict->version) : mrb_nil_value();
+}
+
+/* Database#[] */
+static mrb_value
+mrb_mdb_database_aref_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_value key_obj;
+  mrb_get_args(mrb, "o", &key_obj);
+
+  key_obj = mrb_str_to_str(mrb, key_obj);
+
+  mrb_mdb_database *db = mrb_mdb_database_get(mrb, self);
+  if (db->cache)
+    return mrb_mdb_database_cached_get(mrb, self, db, key_obj);
+
+  mrb_mdb_get_ctx g = { db, key_obj, FALSE, 0 };
+  return mrb_mdb_env_read(mrb, mrb_mdb_database_env_state(mrb, self), mrb_mdb_database_get_body, &g);
+}
+
+/* Database#[]= */
+static mrb_value
+mrb_mdb_database_aset_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_value key_obj, data_obj;
+  mrb_get_args(mrb, "oo", &key_obj, &data_obj);
+
+  mrb_mdb_database *db = mrb_mdb_database_get(mrb, self);
+  key_obj  = mrb_str_to_str(mrb, key_obj);
+  data_obj = mrb_mdb_db_coerce(mrb, db, data_obj);
+
+  if (db->indexed) {
+    mrb_value pairs = mrb_ary_new_capa(mrb, 1);
+    mrb_ary_push(mrb, pairs, mrb_mdb_indexed_pair(mrb, key_obj, data_obj));
+    mrb_mdb_indexed_write(mrb, self, pairs, 0);
+    return data_obj;
+  }
+
+  mrb_value stored = mrb_mdb_db_pack(mrb, db, data_obj);
+  MDB_txn *txn = mrb_mdb_env_write_begin(mrb, mrb_mdb_database_env_state(mrb, self));
+  int rc;
+
+  MDB_val key  = { (size_t)RSTRING_LEN(key_obj),  RSTRING_PTR(key_obj) };
+  rc = mrb_mdb_db_put(mrb, txn, db, &key, stored, 0);
+  if (likely(rc == MDB_SUCCESS))
+    rc = mrb_mdb_bloom_note(txn, db, &key, FALSE);
+  if (unlikely(rc != MDB_SUCCESS)) {
+    mdb_txn_abort(txn);
+    mrb_mdb_raise(mrb, rc, "mdb_put");
+  }
+  rc = mdb_txn_commit(txn);
+  if (unlikely(rc != MDB_SUCCESS))
+    mrb_mdb_raise(mrb, rc, "mdb_txn_commit");
+  return data_obj;
+}
+
+/* Database#reserve(key, size, flags = 0) { |buf| ... } -> block result */
+static mrb_value
+mrb_mdb_database_reserve_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_value key_obj, blk, result;
+  mrb_int size, flags = 0;
+  mrb_get_args(mrb, "oi|i&!", &key_obj, &size, &flags, &blk);
+  if (mrb_nil_p(blk))
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "no block given");
+
+  key_obj = mrb_str_to_str(mrb, key_obj);
+  size_t len = mrb_mdb_reserve_size(mrb, size);
+  unsigned int put_flags = mrb_mdb_flags(mrb, flags);
+  mrb_mdb_reserve_check(mrb, mrb_mdb_database_get(mrb, self)->flags);
+  mrb_mdb_plain_check(mrb, mrb_mdb_database_get(mrb, self), "reserve");
+
+  MDB_txn *txn = mrb_mdb_env_write_begin(mrb, mrb_mdb_database_env_state(mrb, self));
+  mrb_bool exc = FALSE;
+  int rc = mrb_mdb_reserve_yield(mrb, txn, mrb_mdb_database_dbi(mrb, self), key_obj,
+    len, put_flags, blk, &result, &exc);
+  if (likely(rc == MDB_SUCCESS) && !exc) {
+    MDB_val key = { (size_t)RSTRING_LEN(key_obj), RSTRING_PTR(key_obj) };
+    rc = mrb_mdb_bloom_note(txn, mrb_mdb_database_get(mrb, self), &key, FALSE);
+  }
+  if (unlikely(rc != MDB_SUCCESS)) {
+    mdb_txn_abort(txn);
+    mrb_mdb_raise(mrb, rc, "mdb_put");
+  }
+  if (exc) {
+    mdb_txn_abort(txn);
+    mrb_exc_raise(mrb, result);
+  }
+
+  rc = mdb_txn_commit(txn);
+  if (unlikely(rc != MDB_SUCCESS))
+    mrb_mdb_raise(mrb, rc, "mdb_txn_commit");
+  return result;
+}
+
+/* Database#del(key[, data]) */
+static mrb_value
+mrb_mdb_database_del_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_value key_obj, data_obj = mrb_nil_value();
+  mrb_get_args(mrb, "o|o", &key_obj, &data_obj);
+
+  key_obj = mrb_str_to_str(mrb, key_obj);
+
+  /* Indexed primaries are never DUPSORT, so data does not matter. */
+  if (mrb_mdb_database_get(mrb, self)->indexed) {
+    mrb_value pairs = mrb_ary_new_capa(mrb, 1);
+    mrb_ary_push(mrb, pairs, mrb_mdb_indexed_pair(mrb, key_obj, mrb_undef_value()));
+    mrb_mdb_indexed_write(mrb, self, pairs, 0);
+    return self;
+  }
+
+  MDB_txn *txn = mrb_mdb_env_write_begin(mrb, mrb_mdb_database_env_state(mrb, self));
+  int rc;
+
+  MDB_val key = { (size_t)RSTRING_LEN(key_obj), RSTRING_PTR(key_obj) };
   MDB_val dv, *dvp = NULL;
   if (!mrb_nil_p(data_obj)) {
     data_obj = mrb_str_to_str(mrb, data_obj);
@@ -869,359 +4471,1178 @@ mrb_mdb_database_del_m(mrb_state *mrb, mrb_value self)
     dvp = &dv;
   }
   rc = mdb_del(txn, mrb_mdb_database_dbi(mrb, self), &key, dvp);
+  if (rc == MDB_SUCCESS)
+    rc = mrb_mdb_bloom_note(txn, mrb_mdb_database_get(mrb, self), &key, TRUE);
   if (unlikely(rc != MDB_SUCCESS && rc != MDB_NOTFOUND)) {
     mdb_txn_abort(txn);
-    mrb_mdb_raise(mrb, rc, "mdb_del");
+    mrb_mdb_raise(mrb, rc, "mdb_del");
+  }
+  int commit_rc = mdb_txn_commit(txn);
+  if (unlikely(commit_rc != MDB_SUCCESS))
+    mrb_mdb_raise(mrb, commit_rc, "mdb_txn_commit");
+  return self;
+}
+
+/* Database#fetch(key[, default]) { |k| ... } */
+static mrb_value
+mrb_mdb_database_fetch_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_value key_obj, default_val = mrb_undef_value(), blk = mrb_nil_value();
+  mrb_get_args(mrb, "o|o&", &key_obj, &default_val, &blk);
+
+  key_obj = mrb_str_to_str(mrb, key_obj);
+
+  mrb_mdb_env *env = mrb_mdb_database_env_state(mrb, self);
+  mrb_mdb_get_ctx g = { mrb_mdb_database_get(mrb, self), key_obj, FALSE, 0 };
+  mrb_value found_val = mrb_mdb_env_read(mrb, env, mrb_mdb_database_get_body, &g);
+
+  if (g.found)
+    return found_val;
+  if (!mrb_nil_p(blk))
+    return mrb_yield(mrb, blk, key_obj);
+  if (!mrb_undef_p(default_val))
+    return default_val;
+  mrb_raise(mrb, E_KEY_ERROR, "key not found");
+}
+
+/* Look key up in its own read txn; *size gets the value's length when found. */
+static int
+mrb_mdb_database_probe(mrb_state *mrb, mrb_value self, mrb_value key_obj, size_t *size)
+{
+  mrb_mdb_database *db = mrb_mdb_database_get(mrb, self);
+  mrb_mdb_env *env = mrb_mdb_database_env_state(mrb, self);
+  MDB_txn *txn = mrb_mdb_env_read_begin(mrb, env);
+  MDB_val key  = { (size_t)RSTRING_LEN(key_obj), RSTRING_PTR(key_obj) };
+  MDB_val data;
+  int rc = mrb_mdb_db_get(txn, db, &key, &data);
+  if (rc == MDB_SUCCESS)
+    *size = mrb_mdb_db_value_size(db, &data);
+  mrb_mdb_env_read_end(env, txn);
+  if (rc != MDB_SUCCESS && rc != MDB_NOTFOUND)
+    mrb_mdb_raise(mrb, rc, "mdb_get");
+  return rc;
+}
+
+/* Database#key?(key) / #has_key? -> true / false (the value is not copied) */
+static mrb_value
+mrb_mdb_database_key_p_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_value key_obj;
+  mrb_get_args(mrb, "o", &key_obj);
+  size_t size;
+  return mrb_bool_value(mrb_mdb_database_probe(mrb, self, mrb_str_to_str(mrb, key_obj), &size) == MDB_SUCCESS);
+}
+
+/*
+ * Database#bytesize(key) -> Integer or nil
+ *
+ * Length of the value's bytes (before compression; the encoded form for
+ * codec: :native), without reading it into a String.
+ */
+static mrb_value
+mrb_mdb_database_bytesize_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_value key_obj;
+  mrb_get_args(mrb, "o", &key_obj);
+  size_t size;
+  if (mrb_mdb_database_probe(mrb, self, mrb_str_to_str(mrb, key_obj), &size) == MDB_SUCCESS)
+    return mrb_convert_size_t(mrb, size);
+  return mrb_nil_value();
+}
+
+typedef struct {
+  mrb_mdb_database *db;
+  mrb_value         key;
+  mrb_int           offset;
+  mrb_int           length;
+  mrb_bool          filter;
+} mrb_mdb_read_at_ctx;
+
+static mrb_value
+mrb_mdb_database_read_at_body(mrb_state *mrb, mrb_mdb_read *rd)
+{
+  mrb_mdb_read_at_ctx *c = (mrb_mdb_read_at_ctx *)rd->ud;
+  MDB_val key  = { (size_t)RSTRING_LEN(c->key), RSTRING_PTR(c->key) };
+  MDB_val data;
+  int rc = c->filter ? mrb_mdb_db_get(rd->txn, c->db, &key, &data)
+                      : mdb_get(rd->txn, c->db->dbi, &key, &data);
+  if (rc == MDB_NOTFOUND)
+    return mrb_nil_value();
+  if (rc != MDB_SUCCESS)
+    mrb_mdb_raise(mrb, rc, "mdb_get");
+
+  MDB_val raw = data;
+  mrb_value holder;
+  if (c->db->compress != MRB_MDB_COMPRESS_NONE) {
+    uint64_t end = (uint64_t)c->offset + (uint64_t)c->length;
+    mrb_mdb_unpack_prefix(mrb, rd->txn, c->db, &data, end > SIZE_MAX ? SIZE_MAX : (size_t)end, &raw, &holder);
+  }
+  return mrb_mdb_val_slice(mrb, &raw, c->offset, c->length);
+}
+
+/*
+ * Database#read_at(key, offset, length, txn = nil) -> String or nil
+ *
+ * Up to length bytes of the value from offset, copied straight out of the
+ * map. A compressed value is decompressed only as far as the slice ends;
+ * for codec: :native the slice is of the encoded bytes. With txn (an open
+ * MDB::Txn on this env, say from #transaction) the read joins that txn, so
+ * several slices see one snapshot; the Bloom filter is only consulted in a
+ * read-only one.
+ */
+static mrb_value
+mrb_mdb_database_read_at_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_value key_obj, txn_v = mrb_nil_value();
+  mrb_int offset, length;
+  mrb_get_args(mrb, "oii|o", &key_obj, &offset, &length, &txn_v);
+  mrb_mdb_slice_check(mrb, offset, length);
+  key_obj = mrb_str_to_str(mrb, key_obj);
+
+  mrb_mdb_env *e = mrb_mdb_database_env_state(mrb, self);
+  mrb_mdb_read_at_ctx c = { mrb_mdb_database_get(mrb, self), key_obj, offset, length, TRUE };
+  if (mrb_nil_p(txn_v))
+    return mrb_mdb_env_read(mrb, e, mrb_mdb_database_read_at_body, &c);
+
+  mrb_mdb_txn *t = mrb_mdb_txn_state_get(mrb, txn_v);
+  if (unlikely(mdb_txn_env(t->txn) != e->env))
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "MDB::Txn belongs to another MDB::Env");
+  c.filter = (t->flags & MDB_RDONLY) != 0;
+  mrb_mdb_read rd = { t->txn, NULL, &c, mrb_mdb_database_read_at_body };
+  return mrb_mdb_database_read_at_body(mrb, &rd);
+}
+
+/* A batch of String keys for Database#keys? and #multi_get. */
+typedef struct {
+  mrb_mdb_database *db;
+  mrb_value         keys;
+} mrb_mdb_keys_ctx;
+
+static mrb_value
+mrb_mdb_database_keys_p_body(mrb_state *mrb, mrb_mdb_read *rd)
+{
+  mrb_mdb_keys_ctx *c = (mrb_mdb_keys_ctx *)rd->ud;
+  mrb_int len = RARRAY_LEN(c->keys);
+  mrb_value result = mrb_ary_new_capa(mrb, len);
+
+  for (mrb_int i = 0; i < len; i++) {
+    mrb_value key_obj = RARRAY_PTR(c->keys)[i];
+    MDB_val key  = { (size_t)RSTRING_LEN(key_obj), RSTRING_PTR(key_obj) };
+    MDB_val data;
+    int rc = mrb_mdb_db_get(rd->txn, c->db, &key, &data);
+    if (rc != MDB_SUCCESS && rc != MDB_NOTFOUND)
+      mrb_mdb_raise(mrb, rc, "mdb_get");
+    mrb_ary_push(mrb, result, mrb_bool_value(rc == MDB_SUCCESS));
+  }
+  return result;
+}
+
+/* Database#keys?(keys) -> [true / false, ...] in one read txn */
+static mrb_value
+mrb_mdb_database_keys_p_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_value keys_ary;
+  mrb_get_args(mrb, "A", &keys_ary);
+
+  mrb_mdb_keys_ctx c = { mrb_mdb_database_get(mrb, self), mrb_mdb_ary_to_str(mrb, keys_ary) };
+  return mrb_mdb_env_read(mrb, mrb_mdb_database_env_state(mrb, self), mrb_mdb_database_keys_p_body, &c);
+}
+
+/* Database#stat -> MDB::Stat */
+static mrb_value
+mrb_mdb_database_stat_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_mdb_env *env = mrb_mdb_database_env_state(mrb, self);
+  MDB_txn *txn = mrb_mdb_env_read_begin(mrb, env);
+  int rc;
+  MDB_stat stat;
+  rc = mdb_stat(txn, mrb_mdb_database_dbi(mrb, self), &stat);
+  mrb_mdb_env_read_end(env, txn);
+  if (likely(rc == MDB_SUCCESS))
+    return mrb_mdb_stat_to_value(mrb, &stat);
+  mrb_mdb_raise(mrb, rc, "mdb_stat");
+}
+
+/* Shared helper: open a RDONLY txn, read ms_entries, abort */
+static size_t
+mrb_mdb_database_entries(mrb_state *mrb, mrb_value self)
+{
+  mrb_mdb_env *env = mrb_mdb_database_env_state(mrb, self);
+  MDB_txn *txn = mrb_mdb_env_read_begin(mrb, env);
+  int rc;
+  MDB_stat stat;
+  rc = mdb_stat(txn, mrb_mdb_database_dbi(mrb, self), &stat);
+  mrb_mdb_env_read_end(env, txn);
+  if (likely(rc == MDB_SUCCESS))
+    return stat.ms_entries;
+  mrb_mdb_raise(mrb, rc, "mdb_stat");
+}
+
+/* Database#length / #size */
+static mrb_value
+mrb_mdb_database_length_m(mrb_state *mrb, mrb_value self)
+{
+  return mrb_convert_size_t(mrb, mrb_mdb_database_entries(mrb, self));
+}
+
+/* Database#empty? */
+static mrb_value
+mrb_mdb_database_empty_p_m(mrb_state *mrb, mrb_value self)
+{
+  return mrb_bool_value(mrb_mdb_database_entries(mrb, self) == 0);
+}
+
+/* Database#flags */
+static mrb_value
+mrb_mdb_database_flags_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_mdb_database_env_state(mrb, self);
+  return mrb_convert_uint(mrb, mrb_mdb_database_get(mrb, self)->flags);
+}
+
+/* Database#drop(delete=false) */
+static mrb_value
+mrb_mdb_database_drop_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_bool del = FALSE;
+  mrb_get_args(mrb, "|b", &del);
+
+  mrb_mdb_database *db = mrb_mdb_database_get(mrb, self);
+  MDB_txn *txn = mrb_mdb_env_write_begin(mrb, mrb_mdb_database_env_state(mrb, self));
+  mrb_mdb_bloom_txn bloom;
+  if (!del)
+    mrb_mdb_bloom_begin(txn, db, &bloom);
+  int rc;
+  rc = mdb_drop(txn, db->dbi, (int)del);
+  if (rc == MDB_SUCCESS && !del)
+    rc = mrb_mdb_bloom_end(txn, db, &bloom);
+  if (rc == MDB_SUCCESS && del)
+    rc = mrb_mdb_dbi_forget_compare(txn, db->dbi, db->name);
+  if (rc == MDB_SUCCESS && del && db->name)
+    rc = mrb_mdb_db_opts_put(txn, db->name, MRB_MDB_CODEC_RAW, MRB_MDB_COMPRESS_NONE);
+  if (rc == MDB_SUCCESS && del && db->name)
+    rc = mrb_mdb_meta_del(txn, MRB_MDB_DICT_PREFIX, MRB_MDB_DICT_PREFIX_LEN, db->name);
+  if (rc == MDB_SUCCESS && del && db->name)
+    rc = mrb_mdb_meta_del(txn, MRB_MDB_BLOOM_PREFIX, MRB_MDB_BLOOM_PREFIX_LEN, db->name);
+  if (rc == MDB_SUCCESS && del)
+    rc = mrb_mdb_bloom_seal(txn, FALSE);
+  if (unlikely(rc != MDB_SUCCESS)) {
+    mdb_txn_abort(txn);
+    mrb_mdb_raise(mrb, rc, "mdb_drop");
   }
-  int commit_rc = mdb_txn_commit(txn);
-  if (unlikely(commit_rc != MDB_SUCCESS))
-    mrb_mdb_raise(mrb, commit_rc, "mdb_txn_commit");
+  rc = mdb_txn_commit(txn);
+  if (unlikely(rc != MDB_SUCCESS))
+    mrb_mdb_raise(mrb, rc, "mdb_txn_commit");
+  return self;
+}
+
+typedef struct {
+  mrb_mdb_database *db;
+  MDB_cursor_op     op;
+} mrb_mdb_edge_ctx;
+
+static mrb_value
+mrb_mdb_database_edge_body(mrb_state *mrb, mrb_mdb_read *rd)
+{
+  mrb_mdb_edge_ctx *c = (mrb_mdb_edge_ctx *)rd->ud;
+  MDB_cursor *cursor = mrb_mdb_read_cursor(mrb, rd, c->db->dbi);
+  MDB_val key, data;
+  int rc = mdb_cursor_get(cursor, &key, &data, c->op);
+  if (rc == MDB_SUCCESS)
+    return mrb_assoc_new(mrb, mrb_mdb_val_to_str(mrb, &key), mrb_mdb_db_value(mrb, rd->txn, c->db, &data));
+  if (rc != MDB_NOTFOUND)
+    mrb_mdb_raise(mrb, rc, "mdb_cursor_get");
+  return mrb_nil_value();
+}
+
+/* Shared: open RDONLY cursor, seek to MDB_FIRST or MDB_LAST, copy pair, close */
+static mrb_value
+mrb_mdb_database_edge_m(mrb_state *mrb, mrb_value self, MDB_cursor_op op)
+{
+  mrb_mdb_edge_ctx c = { mrb_mdb_database_get(mrb, self), op };
+  return mrb_mdb_env_read(mrb, mrb_mdb_database_env_state(mrb, self), mrb_mdb_database_edge_body, &c);
+}
+
+/* Database#first */
+static mrb_value
+mrb_mdb_database_first_m(mrb_state *mrb, mrb_value self)
+{
+  return mrb_mdb_database_edge_m(mrb, self, MDB_FIRST);
+}
+
+/* Database#last */
+static mrb_value
+mrb_mdb_database_last_m(mrb_state *mrb, mrb_value self)
+{
+  return mrb_mdb_database_edge_m(mrb, self, MDB_LAST);
+}
+
+/*
+ * Database#batch { |txn, dbi| ... }
+ */
+static mrb_value
+mrb_mdb_database_batch_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_value blk;
+  mrb_get_args(mrb, "&!", &blk);
+  if (mrb_nil_p(blk))
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "no block given");
+
+  mrb_value env_obj = mrb_iv_get(mrb, self, MRB_IVSYM(env));
+  mrb_value dbi_val = mrb_convert_uint(mrb, mrb_mdb_database_dbi(mrb, self));
+
+  struct RClass *txn_class = mrb_mdb_gem_state_get(mrb)->txn_class;
+  mrb_value argv[1] = { env_obj };
+  mrb_value txn_obj = mrb_obj_new(mrb, txn_class, 1, argv);
+  mrb_gc_protect(mrb, txn_obj);
+
+  mrb_lmdb_yield2_ctx ctx2 = { blk, txn_obj, dbi_val };
+  mrb_bool exc = FALSE;
+  mrb_value result = mrb_protect_error(mrb, mrb_lmdb_yield2_cb, &ctx2, &exc);
+
+  MDB_txn *txn = mrb_mdb_txn_detach(mrb, txn_obj);
+  if (txn) {
+    if (!exc) {
+      int rc = mdb_txn_commit(txn);
+      if (unlikely(rc != MDB_SUCCESS))
+        mrb_mdb_raise(mrb, rc, "mdb_txn_commit");
+    } else {
+      mdb_txn_abort(txn);
+    }
+  }
+  if (exc) mrb_exc_raise(mrb, result);
+  return self;
+}
+
+/* Database#transaction([flags]) { |txn, dbi| ... } */
+static mrb_value
+mrb_mdb_database_transaction_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_value blk;
+  mrb_int flags = 0;
+  mrb_get_args(mrb, "|i&!", &flags, &blk);
+  if (mrb_nil_p(blk))
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "no block given");
+
+  mrb_value env_obj = mrb_iv_get(mrb, self, MRB_IVSYM(env));
+  mrb_value dbi_val = mrb_convert_uint(mrb, mrb_mdb_database_dbi(mrb, self));
+
+  struct RClass *txn_class = mrb_mdb_gem_state_get(mrb)->txn_class;
+  mrb_value argv[2] = { env_obj, mrb_int_value(mrb, flags) };
+  mrb_value txn_obj = mrb_obj_new(mrb, txn_class, 2, argv);
+  mrb_gc_protect(mrb, txn_obj);
+
+  mrb_lmdb_yield2_ctx ctx2 = { blk, txn_obj, dbi_val };
+  mrb_bool exc = FALSE;
+  mrb_value result = mrb_protect_error(mrb, mrb_lmdb_yield2_cb, &ctx2, &exc);
+
+  MDB_txn *txn = mrb_mdb_txn_detach(mrb, txn_obj);
+  if (txn) {
+    if (!exc) {
+      int rc = mdb_txn_commit(txn);
+      if (unlikely(rc != MDB_SUCCESS))
+        mrb_mdb_raise(mrb, rc, "mdb_txn_commit");
+    } else {
+      mdb_txn_abort(txn);
+    }
+  }
+  if (exc) mrb_exc_raise(mrb, result);
+  return result;
+}
+
+/* Database#cursor([flags]) { |cursor| ... } */
+static mrb_value
+mrb_mdb_database_cursor_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_value blk;
+  mrb_int flags = 0;
+  mrb_get_args(mrb, "|i&!", &flags, &blk);
+  if (mrb_nil_p(blk))
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "no block given");
+
+  mrb_value env_obj = mrb_iv_get(mrb, self, MRB_IVSYM(env));
+  mrb_value dbi_val = mrb_convert_uint(mrb, mrb_mdb_database_dbi(mrb, self));
+
+  mrb_mdb_gem_state *st    = mrb_mdb_gem_state_get(mrb);
+  struct RClass *txn_class = st->txn_class;
+  struct RClass *cur_class = st->cursor_class;
+
+  mrb_value txn_argv[2] = { env_obj, mrb_int_value(mrb, flags) };
+  mrb_value txn_obj = mrb_obj_new(mrb, txn_class, 2, txn_argv);
+  mrb_gc_protect(mrb, txn_obj);
+
+  mrb_value cur_argv[2] = { txn_obj, dbi_val };
+  mrb_value cur_obj = mrb_obj_new(mrb, cur_class, 2, cur_argv);
+  mrb_gc_protect(mrb, cur_obj);
+
+  mrb_lmdb_yield1_ctx ctx1 = { blk, cur_obj };
+  mrb_bool exc = FALSE;
+  mrb_value result = mrb_protect_error(mrb, mrb_lmdb_yield1_cb, &ctx1, &exc);
+
+  MDB_cursor *cursor = (MDB_cursor *)mrb_data_check_get_ptr(mrb, cur_obj, &mdb_cursor_type);
+  if (cursor) {
+    mrb_data_init(cur_obj, NULL, NULL);
+    mdb_cursor_close(cursor);
+  }
+
+  MDB_txn *txn = mrb_mdb_txn_detach(mrb, txn_obj);
+  if (txn) {
+    if (!exc) {
+      int rc = mdb_txn_commit(txn);
+      if (unlikely(rc != MDB_SUCCESS))
+        mrb_mdb_raise(mrb, rc, "mdb_txn_commit");
+    } else {
+      mdb_txn_abort(txn);
+    }
+  }
+  if (exc) mrb_exc_raise(mrb, result);
+  return result;
+}
+
+typedef struct {
+  mrb_mdb_database *db;
+  mrb_value         blk;
+  mrb_value         key;
+} mrb_mdb_each_ctx;
+
+static mrb_value
+mrb_mdb_database_each_body(mrb_state *mrb, mrb_mdb_read *rd)
+{
+  mrb_mdb_each_ctx *c = (mrb_mdb_each_ctx *)rd->ud;
+  MDB_cursor *cursor = mrb_mdb_read_cursor(mrb, rd, c->db->dbi);
+  MDB_val key, data;
+  int ai = mrb_gc_arena_save(mrb);
+
+  int rc = mdb_cursor_get(cursor, &key, &data, MDB_FIRST);
+  while (rc == MDB_SUCCESS) {
+    mrb_yield(mrb, c->blk, mrb_assoc_new(mrb,
+      mrb_mdb_val_to_str(mrb, &key), mrb_mdb_db_value(mrb, rd->txn, c->db, &data)));
+    mrb_gc_arena_restore(mrb, ai);
+    rc = mdb_cursor_get(cursor, &key, &data, MDB_NEXT);
+  }
+  if (rc != MDB_NOTFOUND)
+    mrb_mdb_raise(mrb, rc, "mdb_cursor_get");
+  return mrb_nil_value();
+}
+
+/* Database#each { |k, v| ... } */
+static mrb_value
+mrb_mdb_database_each_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_value blk;
+  mrb_get_args(mrb, "&!", &blk);
+  if (mrb_nil_p(blk))
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "no block given");
+
+  mrb_mdb_each_ctx c = { mrb_mdb_database_get(mrb, self), blk, mrb_nil_value() };
+  mrb_mdb_env_read(mrb, mrb_mdb_database_env_state(mrb, self), mrb_mdb_database_each_body, &c);
+  return self;
+}
+
+/*
+ * Database#each_view { |k, view| ... }
+ *
+ * Like #each, but yields the value as an MDB::View into the map instead of
+ * a copied String. The views are valid until the scan returns.
+ */
+static mrb_value
+mrb_mdb_database_each_view_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_value blk;
+  mrb_get_args(mrb, "&!", &blk);
+  if (mrb_nil_p(blk))
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "no block given");
+
+  struct RClass *txn_class = mrb_mdb_gem_state_get(mrb)->txn_class;
+  mrb_value argv[2] = { mrb_iv_get(mrb, self, MRB_IVSYM(env)), mrb_int_value(mrb, MDB_RDONLY) };
+  mrb_value txn_obj = mrb_obj_new(mrb, txn_class, 2, argv);
+  mrb_gc_protect(mrb, txn_obj);
+  mrb_mdb_txn *t = mrb_mdb_txn_state_get(mrb, txn_obj);
+
+  MDB_cursor *cursor;
+  int rc = mdb_cursor_open(t->txn, mrb_mdb_database_dbi(mrb, self), &cursor);
+  if (unlikely(rc != MDB_SUCCESS)) {
+    mdb_txn_abort(mrb_mdb_txn_detach(mrb, txn_obj));
+    mrb_mdb_raise(mrb, rc, "mdb_cursor_open");
+  }
+
+  MDB_val key, data;
+  int ai = mrb_gc_arena_save(mrb);
+  mrb_value exc_val = mrb_nil_value();
+
+  rc = mdb_cursor_get(cursor, &key, &data, MDB_FIRST);
+  while (rc == MDB_SUCCESS) {
+    mrb_value pair = mrb_assoc_new(mrb,
+      mrb_mdb_val_to_str(mrb, &key), mrb_mdb_view_new(mrb, txn_obj, t, &data));
+    mrb_bool exc = FALSE;
+    mrb_lmdb_yield1_ctx ctx1 = { blk, pair };
+    mrb_value result = mrb_protect_error(mrb, mrb_lmdb_yield1_cb, &ctx1, &exc);
+    mrb_gc_arena_restore(mrb, ai);
+    if (exc) {
+      exc_val = result;
+      break;
+    }
+    rc = mdb_cursor_get(cursor, &key, &data, MDB_NEXT);
+  }
+
+  mdb_cursor_close(cursor);
+  mdb_txn_abort(mrb_mdb_txn_detach(mrb, txn_obj));
+
+  if (!mrb_nil_p(exc_val))
+    mrb_exc_raise(mrb, exc_val);
+  if (rc != MDB_NOTFOUND && rc != MDB_SUCCESS)
+    mrb_mdb_raise(mrb, rc, "mdb_cursor_get");
   return self;
 }
 
-/* Database#fetch(key[, default]) { |k| ... } */
 static mrb_value
-mrb_mdb_database_fetch_m(mrb_state *mrb, mrb_value self)
+mrb_mdb_database_each_key_body(mrb_state *mrb, mrb_mdb_read *rd)
+{
+  mrb_mdb_each_ctx *c = (mrb_mdb_each_ctx *)rd->ud;
+  MDB_cursor *cursor = mrb_mdb_read_cursor(mrb, rd, c->db->dbi);
+  MDB_val key  = { (size_t)RSTRING_LEN(c->key), RSTRING_PTR(c->key) };
+  MDB_val data;
+  int ai = mrb_gc_arena_save(mrb);
+
+  int rc = mdb_cursor_get(cursor, &key, &data, MDB_SET_KEY);
+  while (rc == MDB_SUCCESS) {
+    mrb_yield(mrb, c->blk, mrb_assoc_new(mrb,
+      mrb_mdb_val_to_str(mrb, &key), mrb_mdb_val_to_str(mrb, &data)));
+    mrb_gc_arena_restore(mrb, ai);
+    rc = mdb_cursor_get(cursor, &key, &data, MDB_NEXT_DUP);
+  }
+  if (rc != MDB_NOTFOUND)
+    mrb_mdb_raise(mrb, rc, "mdb_cursor_get");
+  return mrb_nil_value();
+}
+
+/* Database#each_key(key) { |k, v| ... } — DUPSORT databases */
+static mrb_value
+mrb_mdb_database_each_key_m(mrb_state *mrb, mrb_value self)
 {
-  mrb_value key_obj, default_val = mrb_undef_value(), blk = mrb_nil_value();
-  mrb_get_args(mrb, "o|o&", &key_obj, &default_val, &blk);
-
-  key_obj = mrb_str_to_str(mrb, key_obj);
+  mrb_value key_obj, blk;
+  mrb_get_args(mrb, "o&!", &key_obj, &blk);
+  if (mrb_nil_p(blk))
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "no block given");
 
-  MDB_txn *txn;
-  int rc = mdb_txn_begin(mrb_mdb_database_env(mrb, self), NULL, MDB_RDONLY, &txn);
-  if (unlikely(rc != MDB_SUCCESS))
-    mrb_mdb_raise(mrb, rc, "mdb_txn_begin");
+  mrb_mdb_each_ctx c = { mrb_mdb_database_get(mrb, self), blk, mrb_str_to_str(mrb, key_obj) };
+  mrb_mdb_env_read(mrb, mrb_mdb_database_env_state(mrb, self), mrb_mdb_database_each_key_body, &c);
+  return self;
+}
 
-  MDB_val key  = { (size_t)RSTRING_LEN(key_obj), RSTRING_PTR(key_obj) };
-  MDB_val data;
-  rc = mdb_get(txn, mrb_mdb_database_dbi(mrb, self), &key, &data);
-  mrb_value found_val = mrb_nil_value();
-  mrb_bool found = (rc == MDB_SUCCESS);
-  if (found)
-    found_val = mrb_mdb_val_to_str(mrb, &data);
-  mdb_txn_abort(txn);
+/*
+ * Cursor walk shared by the scan iterators.
+ *
+ * Forward: position with `first` (seek is the key for SET_KEY/SET_RANGE),
+ * then advance with `next`. Reverse with first == MDB_SET_RANGE: land on
+ * the last record <= seek (< seek if seek_excl), or on MDB_LAST if there
+ * is none past it. The walk ends at the first key outside `prefix`
+ * (memcmp), past `stop` (database comparator, in scan direction), or once
+ * `limit` records have been produced.
+ */
+/* What a scan hands to Ruby for each record. */
+typedef enum {
+  MRB_MDB_SCAN_PAIRS = 0,
+  MRB_MDB_SCAN_KEYS,
+  MRB_MDB_SCAN_VALUES,
+} mrb_mdb_scan_emit;
+
+typedef struct mrb_mdb_scan {
+  MDB_cursor_op first;
+  MDB_cursor_op next;
+  MDB_val       seek;
+  MDB_val       prefix;     /* mv_size == 0: unbounded */
+  MDB_val       stop;
+  mrb_bool      has_stop;
+  mrb_bool      stop_excl;
+  mrb_bool      seek_excl;
+  mrb_bool      reverse;
+  mrb_int       limit;      /* < 0: unlimited */
+  mrb_mdb_scan_emit emit;
+  mrb_bool      started;
+  MDB_txn      *txn;        /* filled in by the driver */
+  MDB_dbi       dbi;
+  mrb_bool      dupsort;
+  mrb_mdb_database *db;
+  mrb_value     blk;        /* driver arguments */
+  mrb_int       n;
+} mrb_mdb_scan;
+
+static int
+mrb_mdb_scan_position(MDB_cursor *cursor, mrb_mdb_scan *scan, MDB_val *key, MDB_val *data)
+{
+  *key = scan->seek;
+  int rc = mdb_cursor_get(cursor, key, data, scan->first);
+  if (!scan->reverse || scan->first != MDB_SET_RANGE)
+    return rc;
 
-  if (rc != MDB_SUCCESS && rc != MDB_NOTFOUND)
-    mrb_mdb_raise(mrb, rc, "mdb_get");
+  if (rc == MDB_NOTFOUND)
+    return mdb_cursor_get(cursor, key, data, MDB_LAST);
+  if (rc != MDB_SUCCESS)
+    return rc;
+  int c = mdb_cmp(scan->txn, scan->dbi, key, &scan->seek);
+  if (c > 0 || (c == 0 && scan->seek_excl))
+    return mdb_cursor_get(cursor, key, data, MDB_PREV);
+  if (scan->dupsort)
+    return mdb_cursor_get(cursor, key, data, MDB_LAST_DUP);
+  return rc;
+}
 
-  if (found)
-    return found_val;
-  if (!mrb_nil_p(blk))
-    return mrb_yield(mrb, blk, key_obj);
-  if (!mrb_undef_p(default_val))
-    return default_val;
-  mrb_raise(mrb, E_KEY_ERROR, "key not found");
+static int
+mrb_mdb_scan_step(MDB_cursor *cursor, mrb_mdb_scan *scan, MDB_val *key, MDB_val *data)
+{
+  int rc;
+  if (scan->limit == 0)
+    return MDB_NOTFOUND;
+  if (scan->started) {
+    rc = mdb_cursor_get(cursor, key, data, scan->next);
+  } else {
+    scan->started = TRUE;
+    rc = mrb_mdb_scan_position(cursor, scan, key, data);
+  }
+  if (rc != MDB_SUCCESS)
+    return rc;
+
+  if (scan->prefix.mv_size > 0 &&
+      (key->mv_size < scan->prefix.mv_size ||
+       memcmp(key->mv_data, scan->prefix.mv_data, scan->prefix.mv_size) != 0))
+    return MDB_NOTFOUND;
+  if (scan->has_stop) {
+    int c = mdb_cmp(scan->txn, scan->dbi, key, &scan->stop);
+    if (scan->reverse)
+      c = -c;
+    if (c > 0 || (c == 0 && scan->stop_excl))
+      return MDB_NOTFOUND;
+  }
+  if (scan->limit > 0)
+    scan->limit--;
+  return MDB_SUCCESS;
 }
 
-/* Database#stat -> MDB::Stat */
 static mrb_value
-mrb_mdb_database_stat_m(mrb_state *mrb, mrb_value self)
+mrb_mdb_scan_record(mrb_state *mrb, const mrb_mdb_scan *scan, const MDB_val *key, const MDB_val *data)
 {
-  MDB_txn *txn;
-  int rc = mdb_txn_begin(mrb_mdb_database_env(mrb, self), NULL, MDB_RDONLY, &txn);
-  if (unlikely(rc != MDB_SUCCESS))
-    mrb_mdb_raise(mrb, rc, "mdb_txn_begin");
-  MDB_stat stat;
-  rc = mdb_stat(txn, mrb_mdb_database_dbi(mrb, self), &stat);
-  mdb_txn_abort(txn);
-  if (likely(rc == MDB_SUCCESS))
-    return mrb_mdb_stat_to_value(mrb, &stat);
-  mrb_mdb_raise(mrb, rc, "mdb_stat");
+  switch (scan->emit) {
+    case MRB_MDB_SCAN_KEYS:   return mrb_mdb_val_to_str(mrb, key);
+    case MRB_MDB_SCAN_VALUES: return mrb_mdb_db_value(mrb, scan->txn, scan->db, data);
+    default:
+      return mrb_assoc_new(mrb, mrb_mdb_val_to_str(mrb, key), mrb_mdb_db_value(mrb, scan->txn, scan->db, data));
+  }
 }
 
-/* Shared helper: open a RDONLY txn, read ms_entries, abort */
-static size_t
-mrb_mdb_database_entries(mrb_state *mrb, mrb_value self)
+/*
+ * Range bound argument: nil means unbounded (returns FALSE). INTEGERKEY
+ * comparators read a full machine word, so reject anything shorter.
+ */
+static mrb_bool
+mrb_mdb_scan_bound(mrb_state *mrb, mrb_value self, mrb_value obj, MDB_val *out)
 {
-  MDB_txn *txn;
-  int rc = mdb_txn_begin(mrb_mdb_database_env(mrb, self), NULL, MDB_RDONLY, &txn);
-  if (unlikely(rc != MDB_SUCCESS))
-    mrb_mdb_raise(mrb, rc, "mdb_txn_begin");
-  MDB_stat stat;
-  rc = mdb_stat(txn, mrb_mdb_database_dbi(mrb, self), &stat);
-  mdb_txn_abort(txn);
-  if (likely(rc == MDB_SUCCESS))
-    return stat.ms_entries;
-  mrb_mdb_raise(mrb, rc, "mdb_stat");
+  if (mrb_nil_p(obj))
+    return FALSE;
+  obj = mrb_str_to_str(mrb, obj);
+  out->mv_size = (size_t)RSTRING_LEN(obj);
+  out->mv_data = RSTRING_PTR(obj);
+  if ((mrb_mdb_database_get(mrb, self)->flags & MDB_INTEGERKEY) &&
+      out->mv_size != sizeof(unsigned int) && out->mv_size != sizeof(size_t))
+    mrb_mdb_raise(mrb, MDB_BAD_VALSIZE, "range bound");
+  return TRUE;
 }
 
-/* Database#length / #size */
+/* Run body (an mrb_mdb_env_read body) for scan on self. */
 static mrb_value
-mrb_mdb_database_length_m(mrb_state *mrb, mrb_value self)
+mrb_mdb_scan_run(mrb_state *mrb, mrb_value self, mrb_mdb_scan *scan,
+                 mrb_value (*body)(mrb_state *, mrb_mdb_read *))
 {
-  return mrb_convert_size_t(mrb, mrb_mdb_database_entries(mrb, self));
+  mrb_mdb_database *db = mrb_mdb_database_get(mrb, self);
+  mrb_mdb_env *env = mrb_mdb_database_env_state(mrb, self);
+  scan->dbi     = db->dbi;
+  scan->db      = db;
+  scan->dupsort = (db->flags & MDB_DUPSORT) != 0;
+  if (scan->dupsort && scan->emit == MRB_MDB_SCAN_KEYS) {
+    if (scan->next == MDB_NEXT) scan->next = MDB_NEXT_NODUP;
+    if (scan->next == MDB_PREV) scan->next = MDB_PREV_NODUP;
+  }
+  return mrb_mdb_env_read(mrb, env, body, scan);
 }
 
-/* Database#empty? */
-static mrb_value
-mrb_mdb_database_empty_p_m(mrb_state *mrb, mrb_value self)
+/* The scan and its read cursor inside a mrb_mdb_scan_run body. */
+static MDB_cursor *
+mrb_mdb_scan_cursor(mrb_state *mrb, mrb_mdb_read *rd, mrb_mdb_scan **scanp)
 {
-  return mrb_bool_value(mrb_mdb_database_entries(mrb, self) == 0);
+  mrb_mdb_scan *scan = (mrb_mdb_scan *)rd->ud;
+  scan->txn = rd->txn;
+  *scanp = scan;
+  return mrb_mdb_read_cursor(mrb, rd, scan->dbi);
 }
 
-/* Database#flags */
-static mrb_value
-mrb_mdb_database_flags_m(mrb_state *mrb, mrb_value self)
+static void
+mrb_mdb_scan_check(mrb_state *mrb, int rc)
 {
-  MDB_txn *txn;
-  int rc = mdb_txn_begin(mrb_mdb_database_env(mrb, self), NULL, MDB_RDONLY, &txn);
-  if (unlikely(rc != MDB_SUCCESS))
-    mrb_mdb_raise(mrb, rc, "mdb_txn_begin");
-  unsigned int flags;
-  rc = mdb_dbi_flags(txn, mrb_mdb_database_dbi(mrb, self), &flags);
-  mdb_txn_abort(txn);
-  if (likely(rc == MDB_SUCCESS))
-    return mrb_convert_uint(mrb, flags);
-  mrb_mdb_raise(mrb, rc, "mdb_dbi_flags");
+  if (rc != MDB_NOTFOUND && rc != MDB_SUCCESS)
+    mrb_mdb_raise(mrb, rc, "mdb_cursor_get");
 }
 
-/* Database#drop(delete=false) */
 static mrb_value
-mrb_mdb_database_drop_m(mrb_state *mrb, mrb_value self)
+mrb_mdb_scan_each_body(mrb_state *mrb, mrb_mdb_read *rd)
 {
-  mrb_bool del = FALSE;
-  mrb_get_args(mrb, "|b", &del);
+  mrb_mdb_scan *scan;
+  MDB_cursor *cursor = mrb_mdb_scan_cursor(mrb, rd, &scan);
+  MDB_val key, data;
+  int ai = mrb_gc_arena_save(mrb);
 
-  MDB_txn *txn;
-  int rc = mdb_txn_begin(mrb_mdb_database_env(mrb, self), NULL, 0, &txn);
-  if (unlikely(rc != MDB_SUCCESS))
-    mrb_mdb_raise(mrb, rc, "mdb_txn_begin");
-  rc = mdb_drop(txn, mrb_mdb_database_dbi(mrb, self), (int)del);
-  if (unlikely(rc != MDB_SUCCESS)) {
-    mdb_txn_abort(txn);
-    mrb_mdb_raise(mrb, rc, "mdb_drop");
+  int rc = mrb_mdb_scan_step(cursor, scan, &key, &data);
+  while (rc == MDB_SUCCESS) {
+    mrb_yield(mrb, scan->blk, mrb_mdb_scan_record(mrb, scan, &key, &data));
+    mrb_gc_arena_restore(mrb, ai);
+    rc = mrb_mdb_scan_step(cursor, scan, &key, &data);
   }
-  rc = mdb_txn_commit(txn);
-  if (unlikely(rc != MDB_SUCCESS))
-    mrb_mdb_raise(mrb, rc, "mdb_txn_commit");
-  return self;
+  mrb_mdb_scan_check(mrb, rc);
+  return mrb_nil_value();
 }
 
-/* Shared: open RDONLY cursor, seek to MDB_FIRST or MDB_LAST, copy pair, close */
+/* Run scan over self, yielding one record (see emit) per block call. */
 static mrb_value
-mrb_mdb_database_edge_m(mrb_state *mrb, mrb_value self, MDB_cursor_op op)
+mrb_mdb_database_scan_each(mrb_state *mrb, mrb_value self, mrb_mdb_scan *scan, mrb_value blk)
 {
-  MDB_txn *txn;
-  int rc = mdb_txn_begin(mrb_mdb_database_env(mrb, self), NULL, MDB_RDONLY, &txn);
-  if (unlikely(rc != MDB_SUCCESS))
-    mrb_mdb_raise(mrb, rc, "mdb_txn_begin");
-
-  MDB_cursor *cursor;
-  rc = mdb_cursor_open(txn, mrb_mdb_database_dbi(mrb, self), &cursor);
-  if (unlikely(rc != MDB_SUCCESS)) {
-    mdb_txn_abort(txn);
-    mrb_mdb_raise(mrb, rc, "mdb_cursor_open");
-  }
+  scan->blk = blk;
+  mrb_mdb_scan_run(mrb, self, scan, mrb_mdb_scan_each_body);
+  return self;
+}
 
+static mrb_value
+mrb_mdb_scan_slices_body(mrb_state *mrb, mrb_mdb_read *rd)
+{
+  mrb_mdb_scan *scan;
+  MDB_cursor *cursor = mrb_mdb_scan_cursor(mrb, rd, &scan);
+  mrb_int n = scan->n;
   MDB_val key, data;
-  rc = mdb_cursor_get(cursor, &key, &data, op);
-  mrb_value result = mrb_nil_value();
-  if (rc == MDB_SUCCESS)
-    result = mrb_assoc_new(mrb, mrb_mdb_val_to_str(mrb, &key), mrb_mdb_val_to_str(mrb, &data));
-  mdb_cursor_close(cursor);
-  mdb_txn_abort(txn);
+  int ai = mrb_gc_arena_save(mrb);
 
-  if (rc == MDB_SUCCESS || rc == MDB_NOTFOUND)
-    return result;
-  mrb_mdb_raise(mrb, rc, "mdb_cursor_get");
+  int rc = mrb_mdb_scan_step(cursor, scan, &key, &data);
+  while (rc == MDB_SUCCESS) {
+    mrb_value slice = mrb_ary_new_capa(mrb, n < 256 ? n : 256);
+    int ai_slice = mrb_gc_arena_save(mrb);
+    mrb_int len = 0;
+    do {
+      mrb_ary_push(mrb, slice, mrb_mdb_scan_record(mrb, scan, &key, &data));
+      mrb_gc_arena_restore(mrb, ai_slice);
+      rc = mrb_mdb_scan_step(cursor, scan, &key, &data);
+    } while (rc == MDB_SUCCESS && ++len < n);
+
+    mrb_yield(mrb, scan->blk, slice);
+    mrb_gc_arena_restore(mrb, ai);
+  }
+  mrb_mdb_scan_check(mrb, rc);
+  return mrb_nil_value();
 }
 
-/* Database#first */
+/*
+ * Run scan over self, yielding Arrays of up to n [key, value] pairs: one
+ * block call per batch instead of one per record.
+ */
 static mrb_value
-mrb_mdb_database_first_m(mrb_state *mrb, mrb_value self)
+mrb_mdb_database_scan_slices(mrb_state *mrb, mrb_value self, mrb_mdb_scan *scan,
+                             mrb_int n, mrb_value blk)
 {
-  return mrb_mdb_database_edge_m(mrb, self, MDB_FIRST);
+  if (n <= 0)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid slice size");
+  scan->blk = blk;
+  scan->n   = n;
+  mrb_mdb_scan_run(mrb, self, scan, mrb_mdb_scan_slices_body);
+  return self;
 }
 
-/* Database#last */
 static mrb_value
-mrb_mdb_database_last_m(mrb_state *mrb, mrb_value self)
+mrb_mdb_scan_collect_body(mrb_state *mrb, mrb_mdb_read *rd)
 {
-  return mrb_mdb_database_edge_m(mrb, self, MDB_LAST);
+  mrb_mdb_scan *scan;
+  MDB_cursor *cursor = mrb_mdb_scan_cursor(mrb, rd, &scan);
+  MDB_val key, data;
+  mrb_value ary = mrb_ary_new(mrb);
+  int ai = mrb_gc_arena_save(mrb);
+
+  int rc = mrb_mdb_scan_step(cursor, scan, &key, &data);
+  while (rc == MDB_SUCCESS) {
+    mrb_ary_push(mrb, ary, mrb_mdb_scan_record(mrb, scan, &key, &data));
+    mrb_gc_arena_restore(mrb, ai);
+    rc = mrb_mdb_scan_step(cursor, scan, &key, &data);
+  }
+  mrb_mdb_scan_check(mrb, rc);
+  return ary;
 }
 
-/*
- * Database#batch { |txn, dbi| ... }
- */
+/* Run scan over self and return the records as an Array. */
 static mrb_value
-mrb_mdb_database_batch_m(mrb_state *mrb, mrb_value self)
+mrb_mdb_database_scan_collect(mrb_state *mrb, mrb_value self, mrb_mdb_scan *scan)
 {
-  mrb_value blk;
-  mrb_get_args(mrb, "&!", &blk);
-  if (mrb_nil_p(blk))
-    mrb_raise(mrb, E_ARGUMENT_ERROR, "no block given");
-
-  mrb_value env_obj = mrb_iv_get(mrb, self, MRB_IVSYM(env));
+  return mrb_mdb_scan_run(mrb, self, scan, mrb_mdb_scan_collect_body);
+}
 
-  struct RClass *txn_class = mrb_class_get_under_id(mrb,
-    mrb_module_get_id(mrb, MRB_SYM(MDB)), MRB_SYM(Txn));
-  mrb_value argv[1] = { env_obj };
-  mrb_value txn_obj = mrb_obj_new(mrb, txn_class, 1, argv);
-  mrb_gc_protect(mrb, txn_obj);
-  mrb_value dbi_val = mrb_iv_get(mrb, self, MRB_IVSYM(dbi));
+static mrb_value
+mrb_mdb_scan_count_body(mrb_state *mrb, mrb_mdb_read *rd)
+{
+  mrb_mdb_scan *scan;
+  MDB_cursor *cursor = mrb_mdb_scan_cursor(mrb, rd, &scan);
+  if (scan->dupsort && scan->next == MDB_NEXT)
+    scan->next = MDB_NEXT_NODUP;
 
-  mrb_lmdb_yield2_ctx ctx2 = { blk, txn_obj, dbi_val };
-  mrb_bool exc = FALSE;
-  mrb_value result = mrb_protect_error(mrb, mrb_lmdb_yield2_cb, &ctx2, &exc);
+  MDB_val key, data;
+  size_t total = 0;
 
-  MDB_txn *txn = (MDB_txn *)mrb_data_check_get_ptr(mrb, txn_obj, &mdb_txn_type);
-  if (txn) {
-    mrb_data_init(txn_obj, NULL, NULL);
-    if (!exc) {
-      int rc = mdb_txn_commit(txn);
+  int rc = mrb_mdb_scan_step(cursor, scan, &key, &data);
+  while (rc == MDB_SUCCESS) {
+    if (scan->dupsort) {
+      size_t dups;
+      rc = mdb_cursor_count(cursor, &dups);
       if (unlikely(rc != MDB_SUCCESS))
-        mrb_mdb_raise(mrb, rc, "mdb_txn_commit");
+        break;
+      total += dups;
     } else {
-      mdb_txn_abort(txn);
+      total++;
     }
+    rc = mrb_mdb_scan_step(cursor, scan, &key, &data);
   }
-  if (exc) mrb_exc_raise(mrb, result);
-  return self;
+  mrb_mdb_scan_check(mrb, rc);
+  return mrb_convert_size_t(mrb, total);
 }
 
-/* Database#transaction([flags]) { |txn, dbi| ... } */
+/*
+ * Count the records scan visits without materializing them. DUPSORT
+ * databases are walked one key at a time, adding mdb_cursor_count for
+ * each duplicate set.
+ */
 static mrb_value
-mrb_mdb_database_transaction_m(mrb_state *mrb, mrb_value self)
+mrb_mdb_database_scan_count(mrb_state *mrb, mrb_value self, mrb_mdb_scan *scan)
 {
-  mrb_value blk;
-  mrb_int flags = 0;
-  mrb_get_args(mrb, "|i&!", &flags, &blk);
-  if (mrb_nil_p(blk))
-    mrb_raise(mrb, E_ARGUMENT_ERROR, "no block given");
-
-  mrb_value env_obj = mrb_iv_get(mrb, self, MRB_IVSYM(env));
-
-  struct RClass *txn_class = mrb_class_get_under_id(mrb,
-    mrb_module_get_id(mrb, MRB_SYM(MDB)), MRB_SYM(Txn));
-  mrb_value argv[2] = { env_obj, mrb_int_value(mrb, flags) };
-  mrb_value txn_obj = mrb_obj_new(mrb, txn_class, 2, argv);
-  mrb_gc_protect(mrb, txn_obj);
-  mrb_value dbi_val = mrb_iv_get(mrb, self, MRB_IVSYM(dbi));
+  return mrb_mdb_scan_run(mrb, self, scan, mrb_mdb_scan_count_body);
+}
 
-  mrb_lmdb_yield2_ctx ctx2 = { blk, txn_obj, dbi_val };
-  mrb_bool exc = FALSE;
-  mrb_value result = mrb_protect_error(mrb, mrb_lmdb_yield2_cb, &ctx2, &exc);
+/*
+ * Scan options: reverse: and limit: everywhere; exclusive_end: for range
+ * scans (SCAN_OPT_RANGE); prefix:, from: and to: where the method selects
+ * the records itself (SCAN_OPT_SELECT).
+ */
+#define MRB_MDB_SCAN_OPT_RANGE  1
+#define MRB_MDB_SCAN_OPT_SELECT 2
+
+typedef struct mrb_mdb_scan_opts {
+  mrb_bool  exclusive_end;
+  mrb_bool  reverse;
+  mrb_int   limit;
+  mrb_value prefix;
+  mrb_value from;
+  mrb_value to;
+} mrb_mdb_scan_opts;
+
+static void
+mrb_mdb_scan_opts_parse(mrb_state *mrb, mrb_value opts, int allow, mrb_mdb_scan_opts *out)
+{
+  out->exclusive_end = FALSE;
+  out->reverse       = FALSE;
+  out->limit         = -1;
+  out->prefix        = mrb_nil_value();
+  out->from          = mrb_nil_value();
+  out->to            = mrb_nil_value();
+  if (mrb_nil_p(opts))
+    return;
 
-  MDB_txn *txn = (MDB_txn *)mrb_data_check_get_ptr(mrb, txn_obj, &mdb_txn_type);
-  if (txn) {
-    mrb_data_init(txn_obj, NULL, NULL);
-    if (!exc) {
-      int rc = mdb_txn_commit(txn);
-      if (unlikely(rc != MDB_SUCCESS))
-        mrb_mdb_raise(mrb, rc, "mdb_txn_commit");
+  mrb_value keys = mrb_hash_keys(mrb, opts);
+  mrb_int n = RARRAY_LEN(keys);
+  for (mrb_int i = 0; i < n; i++) {
+    mrb_value k = mrb_ary_entry(keys, i);
+    mrb_value v = mrb_hash_get(mrb, opts, k);
+
+    if (!mrb_symbol_p(k))
+      mrb_raisef(mrb, E_ARGUMENT_ERROR, "unknown option %v", k);
+
+    mrb_sym sym = mrb_symbol(k);
+    if ((allow & (MRB_MDB_SCAN_OPT_RANGE|MRB_MDB_SCAN_OPT_SELECT)) && sym == MRB_SYM(exclusive_end)) {
+      out->exclusive_end = mrb_test(v);
+    } else if ((allow & MRB_MDB_SCAN_OPT_SELECT) && sym == MRB_SYM(prefix)) {
+      out->prefix = v;
+    } else if ((allow & MRB_MDB_SCAN_OPT_SELECT) && sym == MRB_SYM(from)) {
+      out->from = v;
+    } else if ((allow & MRB_MDB_SCAN_OPT_SELECT) && sym == MRB_SYM(to)) {
+      out->to = v;
+    } else if (sym == MRB_SYM(reverse)) {
+      out->reverse = mrb_test(v);
+    } else if (sym == MRB_SYM(limit)) {
+      if (mrb_nil_p(v))
+        continue;
+      out->limit = mrb_integer(mrb_to_int(mrb, v));
+      if (out->limit < 0)
+        mrb_raise(mrb, E_RANGE_ERROR, "limit must be non-negative");
     } else {
-      mdb_txn_abort(txn);
+      mrb_raisef(mrb, E_ARGUMENT_ERROR, "unknown option %v", k);
     }
   }
-  if (exc) mrb_exc_raise(mrb, result);
-  return result;
 }
 
-/* Database#cursor([flags]) { |cursor| ... } */
+/*
+ * Set up scan for from..to (either may be nil) in the requested direction.
+ * from is always inclusive; to is exclusive with exclusive_end: true.
+ */
+static void
+mrb_mdb_scan_range(mrb_state *mrb, mrb_value self, mrb_value from, mrb_value to,
+                   const mrb_mdb_scan_opts *opts, mrb_mdb_scan *scan)
+{
+  MDB_val lo, hi;
+  mrb_bool has_lo = mrb_mdb_scan_bound(mrb, self, from, &lo);
+  mrb_bool has_hi = mrb_mdb_scan_bound(mrb, self, to, &hi);
+
+  scan->reverse = opts->reverse;
+  scan->limit   = opts->limit;
+  if (!opts->reverse) {
+    scan->first = (has_lo && lo.mv_size > 0) ? MDB_SET_RANGE : MDB_FIRST;
+    scan->next  = MDB_NEXT;
+    scan->seek  = lo;
+    if (has_hi) {
+      scan->stop      = hi;
+      scan->has_stop  = TRUE;
+      scan->stop_excl = opts->exclusive_end;
+    }
+  } else {
+    scan->first = has_hi ? MDB_SET_RANGE : MDB_LAST;
+    scan->next  = MDB_PREV;
+    if (has_hi) {
+      /* keys are never empty, so nothing sorts at or below "" */
+      if (hi.mv_size == 0)
+        scan->limit = 0;
+      scan->seek      = hi;
+      scan->seek_excl = opts->exclusive_end;
+    }
+    if (has_lo) {
+      scan->stop     = lo;
+      scan->has_stop = TRUE;
+    }
+  }
+}
+
+/*
+ * Set up scan for keys starting with prefix. Reverse scans seek the
+ * smallest key past the prefix range (prefix with its last non-0xFF byte
+ * incremented) and step back from there; prefix_obj must stay reachable
+ * for the duration of the scan.
+ */
+static void
+mrb_mdb_scan_prefix(mrb_state *mrb, mrb_value prefix_obj,
+                    const mrb_mdb_scan_opts *opts, mrb_mdb_scan *scan)
+{
+  scan->prefix.mv_size = (size_t)RSTRING_LEN(prefix_obj);
+  scan->prefix.mv_data = RSTRING_PTR(prefix_obj);
+  scan->reverse = opts->reverse;
+  scan->limit   = opts->limit;
+
+  if (scan->prefix.mv_size == 0)
+    mrb_mdb_raise(mrb, MDB_BAD_VALSIZE, "mdb_cursor_get");
+
+  if (!opts->reverse) {
+    scan->first = MDB_SET_RANGE;
+    scan->next  = MDB_NEXT;
+    scan->seek  = scan->prefix;
+    return;
+  }
+
+  scan->next = MDB_PREV;
+  const uint8_t *p = (const uint8_t *)scan->prefix.mv_data;
+  size_t len = scan->prefix.mv_size;
+  while (len > 0 && p[len - 1] == 0xFF)
+    len--;
+  if (len == 0) {
+    scan->first = MDB_LAST;
+    return;
+  }
+  mrb_value succ = mrb_str_new(mrb, (const char *)p, (mrb_int)len);
+  RSTRING_PTR(succ)[len - 1]++;
+  scan->first        = MDB_SET_RANGE;
+  scan->seek.mv_size = len;
+  scan->seek.mv_data = RSTRING_PTR(succ);
+  scan->seek_excl    = TRUE;
+}
+
+/* Database#reverse_each(limit: nil) { |k, v| ... } */
 static mrb_value
-mrb_mdb_database_cursor_m(mrb_state *mrb, mrb_value self)
+mrb_mdb_database_reverse_each_m(mrb_state *mrb, mrb_value self)
 {
-  mrb_value blk;
-  mrb_int flags = 0;
-  mrb_get_args(mrb, "|i&!", &flags, &blk);
+  mrb_value opts = mrb_nil_value(), blk;
+  mrb_get_args(mrb, "|H&!", &opts, &blk);
   if (mrb_nil_p(blk))
     mrb_raise(mrb, E_ARGUMENT_ERROR, "no block given");
 
-  mrb_value env_obj = mrb_iv_get(mrb, self, MRB_IVSYM(env));
-  mrb_value dbi_val = mrb_iv_get(mrb, self, MRB_IVSYM(dbi));
+  mrb_mdb_scan_opts o;
+  mrb_mdb_scan_opts_parse(mrb, opts, 0, &o);
+  mrb_mdb_scan scan = { .first = MDB_LAST, .next = MDB_PREV, .reverse = TRUE, .limit = o.limit };
+  return mrb_mdb_database_scan_each(mrb, self, &scan, blk);
+}
 
-  struct RClass *mdb_mod   = mrb_module_get_id(mrb, MRB_SYM(MDB));
-  struct RClass *txn_class = mrb_class_get_under_id(mrb, mdb_mod, MRB_SYM(Txn));
-  struct RClass *cur_class = mrb_class_get_under_id(mrb, mdb_mod, MRB_SYM(Cursor));
+/* Database#each_prefix(prefix, reverse: false, limit: nil) { |k, v| ... } */
+static mrb_value
+mrb_mdb_database_each_prefix_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_value prefix_obj, opts = mrb_nil_value(), blk;
+  mrb_get_args(mrb, "o|H&!", &prefix_obj, &opts, &blk);
+  if (mrb_nil_p(blk))
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "no block given");
 
-  mrb_value txn_argv[2] = { env_obj, mrb_int_value(mrb, flags) };
-  mrb_value txn_obj = mrb_obj_new(mrb, txn_class, 2, txn_argv);
-  mrb_gc_protect(mrb, txn_obj);
+  prefix_obj = mrb_str_to_str(mrb, prefix_obj);
+  mrb_mdb_scan_opts o;
+  mrb_mdb_scan_opts_parse(mrb, opts, 0, &o);
+  mrb_mdb_scan scan = { .first = MDB_SET_RANGE, .next = MDB_NEXT };
+  mrb_mdb_scan_prefix(mrb, prefix_obj, &o, &scan);
+  return mrb_mdb_database_scan_each(mrb, self, &scan, blk);
+}
 
-  mrb_value cur_argv[2] = { txn_obj, dbi_val };
-  mrb_value cur_obj = mrb_obj_new(mrb, cur_class, 2, cur_argv);
-  mrb_gc_protect(mrb, cur_obj);
+/*
+ * Database#each_range(from, to, exclusive_end: false, reverse: false,
+ *                     limit: nil) { |k, v| ... }
+ *
+ * Bounds are compared with the database's own comparator; nil leaves that
+ * side open.
+ */
+static mrb_value
+mrb_mdb_database_each_range_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_value from, to, opts = mrb_nil_value(), blk;
+  mrb_get_args(mrb, "oo|H&!", &from, &to, &opts, &blk);
+  if (mrb_nil_p(blk))
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "no block given");
 
-  mrb_lmdb_yield1_ctx ctx1 = { blk, cur_obj };
-  mrb_bool exc = FALSE;
-  mrb_value result = mrb_protect_error(mrb, mrb_lmdb_yield1_cb, &ctx1, &exc);
+  mrb_mdb_scan_opts o;
+  mrb_mdb_scan_opts_parse(mrb, opts, MRB_MDB_SCAN_OPT_RANGE, &o);
+  mrb_mdb_scan scan = { .first = MDB_FIRST, .next = MDB_NEXT };
+  mrb_mdb_scan_range(mrb, self, from, to, &o, &scan);
+  return mrb_mdb_database_scan_each(mrb, self, &scan, blk);
+}
 
-  MDB_cursor *cursor = (MDB_cursor *)mrb_data_check_get_ptr(mrb, cur_obj, &mdb_cursor_type);
-  if (cursor) {
-    mrb_data_init(cur_obj, NULL, NULL);
-    mdb_cursor_close(cursor);
+/*
+ * Common setup for keys / values / each_key_only / each_value: select by
+ * prefix: or by from:/to: (all records when none is given).
+ */
+static void
+mrb_mdb_scan_select(mrb_state *mrb, mrb_value self, mrb_value opts,
+                    mrb_mdb_scan_emit emit, mrb_mdb_scan *scan)
+{
+  mrb_mdb_scan_opts o;
+  mrb_mdb_scan_opts_parse(mrb, opts, MRB_MDB_SCAN_OPT_SELECT, &o);
+  scan->emit = emit;
+  if (!mrb_nil_p(o.prefix)) {
+    if (!mrb_nil_p(o.from) || !mrb_nil_p(o.to))
+      mrb_raise(mrb, E_ARGUMENT_ERROR, "prefix: cannot be combined with from:/to:");
+    mrb_mdb_scan_prefix(mrb, mrb_str_to_str(mrb, o.prefix), &o, scan);
+  } else {
+    mrb_mdb_scan_range(mrb, self, o.from, o.to, &o, scan);
   }
+}
 
-  MDB_txn *txn = (MDB_txn *)mrb_data_check_get_ptr(mrb, txn_obj, &mdb_txn_type);
-  if (txn) {
-    mrb_data_init(txn_obj, NULL, NULL);
-    if (!exc) {
-      int rc = mdb_txn_commit(txn);
-      if (unlikely(rc != MDB_SUCCESS))
-        mrb_mdb_raise(mrb, rc, "mdb_txn_commit");
-    } else {
-      mdb_txn_abort(txn);
-    }
-  }
-  if (exc) mrb_exc_raise(mrb, result);
-  return result;
+/* Database#keys(prefix:/from:/to:, exclusive_end:, reverse:, limit:) -> Array */
+static mrb_value
+mrb_mdb_database_keys_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_value opts = mrb_nil_value();
+  mrb_get_args(mrb, "|H", &opts);
+  mrb_mdb_scan scan = { .first = MDB_FIRST, .next = MDB_NEXT };
+  mrb_mdb_scan_select(mrb, self, opts, MRB_MDB_SCAN_KEYS, &scan);
+  return mrb_mdb_database_scan_collect(mrb, self, &scan);
 }
 
-/* Database#each { |k, v| ... } */
+/* Database#values(prefix:/from:/to:, exclusive_end:, reverse:, limit:) -> Array */
 static mrb_value
-mrb_mdb_database_each_m(mrb_state *mrb, mrb_value self)
+mrb_mdb_database_values_m(mrb_state *mrb, mrb_value self)
 {
-  mrb_value blk;
-  mrb_get_args(mrb, "&!", &blk);
+  mrb_value opts = mrb_nil_value();
+  mrb_get_args(mrb, "|H", &opts);
+  mrb_mdb_scan scan = { .first = MDB_FIRST, .next = MDB_NEXT };
+  mrb_mdb_scan_select(mrb, self, opts, MRB_MDB_SCAN_VALUES, &scan);
+  return mrb_mdb_database_scan_collect(mrb, self, &scan);
+}
+
+/* Database#each_key_only(...) { |k| ... } — same options as #keys */
+static mrb_value
+mrb_mdb_database_each_key_only_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_value opts = mrb_nil_value(), blk;
+  mrb_get_args(mrb, "|H&!", &opts, &blk);
+  if (mrb_nil_p(blk))
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "no block given");
+  mrb_mdb_scan scan = { .first = MDB_FIRST, .next = MDB_NEXT };
+  mrb_mdb_scan_select(mrb, self, opts, MRB_MDB_SCAN_KEYS, &scan);
+  return mrb_mdb_database_scan_each(mrb, self, &scan, blk);
+}
+
+/* Database#each_value(...) { |v| ... } — same options as #values */
+static mrb_value
+mrb_mdb_database_each_value_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_value opts = mrb_nil_value(), blk;
+  mrb_get_args(mrb, "|H&!", &opts, &blk);
   if (mrb_nil_p(blk))
     mrb_raise(mrb, E_ARGUMENT_ERROR, "no block given");
+  mrb_mdb_scan scan = { .first = MDB_FIRST, .next = MDB_NEXT };
+  mrb_mdb_scan_select(mrb, self, opts, MRB_MDB_SCAN_VALUES, &scan);
+  return mrb_mdb_database_scan_each(mrb, self, &scan, blk);
+}
 
+/* Database#count_prefix(prefix) -> Integer */
+static mrb_value
+mrb_mdb_database_count_prefix_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_value prefix_obj;
+  mrb_get_args(mrb, "o", &prefix_obj);
 
-  MDB_txn *txn;
-  int rc = mdb_txn_begin(mrb_mdb_database_env(mrb, self), NULL, MDB_RDONLY, &txn);
-  if (unlikely(rc != MDB_SUCCESS))
-    mrb_mdb_raise(mrb, rc, "mdb_txn_begin");
+  prefix_obj = mrb_str_to_str(mrb, prefix_obj);
+  mrb_mdb_scan_opts o;
+  mrb_mdb_scan_opts_parse(mrb, mrb_nil_value(), 0, &o);
+  mrb_mdb_scan scan = { .first = MDB_SET_RANGE, .next = MDB_NEXT };
+  mrb_mdb_scan_prefix(mrb, prefix_obj, &o, &scan);
+  return mrb_mdb_database_scan_count(mrb, self, &scan);
+}
 
-  MDB_cursor *cursor;
-  rc = mdb_cursor_open(txn, mrb_mdb_database_dbi(mrb, self), &cursor);
-  if (unlikely(rc != MDB_SUCCESS)) {
-    mdb_txn_abort(txn);
-    mrb_mdb_raise(mrb, rc, "mdb_cursor_open");
-  }
+/* Database#count_range(from, to, exclusive_end: false) -> Integer */
+static mrb_value
+mrb_mdb_database_count_range_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_value from, to, opts = mrb_nil_value();
+  mrb_get_args(mrb, "oo|H", &from, &to, &opts);
+
+  mrb_mdb_scan_opts o;
+  mrb_mdb_scan_opts_parse(mrb, opts, MRB_MDB_SCAN_OPT_RANGE, &o);
+  if (o.reverse || o.limit >= 0)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "count_range only takes exclusive_end:");
+  mrb_mdb_scan scan = { .first = MDB_FIRST, .next = MDB_NEXT };
+  mrb_mdb_scan_range(mrb, self, from, to, &o, &scan);
+  return mrb_mdb_database_scan_count(mrb, self, &scan);
+}
 
-  MDB_val key, data;
+static mrb_value
+mrb_mdb_each_dup_page_body(mrb_state *mrb, mrb_mdb_read *rd)
+{
+  mrb_mdb_scan *scan;
+  MDB_cursor *cursor = mrb_mdb_scan_cursor(mrb, rd, &scan);
+  unsigned int db_flags = scan->db->flags;
+  MDB_val key = scan->seek, data;
   int ai = mrb_gc_arena_save(mrb);
-  mrb_value exc_val = mrb_nil_value();
+  mrb_value page;
 
-  rc = mdb_cursor_get(cursor, &key, &data, MDB_FIRST);
+  int rc = mdb_cursor_get(cursor, &key, &data, MDB_SET_KEY);
+  if (rc == MDB_SUCCESS)
+    rc = mrb_mdb_cursor_multiple(mrb, cursor, MDB_GET_MULTIPLE, db_flags, &page);
   while (rc == MDB_SUCCESS) {
-    mrb_value pair = mrb_assoc_new(mrb,
-      mrb_mdb_val_to_str(mrb, &key), mrb_mdb_val_to_str(mrb, &data));
-    mrb_bool exc = FALSE;
-    mrb_lmdb_yield1_ctx ctx1 = { blk, pair };
-    mrb_value result = mrb_protect_error(mrb, mrb_lmdb_yield1_cb, &ctx1, &exc);
+    mrb_yield(mrb, scan->blk, mrb_ary_entry(page, 1));
     mrb_gc_arena_restore(mrb, ai);
-    if (exc) {
-      exc_val = result;
-      break;
-    }
-    rc = mdb_cursor_get(cursor, &key, &data, MDB_NEXT);
+    rc = mrb_mdb_cursor_multiple(mrb, cursor, MDB_NEXT_MULTIPLE, db_flags, &page);
   }
-
-  mdb_cursor_close(cursor);
-  mdb_txn_abort(txn);
-
-  if (!mrb_nil_p(exc_val))
-    mrb_exc_raise(mrb, exc_val);
-  if (rc != MDB_NOTFOUND && rc != MDB_SUCCESS)
-    mrb_mdb_raise(mrb, rc, "mdb_cursor_get");
-  return self;
+  mrb_mdb_scan_check(mrb, rc);
+  return mrb_nil_value();
 }
 
-/* Database#each_key(key) { |k, v| ... } — DUPSORT databases */
+/*
+ * Database#each_dup_page(key) { |dups| ... } — DUPFIXED databases
+ *
+ * Yields the duplicates of key one page at a time (GET_MULTIPLE, then
+ * NEXT_MULTIPLE), decoded to an Array.
+ */
 static mrb_value
-mrb_mdb_database_each_key_m(mrb_state *mrb, mrb_value self)
+mrb_mdb_database_each_dup_page_m(mrb_state *mrb, mrb_value self)
 {
   mrb_value key_obj, blk;
   mrb_get_args(mrb, "o&!", &key_obj, &blk);
@@ -1229,107 +5650,65 @@ mrb_mdb_database_each_key_m(mrb_state *mrb, mrb_value self)
     mrb_raise(mrb, E_ARGUMENT_ERROR, "no block given");
 
   key_obj = mrb_str_to_str(mrb, key_obj);
+  mrb_mdb_scan scan = { .first = MDB_SET_KEY, .blk = blk };
+  scan.seek.mv_size = (size_t)RSTRING_LEN(key_obj);
+  scan.seek.mv_data = RSTRING_PTR(key_obj);
+  mrb_mdb_scan_run(mrb, self, &scan, mrb_mdb_each_dup_page_body);
+  return self;
+}
 
-  MDB_txn *txn;
-  int rc = mdb_txn_begin(mrb_mdb_database_env(mrb, self), NULL, MDB_RDONLY, &txn);
-  if (unlikely(rc != MDB_SUCCESS))
-    mrb_mdb_raise(mrb, rc, "mdb_txn_begin");
-
-  MDB_cursor *cursor;
-  rc = mdb_cursor_open(txn, mrb_mdb_database_dbi(mrb, self), &cursor);
-  if (unlikely(rc != MDB_SUCCESS)) {
-    mdb_txn_abort(txn);
-    mrb_mdb_raise(mrb, rc, "mdb_cursor_open");
-  }
-
-  MDB_val key  = { (size_t)RSTRING_LEN(key_obj), RSTRING_PTR(key_obj) };
-  MDB_val data;
-  int ai = mrb_gc_arena_save(mrb);
-  mrb_value exc_val = mrb_nil_value();
-
-  rc = mdb_cursor_get(cursor, &key, &data, MDB_SET_KEY);
-  while (rc == MDB_SUCCESS) {
-    mrb_value pair = mrb_assoc_new(mrb,
-      mrb_mdb_val_to_str(mrb, &key), mrb_mdb_val_to_str(mrb, &data));
-    mrb_bool exc = FALSE;
-    mrb_lmdb_yield1_ctx ctx1 = { blk, pair };
-    mrb_value result = mrb_protect_error(mrb, mrb_lmdb_yield1_cb, &ctx1, &exc);
-    mrb_gc_arena_restore(mrb, ai);
-    if (exc) {
-      exc_val = result;
-      break;
-    }
-    rc = mdb_cursor_get(cursor, &key, &data, MDB_NEXT_DUP);
+/* Database#each_slice(n) { |pairs| ... } */
+static mrb_value
+mrb_mdb_database_each_slice_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_int n;
+  mrb_value blk;
+  mrb_get_args(mrb, "i&", &n, &blk);
+  /* Blockless, behave like the Enumerable#each_slice this replaces. */
+  if (mrb_nil_p(blk)) {
+    if (n <= 0)
+      mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid slice size");
+    return mrb_funcall_id(mrb, self, MRB_SYM(to_enum), 2,
+                          mrb_symbol_value(MRB_SYM(each_slice)), mrb_int_value(mrb, n));
   }
 
-  mdb_cursor_close(cursor);
-  mdb_txn_abort(txn);
-
-  if (!mrb_nil_p(exc_val))
-    mrb_exc_raise(mrb, exc_val);
-  if (rc != MDB_NOTFOUND && rc != MDB_SUCCESS)
-    mrb_mdb_raise(mrb, rc, "mdb_cursor_get");
-  return self;
+  mrb_mdb_scan scan = { .first = MDB_FIRST, .next = MDB_NEXT };
+  return mrb_mdb_database_scan_slices(mrb, self, &scan, n, blk);
 }
 
-/* Database#each_prefix(prefix) { |k, v| ... } */
+/* Database#each_prefix_slice(prefix, n) { |pairs| ... } */
 static mrb_value
-mrb_mdb_database_each_prefix_m(mrb_state *mrb, mrb_value self)
+mrb_mdb_database_each_prefix_slice_m(mrb_state *mrb, mrb_value self)
 {
   mrb_value prefix_obj, blk;
-  mrb_get_args(mrb, "o&!", &prefix_obj, &blk);
+  mrb_int n;
+  mrb_get_args(mrb, "oi&!", &prefix_obj, &n, &blk);
   if (mrb_nil_p(blk))
     mrb_raise(mrb, E_ARGUMENT_ERROR, "no block given");
 
   prefix_obj = mrb_str_to_str(mrb, prefix_obj);
+  mrb_mdb_scan_opts o;
+  mrb_mdb_scan_opts_parse(mrb, mrb_nil_value(), 0, &o);
+  mrb_mdb_scan scan = { .first = MDB_SET_RANGE, .next = MDB_NEXT };
+  mrb_mdb_scan_prefix(mrb, prefix_obj, &o, &scan);
+  return mrb_mdb_database_scan_slices(mrb, self, &scan, n, blk);
+}
 
-  const char *prefix_ptr = RSTRING_PTR(prefix_obj);
-  mrb_int     prefix_len = RSTRING_LEN(prefix_obj);
-
-  MDB_txn *txn;
-  int rc = mdb_txn_begin(mrb_mdb_database_env(mrb, self), NULL, MDB_RDONLY, &txn);
-  if (unlikely(rc != MDB_SUCCESS))
-    mrb_mdb_raise(mrb, rc, "mdb_txn_begin");
-
-  MDB_cursor *cursor;
-  rc = mdb_cursor_open(txn, mrb_mdb_database_dbi(mrb, self), &cursor);
-  if (unlikely(rc != MDB_SUCCESS)) {
-    mdb_txn_abort(txn);
-    mrb_mdb_raise(mrb, rc, "mdb_cursor_open");
-  }
-
-  MDB_val key  = { (size_t)prefix_len, (void *)prefix_ptr };
-  MDB_val data;
-  rc = mdb_cursor_get(cursor, &key, &data, MDB_SET_RANGE);
-
-  int ai = mrb_gc_arena_save(mrb);
-  mrb_value exc_val = mrb_nil_value();
-
-  while (rc == MDB_SUCCESS) {
-    if ((mrb_int)key.mv_size < prefix_len ||
-        memcmp(key.mv_data, prefix_ptr, (size_t)prefix_len) != 0)
-      break;
-    mrb_value pair = mrb_assoc_new(mrb,
-      mrb_mdb_val_to_str(mrb, &key), mrb_mdb_val_to_str(mrb, &data));
-    mrb_bool exc = FALSE;
-    mrb_lmdb_yield1_ctx ctx1 = { blk, pair };
-    mrb_value result = mrb_protect_error(mrb, mrb_lmdb_yield1_cb, &ctx1, &exc);
-    mrb_gc_arena_restore(mrb, ai);
-    if (exc) {
-      exc_val = result;
-      break;
-    }
-    rc = mdb_cursor_get(cursor, &key, &data, MDB_NEXT);
-  }
-
-  mdb_cursor_close(cursor);
-  mdb_txn_abort(txn);
+/* Database#each_key_slice(key, n) { |pairs| ... } — DUPSORT databases */
+static mrb_value
+mrb_mdb_database_each_key_slice_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_value key_obj, blk;
+  mrb_int n;
+  mrb_get_args(mrb, "oi&!", &key_obj, &n, &blk);
+  if (mrb_nil_p(blk))
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "no block given");
 
-  if (!mrb_nil_p(exc_val))
-    mrb_exc_raise(mrb, exc_val);
-  if (rc != MDB_NOTFOUND && rc != MDB_SUCCESS)
-    mrb_mdb_raise(mrb, rc, "mdb_cursor_get");
-  return self;
+  key_obj = mrb_str_to_str(mrb, key_obj);
+  mrb_mdb_scan scan = { .first = MDB_SET_KEY, .next = MDB_NEXT_DUP };
+  scan.seek.mv_size = (size_t)RSTRING_LEN(key_obj);
+  scan.seek.mv_data = RSTRING_PTR(key_obj);
+  return mrb_mdb_database_scan_slices(mrb, self, &scan, n, blk);
 }
 
 /* Database#<< value — append with auto-increment integer key */
@@ -1340,11 +5719,10 @@ mrb_mdb_database_append_m(mrb_state *mrb, mrb_value self)
   mrb_get_args(mrb, "o", &val_obj);
 
   val_obj = mrb_str_to_str(mrb, val_obj);
+  mrb_mdb_plain_check(mrb, mrb_mdb_database_get(mrb, self), "<<");
 
-  MDB_txn *txn;
-  int rc = mdb_txn_begin(mrb_mdb_database_env(mrb, self), NULL, 0, &txn);
-  if (unlikely(rc != MDB_SUCCESS))
-    mrb_mdb_raise(mrb, rc, "mdb_txn_begin");
+  MDB_txn *txn = mrb_mdb_env_write_begin(mrb, mrb_mdb_database_env_state(mrb, self));
+  int rc;
 
   MDB_cursor *cursor;
   rc = mdb_cursor_open(txn, mrb_mdb_database_dbi(mrb, self), &cursor);
@@ -1370,6 +5748,8 @@ mrb_mdb_database_append_m(mrb_state *mrb, mrb_value self)
 
   rc = mdb_cursor_put(cursor, &key, &data, MDB_APPEND);
   mdb_cursor_close(cursor);
+  if (likely(rc == MDB_SUCCESS))
+    rc = mrb_mdb_bloom_note(txn, mrb_mdb_database_get(mrb, self), &key, FALSE);
   if (unlikely(rc != MDB_SUCCESS)) {
     mdb_txn_abort(txn);
     mrb_mdb_raise(mrb, rc, "mdb_cursor_put");
@@ -1380,42 +5760,41 @@ mrb_mdb_database_append_m(mrb_state *mrb, mrb_value self)
   return self;
 }
 
-/* Database#multi_get(keys) -> Array */
 static mrb_value
-mrb_mdb_database_multi_get_m(mrb_state *mrb, mrb_value self)
+mrb_mdb_database_multi_get_body(mrb_state *mrb, mrb_mdb_read *rd)
 {
-  mrb_value keys_ary;
-  mrb_get_args(mrb, "A", &keys_ary);
-
-  MDB_txn *txn;
-  int rc = mdb_txn_begin(mrb_mdb_database_env(mrb, self), NULL, MDB_RDONLY, &txn);
-  if (unlikely(rc != MDB_SUCCESS))
-    mrb_mdb_raise(mrb, rc, "mdb_txn_begin");
-
-  mrb_int len = RARRAY_LEN(keys_ary);
+  mrb_mdb_keys_ctx *c = (mrb_mdb_keys_ctx *)rd->ud;
+  mrb_int len = RARRAY_LEN(c->keys);
   mrb_value result = mrb_ary_new_capa(mrb, len);
   int ai = mrb_gc_arena_save(mrb);
 
   for (mrb_int i = 0; i < len; i++) {
-    mrb_value key_obj = mrb_str_to_str(mrb, mrb_ary_entry(keys_ary, i));
+    mrb_value key_obj = mrb_ary_entry(c->keys, i);
     MDB_val key  = { (size_t)RSTRING_LEN(key_obj), RSTRING_PTR(key_obj) };
     MDB_val data;
-    rc = mdb_get(txn, mrb_mdb_database_dbi(mrb, self), &key, &data);
+    int rc = mrb_mdb_db_get(rd->txn, c->db, &key, &data);
     if (likely(rc == MDB_SUCCESS))
-      mrb_ary_push(mrb, result, mrb_mdb_val_to_str(mrb, &data));
+      mrb_ary_push(mrb, result, mrb_mdb_db_value(mrb, rd->txn, c->db, &data));
     else if (rc == MDB_NOTFOUND)
       mrb_ary_push(mrb, result, mrb_nil_value());
-    else {
-      mdb_txn_abort(txn);
+    else
       mrb_mdb_raise(mrb, rc, "mdb_get");
-    }
     mrb_gc_arena_restore(mrb, ai);
   }
-
-  mdb_txn_abort(txn);
   return result;
 }
 
+/* Database#multi_get(keys) -> Array */
+static mrb_value
+mrb_mdb_database_multi_get_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_value keys_ary;
+  mrb_get_args(mrb, "A", &keys_ary);
+
+  mrb_mdb_keys_ctx c = { mrb_mdb_database_get(mrb, self), mrb_mdb_ary_to_str(mrb, keys_ary) };
+  return mrb_mdb_env_read(mrb, mrb_mdb_database_env_state(mrb, self), mrb_mdb_database_multi_get_body, &c);
+}
+
 /* Database#batch_put(pairs, flags=0) */
 static mrb_value
 mrb_mdb_database_batch_put_m(mrb_state *mrb, mrb_value self)
@@ -1424,29 +5803,246 @@ mrb_mdb_database_batch_put_m(mrb_state *mrb, mrb_value self)
   mrb_int flags = 0;
   mrb_get_args(mrb, "A|i", &pairs_ary, &flags);
   unsigned int real_flags = mrb_mdb_flags(mrb, flags);
+  mrb_mdb_database *db = mrb_mdb_database_get(mrb, self);
 
-  MDB_txn *txn;
-  int rc = mdb_txn_begin(mrb_mdb_database_env(mrb, self), NULL, 0, &txn);
-  if (unlikely(rc != MDB_SUCCESS))
-    mrb_mdb_raise(mrb, rc, "mdb_txn_begin");
-
+  /*
+   * Coerce (and compress) everything up front so nothing raises inside the
+   * write txn; the indexed path packs inside its own protected txn body.
+   */
   mrb_int len = RARRAY_LEN(pairs_ary);
+  mrb_value pairs = mrb_ary_new_capa(mrb, len);
   int ai = mrb_gc_arena_save(mrb);
-
   for (mrb_int i = 0; i < len; i++) {
-    mrb_value pair   = mrb_ary_entry(pairs_ary, i);
-    mrb_value key_obj = mrb_str_to_str(mrb, mrb_ary_entry(pair, 0));
-    mrb_value val_obj = mrb_str_to_str(mrb, mrb_ary_entry(pair, 1));
+    mrb_value pair = mrb_ary_entry(pairs_ary, i);
+    mrb_value val_obj = mrb_mdb_db_coerce(mrb, db, mrb_ary_entry(pair, 1));
+    if (!db->indexed)
+      val_obj = mrb_mdb_db_pack(mrb, db, val_obj);
+    mrb_ary_push(mrb, pairs, mrb_mdb_indexed_pair(mrb,
+      mrb_str_to_str(mrb, mrb_ary_entry(pair, 0)), val_obj));
+    mrb_gc_arena_restore(mrb, ai);
+  }
+
+  if (db->indexed) {
+    mrb_mdb_indexed_write(mrb, self, pairs, real_flags);
+    return self;
+  }
+
+  MDB_txn *txn = mrb_mdb_env_write_begin(mrb, mrb_mdb_database_env_state(mrb, self));
+  mrb_mdb_bloom_txn bloom;
+  mrb_mdb_bloom_begin(txn, db, &bloom);
+  int rc = MDB_SUCCESS;
+
+  for (mrb_int i = 0; i < len && rc == MDB_SUCCESS; i++) {
+    mrb_value pair    = mrb_ary_entry(pairs, i);
+    mrb_value key_obj = mrb_ary_entry(pair, 0);
     MDB_val key  = { (size_t)RSTRING_LEN(key_obj), RSTRING_PTR(key_obj) };
-    MDB_val data = { (size_t)RSTRING_LEN(val_obj), RSTRING_PTR(val_obj) };
-    rc = mdb_put(txn, mrb_mdb_database_dbi(mrb, self), &key, &data, real_flags);
-    if (unlikely(rc != MDB_SUCCESS)) {
-      mdb_txn_abort(txn);
-      mrb_mdb_raise(mrb, rc, "mdb_put");
+    rc = mrb_mdb_db_put(mrb, txn, db, &key, mrb_ary_entry(pair, 1), real_flags);
+    if (likely(rc == MDB_SUCCESS))
+      rc = mrb_mdb_bloom_add(txn, db, &bloom, &key);
+  }
+  if (likely(rc == MDB_SUCCESS))
+    rc = mrb_mdb_bloom_end(txn, db, &bloom);
+  if (unlikely(rc != MDB_SUCCESS)) {
+    mdb_txn_abort(txn);
+    mrb_mdb_raise(mrb, rc, "mdb_put");
+  }
+
+  rc = mdb_txn_commit(txn);
+  if (unlikely(rc != MDB_SUCCESS))
+    mrb_mdb_raise(mrb, rc, "mdb_txn_commit");
+  return self;
+}
+
+/*
+ * Bulk load: sort the input with the database's own comparators, then write
+ * it through one cursor with MDB_APPEND / MDB_APPENDDUP so leaves are filled
+ * left to right instead of split at random.
+ */
+typedef struct mrb_mdb_bulk_ctx {
+  MDB_txn *txn;
+  MDB_dbi  dbi;
+  mrb_bool dupsort;
+  const mrb_mdb_database *db;
+  mrb_mdb_bloom_txn      *bloom;  /* keys written are added to it */
+} mrb_mdb_bulk_ctx;
+
+static int
+mrb_mdb_bulk_cmp(const mrb_mdb_bulk_ctx *c, const mrb_mdb_bulk_rec *a, const mrb_mdb_bulk_rec *b)
+{
+  int r = mdb_cmp(c->txn, c->dbi, &a->key, &b->key);
+  if (r == 0 && c->dupsort)
+    r = mdb_dcmp(c->txn, c->dbi, &a->data, &b->data);
+  return r;
+}
+
+/* Stable merge sort; tmp holds at least n/2 records. Presorted runs cost one compare. */
+static void
+mrb_mdb_bulk_sort(const mrb_mdb_bulk_ctx *c, mrb_mdb_bulk_rec *v, mrb_mdb_bulk_rec *tmp, size_t n)
+{
+  if (n <= 16) {
+    for (size_t i = 1; i < n; i++) {
+      mrb_mdb_bulk_rec r = v[i];
+      size_t j = i;
+      while (j > 0 && mrb_mdb_bulk_cmp(c, &v[j - 1], &r) > 0) {
+        v[j] = v[j - 1];
+        j--;
+      }
+      v[j] = r;
+    }
+    return;
+  }
+
+  size_t h = n / 2;
+  mrb_mdb_bulk_sort(c, v, tmp, h);
+  mrb_mdb_bulk_sort(c, v + h, tmp, n - h);
+  if (mrb_mdb_bulk_cmp(c, &v[h - 1], &v[h]) <= 0)
+    return;
+
+  memcpy(tmp, v, h * sizeof(mrb_mdb_bulk_rec));
+  size_t i = 0, j = h, k = 0;
+  while (i < h && j < n)
+    v[k++] = mrb_mdb_bulk_cmp(c, &v[j], &tmp[i]) < 0 ? v[j++] : tmp[i++];
+  while (i < h)
+    v[k++] = tmp[i++];
+}
+
+static mrb_bool
+mrb_mdb_bulk_int_size_p(size_t size)
+{
+  return size == sizeof(unsigned int) || size == sizeof(size_t);
+}
+
+/* Write sorted recs through one cursor; on failure *func names the call. */
+static int
+mrb_mdb_bulk_write(const mrb_mdb_bulk_ctx *c, const mrb_mdb_bulk_rec *recs, size_t n, const char **func)
+{
+  MDB_cursor *cursor;
+  *func = "mdb_cursor_open";
+  int rc = mdb_cursor_open(c->txn, c->dbi, &cursor);
+  if (unlikely(rc != MDB_SUCCESS))
+    return rc;
+
+  /* Keys at or before the current last key cannot be appended. */
+  size_t append_from = 0;
+  MDB_val last_key, last_data;
+  rc = mdb_cursor_get(cursor, &last_key, &last_data, MDB_LAST);
+  if (rc == MDB_SUCCESS) {
+    while (append_from < n && mdb_cmp(c->txn, c->dbi, &recs[append_from].key, &last_key) <= 0)
+      append_from++;
+  }
+  else if (rc != MDB_NOTFOUND) {
+    *func = "mdb_cursor_get";
+    mdb_cursor_close(cursor);
+    return rc;
+  }
+
+  *func = "mdb_cursor_put";
+  rc = MDB_SUCCESS;
+  const mrb_mdb_bulk_rec *prev = NULL;
+  for (size_t i = 0; i < n; i++) {
+    const mrb_mdb_bulk_rec *r = &recs[i];
+    if (!c->dupsort && i + 1 < n && mdb_cmp(c->txn, c->dbi, &r->key, &r[1].key) == 0)
+      continue;
+    if (c->dupsort && prev && mrb_mdb_bulk_cmp(c, prev, r) == 0)
+      continue;
+
+    unsigned int flags = 0;
+    if (i >= append_from)
+      flags = (prev && mdb_cmp(c->txn, c->dbi, &prev->key, &r->key) == 0) ? MDB_APPENDDUP : MDB_APPEND;
+    MDB_val key = r->key, data = r->data;
+    rc = mdb_cursor_put(cursor, &key, &data, flags);
+    if (likely(rc == MDB_SUCCESS))
+      rc = mrb_mdb_bloom_add(c->txn, c->db, c->bloom, &r->key);
+    if (unlikely(rc != MDB_SUCCESS))
+      break;
+    prev = r;
+  }
+
+  mdb_cursor_close(cursor);
+  return rc;
+}
+
+/*
+ * Database#bulk_load(pairs) -> self
+ *
+ * pairs is an Array of [key, value] or anything with #to_a (Hash,
+ * Enumerator). For a plain database the last value given for a key wins,
+ * as with batch_put; on DUPSORT identical pairs are stored once. Keys that
+ * sort at or before the current last key are written with a normal put.
+ * Values are encoded and compressed like []=; with indexes attached the
+ * pairs go through the indexed write path in input order instead.
+ */
+static mrb_value
+mrb_mdb_database_bulk_load_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_value pairs_obj;
+  mrb_get_args(mrb, "o", &pairs_obj);
+  if (!mrb_array_p(pairs_obj))
+    pairs_obj = mrb_ensure_array_type(mrb, mrb_funcall_id(mrb, pairs_obj, MRB_SYM(to_a), 0));
+
+  mrb_mdb_database *db = mrb_mdb_database_get(mrb, self);
+  mrb_mdb_env *env = mrb_mdb_database_env_state(mrb, self);
+  mrb_bool dupsort = (db->flags & MDB_DUPSORT) != 0;
+
+  /* Coerce and encode everything up front; strings stay reachable through flat. */
+  mrb_int len = RARRAY_LEN(pairs_obj);
+  mrb_value flat = mrb_ary_new_capa(mrb, len * 2);
+  int ai = mrb_gc_arena_save(mrb);
+  for (mrb_int i = 0; i < len; i++) {
+    mrb_value pair    = mrb_ensure_array_type(mrb, mrb_ary_entry(pairs_obj, i));
+    mrb_value key_obj = mrb_str_to_str(mrb, mrb_ary_entry(pair, 0));
+    mrb_value val_obj = mrb_mdb_db_coerce(mrb, db, mrb_ary_entry(pair, 1));
+    if ((db->flags & MDB_INTEGERKEY) && !mrb_mdb_bulk_int_size_p((size_t)RSTRING_LEN(key_obj)))
+      mrb_mdb_raise(mrb, MDB_BAD_VALSIZE, "bulk_load");
+    if (db->indexed) {
+      mrb_ary_push(mrb, flat, mrb_mdb_indexed_pair(mrb, key_obj, val_obj));
+      mrb_gc_arena_restore(mrb, ai);
+      continue;
     }
+    val_obj = mrb_mdb_db_stored(mrb, db, val_obj);
+    if ((db->flags & MDB_INTEGERDUP) && !mrb_mdb_bulk_int_size_p((size_t)RSTRING_LEN(val_obj)))
+      mrb_mdb_raise(mrb, MDB_BAD_VALSIZE, "bulk_load");
+    mrb_ary_push(mrb, flat, key_obj);
+    mrb_ary_push(mrb, flat, val_obj);
     mrb_gc_arena_restore(mrb, ai);
   }
+  if (len == 0)
+    return self;
+  if (db->indexed) {
+    mrb_mdb_indexed_write(mrb, self, flat, 0);
+    return self;
+  }
+
+  /* recs lives in a String so the GC frees it whichever way we leave. */
+  size_t n = (size_t)len;
+  mrb_value recs_str = mrb_str_new(mrb, NULL, (mrb_int)((n + n / 2) * sizeof(mrb_mdb_bulk_rec)));
+  mrb_mdb_bulk_rec *recs = (mrb_mdb_bulk_rec *)RSTRING_PTR(recs_str);
+  for (size_t i = 0; i < n; i++) {
+    mrb_value key_obj = RARRAY_PTR(flat)[2 * i];
+    mrb_value val_obj = RARRAY_PTR(flat)[2 * i + 1];
+    recs[i].key.mv_size  = (size_t)RSTRING_LEN(key_obj);
+    recs[i].key.mv_data  = RSTRING_PTR(key_obj);
+    recs[i].data.mv_size = (size_t)RSTRING_LEN(val_obj);
+    recs[i].data.mv_data = RSTRING_PTR(val_obj);
+  }
 
+  MDB_txn *txn = mrb_mdb_env_write_begin(mrb, env);
+  /* From here on nothing may raise without aborting txn. */
+  mrb_mdb_bloom_txn bloom;
+  mrb_mdb_bloom_begin(txn, db, &bloom);
+  mrb_mdb_bulk_ctx ctx = { txn, db->dbi, dupsort, db, &bloom };
+  mrb_mdb_bulk_sort(&ctx, recs, recs + n, n);
+
+  const char *func;
+  int rc = mrb_mdb_bulk_write(&ctx, recs, n, &func);
+  if (rc == MDB_SUCCESS) {
+    func = "mdb_put";
+    rc = mrb_mdb_bloom_end(txn, db, &bloom);
+  }
+  if (unlikely(rc != MDB_SUCCESS)) {
+    mdb_txn_abort(txn);
+    mrb_mdb_raise(mrb, rc, func);
+  }
   rc = mdb_txn_commit(txn);
   if (unlikely(rc != MDB_SUCCESS))
     mrb_mdb_raise(mrb, rc, "mdb_txn_commit");
@@ -1460,12 +6056,10 @@ mrb_mdb_database_concat_m(mrb_state *mrb, mrb_value self)
   mrb_value values_ary;
   mrb_get_args(mrb, "o", &values_ary);
   values_ary = mrb_ensure_array_type(mrb, values_ary);
+  mrb_mdb_plain_check(mrb, mrb_mdb_database_get(mrb, self), "concat");
 
-
-  MDB_txn *txn;
-  int rc = mdb_txn_begin(mrb_mdb_database_env(mrb, self), NULL, 0, &txn);
-  if (unlikely(rc != MDB_SUCCESS))
-    mrb_mdb_raise(mrb, rc, "mdb_txn_begin");
+  MDB_txn *txn = mrb_mdb_env_write_begin(mrb, mrb_mdb_database_env_state(mrb, self));
+  int rc;
 
   MDB_cursor *cursor;
   rc = mdb_cursor_open(txn, mrb_mdb_database_dbi(mrb, self), &cursor);
@@ -1485,6 +6079,9 @@ mrb_mdb_database_concat_m(mrb_state *mrb, mrb_value self)
     mrb_mdb_raise(mrb, rc, "mdb_cursor_get");
   }
 
+  mrb_mdb_database *db = mrb_mdb_database_get(mrb, self);
+  mrb_mdb_bloom_txn bloom;
+  mrb_mdb_bloom_begin(txn, db, &bloom);
   mrb_int len = RARRAY_LEN(values_ary);
   int ai = mrb_gc_arena_save(mrb);
 
@@ -1494,6 +6091,8 @@ mrb_mdb_database_concat_m(mrb_state *mrb, mrb_value self)
     MDB_val key  = { (size_t)RSTRING_LEN(key_bin), RSTRING_PTR(key_bin) };
     MDB_val data = { (size_t)RSTRING_LEN(val_obj),  RSTRING_PTR(val_obj) };
     rc = mdb_cursor_put(cursor, &key, &data, MDB_APPEND);
+    if (likely(rc == MDB_SUCCESS))
+      rc = mrb_mdb_bloom_add(txn, db, &bloom, &key);
     if (unlikely(rc != MDB_SUCCESS)) {
       mdb_cursor_close(cursor);
       mdb_txn_abort(txn);
@@ -1504,41 +6103,28 @@ mrb_mdb_database_concat_m(mrb_state *mrb, mrb_value self)
   }
 
   mdb_cursor_close(cursor);
+  rc = mrb_mdb_bloom_end(txn, db, &bloom);
+  if (unlikely(rc != MDB_SUCCESS)) {
+    mdb_txn_abort(txn);
+    mrb_mdb_raise(mrb, rc, "mdb_put");
+  }
   rc = mdb_txn_commit(txn);
   if (unlikely(rc != MDB_SUCCESS))
     mrb_mdb_raise(mrb, rc, "mdb_txn_commit");
   return self;
 }
 
-/* Database#to_a */
 static mrb_value
-mrb_mdb_database_to_a_m(mrb_state *mrb, mrb_value self)
+mrb_mdb_database_to_a_body(mrb_state *mrb, mrb_mdb_read *rd)
 {
-
-  MDB_txn *txn;
-  int rc = mdb_txn_begin(mrb_mdb_database_env(mrb, self), NULL, MDB_RDONLY, &txn);
-  if (unlikely(rc != MDB_SUCCESS))
-    mrb_mdb_raise(mrb, rc, "mdb_txn_begin");
-
-  unsigned int db_flags;
-  rc = mdb_dbi_flags(txn, mrb_mdb_database_dbi(mrb, self), &db_flags);
-  if (unlikely(rc != MDB_SUCCESS)) {
-    mdb_txn_abort(txn);
-    mrb_mdb_raise(mrb, rc, "mdb_dbi_flags");
-  }
-
-  MDB_cursor *cursor;
-  rc = mdb_cursor_open(txn, mrb_mdb_database_dbi(mrb, self), &cursor);
-  if (unlikely(rc != MDB_SUCCESS)) {
-    mdb_txn_abort(txn);
-    mrb_mdb_raise(mrb, rc, "mdb_cursor_open");
-  }
-
+  mrb_mdb_database *db = (mrb_mdb_database *)rd->ud;
+  MDB_cursor *cursor = mrb_mdb_read_cursor(mrb, rd, db->dbi);
   mrb_value ary = mrb_ary_new(mrb);
   int ai = mrb_gc_arena_save(mrb);
+  MDB_val key, data;
+  int rc;
 
-  if (db_flags & MDB_DUPSORT) {
-    MDB_val key, data;
+  if (db->flags & MDB_DUPSORT) {
     rc = mdb_cursor_get(cursor, &key, &data, MDB_FIRST);
     while (rc == MDB_SUCCESS) {
       int rc2 = mdb_cursor_get(cursor, &key, &data, MDB_FIRST_DUP);
@@ -1551,53 +6137,39 @@ mrb_mdb_database_to_a_m(mrb_state *mrb, mrb_value self)
       rc = mdb_cursor_get(cursor, &key, &data, MDB_NEXT_NODUP);
     }
   } else {
-    MDB_val key, data;
     rc = mdb_cursor_get(cursor, &key, &data, MDB_FIRST);
     while (rc == MDB_SUCCESS) {
       mrb_ary_push(mrb, ary,
-        mrb_assoc_new(mrb, mrb_mdb_val_to_str(mrb, &key), mrb_mdb_val_to_str(mrb, &data)));
+        mrb_assoc_new(mrb, mrb_mdb_val_to_str(mrb, &key), mrb_mdb_db_value(mrb, rd->txn, db, &data)));
       mrb_gc_arena_restore(mrb, ai);
       rc = mdb_cursor_get(cursor, &key, &data, MDB_NEXT);
     }
   }
 
-  mdb_cursor_close(cursor);
-  mdb_txn_abort(txn);
-
   if (rc != MDB_NOTFOUND)
     mrb_mdb_raise(mrb, rc, "mdb_cursor_get");
   return ary;
 }
 
-/* Database#to_h */
+/* Database#to_a */
 static mrb_value
-mrb_mdb_database_to_h_m(mrb_state *mrb, mrb_value self)
+mrb_mdb_database_to_a_m(mrb_state *mrb, mrb_value self)
 {
+  mrb_mdb_database *db = mrb_mdb_database_get(mrb, self);
+  return mrb_mdb_env_read(mrb, mrb_mdb_database_env_state(mrb, self), mrb_mdb_database_to_a_body, db);
+}
 
-  MDB_txn *txn;
-  int rc = mdb_txn_begin(mrb_mdb_database_env(mrb, self), NULL, MDB_RDONLY, &txn);
-  if (unlikely(rc != MDB_SUCCESS))
-    mrb_mdb_raise(mrb, rc, "mdb_txn_begin");
-
-  unsigned int db_flags;
-  rc = mdb_dbi_flags(txn, mrb_mdb_database_dbi(mrb, self), &db_flags);
-  if (unlikely(rc != MDB_SUCCESS)) {
-    mdb_txn_abort(txn);
-    mrb_mdb_raise(mrb, rc, "mdb_dbi_flags");
-  }
-
-  MDB_cursor *cursor;
-  rc = mdb_cursor_open(txn, mrb_mdb_database_dbi(mrb, self), &cursor);
-  if (unlikely(rc != MDB_SUCCESS)) {
-    mdb_txn_abort(txn);
-    mrb_mdb_raise(mrb, rc, "mdb_cursor_open");
-  }
-
+static mrb_value
+mrb_mdb_database_to_h_body(mrb_state *mrb, mrb_mdb_read *rd)
+{
+  mrb_mdb_database *db = (mrb_mdb_database *)rd->ud;
+  MDB_cursor *cursor = mrb_mdb_read_cursor(mrb, rd, db->dbi);
   mrb_value hsh = mrb_hash_new(mrb);
   int ai = mrb_gc_arena_save(mrb);
+  MDB_val key, data;
+  int rc;
 
-  if (db_flags & MDB_DUPSORT) {
-    MDB_val key, data;
+  if (db->flags & MDB_DUPSORT) {
     rc = mdb_cursor_get(cursor, &key, &data, MDB_FIRST);
     while (rc == MDB_SUCCESS) {
       mrb_value k      = mrb_mdb_val_to_str(mrb, &key);
@@ -1615,24 +6187,631 @@ mrb_mdb_database_to_h_m(mrb_state *mrb, mrb_value self)
       rc = mdb_cursor_get(cursor, &key, &data, MDB_NEXT_NODUP);
     }
   } else {
-    MDB_val key, data;
     rc = mdb_cursor_get(cursor, &key, &data, MDB_FIRST);
     while (rc == MDB_SUCCESS) {
       mrb_hash_set(mrb, hsh,
-        mrb_mdb_val_to_str(mrb, &key), mrb_mdb_val_to_str(mrb, &data));
+        mrb_mdb_val_to_str(mrb, &key), mrb_mdb_db_value(mrb, rd->txn, db, &data));
       mrb_gc_arena_restore(mrb, ai);
       rc = mdb_cursor_get(cursor, &key, &data, MDB_NEXT);
     }
   }
 
-  mdb_cursor_close(cursor);
-  mdb_txn_abort(txn);
-
   if (rc != MDB_NOTFOUND)
     mrb_mdb_raise(mrb, rc, "mdb_cursor_get");
   return hsh;
 }
 
+/* Database#to_h */
+static mrb_value
+mrb_mdb_database_to_h_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_mdb_database *db = mrb_mdb_database_get(mrb, self);
+  return mrb_mdb_env_read(mrb, mrb_mdb_database_env_state(mrb, self), mrb_mdb_database_to_h_body, db);
+}
+
+/* ========================================================================
+ * MDB::Loader — external merge sort ingestion
+ *
+ * Loader#add buffers pairs up to the memory cap, then sorts the buffer with
+ * the database's comparators and spills it to an unlinked temp file. Runs
+ * are merged in tiers: MRB_MDB_LOADER_FAN_IN runs of one level become one
+ * run of the next, so a record is rewritten once per level (logarithmic in
+ * the input size) and at most FAN_IN - 1 runs per level stay open.
+ * Loader#finish k-way merges the runs
+ * (and whatever is still buffered) and writes the result with MDB_APPEND /
+ * MDB_APPENDDUP in write txns of at most txn_size records. Same duplicate
+ * rules as Database#bulk_load.
+ * ======================================================================== */
+
+#define MRB_MDB_LOADER_MEMORY   (64 * 1024 * 1024)
+#define MRB_MDB_LOADER_TXN_SIZE 100000
+#define MRB_MDB_LOADER_FAN_IN   16
+
+/* Bytes charged per buffered record besides buf: its offset and sort scratch. */
+#define MRB_MDB_LOADER_OVERHEAD \
+  (sizeof(size_t) + sizeof(mrb_mdb_bulk_rec) + sizeof(mrb_mdb_bulk_rec) / 2)
+
+static mrb_mdb_loader *
+mrb_mdb_loader_get(mrb_state *mrb, mrb_value self)
+{
+  mrb_mdb_loader *ld = (mrb_mdb_loader *)mrb_data_get_ptr(mrb, self, &mdb_loader_type);
+  if (unlikely(!ld))
+    mrb_raise(mrb, E_RUNTIME_ERROR, "uninitialized MDB::Loader");
+  if (unlikely(ld->closed))
+    mrb_raise(mrb, E_IO_ERROR, "closed MDB::Loader");
+  return ld;
+}
+
+static mrb_value
+mrb_mdb_loader_db(mrb_state *mrb, mrb_value self)
+{
+  return mrb_iv_get(mrb, self, MRB_IVSYM(db));
+}
+
+/*
+ * Sort the buffered records into ld->recs and drop duplicates: for a plain
+ * database the last pair per key survives, on DUPSORT one of each
+ * identical pair. Returns the number of records left.
+ */
+static size_t
+mrb_mdb_loader_sort(mrb_state *mrb, mrb_value self, mrb_mdb_loader *ld)
+{
+  mrb_value db_obj = mrb_mdb_loader_db(mrb, self);
+  mrb_mdb_database *db = mrb_mdb_database_get(mrb, db_obj);
+  mrb_mdb_env *env = mrb_mdb_database_env_state(mrb, db_obj);
+  size_t n = ld->n;
+  if (n == 0)
+    return 0;
+
+  ld->recs = (mrb_mdb_bulk_rec *)mrb_realloc(mrb, ld->recs, (n + n / 2) * sizeof(mrb_mdb_bulk_rec));
+  for (size_t i = 0; i < n; i++) {
+    const char *p = ld->buf + ld->offs[i];
+    size_t hdr[2];
+    memcpy(hdr, p, sizeof(hdr));
+    ld->recs[i].key.mv_size  = hdr[0];
+    ld->recs[i].key.mv_data  = (void *)(p + sizeof(hdr));
+    ld->recs[i].data.mv_size = hdr[1];
+    ld->recs[i].data.mv_data = (void *)(p + sizeof(hdr) + hdr[0]);
+  }
+
+  MDB_txn *txn = mrb_mdb_env_read_begin(mrb, env);
+  mrb_mdb_bulk_ctx ctx = { txn, db->dbi, (db->flags & MDB_DUPSORT) != 0, db, NULL };
+  mrb_mdb_bulk_sort(&ctx, ld->recs, ld->recs + n, n);
+
+  size_t m = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (!ctx.dupsort && i + 1 < n && mdb_cmp(txn, db->dbi, &ld->recs[i].key, &ld->recs[i + 1].key) == 0)
+      continue;
+    if (ctx.dupsort && m > 0 && mrb_mdb_bulk_cmp(&ctx, &ld->recs[m - 1], &ld->recs[i]) == 0)
+      continue;
+    ld->recs[m++] = ld->recs[i];
+  }
+  mrb_mdb_env_read_end(env, txn);
+  return m;
+}
+
+static FILE *
+mrb_mdb_loader_tmpfile(mrb_state *mrb, mrb_value self)
+{
+#ifndef _WIN32
+  mrb_value dir = mrb_iv_get(mrb, self, MRB_IVSYM(tmpdir));
+  if (!mrb_nil_p(dir)) {
+    mrb_value path = mrb_str_dup(mrb, dir);
+    mrb_str_cat_lit(mrb, path, "/mruby-lmdb-run-XXXXXX");
+    int fd = mkstemp((char *)mrb_string_value_cstr(mrb, &path));
+    if (fd < 0)
+      return NULL;
+    unlink(RSTRING_PTR(path));
+    FILE *f = fdopen(fd, "w+b");
+    if (!f)
+      close(fd);
+    return f;
+  }
+#endif
+  return tmpfile();
+}
+
+static int
+mrb_mdb_loader_write_rec(FILE *f, const mrb_mdb_bulk_rec *r)
+{
+  size_t hdr[2] = { r->key.mv_size, r->data.mv_size };
+  return fwrite(hdr, sizeof(hdr), 1, f) == 1 &&
+         fwrite(r->key.mv_data, 1, r->key.mv_size, f) == r->key.mv_size &&
+         fwrite(r->data.mv_data, 1, r->data.mv_size, f) == r->data.mv_size;
+}
+
+/* Free the merge scratch left by a previous (possibly failed) merge. */
+static void
+mrb_mdb_loader_drop_srcs(mrb_state *mrb, mrb_mdb_loader *ld)
+{
+  for (size_t i = 0; i < ld->nsrcs; i++)
+    mrb_free(mrb, ld->srcs[i].buf);
+  mrb_free(mrb, ld->srcs);
+  mrb_free(mrb, ld->heap);
+  ld->srcs  = NULL;
+  ld->heap  = NULL;
+  ld->nsrcs = 0;
+}
+
+/* Allocate n empty merge sources and their heap. */
+static void
+mrb_mdb_loader_open_srcs(mrb_state *mrb, mrb_mdb_loader *ld, size_t n)
+{
+  mrb_mdb_loader_drop_srcs(mrb, ld);
+  ld->srcs  = (mrb_mdb_loader_src *)mrb_calloc(mrb, n, sizeof(mrb_mdb_loader_src));
+  ld->nsrcs = n;
+  ld->heap  = (size_t *)mrb_malloc(mrb, n * sizeof(size_t));
+}
+
+/* Advance src; MDB_NOTFOUND at the end, an errno value on I/O failure. */
+static int
+mrb_mdb_loader_src_next(mrb_state *mrb, mrb_mdb_loader_src *src)
+{
+  if (!src->f) {
+    if (src->mem == src->mem_end)
+      return MDB_NOTFOUND;
+    src->cur = *src->mem++;
+    return MDB_SUCCESS;
+  }
+
+  size_t hdr[2];
+  if (fread(hdr, sizeof(hdr), 1, src->f) != 1)
+    return feof(src->f) ? MDB_NOTFOUND : (errno ? errno : EIO);
+  size_t need = hdr[0] + hdr[1];
+  if (need > src->cap) {
+    char *p = (char *)mrb_realloc_simple(mrb, src->buf, need);
+    if (!p)
+      return ENOMEM;
+    src->buf = p;
+    src->cap = need;
+  }
+  if (need > 0 && fread(src->buf, need, 1, src->f) != 1)
+    return errno ? errno : EIO;
+  src->cur.key.mv_size  = hdr[0];
+  src->cur.key.mv_data  = src->buf;
+  src->cur.data.mv_size = hdr[1];
+  src->cur.data.mv_data = src->buf + hdr[0];
+  return MDB_SUCCESS;
+}
+
+/* Heap order: record order, then source index so later input wins ties. */
+static mrb_bool
+mrb_mdb_loader_less(const mrb_mdb_bulk_ctx *c, const mrb_mdb_loader_src *srcs, size_t a, size_t b)
+{
+  int r = mrb_mdb_bulk_cmp(c, &srcs[a].cur, &srcs[b].cur);
+  return r < 0 || (r == 0 && a < b);
+}
+
+static void
+mrb_mdb_loader_sift_down(const mrb_mdb_bulk_ctx *c, const mrb_mdb_loader_src *srcs, size_t *heap, size_t k, size_t i)
+{
+  for (;;) {
+    size_t l = 2 * i + 1, m = i;
+    if (l < k && mrb_mdb_loader_less(c, srcs, heap[l], heap[m]))
+      m = l;
+    if (l + 1 < k && mrb_mdb_loader_less(c, srcs, heap[l + 1], heap[m]))
+      m = l + 1;
+    if (m == i)
+      return;
+    size_t t = heap[i]; heap[i] = heap[m]; heap[m] = t;
+    i = m;
+  }
+}
+
+static void
+mrb_mdb_loader_sift_up(const mrb_mdb_bulk_ctx *c, const mrb_mdb_loader_src *srcs, size_t *heap, size_t i)
+{
+  while (i > 0) {
+    size_t p = (i - 1) / 2;
+    if (!mrb_mdb_loader_less(c, srcs, heap[i], heap[p]))
+      return;
+    size_t t = heap[i]; heap[i] = heap[p]; heap[p] = t;
+    i = p;
+  }
+}
+
+/*
+ * Take the smallest record's source off the heap. *skip is set when an
+ * equal record from a later source replaces it.
+ */
+static size_t
+mrb_mdb_loader_pop(const mrb_mdb_bulk_ctx *c, mrb_mdb_loader *ld, size_t *k, mrb_bool *skip)
+{
+  size_t r = ld->heap[0];
+  ld->heap[0] = ld->heap[--*k];
+  mrb_mdb_loader_sift_down(c, ld->srcs, ld->heap, *k, 0);
+  *skip = *k > 0 && (c->dupsort
+    ? mrb_mdb_bulk_cmp(c, &ld->srcs[r].cur, &ld->srcs[ld->heap[0]].cur) == 0
+    : mdb_cmp(c->txn, c->dbi, &ld->srcs[r].cur.key, &ld->srcs[ld->heap[0]].cur.key) == 0);
+  return r;
+}
+
+/* Advance source r and put it back on the heap unless it is drained. */
+static int
+mrb_mdb_loader_refill(mrb_state *mrb, const mrb_mdb_bulk_ctx *c, mrb_mdb_loader *ld, size_t *k, size_t r)
+{
+  int rc = mrb_mdb_loader_src_next(mrb, &ld->srcs[r]);
+  if (rc == MDB_SUCCESS) {
+    ld->heap[(*k)++] = r;
+    mrb_mdb_loader_sift_up(c, ld->srcs, ld->heap, *k - 1);
+  }
+  else if (rc == MDB_NOTFOUND)
+    rc = MDB_SUCCESS;
+  return rc;
+}
+
+/*
+ * Intermediate merge pass: replace runs[first..] (the newest, all of one
+ * level) with their merge, one level up.
+ */
+static void
+mrb_mdb_loader_compact(mrb_state *mrb, mrb_value self, mrb_mdb_loader *ld, size_t first)
+{
+  mrb_value db_obj = mrb_mdb_loader_db(mrb, self);
+  mrb_mdb_database *db = mrb_mdb_database_get(mrb, db_obj);
+  mrb_mdb_env *env = mrb_mdb_database_env_state(mrb, db_obj);
+  size_t n = ld->nruns - first;
+
+  mrb_mdb_loader_open_srcs(mrb, ld, n);
+  for (size_t i = 0; i < n; i++)
+    ld->srcs[i].f = ld->runs[first + i];
+  errno = 0;
+  FILE *out = mrb_mdb_loader_tmpfile(mrb, self);
+  if (!out) {
+    int err = errno ? errno : EIO;
+    mrb_mdb_loader_drop_srcs(mrb, ld);
+    mrb_mdb_raise(mrb, err, "tmpfile");
+  }
+  /* From here on nothing may raise until the read txn is handed back. */
+  MDB_txn *txn = mrb_mdb_env_read_begin(mrb, env);
+  mrb_mdb_bulk_ctx ctx = { txn, db->dbi, (db->flags & MDB_DUPSORT) != 0, db, NULL };
+  size_t k = 0;
+  int rc = MDB_SUCCESS;
+  const char *func = "fread";
+  for (size_t i = 0; i < n && rc == MDB_SUCCESS; i++)
+    rc = mrb_mdb_loader_refill(mrb, &ctx, ld, &k, i);
+  while (rc == MDB_SUCCESS && k > 0) {
+    mrb_bool skip;
+    size_t r = mrb_mdb_loader_pop(&ctx, ld, &k, &skip);
+    if (!skip && !mrb_mdb_loader_write_rec(out, &ld->srcs[r].cur)) {
+      func = "fwrite";
+      rc = errno ? errno : EIO;
+      break;
+    }
+    rc = mrb_mdb_loader_refill(mrb, &ctx, ld, &k, r);
+  }
+  if (rc == MDB_SUCCESS && (fflush(out) != 0 || fseek(out, 0, SEEK_SET) != 0)) {
+    func = "fwrite";
+    rc = errno ? errno : EIO;
+  }
+  mrb_mdb_env_read_end(env, txn);
+  mrb_mdb_loader_drop_srcs(mrb, ld);
+  if (unlikely(rc != MDB_SUCCESS)) {
+    fclose(out);
+    mrb_mdb_raise(mrb, rc, func);
+  }
+
+  for (size_t i = 0; i < n; i++)
+    fclose(ld->runs[first + i]);
+  ld->runs[first] = out;
+  ld->levels[first]++;
+  ld->nruns = first + 1;
+}
+
+/* Sort the buffer and write it out as a new run. */
+static void
+mrb_mdb_loader_spill(mrb_state *mrb, mrb_value self, mrb_mdb_loader *ld)
+{
+  size_t m = mrb_mdb_loader_sort(mrb, self, ld);
+  if (ld->nruns == ld->runs_cap) {
+    size_t cap = ld->runs_cap ? ld->runs_cap * 2 : 8;
+    ld->runs   = (FILE **)mrb_realloc(mrb, ld->runs, cap * sizeof(FILE *));
+    ld->levels = (uint8_t *)mrb_realloc(mrb, ld->levels, cap);
+    ld->runs_cap = cap;
+  }
+
+  errno = 0;
+  FILE *f = mrb_mdb_loader_tmpfile(mrb, self);
+  if (!f)
+    mrb_mdb_raise(mrb, errno ? errno : EIO, "tmpfile");
+
+  int ok = 1;
+  for (size_t i = 0; ok && i < m; i++)
+    ok = mrb_mdb_loader_write_rec(f, &ld->recs[i]);
+  if (ok)
+    ok = fflush(f) == 0 && fseek(f, 0, SEEK_SET) == 0;
+  if (unlikely(!ok)) {
+    int err = errno ? errno : EIO;
+    fclose(f);
+    mrb_mdb_raise(mrb, err, "fwrite");
+  }
+
+  ld->levels[ld->nruns] = 0;
+  ld->runs[ld->nruns++] = f;
+  ld->buf_len = 0;
+  ld->n = 0;
+  /* Levels never increase towards the end, so a full tier is the last FAN_IN runs. */
+  while (ld->nruns >= MRB_MDB_LOADER_FAN_IN &&
+         ld->levels[ld->nruns - MRB_MDB_LOADER_FAN_IN] == ld->levels[ld->nruns - 1])
+    mrb_mdb_loader_compact(mrb, self, ld, ld->nruns - MRB_MDB_LOADER_FAN_IN);
+}
+
+/*
+ * Put r, switching to MDB_APPEND once r sorts after the current last key.
+ * On DUPSORT every put checks the last key so further duplicates of the
+ * key just appended use MDB_APPENDDUP.
+ */
+static int
+mrb_mdb_loader_put(const mrb_mdb_bulk_ctx *c, MDB_cursor *cursor, mrb_bool *appending, const mrb_mdb_bulk_rec *r)
+{
+  unsigned int flags = MDB_APPEND;
+  if (!*appending || c->dupsort) {
+    MDB_val last_key, last_data;
+    int rc = mdb_cursor_get(cursor, &last_key, &last_data, MDB_LAST);
+    if (rc == MDB_SUCCESS) {
+      int cmp = mdb_cmp(c->txn, c->dbi, &r->key, &last_key);
+      if (cmp > 0)
+        *appending = TRUE;
+      else
+        flags = (*appending && cmp == 0) ? MDB_APPENDDUP : 0;
+    }
+    else if (rc == MDB_NOTFOUND)
+      *appending = TRUE;
+    else
+      return rc;
+  }
+  MDB_val key = r->key, data = r->data;
+  int rc = mdb_cursor_put(cursor, &key, &data, flags);
+  if (rc == MDB_SUCCESS)
+    rc = mrb_mdb_bloom_add(c->txn, c->db, c->bloom, &r->key);
+  return rc;
+}
+
+/* Loader.new(db, memory: 64 MiB, txn_size: 100_000, tmpdir: nil) */
+static mrb_value
+mrb_mdb_loader_init(mrb_state *mrb, mrb_value self)
+{
+  mrb_value db_obj, opts = mrb_nil_value();
+  mrb_get_args(mrb, "o|H", &db_obj, &opts);
+  mrb_mdb_database_get(mrb, db_obj);
+  if (mrb_data_check_get_ptr(mrb, self, &mdb_loader_type))
+    mrb_raise(mrb, E_RUNTIME_ERROR, "MDB::Loader already initialized");
+
+  mrb_int memory = MRB_MDB_LOADER_MEMORY, txn_size = MRB_MDB_LOADER_TXN_SIZE;
+  mrb_value tmpdir = mrb_nil_value();
+  if (!mrb_nil_p(opts)) {
+    mrb_value keys = mrb_hash_keys(mrb, opts);
+    for (mrb_int i = 0; i < RARRAY_LEN(keys); i++) {
+      mrb_value k = mrb_ary_entry(keys, i);
+      mrb_value v = mrb_hash_get(mrb, opts, k);
+      mrb_sym sym = mrb_symbol_p(k) ? mrb_symbol(k) : 0;
+      if (sym == MRB_SYM(memory)) {
+        memory = mrb_integer(mrb_to_int(mrb, v));
+      } else if (sym == MRB_SYM(txn_size)) {
+        txn_size = mrb_integer(mrb_to_int(mrb, v));
+      } else if (sym == MRB_SYM(tmpdir)) {
+        tmpdir = mrb_nil_p(v) ? v : mrb_str_to_str(mrb, v);
+        if (!mrb_nil_p(tmpdir))
+          mrb_string_value_cstr(mrb, &tmpdir);
+      } else {
+        mrb_raisef(mrb, E_ARGUMENT_ERROR, "unknown option %v", k);
+      }
+    }
+  }
+  if (memory <= 0)
+    mrb_raise(mrb, E_RANGE_ERROR, "memory must be positive");
+  if (txn_size <= 0)
+    mrb_raise(mrb, E_RANGE_ERROR, "txn_size must be positive");
+#ifdef _WIN32
+  if (!mrb_nil_p(tmpdir))
+    mrb_raise(mrb, E_NOTIMP_ERROR, "tmpdir: is not supported on Windows");
+#endif
+
+  mrb_mdb_loader *ld = (mrb_mdb_loader *)mrb_calloc(mrb, 1, sizeof(mrb_mdb_loader));
+  ld->memory   = (size_t)memory;
+  ld->txn_size = (size_t)txn_size;
+  mrb_data_init(self, ld, &mdb_loader_type);
+  mrb_iv_set(mrb, self, MRB_IVSYM(db), db_obj);
+  mrb_iv_set(mrb, self, MRB_IVSYM(tmpdir), tmpdir);
+  return self;
+}
+
+/* The loader writes around the index path, so indexed databases are refused. */
+static mrb_mdb_database *
+mrb_mdb_loader_database(mrb_state *mrb, mrb_value self)
+{
+  mrb_mdb_database *db = mrb_mdb_database_get(mrb, mrb_mdb_loader_db(mrb, self));
+  if (unlikely(db->indexed))
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "MDB::Loader cannot maintain indexes; use bulk_load");
+  return db;
+}
+
+/* Loader#add(key, value) -> self; values are encoded and compressed like []= */
+static mrb_value
+mrb_mdb_loader_add_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_value key_obj, val_obj;
+  mrb_get_args(mrb, "oo", &key_obj, &val_obj);
+  mrb_mdb_loader *ld = mrb_mdb_loader_get(mrb, self);
+  mrb_mdb_database *db = mrb_mdb_loader_database(mrb, self);
+  key_obj = mrb_str_to_str(mrb, key_obj);
+  val_obj = mrb_mdb_db_stored(mrb, db, mrb_mdb_db_coerce(mrb, db, val_obj));
+
+  unsigned int db_flags = db->flags;
+  size_t klen = (size_t)RSTRING_LEN(key_obj), dlen = (size_t)RSTRING_LEN(val_obj);
+  if ((db_flags & MDB_INTEGERKEY) && !mrb_mdb_bulk_int_size_p(klen))
+    mrb_mdb_raise(mrb, MDB_BAD_VALSIZE, "Loader#add");
+  if ((db_flags & MDB_INTEGERDUP) && !mrb_mdb_bulk_int_size_p(dlen))
+    mrb_mdb_raise(mrb, MDB_BAD_VALSIZE, "Loader#add");
+
+  size_t rec_len = 2 * sizeof(size_t) + klen + dlen;
+  if (ld->n > 0 &&
+      ld->buf_len + rec_len + (ld->n + 1) * MRB_MDB_LOADER_OVERHEAD > ld->memory)
+    mrb_mdb_loader_spill(mrb, self, ld);
+
+  if (ld->buf_len + rec_len > ld->buf_cap) {
+    size_t cap = ld->buf_cap ? ld->buf_cap * 2 : 4096;
+    if (cap < ld->buf_len + rec_len)
+      cap = ld->buf_len + rec_len;
+    if (cap > ld->memory && ld->memory >= ld->buf_len + rec_len)
+      cap = ld->memory;
+    ld->buf = (char *)mrb_realloc(mrb, ld->buf, cap);
+    ld->buf_cap = cap;
+  }
+  if (ld->n == ld->offs_cap) {
+    ld->offs_cap = ld->offs_cap ? ld->offs_cap * 2 : 256;
+    ld->offs = (size_t *)mrb_realloc(mrb, ld->offs, ld->offs_cap * sizeof(size_t));
+  }
+
+  char *p = ld->buf + ld->buf_len;
+  size_t hdr[2] = { klen, dlen };
+  memcpy(p, hdr, sizeof(hdr));
+  memcpy(p + sizeof(hdr), RSTRING_PTR(key_obj), klen);
+  memcpy(p + sizeof(hdr) + klen, RSTRING_PTR(val_obj), dlen);
+  ld->offs[ld->n++] = ld->buf_len;
+  ld->buf_len += rec_len;
+  ld->added++;
+  return self;
+}
+
+/* Loader#finish -> number of records written; closes the loader */
+static mrb_value
+mrb_mdb_loader_finish_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_mdb_loader *ld = mrb_mdb_loader_get(mrb, self);
+  mrb_value db_obj = mrb_mdb_loader_db(mrb, self);
+  mrb_mdb_database *db = mrb_mdb_loader_database(mrb, self);
+  mrb_mdb_env *env = mrb_mdb_database_env_state(mrb, db_obj);
+
+  /* The buffer is the last, highest-priority source. */
+  size_t m = mrb_mdb_loader_sort(mrb, self, ld);
+  mrb_mdb_loader_open_srcs(mrb, ld, ld->nruns + 1);
+  for (size_t i = 0; i < ld->nruns; i++)
+    ld->srcs[i].f = ld->runs[i];
+  ld->srcs[ld->nruns].mem     = ld->recs;
+  ld->srcs[ld->nruns].mem_end = ld->recs + m;
+
+  mrb_mdb_bloom_txn bloom;
+  mrb_mdb_bulk_ctx ctx = { NULL, db->dbi, (db->flags & MDB_DUPSORT) != 0, db, &bloom };
+  size_t k = 0;
+  int rc = MDB_SUCCESS;
+  const char *func = "fread";
+  for (size_t i = 0; i < ld->nsrcs && rc == MDB_SUCCESS; i++) {
+    rc = mrb_mdb_loader_src_next(mrb, &ld->srcs[i]);
+    if (rc == MDB_SUCCESS)
+      ld->heap[k++] = i;
+    else if (rc == MDB_NOTFOUND)
+      rc = MDB_SUCCESS;
+  }
+
+  MDB_txn *txn = NULL;
+  MDB_cursor *cursor = NULL;
+  mrb_bool appending = FALSE;
+  size_t in_txn = 0, written = 0;
+  if (rc == MDB_SUCCESS && k > 0) {
+    /* Not mrb_mdb_env_write_begin: a failure must still release the loader. */
+    mrb_mdb_env_release_snapshot(env);
+    func = "mdb_txn_begin";
+    if ((rc = mdb_txn_begin(env->env, NULL, 0, &txn)) != MDB_SUCCESS)
+      txn = NULL;
+  }
+  if (rc == MDB_SUCCESS && k > 0) {
+    ctx.txn = txn;
+    mrb_mdb_bloom_begin(txn, db, &bloom);
+    for (size_t i = k / 2; i-- > 0; )
+      mrb_mdb_loader_sift_down(&ctx, ld->srcs, ld->heap, k, i);
+  }
+
+  while (rc == MDB_SUCCESS && k > 0) {
+    mrb_bool skip;
+    size_t r = mrb_mdb_loader_pop(&ctx, ld, &k, &skip);
+    if (!skip) {
+      if (!cursor) {
+        func = "mdb_cursor_open";
+        if ((rc = mdb_cursor_open(txn, db->dbi, &cursor)) != MDB_SUCCESS) {
+          cursor = NULL;
+          break;
+        }
+      }
+      func = "mdb_cursor_put";
+      if ((rc = mrb_mdb_loader_put(&ctx, cursor, &appending, &ld->srcs[r].cur)) != MDB_SUCCESS)
+        break;
+      written++;
+      if (++in_txn == ld->txn_size && k > 0) {
+        mdb_cursor_close(cursor);
+        cursor = NULL;
+        in_txn = 0;
+        func = "mdb_put";
+        if ((rc = mrb_mdb_bloom_end(txn, db, &bloom)) != MDB_SUCCESS)
+          break;
+        func = "mdb_txn_commit";
+        rc = mdb_txn_commit(txn);
+        if (rc == MDB_SUCCESS)
+          rc = mdb_txn_begin(env->env, NULL, 0, &txn);
+        if (rc != MDB_SUCCESS) {
+          txn = NULL;
+          break;
+        }
+        ctx.txn = txn;
+        mrb_mdb_bloom_begin(txn, db, &bloom);
+      }
+    }
+
+    func = "fread";
+    rc = mrb_mdb_loader_refill(mrb, &ctx, ld, &k, r);
+  }
+
+  if (cursor)
+    mdb_cursor_close(cursor);
+  if (txn && rc == MDB_SUCCESS) {
+    func = "mdb_put";
+    rc = mrb_mdb_bloom_end(txn, db, &bloom);
+  }
+  if (txn && rc == MDB_SUCCESS) {
+    func = "mdb_txn_commit";
+    rc = mdb_txn_commit(txn);
+  }
+  else if (txn)
+    mdb_txn_abort(txn);
+  mrb_mdb_loader_release(mrb, ld);
+  if (unlikely(rc != MDB_SUCCESS))
+    mrb_mdb_raise(mrb, rc, func);
+  return mrb_convert_size_t(mrb, written);
+}
+
+/* Loader#close — discard buffered pairs and spilled runs */
+static mrb_value
+mrb_mdb_loader_close_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_mdb_loader *ld = (mrb_mdb_loader *)mrb_data_get_ptr(mrb, self, &mdb_loader_type);
+  if (!ld || ld->closed)
+    return mrb_false_value();
+  mrb_mdb_loader_release(mrb, ld);
+  return mrb_true_value();
+}
+
+/* Loader#closed? */
+static mrb_value
+mrb_mdb_loader_closed_p_m(mrb_state *mrb, mrb_value self)
+{
+  mrb_mdb_loader *ld = (mrb_mdb_loader *)mrb_data_get_ptr(mrb, self, &mdb_loader_type);
+  return mrb_bool_value(!ld || ld->closed);
+}
+
+/* Loader#size — pairs added so far */
+static mrb_value
+mrb_mdb_loader_size_m(mrb_state *mrb, mrb_value self)
+{
+  return mrb_convert_size_t(mrb, mrb_mdb_loader_get(mrb, self)->added);
+}
+
+/* Loader#runs — sorted runs spilled to disk so far */
+static mrb_value
+mrb_mdb_loader_runs_m(mrb_state *mrb, mrb_value self)
+{
+  return mrb_convert_size_t(mrb, mrb_mdb_loader_get(mrb, self)->nruns);
+}
+
 /* ========================================================================
  * MDB bulk module functions (low-level, used by old Ruby helpers still
  * callable from user code via MDB.get / MDB.put / MDB.del etc.)
@@ -1778,6 +6957,38 @@ mrb_lmdb_del(mrb_state *mrb, MDB_txn *txn, MDB_dbi dbi,
   mrb_mdb_raise(mrb, rc, "mdb_del");
 }
 
+MRB_API MDB_env *
+mrb_lmdb_env_ptr(mrb_state *mrb, mrb_value env)
+{
+  return mrb_mdb_env_get(mrb, env);
+}
+
+MRB_API MDB_txn *
+mrb_lmdb_txn_ptr(mrb_state *mrb, mrb_value txn)
+{
+  return mrb_mdb_txn_get(mrb, txn);
+}
+
+MRB_API MDB_dbi
+mrb_lmdb_dbi(mrb_state *mrb, mrb_value database)
+{
+  return mrb_mdb_database_dbi(mrb, database);
+}
+
+MRB_API void
+mrb_lmdb_env_release(MDB_env *env)
+{
+  mrb_mdb_env *e = (mrb_mdb_env *)mdb_env_get_userctx(env);
+  if (e)
+    mrb_mdb_env_release_snapshot(e);
+}
+
+MRB_API mrb_noreturn void
+mrb_lmdb_raise(mrb_state *mrb, int rc, const char *func)
+{
+  mrb_mdb_raise(mrb, rc, func);
+}
+
 /* ========================================================================
  * Gem init / final
  * ======================================================================== */
@@ -1792,6 +7003,16 @@ mrb_mruby_lmdb_gem_init(mrb_state *mrb)
   struct RClass *mdb_cursor_class;
   struct RClass *mdb_dbi_mod;
   struct RClass *mdb_database_class;
+  struct RClass *mdb_view_class;
+  struct RClass *mdb_buffer_class;
+  struct RClass *mdb_loader_class;
+  struct RClass *mdb_index_class;
+  struct RClass *mdb_key_mod;
+
+  mrb_mdb_gem_state *st = (mrb_mdb_gem_state *)mrb_calloc(mrb, 1, sizeof(mrb_mdb_gem_state));
+  mrb_iv_set(mrb, mrb_obj_value(mrb->object_class), MRB_SYM(__mruby_lmdb__),
+    mrb_obj_value(mrb_data_object_alloc(mrb, mrb->object_class, st, &mdb_gem_state_type)));
+  st->mdb_mod = mdb_mod;
 
   mrb_define_const_id(mrb, mdb_mod, MRB_SYM(VERSION),
     mrb_str_new_lit_frozen(mrb, MDB_VERSION_STRING));
@@ -1818,6 +7039,7 @@ mrb_mruby_lmdb_gem_init(mrb_state *mrb)
   /* ── MDB::Error ──────────────────────────────────────────────────────── */
   mdb_error_class = mrb_define_class_under_id(mrb, mdb_mod,
     MRB_SYM(Error), E_RUNTIME_ERROR);
+  st->error_class = mdb_error_class;
 
   mrb_value error2class = mrb_hash_new(mrb);
   mrb_define_const_id(mrb, mdb_error_class, MRB_SYM(Error2Class), error2class);
@@ -1829,6 +7051,7 @@ mrb_mruby_lmdb_gem_init(mrb_state *mrb)
         RB_CLASS_NAME, mdb_error_class); \
       mrb_hash_set(mrb, error2class, mrb_int_value(mrb, MDB_ERROR), \
         mrb_obj_value(err)); \
+      st->errors[MDB_ERROR - MDB_KEYEXIST] = err; \
       mrb_gc_arena_restore(mrb, ai); \
     } while(0)
   #include "known_errors_def.cstub"
@@ -1838,6 +7061,7 @@ mrb_mruby_lmdb_gem_init(mrb_state *mrb)
   mdb_env_class = mrb_define_class_under_id(mrb, mdb_mod,
     MRB_SYM(Env), mrb->object_class);
   MRB_SET_INSTANCE_TT(mdb_env_class, MRB_TT_CDATA);
+  st->env_class = mdb_env_class;
 
   mrb_define_method_id(mrb, mdb_env_class,       MRB_SYM(initialize),   mrb_mdb_env_init,             MRB_ARGS_OPT(1));
   mrb_define_method_id(mrb, mdb_env_class,       MRB_SYM(open),         mrb_mdb_env_open,             MRB_ARGS_ARG(1,2));
@@ -1855,13 +7079,16 @@ mrb_mruby_lmdb_gem_init(mrb_state *mrb)
   mrb_define_method_id(mrb, mdb_env_class,       MRB_SYM_E(maxdbs),     mrb_mdb_env_set_maxdbs_m,     MRB_ARGS_REQ(1));
   mrb_define_method_id(mrb, mdb_env_class,       MRB_SYM(maxkeysize),   mrb_mdb_env_get_maxkeysize_m, MRB_ARGS_NONE());
   mrb_define_method_id(mrb, mdb_env_class,       MRB_SYM(reader_check), mrb_mdb_reader_check_m,       MRB_ARGS_NONE());
+  mrb_define_method_id(mrb, mdb_env_class,       MRB_SYM(max_staleness),   mrb_mdb_env_get_max_staleness_m, MRB_ARGS_NONE());
+  mrb_define_method_id(mrb, mdb_env_class,       MRB_SYM_E(max_staleness), mrb_mdb_env_set_max_staleness_m, MRB_ARGS_REQ(1));
   mrb_define_method_id(mrb, mdb_env_class,       MRB_SYM(transaction),  mrb_mdb_env_transaction_m,    MRB_ARGS_OPT(1)|MRB_ARGS_BLOCK());
-  mrb_define_method_id(mrb, mdb_env_class,       MRB_SYM(database),     mrb_mdb_env_database_m,       MRB_ARGS_OPT(2));
+  mrb_define_method_id(mrb, mdb_env_class,       MRB_SYM(database),     mrb_mdb_env_database_m,       MRB_ARGS_ANY());
 
   /* ── MDB::Txn ────────────────────────────────────────────────────────── */
   mdb_txn_class = mrb_define_class_under_id(mrb, mdb_mod,
     MRB_SYM(Txn), mrb->object_class);
   MRB_SET_INSTANCE_TT(mdb_txn_class, MRB_TT_CDATA);
+  st->txn_class = mdb_txn_class;
 
   mrb_define_method_id(mrb, mdb_txn_class, MRB_SYM(initialize), mrb_mdb_txn_init,     MRB_ARGS_ARG(1,2));
   mrb_define_method_id(mrb, mdb_txn_class, MRB_SYM(commit),     mrb_mdb_txn_commit_m, MRB_ARGS_NONE());
@@ -1869,15 +7096,89 @@ mrb_mruby_lmdb_gem_init(mrb_state *mrb)
   mrb_define_method_id(mrb, mdb_txn_class, MRB_SYM(reset),      mrb_mdb_txn_reset_m,  MRB_ARGS_NONE());
   mrb_define_method_id(mrb, mdb_txn_class, MRB_SYM(renew),      mrb_mdb_txn_renew_m,  MRB_ARGS_NONE());
 
+  /* ── MDB::View ───────────────────────────────────────────────────────── */
+  mdb_view_class = mrb_define_class_under_id(mrb, mdb_mod,
+    MRB_SYM(View), mrb->object_class);
+  MRB_SET_INSTANCE_TT(mdb_view_class, MRB_TT_CDATA);
+  st->view_class = mdb_view_class;
+  mrb_undef_class_method_id(mrb, mdb_view_class, MRB_SYM(new));
+
+  mrb_define_method_id(mrb, mdb_view_class, MRB_SYM_Q(valid),       mrb_mdb_view_valid_p_m,      MRB_ARGS_NONE());
+  mrb_define_method_id(mrb, mdb_view_class, MRB_SYM(bytesize),      mrb_mdb_view_bytesize_m,     MRB_ARGS_NONE());
+  mrb_define_method_id(mrb, mdb_view_class, MRB_SYM(size),          mrb_mdb_view_bytesize_m,     MRB_ARGS_NONE());
+  mrb_define_method_id(mrb, mdb_view_class, MRB_SYM(length),        mrb_mdb_view_bytesize_m,     MRB_ARGS_NONE());
+  mrb_define_method_id(mrb, mdb_view_class, MRB_SYM(to_s),          mrb_mdb_view_to_s_m,         MRB_ARGS_NONE());
+  mrb_define_method_id(mrb, mdb_view_class, MRB_SYM(to_str),        mrb_mdb_view_to_s_m,         MRB_ARGS_NONE());
+  mrb_define_method_id(mrb, mdb_view_class, MRB_SYM(byteslice),     mrb_mdb_view_byteslice_m,    MRB_ARGS_ARG(1,1));
+  mrb_define_method_id(mrb, mdb_view_class, MRB_SYM(getbyte),       mrb_mdb_view_getbyte_m,      MRB_ARGS_REQ(1));
+  mrb_define_method_id(mrb, mdb_view_class, MRB_SYM_Q(start_with),  mrb_mdb_view_start_with_p_m, MRB_ARGS_REQ(1));
+  mrb_define_method_id(mrb, mdb_view_class, MRB_OPSYM(eq),          mrb_mdb_view_eq_m,           MRB_ARGS_REQ(1));
+  mrb_define_method_id(mrb, mdb_view_class, MRB_SYM(to_fix),        mrb_mdb_view_to_fix_m,       MRB_ARGS_NONE());
+
+  /* ── MDB::Buffer ─────────────────────────────────────────────────────── */
+  mdb_buffer_class = mrb_define_class_under_id(mrb, mdb_mod,
+    MRB_SYM(Buffer), mrb->object_class);
+  MRB_SET_INSTANCE_TT(mdb_buffer_class, MRB_TT_CDATA);
+  st->buffer_class = mdb_buffer_class;
+  mrb_undef_class_method_id(mrb, mdb_buffer_class, MRB_SYM(new));
+
+  mrb_define_method_id(mrb, mdb_buffer_class, MRB_SYM_Q(valid),   mrb_mdb_buffer_valid_p_m,  MRB_ARGS_NONE());
+  mrb_define_method_id(mrb, mdb_buffer_class, MRB_SYM(bytesize),  mrb_mdb_buffer_bytesize_m, MRB_ARGS_NONE());
+  mrb_define_method_id(mrb, mdb_buffer_class, MRB_SYM(size),      mrb_mdb_buffer_bytesize_m, MRB_ARGS_NONE());
+  mrb_define_method_id(mrb, mdb_buffer_class, MRB_SYM(length),    mrb_mdb_buffer_bytesize_m, MRB_ARGS_NONE());
+  mrb_define_method_id(mrb, mdb_buffer_class, MRB_SYM(pos),       mrb_mdb_buffer_pos_m,      MRB_ARGS_NONE());
+  mrb_define_method_id(mrb, mdb_buffer_class, MRB_SYM_E(pos),     mrb_mdb_buffer_set_pos_m,  MRB_ARGS_REQ(1));
+  mrb_define_method_id(mrb, mdb_buffer_class, MRB_SYM(write),     mrb_mdb_buffer_write_m,    MRB_ARGS_REQ(1));
+  mrb_define_method_id(mrb, mdb_buffer_class, MRB_OPSYM(lshift),  mrb_mdb_buffer_append_m,   MRB_ARGS_REQ(1));
+  mrb_define_method_id(mrb, mdb_buffer_class, MRB_OPSYM(aset),    mrb_mdb_buffer_aset_m,     MRB_ARGS_REQ(2));
+  mrb_define_method_id(mrb, mdb_buffer_class, MRB_SYM(setbyte),   mrb_mdb_buffer_setbyte_m,  MRB_ARGS_REQ(2));
+  mrb_define_method_id(mrb, mdb_buffer_class, MRB_SYM(to_s),      mrb_mdb_buffer_to_s_m,     MRB_ARGS_NONE());
+
+  /* ── MDB::Key ────────────────────────────────────────────────────────── */
+  mdb_key_mod = mrb_define_module_under_id(mrb, mdb_mod, MRB_SYM(Key));
+  mrb_define_module_function_id(mrb, mdb_key_mod, MRB_SYM(pack),   mrb_mdb_key_pack_m,   MRB_ARGS_ANY());
+  mrb_define_module_function_id(mrb, mdb_key_mod, MRB_SYM(unpack), mrb_mdb_key_unpack_m, MRB_ARGS_REQ(1));
+
+  /* ── MDB::Index ──────────────────────────────────────────────────────── */
+  mdb_index_class = mrb_define_class_under_id(mrb, mdb_mod,
+    MRB_SYM(Index), mrb->object_class);
+  MRB_SET_INSTANCE_TT(mdb_index_class, MRB_TT_CDATA);
+  st->index_class = mdb_index_class;
+
+  mrb_define_method_id(mrb, mdb_index_class, MRB_SYM(initialize), mrb_mdb_index_init,       MRB_ARGS_ARG(2,1)|MRB_ARGS_BLOCK());
+  mrb_define_method_id(mrb, mdb_index_class, MRB_OPSYM(aref),     mrb_mdb_index_aref_m,     MRB_ARGS_REQ(1));
+  mrb_define_method_id(mrb, mdb_index_class, MRB_SYM(entries),    mrb_mdb_index_entries_m,  MRB_ARGS_ARG(1,1));
+  mrb_define_method_id(mrb, mdb_index_class, MRB_SYM(values),     mrb_mdb_index_values_m,   MRB_ARGS_REQ(1));
+  mrb_define_method_id(mrb, mdb_index_class, MRB_SYM(keys),       mrb_mdb_index_keys_m,     MRB_ARGS_REQ(1));
+  mrb_define_method_id(mrb, mdb_index_class, MRB_SYM(rebuild),    mrb_mdb_index_rebuild_m,  MRB_ARGS_NONE());
+
+  /* ── MDB::Loader ─────────────────────────────────────────────────────── */
+  mdb_loader_class = mrb_define_class_under_id(mrb, mdb_mod,
+    MRB_SYM(Loader), mrb->object_class);
+  MRB_SET_INSTANCE_TT(mdb_loader_class, MRB_TT_CDATA);
+  st->loader_class = mdb_loader_class;
+
+  mrb_define_method_id(mrb, mdb_loader_class, MRB_SYM(initialize), mrb_mdb_loader_init,       MRB_ARGS_ARG(1,1));
+  mrb_define_method_id(mrb, mdb_loader_class, MRB_SYM(add),        mrb_mdb_loader_add_m,      MRB_ARGS_REQ(2));
+  mrb_define_method_id(mrb, mdb_loader_class, MRB_SYM(finish),     mrb_mdb_loader_finish_m,   MRB_ARGS_NONE());
+  mrb_define_method_id(mrb, mdb_loader_class, MRB_SYM(close),      mrb_mdb_loader_close_m,    MRB_ARGS_NONE());
+  mrb_define_method_id(mrb, mdb_loader_class, MRB_SYM_Q(closed),   mrb_mdb_loader_closed_p_m, MRB_ARGS_NONE());
+  mrb_define_method_id(mrb, mdb_loader_class, MRB_SYM(size),       mrb_mdb_loader_size_m,     MRB_ARGS_NONE());
+  mrb_define_method_id(mrb, mdb_loader_class, MRB_SYM(runs),       mrb_mdb_loader_runs_m,     MRB_ARGS_NONE());
+
   /* ── MDB::Dbi ────────────────────────────────────────────────────────── */
   mdb_dbi_mod = mrb_define_module_under_id(mrb, mdb_mod, MRB_SYM(Dbi));
-  mrb_define_module_function_id(mrb, mdb_dbi_mod, MRB_SYM(open),  mrb_mdb_dbi_open_m,  MRB_ARGS_ARG(1,2));
+  mrb_define_module_function_id(mrb, mdb_dbi_mod, MRB_SYM(open),  mrb_mdb_dbi_open_m,  MRB_ARGS_ARG(1,3));
   mrb_define_module_function_id(mrb, mdb_dbi_mod, MRB_SYM(flags), mrb_mdb_dbi_flags_m, MRB_ARGS_REQ(2));
 
   /* ── MDB module functions ────────────────────────────────────────────── */
   mrb_define_module_function_id(mrb, mdb_mod, MRB_SYM(stat),          mrb_mdb_stat_m,          MRB_ARGS_REQ(2));
   mrb_define_module_function_id(mrb, mdb_mod, MRB_SYM(get),           mrb_mdb_get_m,           MRB_ARGS_REQ(3));
+  mrb_define_module_function_id(mrb, mdb_mod, MRB_SYM(get_view),      mrb_mdb_get_view_m,      MRB_ARGS_REQ(3));
+  mrb_define_module_function_id(mrb, mdb_mod, MRB_SYM_Q(exists),      mrb_mdb_exists_p_m,      MRB_ARGS_REQ(3));
+  mrb_define_module_function_id(mrb, mdb_mod, MRB_SYM(read_at),       mrb_mdb_read_at_m,       MRB_ARGS_REQ(5));
   mrb_define_module_function_id(mrb, mdb_mod, MRB_SYM(put),           mrb_mdb_put_m,           MRB_ARGS_ARG(4,1));
+  mrb_define_module_function_id(mrb, mdb_mod, MRB_SYM(reserve),       mrb_mdb_reserve_m,       MRB_ARGS_ARG(4,1)|MRB_ARGS_BLOCK());
   mrb_define_module_function_id(mrb, mdb_mod, MRB_SYM(del),           mrb_mdb_del_m,           MRB_ARGS_ARG(3,1));
   mrb_define_module_function_id(mrb, mdb_mod, MRB_SYM(drop),          mrb_mdb_drop_m,          MRB_ARGS_ARG(2,1));
   mrb_define_module_function_id(mrb, mdb_mod, MRB_SYM(multi_get),     mrb_mdb_multi_get_m,     MRB_ARGS_REQ(3));
@@ -1888,6 +7189,7 @@ mrb_mruby_lmdb_gem_init(mrb_state *mrb)
   mdb_cursor_class = mrb_define_class_under_id(mrb, mdb_mod,
     MRB_SYM(Cursor), mrb->object_class);
   MRB_SET_INSTANCE_TT(mdb_cursor_class, MRB_TT_CDATA);
+  st->cursor_class = mdb_cursor_class;
 
   #define DEFINE_CURSOR_CONST(name) \
     mrb_define_const_id(mrb, mdb_cursor_class, MRB_SYM(name), mrb_int_value(mrb, MDB_##name))
@@ -1906,7 +7208,11 @@ mrb_mruby_lmdb_gem_init(mrb_state *mrb)
   mrb_define_method_id(mrb, mdb_cursor_class, MRB_SYM(initialize), mrb_mdb_cursor_init,    MRB_ARGS_REQ(2));
   mrb_define_method_id(mrb, mdb_cursor_class, MRB_SYM(close),      mrb_mdb_cursor_close_m, MRB_ARGS_NONE());
   mrb_define_method_id(mrb, mdb_cursor_class, MRB_SYM(renew),      mrb_mdb_cursor_renew_m, MRB_ARGS_REQ(1));
+  mrb_define_method_id(mrb, mdb_cursor_class, MRB_SYM(get_multiple),  mrb_mdb_cursor_get_multiple_m,  MRB_ARGS_OPT(1));
+  mrb_define_method_id(mrb, mdb_cursor_class, MRB_SYM(next_multiple), mrb_mdb_cursor_next_multiple_m, MRB_ARGS_NONE());
+  mrb_define_method_id(mrb, mdb_cursor_class, MRB_SYM(prev_multiple), mrb_mdb_cursor_prev_multiple_m, MRB_ARGS_NONE());
   mrb_define_method_id(mrb, mdb_cursor_class, MRB_SYM(get),        mrb_mdb_cursor_get_m,   MRB_ARGS_ARG(1,2));
+  mrb_define_method_id(mrb, mdb_cursor_class, MRB_SYM(get_view),   mrb_mdb_cursor_get_view_m, MRB_ARGS_ARG(1,2));
   mrb_define_method_id(mrb, mdb_cursor_class, MRB_SYM(put),        mrb_mdb_cursor_put_m,   MRB_ARGS_ARG(2,1));
   mrb_define_method_id(mrb, mdb_cursor_class, MRB_SYM(del),        mrb_mdb_cursor_del_m,   MRB_ARGS_OPT(1));
   mrb_define_method_id(mrb, mdb_cursor_class, MRB_SYM(count),      mrb_mdb_cursor_count_m, MRB_ARGS_NONE());
@@ -1929,16 +7235,37 @@ mrb_mruby_lmdb_gem_init(mrb_state *mrb)
   /* ── MDB::Database ───────────────────────────────────────────────────── */
   mdb_database_class = mrb_define_class_under_id(mrb, mdb_mod,
     MRB_SYM(Database), mrb->object_class);
+  MRB_SET_INSTANCE_TT(mdb_database_class, MRB_TT_CDATA);
+  st->database_class = mdb_database_class;
 
   mrb_include_module(mrb, mdb_database_class,
     mrb_module_get_id(mrb, MRB_SYM(Enumerable)));
 
-  mrb_define_method_id(mrb, mdb_database_class, MRB_SYM(initialize),  mrb_mdb_database_init,        MRB_ARGS_ARG(1,2));
+  mrb_define_method_id(mrb, mdb_database_class, MRB_SYM(initialize),  mrb_mdb_database_init,        MRB_ARGS_ARG(1,3));
   mrb_define_method_id(mrb, mdb_database_class, MRB_SYM(dbi),         mrb_mdb_database_dbi_m,       MRB_ARGS_NONE());
+  mrb_define_method_id(mrb, mdb_database_class, MRB_SYM(codec),       mrb_mdb_database_codec_m,     MRB_ARGS_NONE());
+  mrb_define_method_id(mrb, mdb_database_class, MRB_SYM_E(codec),     mrb_mdb_database_set_codec_m, MRB_ARGS_REQ(1));
+  mrb_define_method_id(mrb, mdb_database_class, MRB_SYM(compress),    mrb_mdb_database_compress_m,  MRB_ARGS_NONE());
+  mrb_define_method_id(mrb, mdb_database_class, MRB_SYM_E(compress),  mrb_mdb_database_set_compress_m, MRB_ARGS_REQ(1));
+  mrb_define_method_id(mrb, mdb_database_class, MRB_SYM(cache),       mrb_mdb_database_cache_m,     MRB_ARGS_NONE());
+  mrb_define_method_id(mrb, mdb_database_class, MRB_SYM_E(cache),     mrb_mdb_database_set_cache_m, MRB_ARGS_REQ(1));
+  mrb_define_method_id(mrb, mdb_database_class, MRB_SYM(cache_stats), mrb_mdb_database_cache_stats_m, MRB_ARGS_NONE());
+  mrb_define_method_id(mrb, mdb_database_class, MRB_SYM(cache_clear), mrb_mdb_database_cache_clear_m, MRB_ARGS_NONE());
+  mrb_define_method_id(mrb, mdb_database_class, MRB_SYM(rebuild_bloom), mrb_mdb_database_rebuild_bloom_m, MRB_ARGS_OPT(2));
+  mrb_define_method_id(mrb, mdb_database_class, MRB_SYM(drop_bloom),    mrb_mdb_database_drop_bloom_m,    MRB_ARGS_NONE());
+  mrb_define_method_id(mrb, mdb_database_class, MRB_SYM(bloom_stats),   mrb_mdb_database_bloom_stats_m,   MRB_ARGS_NONE());
+  mrb_define_method_id(mrb, mdb_database_class, MRB_SYM(train_dictionary),   mrb_mdb_database_train_dictionary_m,   MRB_ARGS_OPT(2));
+  mrb_define_method_id(mrb, mdb_database_class, MRB_SYM(dictionary_version), mrb_mdb_database_dictionary_version_m, MRB_ARGS_NONE());
   mrb_define_method_id(mrb, mdb_database_class, MRB_OPSYM(aref),          mrb_mdb_database_aref_m,      MRB_ARGS_REQ(1));
   mrb_define_method_id(mrb, mdb_database_class, MRB_OPSYM(aset),        mrb_mdb_database_aset_m,      MRB_ARGS_REQ(2));
+  mrb_define_method_id(mrb, mdb_database_class, MRB_SYM(reserve),     mrb_mdb_database_reserve_m,   MRB_ARGS_ARG(2,1)|MRB_ARGS_BLOCK());
   mrb_define_method_id(mrb, mdb_database_class, MRB_SYM(del),         mrb_mdb_database_del_m,       MRB_ARGS_ARG(1,1));
   mrb_define_method_id(mrb, mdb_database_class, MRB_SYM(fetch),       mrb_mdb_database_fetch_m,     MRB_ARGS_ARG(1,1)|MRB_ARGS_BLOCK());
+  mrb_define_method_id(mrb, mdb_database_class, MRB_SYM_Q(key),       mrb_mdb_database_key_p_m,     MRB_ARGS_REQ(1));
+  mrb_define_method_id(mrb, mdb_database_class, MRB_SYM_Q(has_key),   mrb_mdb_database_key_p_m,     MRB_ARGS_REQ(1));
+  mrb_define_method_id(mrb, mdb_database_class, MRB_SYM_Q(keys),      mrb_mdb_database_keys_p_m,    MRB_ARGS_REQ(1));
+  mrb_define_method_id(mrb, mdb_database_class, MRB_SYM(bytesize),    mrb_mdb_database_bytesize_m,  MRB_ARGS_REQ(1));
+  mrb_define_method_id(mrb, mdb_database_class, MRB_SYM(read_at),     mrb_mdb_database_read_at_m,   MRB_ARGS_ARG(3, 1));
   mrb_define_method_id(mrb, mdb_database_class, MRB_SYM(stat),        mrb_mdb_database_stat_m,      MRB_ARGS_NONE());
   mrb_define_method_id(mrb, mdb_database_class, MRB_SYM(length),      mrb_mdb_database_length_m,    MRB_ARGS_NONE());
   mrb_define_method_id(mrb, mdb_database_class, MRB_SYM(size),        mrb_mdb_database_length_m,    MRB_ARGS_NONE());
@@ -1951,11 +7278,25 @@ mrb_mruby_lmdb_gem_init(mrb_state *mrb)
   mrb_define_method_id(mrb, mdb_database_class, MRB_SYM(transaction), mrb_mdb_database_transaction_m, MRB_ARGS_OPT(1)|MRB_ARGS_BLOCK());
   mrb_define_method_id(mrb, mdb_database_class, MRB_SYM(cursor),      mrb_mdb_database_cursor_m,      MRB_ARGS_OPT(1)|MRB_ARGS_BLOCK());
   mrb_define_method_id(mrb, mdb_database_class, MRB_SYM(each),        mrb_mdb_database_each_m,      MRB_ARGS_BLOCK());
+  mrb_define_method_id(mrb, mdb_database_class, MRB_SYM(each_view),   mrb_mdb_database_each_view_m, MRB_ARGS_BLOCK());
   mrb_define_method_id(mrb, mdb_database_class, MRB_SYM(each_key),    mrb_mdb_database_each_key_m,  MRB_ARGS_REQ(1)|MRB_ARGS_BLOCK());
-  mrb_define_method_id(mrb, mdb_database_class, MRB_SYM(each_prefix), mrb_mdb_database_each_prefix_m, MRB_ARGS_REQ(1)|MRB_ARGS_BLOCK());
+  mrb_define_method_id(mrb, mdb_database_class, MRB_SYM(each_prefix), mrb_mdb_database_each_prefix_m, MRB_ARGS_ARG(1,1)|MRB_ARGS_BLOCK());
+  mrb_define_method_id(mrb, mdb_database_class, MRB_SYM(reverse_each),      mrb_mdb_database_reverse_each_m,      MRB_ARGS_OPT(1)|MRB_ARGS_BLOCK());
+  mrb_define_method_id(mrb, mdb_database_class, MRB_SYM(each_range),        mrb_mdb_database_each_range_m,        MRB_ARGS_ARG(2,1)|MRB_ARGS_BLOCK());
+  mrb_define_method_id(mrb, mdb_database_class, MRB_SYM(keys),              mrb_mdb_database_keys_m,              MRB_ARGS_OPT(1));
+  mrb_define_method_id(mrb, mdb_database_class, MRB_SYM(values),            mrb_mdb_database_values_m,            MRB_ARGS_OPT(1));
+  mrb_define_method_id(mrb, mdb_database_class, MRB_SYM(each_key_only),     mrb_mdb_database_each_key_only_m,     MRB_ARGS_OPT(1)|MRB_ARGS_BLOCK());
+  mrb_define_method_id(mrb, mdb_database_class, MRB_SYM(each_value),        mrb_mdb_database_each_value_m,        MRB_ARGS_OPT(1)|MRB_ARGS_BLOCK());
+  mrb_define_method_id(mrb, mdb_database_class, MRB_SYM(count_prefix),      mrb_mdb_database_count_prefix_m,      MRB_ARGS_REQ(1));
+  mrb_define_method_id(mrb, mdb_database_class, MRB_SYM(count_range),       mrb_mdb_database_count_range_m,       MRB_ARGS_ARG(2,1));
+  mrb_define_method_id(mrb, mdb_database_class, MRB_SYM(each_dup_page),     mrb_mdb_database_each_dup_page_m,     MRB_ARGS_REQ(1)|MRB_ARGS_BLOCK());
+  mrb_define_method_id(mrb, mdb_database_class, MRB_SYM(each_slice),        mrb_mdb_database_each_slice_m,        MRB_ARGS_REQ(1)|MRB_ARGS_BLOCK());
+  mrb_define_method_id(mrb, mdb_database_class, MRB_SYM(each_prefix_slice), mrb_mdb_database_each_prefix_slice_m, MRB_ARGS_REQ(2)|MRB_ARGS_BLOCK());
+  mrb_define_method_id(mrb, mdb_database_class, MRB_SYM(each_key_slice),    mrb_mdb_database_each_key_slice_m,    MRB_ARGS_REQ(2)|MRB_ARGS_BLOCK());
   mrb_define_method_id(mrb, mdb_database_class, MRB_OPSYM(lshift),          mrb_mdb_database_append_m,    MRB_ARGS_REQ(1));
   mrb_define_method_id(mrb, mdb_database_class, MRB_SYM(multi_get),   mrb_mdb_database_multi_get_m, MRB_ARGS_REQ(1));
   mrb_define_method_id(mrb, mdb_database_class, MRB_SYM(batch_put),   mrb_mdb_database_batch_put_m, MRB_ARGS_ARG(1,1));
+  mrb_define_method_id(mrb, mdb_database_class, MRB_SYM(bulk_load),   mrb_mdb_database_bulk_load_m, MRB_ARGS_REQ(1));
   mrb_define_method_id(mrb, mdb_database_class, MRB_SYM(concat),      mrb_mdb_database_concat_m,    MRB_ARGS_REQ(1));
   mrb_define_method_id(mrb, mdb_database_class, MRB_SYM(to_a),        mrb_mdb_database_to_a_m,      MRB_ARGS_NONE());
   mrb_define_method_id(mrb, mdb_database_class, MRB_SYM(to_h),        mrb_mdb_database_to_h_m,      MRB_ARGS_NONE());
@@ -1968,5 +7309,9 @@ mrb_mruby_lmdb_gem_init(mrb_state *mrb)
 MRB_API void
 mrb_mruby_lmdb_gem_final(mrb_state *mrb)
 {
-  (void)mrb;
+  /* A later mrb_state may be allocated at the same address. */
+  if (mrb_mdb_gem_state_owner == mrb) {
+    mrb_mdb_gem_state_owner = NULL;
+    mrb_mdb_gem_state_last  = NULL;
+  }
 }
\ No newline at end of file
@@ -5,8 +5,18 @@
 #include <stddef.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#ifdef _WIN32
+# include <windows.h>
+#else
+# include <time.h>
+# include <unistd.h>
+#endif
 
 #include "lmdb.h"
+#include "mrb_lmdb_lz4.h"
 
 #include <mruby.h>
 #include <mruby/data.h>
@@ -20,20 +30,313 @@
 #include <mruby/branch_pred.h>
 #include <mruby/num_helpers.h>
 
+/* ── Native state ─────────────────────────────────────────────────────────── */
+
+/*
+ * MDB::Env payload. Env#close closes env and sets it to NULL but leaves the
+ * struct attached until GC, so Databases can keep a pointer to it.
+ *
+ * One-shot Database reads borrow rtxn instead of paying
+ * for mdb_txn_begin/mdb_txn_abort on every call: with max_staleness == 0
+ * the txn is reset after each read and renewed on the next one; with a
+ * positive bound the snapshot stays open and is renewed once it is older
+ * than max_staleness seconds (or as soon as this Env starts another txn).
+ *
+ * The struct is also the MDB_env user context, so code that only has an
+ * MDB_txn can find it through mdb_env_get_userctx(mdb_txn_env(txn)).
+ */
+typedef struct mrb_mdb_env {
+  MDB_env *env;
+  MDB_txn *rtxn;
+  double   rtxn_taken;
+  double   max_staleness;
+  mrb_bool rtxn_live;   /* snapshot held, i.e. not reset */
+  mrb_bool rtxn_busy;   /* checked out by an in-flight read */
+  uint8_t *cmp;         /* native comparator ids per dbi (key | dup << 4) */
+  size_t   cmp_len;
+} mrb_mdb_env;
+
+/*
+ * MDB::Txn payload. generation is bumped whenever the snapshot is released
+ * (reset); MDB::View objects remember the generation they were created in.
+ */
+typedef struct mrb_mdb_txn {
+  MDB_txn     *txn;
+  unsigned int flags;
+  uint32_t     generation;
+} mrb_mdb_txn;
+
+/*
+ * MDB::Database payload. env is owned by the MDB::Env held in @env (which
+ * keeps it alive); flags are the persistent DB flags read at open time.
+ * indexed is set once an MDB::Index is attached (kept in @indexes); codec
+ * selects how values are encoded (MRB_MDB_CODEC_RAW / _NATIVE) and compress
+ * how the encoded bytes are stored (MRB_MDB_COMPRESS_NONE / _LZ4).
+ *
+ * name is the DB name (NULL for the main DB); it keys the trained
+ * compression dictionaries. dicts caches every dictionary version seen so
+ * far, loaded on first use; dict is the one new writes use (NULL: none).
+ *
+ * cache is the optional read-through value cache (NULL: disabled).
+ *
+ * bloom is set while a Bloom filter exists for the DB. bloom_hdr is its
+ * header as of read snapshot bloom_txnid, and bloom_usable whether lookups
+ * in that snapshot may trust it. The counters are this handle's lookups
+ * the filter answered (bloom_negatives) and the ones it let through that
+ * then missed (bloom_false).
+ */
+typedef struct mrb_mdb_dict {
+  uint32_t         version;
+  uint8_t         *data;
+  mrb_mdb_lz4_dict lz;
+} mrb_mdb_dict;
+
+/*
+ * Read cache for Database#[]. Each entry owns a copy of its key and refers
+ * to its frozen value by slot in the Database's @cache_values Array, which
+ * keeps the values alive for the GC; freed slots are reused. Entries are
+ * chained in buckets by key hash and linked most-recently-used first.
+ * txnid is the last committed txn the entries are valid for; cost counts
+ * key and value bytes plus a fixed per-entry overhead against limit.
+ */
+typedef struct mrb_mdb_cache_entry {
+  struct mrb_mdb_cache_entry *prev, *next, *chain;
+  uint32_t hash;
+  mrb_int  slot;
+  size_t   cost;
+  size_t   klen;
+  char     key[];
+} mrb_mdb_cache_entry;
+
+typedef struct mrb_mdb_cache {
+  mrb_mdb_cache_entry **buckets;
+  size_t               nbuckets;
+  size_t               count;
+  mrb_mdb_cache_entry *head, *tail;
+  mrb_int             *free_slots;
+  size_t               nfree;
+  size_t               free_cap;
+  mrb_int              nslots;
+  size_t               bytes;
+  size_t               limit;
+  size_t               txnid;
+  uint64_t             hits;
+  uint64_t             misses;
+} mrb_mdb_cache;
+
+/* Bloom filter header as stored in the main DB; see mrb_lmdb.c. */
+typedef struct mrb_mdb_bloom_hdr {
+  uint32_t magic;
+  uint32_t nsegs;
+  uint32_t hashes;
+  uint32_t bits_per_key;
+  uint64_t keys;     /* distinct keys added since the last rebuild */
+  uint64_t deletes;  /* deletes since the last rebuild */
+  uint64_t txnid;    /* last write txn that kept it, or MRB_MDB_BLOOM_STALE */
+} mrb_mdb_bloom_hdr;
+
+typedef struct mrb_mdb_database {
+  mrb_mdb_env   *env;
+  MDB_dbi        dbi;
+  unsigned int   flags;
+  mrb_bool       indexed;
+  uint8_t        codec;
+  uint8_t        compress;
+  char          *name;
+  mrb_mdb_dict **dicts;
+  size_t         ndicts;
+  mrb_mdb_dict  *dict;
+  mrb_mdb_cache *cache;
+  mrb_bool       bloom;
+  mrb_bool       bloom_usable;
+  size_t         bloom_txnid;
+  mrb_mdb_bloom_hdr bloom_hdr;
+  uint64_t       bloom_negatives;
+  uint64_t       bloom_false;
+} mrb_mdb_database;
+
+/*
+ * MDB::Index payload: the index dbi, and the MDB::Key part of the primary
+ * value to index (field >= 0) or -1 when the @extract block is used.
+ */
+typedef struct mrb_mdb_index {
+  MDB_dbi dbi;
+  mrb_int field;
+} mrb_mdb_index;
+
+/* MDB::View payload: points straight into the map, never owns memory. */
+typedef struct mrb_mdb_view {
+  const char *ptr;
+  size_t      len;
+  uint32_t    generation;
+} mrb_mdb_view;
+
+/*
+ * MDB::Buffer payload: space handed out by MDB_RESERVE. ptr is NULL once
+ * the reserve block returns.
+ */
+typedef struct mrb_mdb_buffer {
+  char  *ptr;
+  size_t len;
+  size_t pos;
+} mrb_mdb_buffer;
+
+/* A key/data pair borrowed from elsewhere (input Strings, a loader buffer). */
+typedef struct mrb_mdb_bulk_rec {
+  MDB_val key;
+  MDB_val data;
+} mrb_mdb_bulk_rec;
+
+/* One sorted input of the MDB::Loader merge: a spilled run or the buffer. */
+typedef struct mrb_mdb_loader_src {
+  FILE                   *f;
+  const mrb_mdb_bulk_rec *mem, *mem_end;
+  char                   *buf;
+  size_t                  cap;
+  mrb_mdb_bulk_rec        cur;
+} mrb_mdb_loader_src;
+
+/*
+ * MDB::Loader payload. Pairs are buffered in buf as
+ * [size_t klen][size_t dlen][key][data] (the run file format too) with
+ * their offsets in offs; when the buffer reaches memory bytes it is sorted
+ * and spilled to an unlinked temp file. levels[i] counts the merges behind
+ * runs[i] (0 for a spilled buffer). recs, srcs and heap are scratch for
+ * sorting and merging and are freed with the loader.
+ */
+typedef struct mrb_mdb_loader {
+  char               *buf;
+  size_t              buf_len, buf_cap;
+  size_t             *offs;
+  size_t              n, offs_cap;
+  mrb_mdb_bulk_rec   *recs;
+  FILE              **runs;
+  uint8_t            *levels;
+  size_t              nruns, runs_cap;
+  mrb_mdb_loader_src *srcs;
+  size_t              nsrcs;
+  size_t             *heap;
+  size_t              memory;
+  size_t              txn_size;
+  size_t              added;
+  mrb_bool            closed;
+} mrb_mdb_loader;
+
+/*
+ * Per-mrb_state gem state: classes and the error mapping, resolved once in
+ * gem_init. MDB::Stat and MDB::Env::Info are defined in mrblib, which
+ * loads after gem_init, so those two are filled in on first use.
+ */
+typedef struct mrb_mdb_gem_state {
+  struct RClass *mdb_mod;
+  struct RClass *error_class;
+  struct RClass *env_class;
+  struct RClass *txn_class;
+  struct RClass *cursor_class;
+  struct RClass *database_class;
+  struct RClass *view_class;
+  struct RClass *buffer_class;
+  struct RClass *loader_class;
+  struct RClass *index_class;
+  struct RClass *stat_class;
+  struct RClass *info_class;
+  struct RClass *errors[MDB_LAST_ERRCODE - MDB_KEYEXIST + 1];
+} mrb_mdb_gem_state;
+
 /* ── Data type descriptors ────────────────────────────────────────────────── */
 
+static void mrb_mdb_gem_state_free(mrb_state *mrb, void *p) {
+  mrb_free(mrb, p);
+}
+
 static void mrb_mdb_env_free(mrb_state *mrb, void *p) {
-  if (p) mdb_env_close((MDB_env *)p);
+  mrb_mdb_env *e = (mrb_mdb_env *)p;
+  if (e) {
+    if (e->rtxn) mdb_txn_abort(e->rtxn);
+    if (e->env) mdb_env_close(e->env);
+    mrb_free(mrb, e->cmp);
+    mrb_free(mrb, e);
+  }
 }
 
 static void mrb_mdb_txn_free(mrb_state *mrb, void *p) {
-  if (p) mdb_txn_abort((MDB_txn *)p);
+  mrb_mdb_txn *t = (mrb_mdb_txn *)p;
+  if (t) {
+    mdb_txn_abort(t->txn);
+    mrb_free(mrb, t);
+  }
 }
 
 static void mrb_mdb_cursor_free(mrb_state *mrb, void *p) {
   if (p) mdb_cursor_close((MDB_cursor *)p);
 }
 
+/* Drop every cache entry; the slot Array is the caller's to replace. */
+static void mrb_mdb_cache_release(mrb_state *mrb, mrb_mdb_cache *c) {
+  mrb_mdb_cache_entry *e = c->head;
+  while (e) {
+    mrb_mdb_cache_entry *next = e->next;
+    mrb_free(mrb, e);
+    e = next;
+  }
+  if (c->buckets)
+    memset(c->buckets, 0, c->nbuckets * sizeof(*c->buckets));
+  c->head = c->tail = NULL;
+  c->count = c->bytes = c->nfree = 0;
+  c->nslots = 0;
+}
+
+static void mrb_mdb_database_free(mrb_state *mrb, void *p) {
+  mrb_mdb_database *db = (mrb_mdb_database *)p;
+  if (db) {
+    if (db->cache) {
+      mrb_mdb_cache_release(mrb, db->cache);
+      mrb_free(mrb, db->cache->buckets);
+      mrb_free(mrb, db->cache->free_slots);
+      mrb_free(mrb, db->cache);
+    }
+    for (size_t i = 0; i < db->ndicts; i++) {
+      mrb_free(mrb, db->dicts[i]->data);
+      mrb_free(mrb, db->dicts[i]);
+    }
+    mrb_free(mrb, db->dicts);
+    mrb_free(mrb, db->name);
+    mrb_free(mrb, db);
+  }
+}
+
+static void mrb_mdb_view_free(mrb_state *mrb, void *p) {
+  mrb_free(mrb, p);
+}
+
+/* Close spilled runs and drop all buffers; the loader is unusable afterwards. */
+static void mrb_mdb_loader_release(mrb_state *mrb, mrb_mdb_loader *ld) {
+  for (size_t i = 0; i < ld->nruns; i++)
+    fclose(ld->runs[i]);
+  for (size_t i = 0; i < ld->nsrcs; i++)
+    mrb_free(mrb, ld->srcs[i].buf);
+  mrb_free(mrb, ld->runs);
+  mrb_free(mrb, ld->levels);
+  mrb_free(mrb, ld->srcs);
+  mrb_free(mrb, ld->heap);
+  mrb_free(mrb, ld->recs);
+  mrb_free(mrb, ld->offs);
+  mrb_free(mrb, ld->buf);
+  memset(ld, 0, sizeof(*ld));
+  ld->closed = TRUE;
+}
+
+static void mrb_mdb_loader_free(mrb_state *mrb, void *p) {
+  if (p) {
+    mrb_mdb_loader_release(mrb, (mrb_mdb_loader *)p);
+    mrb_free(mrb, p);
+  }
+}
+
+static const struct mrb_data_type mdb_gem_state_type = {
+  "mruby-lmdb", mrb_mdb_gem_state_free,
+};
+
 static const struct mrb_data_type mdb_env_type = {
   "MDB::Env", mrb_mdb_env_free,
 };
@@ -46,11 +349,80 @@ static const struct mrb_data_type mdb_cursor_type = {
   "MDB::Cursor", mrb_mdb_cursor_free,
 };
 
+static const struct mrb_data_type mdb_database_type = {
+  "MDB::Database", mrb_mdb_database_free,
+};
+
+static const struct mrb_data_type mdb_view_type = {
+  "MDB::View", mrb_mdb_view_free,
+};
+
+static const struct mrb_data_type mdb_buffer_type = {
+  "MDB::Buffer", mrb_mdb_view_free,
+};
+
+static const struct mrb_data_type mdb_index_type = {
+  "MDB::Index", mrb_mdb_view_free,
+};
+
+static const struct mrb_data_type mdb_loader_type = {
+  "MDB::Loader", mrb_mdb_loader_free,
+};
+
 /* IOError for closed handles */
 #ifndef E_IO_ERROR
 #define E_IO_ERROR (mrb_exc_get(mrb, "IOError"))
 #endif
 
+/* ── Gem state ────────────────────────────────────────────────────────────── */
+
+#ifdef _MSC_VER
+# define MRB_MDB_THREAD_LOCAL __declspec(thread)
+#else
+# define MRB_MDB_THREAD_LOCAL __thread
+#endif
+
+/*
+ * The state lives under a non-@ ivar of Object, so it is invisible from
+ * Ruby and freed with the mrb_state. Each thread remembers the last
+ * interpreter it asked for, so the ivar is only probed when a thread
+ * switches interpreters; gem_final forgets an interpreter being closed.
+ */
+static MRB_MDB_THREAD_LOCAL mrb_state         *mrb_mdb_gem_state_owner;
+static MRB_MDB_THREAD_LOCAL mrb_mdb_gem_state *mrb_mdb_gem_state_last;
+
+static mrb_mdb_gem_state *
+mrb_mdb_gem_state_get(mrb_state *mrb)
+{
+  if (likely(mrb_mdb_gem_state_owner == mrb))
+    return mrb_mdb_gem_state_last;
+  mrb_value v = mrb_iv_get(mrb, mrb_obj_value(mrb->object_class), MRB_SYM(__mruby_lmdb__));
+  mrb_mdb_gem_state *st = (mrb_mdb_gem_state *)mrb_data_get_ptr(mrb, v, &mdb_gem_state_type);
+  if (st) {
+    mrb_mdb_gem_state_owner = mrb;
+    mrb_mdb_gem_state_last  = st;
+  }
+  return st;
+}
+
+static struct RClass *
+mrb_mdb_stat_class(mrb_state *mrb)
+{
+  mrb_mdb_gem_state *st = mrb_mdb_gem_state_get(mrb);
+  if (unlikely(!st->stat_class))
+    st->stat_class = mrb_class_get_under_id(mrb, st->mdb_mod, MRB_SYM(Stat));
+  return st->stat_class;
+}
+
+static struct RClass *
+mrb_mdb_info_class(mrb_state *mrb)
+{
+  mrb_mdb_gem_state *st = mrb_mdb_gem_state_get(mrb);
+  if (unlikely(!st->info_class))
+    st->info_class = mrb_class_get_under_id(mrb, st->env_class, MRB_SYM(Info));
+  return st->info_class;
+}
+
 /* ── Error handling ───────────────────────────────────────────────────────── */
 
 mrb_noreturn static void
@@ -59,34 +431,62 @@ mrb_mdb_raise(mrb_state *mrb, int rc, const char *func)
   if (rc > 0) {
     mrb_sys_fail(mrb, func);
   }
-  struct RClass *mdb_error = mrb_class_get_under_id(mrb,
-    mrb_module_get_id(mrb, MRB_SYM(MDB)), MRB_SYM(Error));
-  mrb_value error2class = mrb_const_get(mrb,
-    mrb_obj_value(mdb_error), MRB_SYM(Error2Class));
-  mrb_value key = mrb_fixnum_value(rc);
-  mrb_value cls = mrb_hash_fetch(mrb, error2class, key, mrb_obj_value(mdb_error));
+  mrb_mdb_gem_state *st = mrb_mdb_gem_state_get(mrb);
+  struct RClass *cls = NULL;
+  if (rc >= MDB_KEYEXIST && rc <= MDB_LAST_ERRCODE)
+    cls = st->errors[rc - MDB_KEYEXIST];
+  if (!cls)
+    cls = st->error_class;
 
-  mrb_raisef(mrb, (struct RClass *)mrb_ptr(cls), "%s: %s", func, mdb_strerror(rc));
+  mrb_raisef(mrb, cls, "%s: %s", func, mdb_strerror(rc));
 }
 
 /* ── Safe data pointer extraction ─────────────────────────────────────────── */
 
+static mrb_mdb_env *
+mrb_mdb_env_state_get(mrb_state *mrb, mrb_value self)
+{
+  mrb_mdb_env *p = (mrb_mdb_env *)mrb_data_check_get_ptr(mrb, self, &mdb_env_type);
+  if (likely(p && p->env))
+    return p;
+  mrb_raise(mrb, E_IO_ERROR, "closed MDB::Env");
+}
+
 static MDB_env *
 mrb_mdb_env_get(mrb_state *mrb, mrb_value self)
 {
-  MDB_env *p = (MDB_env *)mrb_data_check_get_ptr(mrb, self, &mdb_env_type);
+  return mrb_mdb_env_state_get(mrb, self)->env;
+}
+
+static mrb_mdb_txn *
+mrb_mdb_txn_state_get(mrb_state *mrb, mrb_value self)
+{
+  mrb_mdb_txn *p = (mrb_mdb_txn *)mrb_data_check_get_ptr(mrb, self, &mdb_txn_type);
   if (likely(p))
     return p;
-  mrb_raise(mrb, E_IO_ERROR, "closed MDB::Env");
+  mrb_raise(mrb, E_RUNTIME_ERROR, "closed MDB::Txn");
 }
 
 static MDB_txn *
 mrb_mdb_txn_get(mrb_state *mrb, mrb_value self)
 {
-  MDB_txn *p = (MDB_txn *)mrb_data_check_get_ptr(mrb, self, &mdb_txn_type);
-  if (likely(p))
-    return p;
-  mrb_raise(mrb, E_RUNTIME_ERROR, "closed MDB::Txn");
+  return mrb_mdb_txn_state_get(mrb, self)->txn;
+}
+
+/*
+ * Detach the MDB_txn from a Txn object and return it (NULL if already
+ * closed). The caller is responsible for committing or aborting it.
+ */
+static MDB_txn *
+mrb_mdb_txn_detach(mrb_state *mrb, mrb_value self)
+{
+  mrb_mdb_txn *p = (mrb_mdb_txn *)mrb_data_check_get_ptr(mrb, self, &mdb_txn_type);
+  if (!p)
+    return NULL;
+  MDB_txn *txn = p->txn;
+  mrb_data_init(self, NULL, NULL);
+  mrb_free(mrb, p);
+  return txn;
 }
 
 static MDB_cursor *
@@ -98,21 +498,174 @@ mrb_mdb_cursor_get(mrb_state *mrb, mrb_value self)
   mrb_raise(mrb, E_RUNTIME_ERROR, "closed MDB::Cursor");
 }
 
-static MDB_env *
-mrb_mdb_database_env(mrb_state *mrb, mrb_value self)
+static mrb_mdb_database *
+mrb_mdb_database_get(mrb_state *mrb, mrb_value self)
+{
+  mrb_mdb_database *p = (mrb_mdb_database *)mrb_data_check_get_ptr(mrb, self, &mdb_database_type);
+  if (likely(p))
+    return p;
+  mrb_raise(mrb, E_RUNTIME_ERROR, "uninitialized MDB::Database");
+}
+
+static mrb_mdb_env *
+mrb_mdb_database_env_state(mrb_state *mrb, mrb_value self)
 {
-  mrb_value env_v = mrb_iv_get(mrb, self, MRB_IVSYM(env));
-  return mrb_mdb_env_get(mrb, env_v);
+  mrb_mdb_env *e = mrb_mdb_database_get(mrb, self)->env;
+  if (likely(e->env))
+    return e;
+  mrb_raise(mrb, E_IO_ERROR, "closed MDB::Env");
 }
 
 static MDB_dbi
 mrb_mdb_database_dbi(mrb_state *mrb, mrb_value self)
 {
-  mrb_value dbi_v = mrb_iv_get(mrb, self, MRB_IVSYM(dbi));
-  mrb_int dbi = mrb_integer(dbi_v);
-  if (likely(dbi >= 0 && (uint64_t)dbi <= UINT_MAX))
-    return (MDB_dbi)dbi;
-  mrb_raise(mrb, E_RANGE_ERROR, "dbi out of range");
+  return mrb_mdb_database_get(mrb, self)->dbi;
+}
+
+/* ── Parked read transaction ──────────────────────────────────────────────── */
+
+static double
+mrb_mdb_monotonic_time(void)
+{
+#ifdef _WIN32
+  return (double)GetTickCount64() / 1000.0;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+#endif
+}
+
+/*
+ * Drop a held snapshot before this thread opens any other transaction:
+ * LMDB allows one read txn per thread, and it keeps our own writes visible
+ * to the next one-shot read.
+ */
+static void
+mrb_mdb_env_release_snapshot(mrb_mdb_env *e)
+{
+  if (e->rtxn_live && !e->rtxn_busy) {
+    mdb_txn_reset(e->rtxn);
+    e->rtxn_live = FALSE;
+  }
+}
+
+/* Check out a read-only txn for a one-shot read. Pair with _read_end. */
+static MDB_txn *
+mrb_mdb_env_read_begin(mrb_state *mrb, mrb_mdb_env *e)
+{
+  MDB_txn *txn;
+  int rc;
+
+  if (e->rtxn && !e->rtxn_busy) {
+    if (e->rtxn_live) {
+      if (e->max_staleness > 0 &&
+          mrb_mdb_monotonic_time() - e->rtxn_taken <= e->max_staleness) {
+        e->rtxn_busy = TRUE;
+        return e->rtxn;
+      }
+      mdb_txn_reset(e->rtxn);
+      e->rtxn_live = FALSE;
+    }
+    rc = mdb_txn_renew(e->rtxn);
+    if (unlikely(rc != MDB_SUCCESS))
+      mrb_mdb_raise(mrb, rc, "mdb_txn_renew");
+    e->rtxn_live = TRUE;
+    e->rtxn_busy = TRUE;
+    if (e->max_staleness > 0)
+      e->rtxn_taken = mrb_mdb_monotonic_time();
+    return e->rtxn;
+  }
+
+  rc = mdb_txn_begin(e->env, NULL, MDB_RDONLY, &txn);
+  if (unlikely(rc != MDB_SUCCESS))
+    mrb_mdb_raise(mrb, rc, "mdb_txn_begin");
+  if (!e->rtxn) {
+    e->rtxn      = txn;
+    e->rtxn_live = TRUE;
+    e->rtxn_busy = TRUE;
+    if (e->max_staleness > 0)
+      e->rtxn_taken = mrb_mdb_monotonic_time();
+  }
+  return txn;
+}
+
+/* Return a txn obtained from _read_begin; never raises. */
+static void
+mrb_mdb_env_read_end(mrb_mdb_env *e, MDB_txn *txn)
+{
+  if (txn != e->rtxn) {
+    mdb_txn_abort(txn);
+    return;
+  }
+  e->rtxn_busy = FALSE;
+  if (e->max_staleness <= 0) {
+    mdb_txn_reset(txn);
+    e->rtxn_live = FALSE;
+  }
+}
+
+/*
+ * A one-shot read for mrb_mdb_env_read. body runs with txn checked out and
+ * may raise (allocation, codec errors, its own LMDB errors); a cursor it
+ * leaves in cursor is closed afterwards.
+ */
+typedef struct mrb_mdb_read {
+  MDB_txn    *txn;
+  MDB_cursor *cursor;
+  void       *ud;
+  mrb_value (*body)(mrb_state *mrb, struct mrb_mdb_read *rd);
+} mrb_mdb_read;
+
+static mrb_value
+mrb_mdb_env_read_cb(mrb_state *mrb, void *ud)
+{
+  mrb_mdb_read *rd = (mrb_mdb_read *)ud;
+  return rd->body(mrb, rd);
+}
+
+/*
+ * Run body in a txn from _read_begin under mrb_protect_error, so the txn
+ * is always handed back: a read that raised must not leave rtxn_busy set,
+ * or every later read would begin a second read txn on this thread.
+ */
+static mrb_value
+mrb_mdb_env_read(mrb_state *mrb, mrb_mdb_env *e,
+                 mrb_value (*body)(mrb_state *, mrb_mdb_read *), void *ud)
+{
+  mrb_mdb_read rd = { mrb_mdb_env_read_begin(mrb, e), NULL, ud, body };
+  mrb_bool exc = FALSE;
+  mrb_value result = mrb_protect_error(mrb, mrb_mdb_env_read_cb, &rd, &exc);
+  if (rd.cursor)
+    mdb_cursor_close(rd.cursor);
+  mrb_mdb_env_read_end(e, rd.txn);
+  if (exc)
+    mrb_exc_raise(mrb, result);
+  return result;
+}
+
+/* Open rd->cursor on dbi inside an mrb_mdb_env_read body. */
+static MDB_cursor *
+mrb_mdb_read_cursor(mrb_state *mrb, mrb_mdb_read *rd, MDB_dbi dbi)
+{
+  int rc = mdb_cursor_open(rd->txn, dbi, &rd->cursor);
+  if (unlikely(rc != MDB_SUCCESS)) {
+    rd->cursor = NULL;
+    mrb_mdb_raise(mrb, rc, "mdb_cursor_open");
+  }
+  return rd->cursor;
+}
+
+/* Begin a write txn for a one-shot Database write. */
+static MDB_txn *
+mrb_mdb_env_write_begin(mrb_state *mrb, mrb_mdb_env *e)
+{
+  MDB_txn *txn;
+  mrb_mdb_env_release_snapshot(e);
+  int rc = mdb_txn_begin(e->env, NULL, 0, &txn);
+  if (unlikely(rc != MDB_SUCCESS))
+    mrb_mdb_raise(mrb, rc, "mdb_txn_begin");
+  return txn;
 }
 
 /* ── Range validation helpers ─────────────────────────────────────────────── */
@@ -149,6 +702,40 @@ mrb_mdb_val_to_str(mrb_state *mrb, const MDB_val *val)
   return mrb_str_new(mrb, (const char *)val->mv_data, (mrb_int)val->mv_size);
 }
 
+/* Raise unless offset and length are usable for mrb_mdb_val_slice. */
+static void
+mrb_mdb_slice_check(mrb_state *mrb, mrb_int offset, mrb_int length)
+{
+  if (offset < 0 || length < 0)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "offset and length must not be negative");
+}
+
+/* Bytes [offset, offset + length) of val, clamped to its end ("" past it). */
+static mrb_value
+mrb_mdb_val_slice(mrb_state *mrb, const MDB_val *val, mrb_int offset, mrb_int length)
+{
+  size_t off = (uint64_t)offset < val->mv_size ? (size_t)offset : val->mv_size;
+  size_t len = (uint64_t)length < val->mv_size - off ? (size_t)length : val->mv_size - off;
+  return mrb_str_new(mrb, (const char *)val->mv_data + off, (mrb_int)len);
+}
+
+/* Array of Strings: returns ary itself if it already is one, else a coerced copy. */
+static mrb_value
+mrb_mdb_ary_to_str(mrb_state *mrb, mrb_value ary)
+{
+  mrb_int len = RARRAY_LEN(ary);
+  mrb_int i = 0;
+  while (i < len && mrb_string_p(mrb_ary_entry(ary, i)))
+    i++;
+  if (i == len)
+    return ary;
+
+  mrb_value out = mrb_ary_new_capa(mrb, len);
+  for (mrb_int j = 0; j < len; j++)
+    mrb_ary_push(mrb, out, mrb_str_to_str(mrb, mrb_ary_entry(ary, j)));
+  return out;
+}
+
 /* ── Stat helper ──────────────────────────────────────────────────────────── */
 
 static mrb_value
@@ -162,7 +749,7 @@ mrb_mdb_stat_to_value(mrb_state *mrb, const MDB_stat *stat)
     mrb_convert_size_t(mrb, stat->ms_overflow_pages),
     mrb_convert_size_t(mrb, stat->ms_entries),
   };
-  return mrb_obj_new(mrb, mrb_class_get_under_id(mrb, mrb_module_get_id(mrb, MRB_SYM(MDB)), MRB_SYM(Stat)), 6, args);
+  return mrb_obj_new(mrb, mrb_mdb_stat_class(mrb), 6, args);
 }
 
 #endif /* MRB_LMDB_INTERNAL_H */
\ No newline at end of file
@@ -0,0 +1,290 @@
+#include <string.h>
+#include "mrb_lmdb_lz4.h"
+
+/*
+ * LZ4 block format: a run of sequences, each
+ *
+ *   token (literal length << 4 | match length - 4)
+ *   [literal length - 15 as 255-byte run]  literals
+ *   offset (2 bytes little-endian)
+ *   [match length - 19 as 255-byte run]
+ *
+ * The last sequence has literals only. Matches must not start within the
+ * last 12 bytes nor extend into the last 5, which is what lets the
+ * reference decoder skip bounds checks; we honour that on output.
+ */
+
+#define LZ4_MINMATCH     4
+#define LZ4_MFLIMIT      12
+#define LZ4_LASTLITERALS 5
+#define LZ4_MAX_OFFSET   65535
+#define LZ4_HASH_LOG     MRB_MDB_LZ4_HASH_LOG
+
+static inline uint32_t
+lz4_read32(const uint8_t *p)
+{
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint32_t
+lz4_hash(uint32_t v)
+{
+  return (v * 2654435761u) >> (32 - LZ4_HASH_LOG);
+}
+
+static inline uint8_t *
+lz4_put_len(uint8_t *op, size_t len)
+{
+  while (len >= 255) {
+    *op++ = 255;
+    len -= 255;
+  }
+  *op++ = (uint8_t)len;
+  return op;
+}
+
+/* Bytes needed for one sequence header + literals + offset + match length. */
+static inline size_t
+lz4_seq_size(size_t lit, size_t mlen)
+{
+  return 1 + (lit >= 15 ? (lit - 15) / 255 + 1 : 0) + lit + 2
+       + (mlen >= 15 ? (mlen - 15) / 255 + 1 : 0);
+}
+
+/*
+ * Positions in the hash table are counted from the start of the dictionary,
+ * so the input's first byte is position dlen. A match found in the
+ * dictionary stops at its end rather than running on into the input.
+ */
+static size_t
+lz4_compress_core(const uint8_t *dict, size_t dlen, const uint32_t *dict_table,
+                  const uint8_t *src, size_t n, uint8_t *dst, size_t cap)
+{
+  if (n > MRB_MDB_LZ4_MAX_INPUT)
+    return 0;
+
+  const uint8_t *ip = src, *anchor = src, *end = src + n;
+  uint8_t *op = dst, *oend = dst + cap;
+
+  if (n > LZ4_MFLIMIT) {
+    uint32_t table[1 << LZ4_HASH_LOG];
+    if (dict_table)
+      memcpy(table, dict_table, sizeof(table));
+    else
+      memset(table, 0, sizeof(table));
+    const uint8_t *mflimit    = end - LZ4_MFLIMIT;
+    const uint8_t *matchlimit = end - LZ4_LASTLITERALS;
+
+    for (ip += dlen ? 0 : 1; ip < mflimit; ) {
+      uint32_t seq = lz4_read32(ip);
+      uint32_t h = lz4_hash(seq);
+      uint32_t cand = table[h];
+      uint32_t here = (uint32_t)(dlen + (size_t)(ip - src));
+      table[h] = here;
+
+      const uint8_t *ref, *ref_start, *ref_end;
+      if (cand >= dlen) {
+        ref = src + (cand - dlen);
+        ref_start = src;
+        ref_end   = NULL;
+      } else {
+        if ((size_t)cand + LZ4_MINMATCH > dlen) {
+          ip++;
+          continue;
+        }
+        ref = dict + cand;
+        ref_start = dict;
+        ref_end   = dict + dlen;
+      }
+      if (cand >= here || here - cand > LZ4_MAX_OFFSET || lz4_read32(ref) != seq) {
+        ip++;
+        continue;
+      }
+
+      while (ip > anchor && ref > ref_start && ip[-1] == ref[-1]) {
+        ip--;
+        ref--;
+      }
+      const uint8_t *mp = ip + LZ4_MINMATCH, *rp = ref + LZ4_MINMATCH;
+      while (mp < matchlimit && rp != ref_end && *mp == *rp) {
+        mp++;
+        rp++;
+      }
+
+      size_t lit = (size_t)(ip - anchor), mlen = (size_t)(mp - ip) - LZ4_MINMATCH;
+      if (lz4_seq_size(lit, mlen) > (size_t)(oend - op))
+        return 0;
+
+      uint8_t *token = op++;
+      *token = (uint8_t)((lit >= 15 ? 15 : lit) << 4);
+      if (lit >= 15)
+        op = lz4_put_len(op, lit - 15);
+      memcpy(op, anchor, lit);
+      op += lit;
+      size_t off = here - cand;
+      *op++ = (uint8_t)off;
+      *op++ = (uint8_t)(off >> 8);
+      *token |= (uint8_t)(mlen >= 15 ? 15 : mlen);
+      if (mlen >= 15)
+        op = lz4_put_len(op, mlen - 15);
+
+      ip = anchor = mp;
+      if (ip < mflimit)
+        table[lz4_hash(lz4_read32(ip - 2))] = (uint32_t)(dlen + (size_t)(ip - 2 - src));
+    }
+  }
+
+  size_t lit = (size_t)(end - anchor);
+  if (1 + (lit >= 15 ? (lit - 15) / 255 + 1 : 0) + lit > (size_t)(oend - op))
+    return 0;
+  *op++ = (uint8_t)((lit >= 15 ? 15 : lit) << 4);
+  if (lit >= 15)
+    op = lz4_put_len(op, lit - 15);
+  memcpy(op, anchor, lit);
+  op += lit;
+  return (size_t)(op - dst);
+}
+
+size_t
+mrb_mdb_lz4_compress(const uint8_t *src, size_t n, uint8_t *dst, size_t cap)
+{
+  return lz4_compress_core(NULL, 0, NULL, src, n, dst, cap);
+}
+
+void
+mrb_mdb_lz4_dict_init(mrb_mdb_lz4_dict *d, const uint8_t *data, size_t len)
+{
+  if (len > MRB_MDB_LZ4_MAX_DICT) {
+    data += len - MRB_MDB_LZ4_MAX_DICT;
+    len = MRB_MDB_LZ4_MAX_DICT;
+  }
+  d->data = data;
+  d->len  = len;
+  memset(d->table, 0, sizeof(d->table));
+  for (size_t i = 0; i + LZ4_MINMATCH <= len; i++)
+    d->table[lz4_hash(lz4_read32(data + i))] = (uint32_t)i;
+}
+
+size_t
+mrb_mdb_lz4_compress_dict(const mrb_mdb_lz4_dict *d, const uint8_t *src, size_t n,
+                          uint8_t *dst, size_t cap)
+{
+  return lz4_compress_core(d->data, d->len, d->table, src, n, dst, cap);
+}
+
+/* Read a 255-run length extension; false if the input ends first. */
+static inline bool
+lz4_get_len(const uint8_t **ipp, const uint8_t *iend, size_t *len)
+{
+  const uint8_t *ip = *ipp;
+  uint8_t b;
+  do {
+    if (ip == iend)
+      return false;
+    b = *ip++;
+    *len += b;
+  } while (b == 255);
+  *ipp = ip;
+  return true;
+}
+
+/* With partial, output stops (successfully) once cap bytes are produced. */
+static bool
+lz4_decompress_core(const uint8_t *dict, size_t dlen, const uint8_t *src, size_t n,
+                    uint8_t *dst, size_t cap, size_t *out_len, bool partial)
+{
+  const uint8_t *ip = src, *iend = src + n;
+  uint8_t *op = dst, *oend = dst + cap;
+
+  if (n == 0)
+    return false;
+
+  for (;;) {
+    if (ip == iend)
+      return false;
+    unsigned token = *ip++;
+
+    size_t lit = token >> 4;
+    if (lit == 15 && !lz4_get_len(&ip, iend, &lit))
+      return false;
+    if (lit > (size_t)(iend - ip))
+      return false;
+    if (lit > (size_t)(oend - op)) {
+      if (!partial)
+        return false;
+      memcpy(op, ip, (size_t)(oend - op));
+      op = oend;
+      break;
+    }
+    memcpy(op, ip, lit);
+    op += lit;
+    ip += lit;
+    if (ip == iend)
+      break;
+
+    if (iend - ip < 2)
+      return false;
+    size_t off = (size_t)ip[0] | ((size_t)ip[1] << 8);
+    ip += 2;
+    if (off == 0 || off > (size_t)(op - dst) + dlen)
+      return false;
+
+    size_t mlen = token & 15;
+    if (mlen == 15 && !lz4_get_len(&ip, iend, &mlen))
+      return false;
+    mlen += LZ4_MINMATCH;
+    if (mlen > (size_t)(oend - op)) {
+      if (!partial)
+        return false;
+      mlen = (size_t)(oend - op);
+    }
+
+    const uint8_t *m;
+    size_t produced = (size_t)(op - dst);
+    if (off > produced) {
+      /* Starts in the dictionary and may run on into the output. */
+      size_t back = off - produced;
+      size_t from_dict = back < mlen ? back : mlen;
+      memcpy(op, dict + dlen - back, from_dict);
+      op += from_dict;
+      mlen -= from_dict;
+      m = dst;
+    } else {
+      m = op - off;
+    }
+    if ((size_t)(op - m) >= mlen) {
+      memcpy(op, m, mlen);
+      op += mlen;
+    } else {
+      while (mlen--)
+        *op++ = *m++;
+    }
+    if (partial && op == oend)
+      break;
+  }
+
+  *out_len = (size_t)(op - dst);
+  return true;
+}
+
+bool
+mrb_mdb_lz4_decompress_dict(const uint8_t *dict, size_t dlen, const uint8_t *src, size_t n,
+                            uint8_t *dst, size_t cap, size_t *out_len)
+{
+  return lz4_decompress_core(dict, dlen, src, n, dst, cap, out_len, false);
+}
+
+bool
+mrb_mdb_lz4_decompress_prefix(const uint8_t *dict, size_t dlen, const uint8_t *src, size_t n,
+                              uint8_t *dst, size_t cap, size_t *out_len)
+{
+  return lz4_decompress_core(dict, dlen, src, n, dst, cap, out_len, true);
+}
+
+bool
+mrb_mdb_lz4_decompress(const uint8_t *src, size_t n, uint8_t *dst, size_t cap, size_t *out_len)
+{
+  return mrb_mdb_lz4_decompress_dict(NULL, 0, src, n, dst, cap, out_len);
+}
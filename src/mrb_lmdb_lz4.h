@@ -0,0 +1,65 @@
+#ifndef MRB_LMDB_LZ4_H
+#define MRB_LMDB_LZ4_H
+
+/*
+ * Minimal LZ4 block codec (raw block format, no frame header), with
+ * optional prefix dictionaries.
+ *
+ * Output is readable by LZ4_decompress_safe() and this decoder accepts any
+ * block LZ4_compress_default() produces. Single-pass greedy matcher with a
+ * 4096-entry hash table on the stack: no allocation, no global state.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Largest input mrb_mdb_lz4_compress accepts (same limit as liblz4). */
+#define MRB_MDB_LZ4_MAX_INPUT 0x7E000000u
+
+/* Worst-case compressed size for n input bytes. */
+#define MRB_MDB_LZ4_BOUND(n) ((n) + (n) / 255 + 16)
+
+/* Matches reach back at most this far, so only a dictionary's tail is used. */
+#define MRB_MDB_LZ4_MAX_DICT 65536
+
+#define MRB_MDB_LZ4_HASH_LOG 12
+
+/*
+ * A prefix dictionary prepared for compression: data is borrowed (keep it
+ * alive), table holds its hashed positions so each block starts warm.
+ */
+typedef struct mrb_mdb_lz4_dict {
+  const uint8_t *data;
+  size_t         len;
+  uint32_t       table[1 << MRB_MDB_LZ4_HASH_LOG];
+} mrb_mdb_lz4_dict;
+
+/* Compress n bytes into dst; returns the block size, or 0 if it does not fit in cap. */
+size_t mrb_mdb_lz4_compress(const uint8_t *src, size_t n, uint8_t *dst, size_t cap);
+
+/* Decompress a block into dst; false on malformed input or overflow of cap. */
+bool mrb_mdb_lz4_decompress(const uint8_t *src, size_t n, uint8_t *dst, size_t cap, size_t *out_len);
+
+/* Prepare d for data (only the last MRB_MDB_LZ4_MAX_DICT bytes are kept). */
+void mrb_mdb_lz4_dict_init(mrb_mdb_lz4_dict *d, const uint8_t *data, size_t len);
+
+/*
+ * Same as mrb_mdb_lz4_compress, but matches may refer into the dictionary.
+ * Readable by LZ4_decompress_safe_usingDict() with the same dictionary.
+ */
+size_t mrb_mdb_lz4_compress_dict(const mrb_mdb_lz4_dict *d, const uint8_t *src, size_t n,
+                                 uint8_t *dst, size_t cap);
+
+/* Decompress a block compressed against dict (dict may be NULL when dlen is 0). */
+bool mrb_mdb_lz4_decompress_dict(const uint8_t *dict, size_t dlen, const uint8_t *src, size_t n,
+                                 uint8_t *dst, size_t cap, size_t *out_len);
+
+/*
+ * Decompress only the first cap bytes of a block (fewer if it is shorter);
+ * the rest of the input is not looked at.
+ */
+bool mrb_mdb_lz4_decompress_prefix(const uint8_t *dict, size_t dlen, const uint8_t *src, size_t n,
+                                   uint8_t *dst, size_t cap, size_t *out_len);
+
+#endif /* MRB_LMDB_LZ4_H */
@@ -0,0 +1,139 @@
+/*
+ * Compiles <mruby/lmdb.hpp> with the gem's tests and exposes a few
+ * MDBHppTest methods to test/test.rb. mruby values are only built outside
+ * protect() so no mruby exception unwinds through the C++ wrappers.
+ */
+
+#include <mruby.h>
+#include <mruby/array.h>
+#include <mruby/string.h>
+#include <mruby/lmdb.hpp>
+
+#include <cstdint>
+#include <string>
+
+namespace {
+
+struct scan_result {
+  size_t      all = 0;
+  size_t      all_bytes = 0;
+  size_t      prefix = 0;
+  size_t      range = 0;
+  size_t      stopped = 0;
+  std::string first_key;
+  std::string copied;
+  bool        missing_found = true;
+  bool        deleted = false;
+  size_t      int_range = 0;
+  int64_t     int_sum = 0;
+};
+
+/* MDBHppTest.scan(env) -> [all, bytes, prefix, range, stopped, first_key,
+ *                          copied, missing_found, deleted, int_range, int_sum]
+ * Needs an Env opened with maxdbs >= 2. */
+mrb_value
+hpp_scan(mrb_state *mrb, mrb_value self)
+{
+  mrb_value env_obj;
+  mrb_get_args(mrb, "o", &env_obj);
+  MDB_env *env = mrb_lmdb_env_ptr(mrb, env_obj);
+
+  scan_result r = mrb_lmdb::protect(mrb, [&] {
+    scan_result out;
+    {
+      mrb_lmdb::txn w(env);
+      MDB_dbi dbi = w.open("hpp_strs", MDB_CREATE);
+      w.put(dbi, "a:1", "x");
+      w.put(dbi, std::string("a:2"), std::string("yy"));
+      w.put(dbi, "b:1", std::string_view("zzz"));
+      w.put(dbi, "c:1", "gone");
+      out.deleted = w.del(dbi, "c:1");
+
+      MDB_dbi ints = w.open("hpp_ints", MDB_CREATE | MDB_INTEGERKEY);
+      for (size_t i = 1; i <= 10; i++)
+        w.put(ints, i, static_cast<int64_t>(i * 10));
+      w.commit();
+    }
+
+    mrb_lmdb::txn t(env, MDB_RDONLY);
+    MDB_dbi dbi = t.open("hpp_strs");
+    out.all = mrb_lmdb::for_each(t, dbi, [&](std::string_view, std::string_view v) {
+      out.all_bytes += v.size();
+    });
+    out.prefix = mrb_lmdb::for_each_prefix(t, dbi, "a:", [](std::string_view, std::string_view) {});
+    out.range = mrb_lmdb::for_each_range(t, dbi, "a:2", "b:2", [](std::string_view, std::string_view) {});
+    out.stopped = mrb_lmdb::for_each(t, dbi, [](std::string_view k, std::string_view) {
+      return k != "a:2";
+    });
+
+    mrb_lmdb::cursor c(t, dbi);
+    std::string_view k, v;
+    if (c.get(k, v, MDB_FIRST))
+      out.first_key = std::string(k);
+    c.close();
+
+    out.copied = t.get_as<std::string>(dbi, "b:1").value_or("");
+    out.missing_found = t.get(dbi, "nope").has_value();
+
+    MDB_dbi ints = t.open("hpp_ints", MDB_INTEGERKEY);
+    out.int_range = mrb_lmdb::for_each_range<size_t, int64_t>(t, ints, 3, 7, [&](size_t, int64_t n) {
+      out.int_sum += n;
+    });
+    return out;
+  });
+
+  mrb_value ary = mrb_ary_new_capa(mrb, 11);
+  mrb_ary_push(mrb, ary, mrb_int_value(mrb, (mrb_int)r.all));
+  mrb_ary_push(mrb, ary, mrb_int_value(mrb, (mrb_int)r.all_bytes));
+  mrb_ary_push(mrb, ary, mrb_int_value(mrb, (mrb_int)r.prefix));
+  mrb_ary_push(mrb, ary, mrb_int_value(mrb, (mrb_int)r.range));
+  mrb_ary_push(mrb, ary, mrb_int_value(mrb, (mrb_int)r.stopped));
+  mrb_ary_push(mrb, ary, mrb_str_new(mrb, r.first_key.data(), (mrb_int)r.first_key.size()));
+  mrb_ary_push(mrb, ary, mrb_str_new(mrb, r.copied.data(), (mrb_int)r.copied.size()));
+  mrb_ary_push(mrb, ary, mrb_bool_value(r.missing_found));
+  mrb_ary_push(mrb, ary, mrb_bool_value(r.deleted));
+  mrb_ary_push(mrb, ary, mrb_int_value(mrb, (mrb_int)r.int_range));
+  mrb_ary_push(mrb, ary, mrb_int_value(mrb, (mrb_int)r.int_sum));
+  return ary;
+}
+
+/* MDBHppTest.count(txn, db) -> records visited through a txn_ref on an MDB::Txn. */
+mrb_value
+hpp_count(mrb_state *mrb, mrb_value self)
+{
+  mrb_value txn_obj, db_obj;
+  mrb_get_args(mrb, "oo", &txn_obj, &db_obj);
+  mrb_lmdb::txn_ref t(mrb, txn_obj);
+  MDB_dbi dbi = mrb_lmdb_dbi(mrb, db_obj);
+
+  size_t n = mrb_lmdb::protect(mrb, [&] {
+    return mrb_lmdb::for_each(t, dbi, [](std::string_view, std::string_view) {});
+  });
+  return mrb_int_value(mrb, (mrb_int)n);
+}
+
+/* MDBHppTest.open_missing(env) raises the MDB::Error for MDB_NOTFOUND. */
+mrb_value
+hpp_open_missing(mrb_state *mrb, mrb_value self)
+{
+  mrb_value env_obj;
+  mrb_get_args(mrb, "o", &env_obj);
+  MDB_env *env = mrb_lmdb_env_ptr(mrb, env_obj);
+
+  mrb_lmdb::protect(mrb, [&] {
+    mrb_lmdb::txn t(env, MDB_RDONLY);
+    t.open("hpp_no_such_db");
+  });
+  return mrb_nil_value();
+}
+
+} // namespace
+
+extern "C" void
+mrb_mruby_lmdb_gem_test(mrb_state *mrb)
+{
+  struct RClass *mod = mrb_define_module(mrb, "MDBHppTest");
+  mrb_define_module_function(mrb, mod, "scan", hpp_scan, MRB_ARGS_REQ(1));
+  mrb_define_module_function(mrb, mod, "count", hpp_count, MRB_ARGS_REQ(2));
+  mrb_define_module_function(mrb, mod, "open_missing", hpp_open_missing, MRB_ARGS_REQ(1));
+}
@@ -67,6 +67,57 @@ assert('Env.new negative maxdbs raises RangeError') do
   assert_raise(RangeError) { MDB::Env.new(maxdbs: -1) }
 end
 
+assert('Env.new max_staleness option') do
+  env = MDB::Env.new(max_staleness: 5)
+  assert_equal 5.0, env.max_staleness
+  env.close
+end
+
+assert('Env.new negative max_staleness raises RangeError') do
+  assert_raise(RangeError) { MDB::Env.new(max_staleness: -1) }
+end
+
+assert('one-shot reads reuse the parked read txn and see new writes') do
+  with_test_db do |env|
+    db = env.database
+    db["k"] = "a"
+    assert_equal "a", db["k"]
+    db["k"] = "b"
+    assert_equal "b", db["k"]
+    assert_equal ["b"], db.multi_get(["k"])
+  end
+end
+
+assert('max_staleness keeps the snapshot but not across own writes or txns') do
+  with_test_db do |env|
+    env.max_staleness = 60
+    db = env.database
+    db["k"] = "a"
+    assert_equal "a", db["k"]
+    db["k"] = "b"
+    assert_equal "b", db["k"]
+    env.transaction(MDB::RDONLY) { |txn| assert_equal "b", MDB.get(txn, db.dbi, "k") }
+    env.transaction { |txn| MDB.put(txn, db.dbi, "k", "c") }
+    assert_equal "c", db["k"]
+    assert_equal 1, db.length
+  end
+end
+
+assert('a read that raises hands the parked read txn back') do
+  with_test_db do |env|
+    env.max_staleness = 60
+    db = env.database
+    db["k"] = "a"
+    assert_raise(RuntimeError) { db.each { |_| raise "stop" } }
+    assert_raise(RuntimeError) { db.each_slice(1) { |_| raise "stop" } }
+    assert_raise(RuntimeError) { db.each_range("a", "z") { |_| raise "stop" } }
+    env.transaction(MDB::RDONLY) { |txn| assert_equal "a", MDB.get(txn, db.dbi, "k") }
+    db["k"] = "b"
+    assert_equal "b", db["k"]
+    assert_equal [["k", "b"]], db.to_a
+  end
+end
+
 assert('Env#stat returns MDB::Stat') do
   with_test_db do |env|
     s = env.stat
@@ -125,6 +176,27 @@ assert('Env#close is idempotent') do
   end
 end
 
+assert('Database methods raise IOError after Env#close') do
+  with_test_db do |env|
+    db = env.database
+    db["a"] = "1"
+    env.close
+    assert_raise(IOError) { db["a"] }
+    assert_raise(IOError) { db["b"] = "2" }
+    assert_raise(IOError) { db.flags }
+    assert_raise(IOError) { db.each { } }
+  end
+end
+
+assert('Database#dbi and #flags are cached at open') do
+  with_test_db do |env|
+    db = env.database(MDB::DUPSORT | MDB::CREATE, "dups")
+    assert_true db.dbi.is_a?(Integer)
+    assert_equal MDB::DUPSORT, db.flags & MDB::DUPSORT
+    assert_equal 0, env.database.flags & MDB::DUPSORT
+  end
+end
+
 assert('Env#mapsize= negative raises RangeError') do
   with_test_db { |env| assert_raise(RangeError) { env.mapsize = -1 } }
 end
@@ -435,6 +507,1091 @@ assert('Database#each_prefix exception propagates') do
   end
 end
 
+assert('Database#each_slice yields batches of pairs') do
+  with_test_db do |env|
+    db = env.database
+    5.times { |i| db["k#{i}"] = "v#{i}" }
+    slices = []
+    db.each_slice(2) { |pairs| slices << pairs }
+    assert_equal [2, 2, 1], slices.map(&:size)
+    assert_equal ["k0", "v0"], slices[0][0]
+    assert_equal ["k4", "v4"], slices[2][0]
+  end
+end
+
+assert('Database#each_slice invalid size raises ArgumentError') do
+  with_test_db do |env|
+    assert_raise(ArgumentError) { env.database.each_slice(0) { } }
+    assert_raise(ArgumentError) { env.database.each_slice(0) }
+  end
+end
+
+assert('Database#each_slice without a block returns an Enumerator') do
+  with_test_db do |env|
+    db = env.database
+    3.times { |i| db["k#{i}"] = "v#{i}" }
+    e = db.each_slice(2)
+    assert_kind_of Enumerator, e
+    assert_equal [[["k0", "v0"], ["k1", "v1"]], [["k2", "v2"]]], e.to_a
+  end
+end
+
+assert('Database#each_slice exception propagates') do
+  with_test_db do |env|
+    db = env.database
+    4.times { |i| db["k#{i}"] = "v" }
+    calls = 0
+    assert_raise(RuntimeError) { db.each_slice(2) { calls += 1; raise "stop" } }
+    assert_equal 1, calls
+    assert_equal "v", db["k0"]
+  end
+end
+
+assert('Database#each_prefix_slice stays within the prefix') do
+  with_test_db do |env|
+    db = env.database
+    db["a:1"] = "1"; db["a:2"] = "2"; db["a:3"] = "3"; db["b:1"] = "x"
+    slices = []
+    db.each_prefix_slice("a:", 2) { |pairs| slices << pairs.map(&:first) }
+    assert_equal [["a:1", "a:2"], ["a:3"]], slices
+  end
+end
+
+assert('Database#each_key_slice yields duplicates in batches') do
+  with_test_db do |env|
+    db = env.database(MDB::DUPSORT | MDB::CREATE, "dups")
+    %w(a b c).each { |v| db["k"] = v }
+    db["l"] = "z"
+    slices = []
+    db.each_key_slice("k", 2) { |pairs| slices << pairs.map(&:last) }
+    assert_equal [["a", "b"], ["c"]], slices
+  end
+end
+
+assert('Database#each_range yields from..to inclusive') do
+  with_test_db do |env|
+    db = env.database
+    %w(a b c d e).each { |k| db[k] = k.upcase }
+    seen = []
+    db.each_range("b", "d") { |k, v| seen << [k, v] }
+    assert_equal [["b", "B"], ["c", "C"], ["d", "D"]], seen
+  end
+end
+
+assert('Database#each_range exclusive_end and open bounds') do
+  with_test_db do |env|
+    db = env.database
+    %w(a b c d e).each { |k| db[k] = k }
+    seen = []
+    db.each_range("b", "d", exclusive_end: true) { |k, _| seen << k }
+    assert_equal %w(b c), seen
+    seen = []
+    db.each_range(nil, "bb") { |k, _| seen << k }
+    assert_equal %w(a b), seen
+    seen = []
+    db.each_range("cc", nil) { |k, _| seen << k }
+    assert_equal %w(d e), seen
+  end
+end
+
+assert('Database#each_range reverse and limit') do
+  with_test_db do |env|
+    db = env.database
+    %w(a b c d e).each { |k| db[k] = k }
+    seen = []
+    db.each_range("b", "d", reverse: true) { |k, _| seen << k }
+    assert_equal %w(d c b), seen
+    seen = []
+    db.each_range("b", "d", reverse: true, exclusive_end: true) { |k, _| seen << k }
+    assert_equal %w(c b), seen
+    seen = []
+    db.each_range(nil, "cc", reverse: true, limit: 2) { |k, _| seen << k }
+    assert_equal %w(c b), seen
+    seen = []
+    db.each_range(nil, nil, limit: 0) { |k, _| seen << k }
+    assert_equal [], seen
+  end
+end
+
+assert('Database#each_range uses the INTEGERKEY comparator') do
+  with_test_db do |env|
+    db = env.database(MDB::INTEGERKEY | MDB::CREATE, "ints")
+    [1, 2, 255, 256, 1000].each { |i| db[i.to_bin] = i.to_s }
+    seen = []
+    db.each_range(2.to_bin, 256.to_bin) { |_, v| seen << v }
+    assert_equal %w(2 255 256), seen
+    assert_raise(MDB::BAD_VALSIZE) { db.each_range("x", nil) { } }
+  end
+end
+
+assert('Database#each_range unknown option raises ArgumentError') do
+  with_test_db do |env|
+    assert_raise(ArgumentError) { env.database.each_range(nil, nil, bogus: 1) { } }
+    assert_raise(RangeError) { env.database.each_range(nil, nil, limit: -1) { } }
+  end
+end
+
+assert('Database#reverse_each walks backwards with a limit') do
+  with_test_db do |env|
+    db = env.database
+    %w(a b c d).each { |k| db[k] = k }
+    seen = []
+    db.reverse_each { |k, _| seen << k }
+    assert_equal %w(d c b a), seen
+    seen = []
+    db.reverse_each(limit: 2) { |k, _| seen << k }
+    assert_equal %w(d c), seen
+  end
+end
+
+assert('Database#each_prefix reverse returns the last N matches') do
+  with_test_db do |env|
+    db = env.database
+    db["user:1:a"] = "1"; db["user:1:b"] = "2"; db["user:1:c"] = "3"
+    db["user:0:z"] = "x"; db["user:2:a"] = "y"
+    seen = []
+    db.each_prefix("user:1:", reverse: true, limit: 2) { |_, v| seen << v }
+    assert_equal %w(3 2), seen
+    seen = []
+    db.each_prefix("user:1:", limit: 1) { |_, v| seen << v }
+    assert_equal %w(1), seen
+  end
+end
+
+assert('Database#each_prefix reverse handles 0xFF prefixes and the last key') do
+  with_test_db do |env|
+    db = env.database
+    db["a\xFF\x01"] = "1"; db["a\xFF\x02"] = "2"; db["b"] = "3"
+    seen = []
+    db.each_prefix("a\xFF", reverse: true) { |_, v| seen << v }
+    assert_equal %w(2 1), seen
+    seen = []
+    db.each_prefix("b", reverse: true) { |_, v| seen << v }
+    assert_equal %w(3), seen
+    assert_raise(ArgumentError) { db.each_prefix("a", exclusive_end: true) { } }
+  end
+end
+
+assert('Database#keys and #values') do
+  with_test_db do |env|
+    db = env.database
+    db["a"] = "1"; db["b:1"] = "2"; db["b:2"] = "3"; db["c"] = "4"
+    assert_equal ["a", "b:1", "b:2", "c"], db.keys
+    assert_equal ["1", "2", "3", "4"], db.values
+    assert_equal ["b:1", "b:2"], db.keys(prefix: "b:")
+    assert_equal ["3", "2"], db.values(prefix: "b:", reverse: true)
+    assert_equal ["b:1", "b:2"], db.keys(from: "b", to: "c", exclusive_end: true)
+    assert_equal ["c"], db.keys(reverse: true, limit: 1)
+  end
+end
+
+assert('Database#each_key_only and #each_value') do
+  with_test_db do |env|
+    db = env.database
+    db["a"] = "1"; db["b"] = "2"
+    ks = []; vs = []
+    db.each_key_only { |k| ks << k }
+    db.each_value(from: "b") { |v| vs << v }
+    assert_equal ["a", "b"], ks
+    assert_equal ["2"], vs
+  end
+end
+
+assert('Database#keys lists each DUPSORT key once') do
+  with_test_db do |env|
+    db = env.database(MDB::DUPSORT | MDB::CREATE, "dups")
+    db["k"] = "1"; db["k"] = "2"; db["l"] = "3"
+    assert_equal ["k", "l"], db.keys
+    assert_equal ["l", "k"], db.keys(reverse: true)
+    assert_equal ["1", "2", "3"], db.values
+  end
+end
+
+assert('Database#keys rejects prefix: with from:/to:') do
+  with_test_db do |env|
+    assert_raise(ArgumentError) { env.database.keys(prefix: "a", from: "a") }
+    assert_raise(ArgumentError) { env.database.keys(bogus: 1) }
+  end
+end
+
+assert('Database#count_prefix and #count_range') do
+  with_test_db do |env|
+    db = env.database
+    db["a"] = "1"; db["b:1"] = "2"; db["b:2"] = "3"; db["c"] = "4"
+    assert_equal 2, db.count_prefix("b:")
+    assert_equal 0, db.count_prefix("x")
+    assert_equal 3, db.count_range("b", "c")
+    assert_equal 2, db.count_range("b", "c", exclusive_end: true)
+    assert_equal 4, db.count_range(nil, nil)
+    assert_raise(ArgumentError) { db.count_range(nil, nil, reverse: true) }
+  end
+end
+
+assert('Database#count_prefix counts DUPSORT duplicates') do
+  with_test_db do |env|
+    db = env.database(MDB::DUPSORT | MDB::CREATE, "dups")
+    %w(1 2 3).each { |v| db["t:a"] = v }
+    db["t:b"] = "4"; db["u"] = "5"
+    assert_equal 4, db.count_prefix("t:")
+    assert_equal 5, db.count_range(nil, nil)
+    assert_equal 3, db.count_range("t:a", "t:a")
+  end
+end
+
+assert('Database#each_dup_page decodes DUPFIXED pages') do
+  with_test_db do |env|
+    db = env.database(MDB::DUPSORT | MDB::DUPFIXED | MDB::CREATE, "fixed")
+    %w(aa bb cc).each { |v| db["k"] = v }
+    pages = []
+    db.each_dup_page("k") { |dups| pages << dups }
+    assert_equal [%w(aa bb cc)], pages
+    db.each_dup_page("missing") { |dups| pages << dups }
+    assert_equal 1, pages.size
+  end
+end
+
+assert('Database#each_dup_page returns Integers for INTEGERDUP') do
+  with_test_db do |env|
+    db = env.database(MDB::DUPSORT | MDB::DUPFIXED | MDB::INTEGERDUP | MDB::CREATE, "ints")
+    db.batch { |txn, dbi| 1.upto(2000) { |i| MDB.put(txn, dbi, "k", i.to_bin) } }
+    all = []
+    db.each_dup_page("k") { |dups| all.concat(dups) }
+    assert_equal (1..2000).to_a, all
+  end
+end
+
+assert('Cursor#get_multiple and #next_multiple') do
+  with_test_db do |env|
+    db = env.database(MDB::DUPSORT | MDB::DUPFIXED | MDB::CREATE, "fixed")
+    %w(x1 x2).each { |v| db["k"] = v }
+    db.cursor(MDB::RDONLY) do |c|
+      assert_equal ["k", %w(x1 x2)], c.get_multiple("k")
+      assert_nil c.next_multiple
+      assert_nil c.get_multiple("nope")
+    end
+  end
+end
+
+assert('Cursor#get_multiple on a non-DUPFIXED db raises MDB::INCOMPATIBLE') do
+  with_test_db do |env|
+    db = env.database
+    db["k"] = "v"
+    db.cursor(MDB::RDONLY) do |c|
+      assert_raise(MDB::INCOMPATIBLE) { c.get_multiple("k") }
+    end
+  end
+end
+
+assert('Database#reserve writes in place and zero-fills unwritten bytes') do
+  with_test_db do |env|
+    db = env.database
+    saved = nil
+    ret = db.reserve("k", 8) do |buf|
+      saved = buf
+      assert_equal 8, buf.bytesize
+      buf << "ab"
+      assert_equal 2, buf.pos
+      buf[4] = "z"
+      :done
+    end
+    assert_equal :done, ret
+    assert_equal "ab\0\0z\0\0\0", db["k"]
+    assert_false saved.valid?
+    assert_raise(RuntimeError) { saved.write("x") }
+  end
+end
+
+assert('Database#reserve raises on overflow and aborts on exception') do
+  with_test_db do |env|
+    db = env.database
+    assert_raise(RangeError) { db.reserve("k", 2) { |buf| buf.write("abc") } }
+    assert_nil db["k"]
+    assert_raise(RangeError) { db.reserve("k", -1) { } }
+  end
+end
+
+assert('Database#reserve zeroes gaps below the last write') do
+  with_test_db do |env|
+    db = env.database
+    db.reserve("k", 8) { |buf| buf.pos = 5; buf.write("x"); assert_equal "\0" * 5 + "x\0\0", buf.to_s }
+    assert_equal "\0" * 5 + "x\0\0", db["k"]
+  end
+end
+
+assert('reserve raises ArgumentError on DUPSORT databases') do
+  with_test_db do |env|
+    db = env.database(MDB::DUPSORT | MDB::CREATE, "dups")
+    assert_raise(ArgumentError) { db.reserve("k", 4) { } }
+    assert_raise(ArgumentError) do
+      db.transaction { |txn, dbi| MDB.reserve(txn, dbi, "k", 4) { } }
+    end
+    assert_equal 0, db.length
+  end
+end
+
+assert('reserve, << and concat raise on indexed, codec: and compress: databases') do
+  with_test_db(maxdbs: 8) do |env|
+    docs    = env.database(MDB::CREATE | MDB::INTEGERKEY, "docs", codec: :native)
+    pages   = env.database(MDB::CREATE | MDB::INTEGERKEY, "pages", compress: :lz4)
+    users   = env.database(MDB::CREATE | MDB::INTEGERKEY, "users")
+    by_city = env.database(MDB::CREATE | MDB::DUPSORT, "by_city")
+    MDB::Index.new(users, by_city) { |id, v| v }
+    [docs, pages, users].each do |db|
+      assert_raise(ArgumentError) { db.reserve("k", 4) { } }
+      assert_raise(ArgumentError) { db << "v" }
+      assert_raise(ArgumentError) { db.concat(["v"]) }
+      assert_equal 0, db.length
+    end
+    assert_equal 0, by_city.length
+  end
+end
+
+assert('MDB.reserve inside a transaction') do
+  with_test_db do |env|
+    db = env.database
+    db.transaction do |txn, dbi|
+      MDB.reserve(txn, dbi, "k", 3) { |buf| buf.write("xyz") }
+    end
+    assert_equal "xyz", db["k"]
+  end
+end
+
+assert('Database#bulk_load sorts input and keeps the last value per key') do
+  with_test_db do |env|
+    db = env.database
+    db.bulk_load([["c", "3"], ["a", "1"], ["b", "2"], ["a", "x"]])
+    assert_equal [["a", "x"], ["b", "2"], ["c", "3"]], db.to_a
+    db.bulk_load({ "0" => "z", "d" => "4" })
+    assert_equal %w(0 a b c d), db.keys
+  end
+end
+
+assert('Database#bulk_load orders INTEGERKEY and DUPSORT data') do
+  with_test_db do |env|
+    ints = env.database(MDB::INTEGERKEY | MDB::CREATE, "ints")
+    ints.bulk_load([300, 2, 70000, 1].map { |i| [i.to_bin, i.to_s] })
+    assert_equal %w(1 2 300 70000), ints.values
+    assert_raise(MDB::BAD_VALSIZE) { ints.bulk_load([["abc", "v"]]) }
+
+    dups = env.database(MDB::DUPSORT | MDB::CREATE, "dups")
+    dups.bulk_load([["k", "b"], ["j", "z"], ["k", "a"], ["k", "b"]])
+    assert_equal [["j", "z"], ["k", "a"], ["k", "b"]], dups.to_a
+  end
+end
+
+assert('Database#bulk_load encodes values and maintains indexes') do
+  with_test_db(maxdbs: 8) do |env|
+    docs = env.database(MDB::CREATE, "docs", codec: :native)
+    docs.bulk_load([["b", { "n" => 2 }], ["a", [1, :x]], ["c", "\xC1\x01raw"]])
+    assert_equal [1, :x], docs["a"]
+    assert_equal({ "n" => 2 }, docs["b"])
+    assert_equal "\xC1\x01raw", docs["c"]
+
+    packed = env.database(MDB::CREATE, "packed", compress: :lz4)
+    big = "row " * 100
+    packed.bulk_load([["x", big], ["y", "\xC2L\x05hello"]])
+    assert_equal big, packed["x"]
+    assert_equal "\xC2L\x05hello", packed["y"]
+    assert_true env.database(0, "packed", compress: nil).bytesize("x") < big.bytesize
+
+    users   = env.database(MDB::CREATE, "users")
+    by_city = env.database(MDB::CREATE | MDB::DUPSORT, "by_city")
+    idx = MDB::Index.new(users, by_city) { |id, v| v.split(",")[1] }
+    users.bulk_load([["2", "b,paris"], ["1", "a,rome"], ["2", "b,oslo"]])
+    assert_equal ["1"], idx.keys("rome")
+    assert_equal ["2"], idx.keys("oslo")
+    assert_equal [], idx.keys("paris")
+  end
+end
+
+assert('MDB::Loader spills runs and merges them in order') do
+  with_test_db do |env|
+    db = env.database
+    db["m050"] = "old"
+    l = MDB::Loader.new(db, memory: 1024, txn_size: 7)
+    100.times { |i| l.add("m%03d" % ((i * 37) % 100), i.to_s) }
+    l << ["m007", "last"]
+    assert_true l.runs > 1
+    assert_equal 101, l.size
+    assert_equal 100, l.finish
+    assert_true l.closed?
+    assert_equal 100, db.length
+    assert_equal (0...100).map { |i| "m%03d" % i }, db.keys
+    assert_equal "last", db["m007"]
+    assert_raise(IOError) { l.add("x", "y") }
+  end
+end
+
+assert('MDB::Loader merges runs in tiers once the fan-in is reached') do
+  with_test_db do |env|
+    db = env.database
+    l = MDB::Loader.new(db, memory: 256)
+    1200.times { |i| l.add("k%04d" % ((i * 7) % 500), i.to_s) }
+    assert_true l.runs < 32
+    assert_equal 500, l.finish
+    assert_equal (0...500).map { |i| "k%04d" % i }, db.keys
+    assert_equal "1095", db["k0165"]
+    assert_equal "999", db["k0493"]
+  end
+end
+
+assert('MDB::Loader encodes values and refuses indexed databases') do
+  with_test_db(maxdbs: 8) do |env|
+    docs = env.database(MDB::CREATE, "docs", codec: :native, compress: :lz4)
+    MDB::Loader.open(docs, memory: 256) do |l|
+      l.add("a", { "n" => [1, 2] })
+      l.add("b", "\xC2S" + "x" * 200)
+    end
+    assert_equal({ "n" => [1, 2] }, docs["a"])
+    assert_equal "\xC2S" + "x" * 200, docs["b"]
+
+    users   = env.database(MDB::CREATE, "users")
+    by_city = env.database(MDB::CREATE | MDB::DUPSORT, "by_city")
+    l = MDB::Loader.new(users)
+    l.add("1", "a,rome")
+    MDB::Index.new(users, by_city) { |id, v| v.split(",")[1] }
+    assert_raise(ArgumentError) { l.finish }
+    assert_raise(ArgumentError) { l.add("2", "b,oslo") }
+    l.close
+    assert_nil users["1"]
+  end
+end
+
+assert('MDB::Loader.open on DUPSORT and discard on exception') do
+  with_test_db do |env|
+    db = env.database(MDB::DUPSORT | MDB::CREATE, "dups")
+    n = MDB::Loader.open(db, memory: 256) do |l|
+      l.concat([["k", "b"], ["k", "a"], ["j", "z"], ["k", "b"]])
+    end
+    assert_equal 3, n
+    assert_equal [["j", "z"], ["k", "a"], ["k", "b"]], db.to_a
+    assert_raise(RuntimeError) do
+      MDB::Loader.open(db) { |l| l.add("x", "y"); raise "stop" }
+    end
+    assert_nil db["x"]
+    assert_raise(ArgumentError) { MDB::Loader.new(db, bogus: 1) }
+  end
+end
+
+assert('MDB::Key.pack round-trips and preserves tuple order') do
+  tuples = [
+    [nil], [false], [true],
+    [-(2**40), "b"], [-1], [0], [1, "a"], [1, "a", 0], [1, "a\0"], [1, "b"], [2**40],
+    [-1.5], [-0.5], [0.0], [0.25], [1e10],
+    [""], ["a"], ["a\0b"], ["ab"], ["b"]
+  ]
+  tuples.each { |t| assert_equal t, MDB::Key.unpack(MDB::Key.pack(*t)) }
+  packed = tuples.map { |t| MDB::Key.pack(*t) }
+  assert_equal packed, packed.sort
+  assert_raise(TypeError) { MDB::Key.pack(:sym) }
+  assert_raise(ArgumentError) { MDB::Key.unpack("\x30abc") }
+  assert_raise(ArgumentError) { MDB::Key.unpack("\x30abc\x00") }
+  assert_raise(ArgumentError) { MDB::Key.unpack("\x30abc\x00\x02") }
+end
+
+assert('MDB::Key strings are not prefixes of longer strings') do
+  a, a0 = MDB::Key.pack("a"), MDB::Key.pack("a\0")
+  assert_false a0.start_with?(a)
+  assert_false MDB::Key.pack("a", 1).start_with?(MDB::Key.pack("a\0"))
+  with_test_db do |env|
+    db = env.database
+    [["a"], ["a\0"], ["a\0", 1], ["a", 2], ["ab"]].each { |t| db[MDB::Key.pack(*t)] = t.inspect }
+    assert_equal [["a"], ["a", 2]], db.keys(prefix: a).map { |k| MDB::Key.unpack(k) }
+    assert_equal [["a\0"], ["a\0", 1]], db.keys(prefix: a0).map { |k| MDB::Key.unpack(k) }
+  end
+end
+
+assert('MDB::Key keys range-scan in the default comparator') do
+  with_test_db do |env|
+    db = env.database
+    [[2, 5], [1, 300], [1, -7], [1, 20], [3, 0]].each { |t| db[MDB::Key.pack(*t)] = t.inspect }
+    assert_equal [[1, -7], [1, 20], [1, 300]], db.keys(prefix: MDB::Key.pack(1)).map { |k| MDB::Key.unpack(k) }
+    assert_equal ["[1, 20]", "[1, 300]", "[2, 5]"], db.values(from: MDB::Key.pack(1, 0), to: MDB::Key.pack(2, 5))
+  end
+end
+
+assert('Env#database with native comparators') do
+  with_test_db(0, maxdbs: 8) do |env|
+    be = lambda { |i| (0..7).map { |b| ((i >> (56 - 8 * b)) & 0xff).chr }.join }
+    ids = env.database(MDB::CREATE, "ids", compare: :int64_be)
+    [5, -3, 300, 0].each { |i| ids[be.call(i)] = i.to_s }
+    assert_equal %w(-3 0 5 300), ids.values
+
+    desc = env.database(MDB::CREATE, "desc", compare: :reverse)
+    %w(a c b).each { |k| desc[k] = k }
+    assert_equal %w(c b a), desc.keys
+
+    len = env.database(MDB::CREATE, "len", compare: :length)
+    %w(bb a ccc aa).each { |k| len[k] = k }
+    assert_equal %w(a aa bb ccc), len.keys
+
+    dups = env.database(MDB::CREATE | MDB::DUPSORT, "dups", dupsort_compare: :reverse)
+    %w(x z y).each { |v| dups["k"] = v }
+    assert_equal %w(z y x), dups.values
+
+    again = env.database(0, "desc")
+    again["d"] = "d"
+    assert_equal %w(d c b a), again.keys
+    assert_raise(MDB::INCOMPATIBLE) { env.database(0, "desc", compare: :length) }
+    assert_raise(ArgumentError) { env.database(0, "x", compare: :bogus) }
+  end
+end
+
+assert('Env#database records comparators in the file') do
+  with_test_db(0, maxdbs: 8) do |env|
+    desc = env.database(MDB::CREATE, "desc", compare: :reverse)
+    %w(a c b).each { |k| desc[k] = k }
+    plain = env.database(MDB::CREATE, "plain")
+    plain["a"] = "a"
+    assert_raise(MDB::INCOMPATIBLE) { env.database(0, "plain", compare: :reverse) }
+
+    fresh = env.database(MDB::CREATE, "fresh")
+    assert_raise(MDB::INCOMPATIBLE) { env.database(0, "fresh", compare: :length) }
+    fresh.drop(true)
+    again = env.database(MDB::CREATE, "fresh", compare: :reverse)
+    again["a"] = again["b"] = "x"
+    assert_equal %w(b a), again.keys
+
+    path = env.path
+    env.close
+    env = MDB::Env.new(mapsize: 10485760, maxdbs: 8)
+    env.open(path, MDB::NOSUBDIR)
+    assert_equal %w(c b a), env.database(0, "desc").keys
+    assert_raise(MDB::INCOMPATIBLE) { env.database(0, "desc", compare: :length) }
+    assert_raise(MDB::INCOMPATIBLE) { env.database(0, "plain", compare: :reverse) }
+    assert_equal %w(b a), env.database(0, "fresh").keys
+    env.close
+  end
+end
+
+assert('MDB::Index follows puts and deletes on the primary') do
+  with_test_db(0, maxdbs: 8) do |env|
+    users = env.database(MDB::CREATE, "users")
+    by_city = env.database(MDB::CREATE | MDB::DUPSORT, "by_city")
+    idx = MDB::Index.new(users, by_city) { |id, v| v.split(",")[1] }
+    users["1"] = "ann,paris"
+    users["2"] = "bob,oslo"
+    users.batch_put([["3", "cy,paris"]])
+    assert_equal %w(1 3), idx.keys("paris")
+    assert_equal "bob,oslo", idx["oslo"]
+
+    users["1"] = "ann,oslo"
+    assert_equal %w(3), idx.keys("paris")
+    assert_equal [["1", "ann,oslo"], ["2", "bob,oslo"]], idx.entries("oslo")
+    users.del("2")
+    assert_equal %w(ann,oslo), idx.values("oslo")
+    assert_nil idx["rome"]
+
+    assert_raise(RuntimeError) { MDB::Index.new(users, by_city) { raise "boom" }; users["4"] = "x,y" }
+    assert_nil users["4"]
+  end
+end
+
+assert('MDB::Index field: and rebuild') do
+  with_test_db(0, maxdbs: 8) do |env|
+    orders = env.database(MDB::CREATE, "orders")
+    orders["a"] = MDB::Key.pack(7, "x")
+    orders["b"] = MDB::Key.pack(8, "y")
+    by_tenant = env.database(MDB::CREATE | MDB::DUPSORT, "by_tenant")
+    idx = MDB::Index.new(orders, by_tenant, field: 0)
+    assert_equal [], idx.keys(MDB::Key.pack(7))
+    idx.rebuild
+    assert_equal %w(a), idx.keys(MDB::Key.pack(7))
+    orders["c"] = MDB::Key.pack(7, "z")
+    assert_equal %w(a c), idx.keys(MDB::Key.pack(7))
+    assert_raise(ArgumentError) { MDB::Index.new(orders, orders, field: 0) }
+  end
+end
+
+assert('MDB::Index field: on a codec: :native primary') do
+  with_test_db(0, maxdbs: 8) do |env|
+    orders = env.database(MDB::CREATE, "orders", codec: :native)
+    by_tenant = env.database(MDB::CREATE | MDB::DUPSORT, "by_tenant")
+    idx = MDB::Index.new(orders, by_tenant, field: 0)
+    orders["a"] = [7, "x"]
+    orders["b"] = { 0 => 8, "note" => "y" }
+    orders["c"] = []
+    orders["d"] = MDB::Key.pack(7, "z")
+    assert_equal %w(a d), idx.keys(MDB::Key.pack(7))
+    assert_equal %w(b), idx.keys(MDB::Key.pack(8))
+    orders["a"] = ["t", 1]
+    assert_equal %w(d), idx.keys(MDB::Key.pack(7))
+    assert_equal [["a", ["t", 1]]], idx.entries(MDB::Key.pack("t"))
+    assert_equal 3, by_tenant.length
+  end
+end
+
+assert('Database codec: :native round-trips mruby values') do
+  with_test_db do |env|
+    db = env.database(MDB::CREATE, "docs", codec: :native)
+    assert_equal :native, db.codec
+    doc = { "name" => "a", "tags" => [:x, :y], "n" => -300, "f" => 1.5, "ok" => true, "none" => nil }
+    db["1"] = doc
+    db.batch_put([["2", [1, [2, "three"]]], ["3", nil]])
+    assert_equal doc, db["1"]
+    assert_equal [1, [2, "three"]], db["2"]
+    assert_equal nil, db.fetch("3")
+    assert_equal [["1", doc], ["2", [1, [2, "three"]]], ["3", nil]], db.to_a
+    assert_raise(TypeError) { db["4"] = Object.new }
+    assert_raise(KeyError) { db.fetch("4") }
+  end
+end
+
+assert('Database codec: raw values stay readable, DUPSORT rejected') do
+  with_test_db do |env|
+    raw = env.database(MDB::CREATE, "legacy")
+    raw["old"] = "plain"
+    db = env.database(0, "legacy", codec: :native)
+    db["new"] = 42
+    assert_equal "plain", db["old"]
+    assert_equal 42, db["new"]
+    assert_equal 0xC1, raw["new"].getbyte(0)
+    db.codec = :raw
+    assert_equal String, db["new"].class
+    assert_raise(ArgumentError) { env.database(MDB::CREATE | MDB::DUPSORT, "dups", codec: :native) }
+    assert_raise(ArgumentError) { env.database(MDB::CREATE, "other", codec: :yaml) }
+  end
+end
+
+assert('Database codec: and compress: are recorded for later opens') do
+  with_test_db(0, maxdbs: 8) do |env|
+    docs = env.database(MDB::CREATE, "docs", codec: :native, compress: :lz4)
+    doc = { "body" => "lorem ipsum " * 20 }
+    docs["1"] = doc
+    assert_equal doc, env.database(0, "docs")["1"]
+    raw = env.database(0, "docs", codec: :raw, compress: nil)
+    assert_equal 0xC2, raw["1"].getbyte(0)
+    assert_equal [:native, :lz4], [env.database(0, "docs").codec, env.database(0, "docs").compress]
+
+    plain = env.database(MDB::CREATE, "plain", compress: :lz4)
+    plain.compress = nil
+    plain["a"] = "x" * 100
+    env.database(MDB::CREATE, "gone", codec: :native).drop(true)
+
+    path = env.path
+    env.close
+    env = MDB::Env.new(mapsize: 10485760, maxdbs: 8)
+    env.open(path, MDB::NOSUBDIR)
+    again = env.database(0, "docs")
+    assert_equal :native, again.codec
+    assert_equal :lz4, again.compress
+    assert_equal doc, again["1"]
+    assert_nil env.database(0, "plain").compress
+    assert_equal :raw, env.database(MDB::CREATE, "gone").codec
+    env.close
+  end
+end
+
+assert('Database compress: :lz4 stores values compressed') do
+  with_test_db do |env|
+    db  = env.database(MDB::CREATE, "pages", compress: :lz4)
+    raw = env.database(0, "pages", compress: nil)
+    assert_equal :lz4, db.compress
+    text = "<li>item</li>\n" * 500
+    db["big"] = text
+    db.batch_put([["small", "tiny"], ["mark", "\xC2L not a header"]])
+    assert_equal text, db["big"]
+    assert_true raw["big"].bytesize < text.bytesize / 4
+    assert_equal 0xC2, raw["big"].getbyte(0)
+    assert_equal "tiny", raw["small"]
+    assert_equal "\xC2L not a header", db["mark"]
+    assert_equal [text, "\xC2L not a header", "tiny"], db.multi_get(%w(big mark small))
+    seen = {}
+    db.each { |k, v| seen[k] = v }
+    assert_equal text, seen["big"]
+
+    raw["cut"] = raw["big"][0...-8]
+    assert_raise(MDB::CORRUPTED) { db["cut"] }
+    assert_raise(MDB::CORRUPTED) { db.read_at("cut", 0, text.bytesize) }
+    assert_equal text, db["big"]
+  end
+end
+
+assert('Database compress: reads legacy values and stacks with codec:') do
+  with_test_db do |env|
+    raw = env.database(MDB::CREATE, "docs")
+    raw["old"] = "x" * 100
+    db = env.database(0, "docs", codec: :native, compress: :lz4)
+    doc = { "body" => "lorem ipsum " * 50, "n" => 7 }
+    db["new"] = doc
+    assert_equal "x" * 100, db["old"]
+    assert_equal doc, db["new"]
+    db.compress = nil
+    assert_equal String, db["new"].class
+    assert_raise(ArgumentError) { env.database(MDB::CREATE | MDB::DUPSORT, "d", compress: :lz4) }
+    assert_raise(ArgumentError) { env.database(MDB::CREATE, "z", compress: :zstd) }
+  end
+end
+
+assert('Database#train_dictionary compresses small values against a versioned dictionary') do
+  with_test_db(0, maxdbs: 4) do |env|
+    rows = env.database(MDB::CREATE, "rows", compress: :lz4)
+    raw  = env.database(0, "rows", compress: nil)
+    row = lambda { |i| "{\"id\":#{i},\"name\":\"user#{i % 7}\",\"email\":\"user#{i}@example.com\",\"active\":true}" }
+    assert_raise(RuntimeError) { rows.train_dictionary }
+    rows.batch_put((0...200).map { |i| ["a%03d" % i, row.call(i)] })
+    assert_nil rows.dictionary_version
+
+    assert_equal 1, rows.train_dictionary(100)
+    assert_equal 1, rows.dictionary_version
+    rows["b1"] = row.call(1000)
+    assert_equal 0xC2, raw["b1"].getbyte(0)
+    assert_equal "D", raw["b1"][1]
+    assert_true raw["b1"].bytesize < row.call(1000).bytesize
+
+    assert_equal 2, rows.train_dictionary(50, 1024)
+    rows["b2"] = row.call(2000)
+    assert_equal row.call(1000), rows["b1"]
+    assert_equal row.call(2000), rows["b2"]
+    assert_equal row.call(5), rows["a005"]
+
+    again = env.database(0, "rows", compress: :lz4)
+    assert_equal 2, again.dictionary_version
+    assert_equal [row.call(1000), row.call(2000)], again.multi_get(%w(b1 b2))
+  end
+end
+
+assert('Database: a missing dictionary raises MDB::CORRUPTED') do
+  with_test_db(0, maxdbs: 4) do |env|
+    env.max_staleness = 60
+    rows = env.database(MDB::CREATE, "rows", compress: :lz4)
+    row = lambda { |i| "{\"id\":#{i},\"name\":\"user#{i % 7}\",\"email\":\"user#{i}@example.com\",\"active\":true}" }
+    rows.batch_put((0...100).map { |i| ["a%03d" % i, row.call(i)] })
+    rows.train_dictionary(50)
+    rows["b1"] = row.call(1000)
+    assert_equal "D", env.database(0, "rows", compress: nil)["b1"][1]
+    main = env.database
+    main.del("\0mrb-lmdb-dict\0rows\0\0\0\0\1")
+
+    fresh = env.database(0, "rows")
+    assert_raise(MDB::CORRUPTED) { fresh["b1"] }
+    assert_raise(MDB::CORRUPTED) { fresh.to_a }
+    assert_equal row.call(5), fresh["a005"]
+    fresh["c"] = "ok"
+    assert_equal "ok", fresh["c"]
+    assert_raise(ArgumentError) { main.train_dictionary }
+    assert_raise(ArgumentError) { main.rebuild_bloom }
+  end
+end
+
+assert('Database#drop(true) deletes the dictionary and Bloom filter records') do
+  with_test_db(0, maxdbs: 4) do |env|
+    row = lambda { |i| "{\"id\":#{i},\"name\":\"user#{i % 7}\",\"email\":\"user#{i}@example.com\"}" }
+    rows  = env.database(MDB::CREATE, "rows", compress: :lz4)
+    rows2 = env.database(MDB::CREATE, "rows2", compress: :lz4)
+    [rows, rows2].each do |db|
+      db.batch_put((0...100).map { |i| ["a%03d" % i, row.call(i)] })
+      db.train_dictionary(50)
+      db.rebuild_bloom(10)
+    end
+    main = env.database
+    meta = lambda do |name|
+      ["\0mrb-lmdb-dict\0#{name}", "\0mrb-lmdb-bloom\0#{name}"].map do |base|
+        main.keys.select { |k| k == base || (k.start_with?(base + "\0") && k.bytesize == base.bytesize + 5) }
+      end.flatten
+    end
+    assert_false meta.call("rows").empty?
+    rows.drop(true)
+    assert_equal [], meta.call("rows")
+    assert_false meta.call("rows2").empty?
+    assert_equal row.call(5), rows2["a005"]
+    assert_nil env.database(MDB::CREATE, "rows").dictionary_version
+  end
+end
+
+assert('Database cache: serves repeat reads until the next commit') do
+  with_test_db do |env|
+    db = env.database(MDB::CREATE, "hot", cache: 1 << 16)
+    db["a"] = "1"
+    v = db["a"]
+    assert_true v.frozen?
+    assert_same v, db["a"]
+    assert_nil db["nope"]
+    assert_nil db["nope"]
+    assert_equal({ hits: 2, misses: 2, entries: 2 }, db.cache_stats.select { |k, _| [:hits, :misses, :entries].include?(k) })
+
+    other = env.database(0, "hot")
+    other["a"] = "2"
+    assert_equal "2", db["a"]
+    assert_equal 1, db.cache_stats[:entries]
+
+    db.cache_clear
+    assert_equal 0, db.cache_stats[:entries]
+    db.cache = nil
+    assert_nil db.cache_stats
+    assert_false db["a"].frozen?
+    assert_raise(ArgumentError) { env.database(0, "hot", cache: -1) }
+  end
+end
+
+assert('Database cache: evicts least recently used under its limit') do
+  with_test_db do |env|
+    db = env.database(MDB::CREATE, "lru", codec: :native, cache: 1000)
+    db.batch_put((0...20).map { |i| ["k%02d" % i, { "v" => "x" * 100 }] })
+    20.times { |i| db["k%02d" % i] }
+    stats = db.cache_stats
+    assert_true stats[:bytes] <= 1000
+    assert_true stats[:entries] < 20
+    assert_true db["k19"].frozen?
+    assert_true db["k19"]["v"].frozen?
+    assert_equal stats[:hits] + 2, db.cache_stats[:hits]
+    db["k00"]
+    assert_equal stats[:misses] + 1, db.cache_stats[:misses]
+  end
+end
+
+assert('Database#rebuild_bloom answers lookups for absent keys from the filter') do
+  with_test_db do |env|
+    db = env.database(MDB::CREATE, "bloom")
+    db.batch_put((0...500).map { |i| ["k#{i}", "v#{i}"] })
+    assert_nil db.bloom_stats
+    assert_true db.rebuild_bloom(10) > 490
+
+    200.times { |i| assert_nil db["absent#{i}"] }
+    assert_equal "v7", db["k7"]
+    assert_equal ["v1", nil, "v499"], db.multi_get(%w(k1 nope k499))
+    stats = db.bloom_stats
+    assert_equal 7, stats[:hashes]
+    assert_true stats[:keys] > 490
+    assert_true stats[:negatives] > 150
+    assert_true stats[:observed_fp] < 0.2
+    assert_true stats[:estimated_fp] < 0.05
+
+    other = env.database(0, "bloom")
+    other["late"] = "1"
+    other.batch_put([["later", "2"]])
+    other.del("k0")
+    assert_equal "1", db["late"]
+    assert_equal "2", db["later"]
+    assert_nil db["k0"]
+    assert_true db.bloom_stats[:keys] >= stats[:keys]
+    assert_equal 1, db.bloom_stats[:deletes]
+
+    assert_true db.drop_bloom
+    assert_false db.drop_bloom
+    assert_nil db.bloom_stats
+    assert_equal "v9", db["k9"]
+  end
+end
+
+assert('Database: writes that bypass the Bloom filter do not hide keys') do
+  with_test_db do |env|
+    db = env.database(MDB::CREATE, "bloom_raw")
+    db.batch_put((0...100).map { |i| ["k#{i}", "v#{i}"] })
+    db.rebuild_bloom(10)
+    assert_false db.bloom_stats[:stale]
+
+    db.transaction { |txn, dbi| MDB.put(txn, dbi, "raw1", "a") }
+    assert_equal "a", db["raw1"]
+    db.cursor { |c| c.put("raw2", "b") }
+    assert_equal "b", db["raw2"]
+    assert_equal ["a", "b", nil], db.multi_get(%w(raw1 raw2 nope))
+    assert_true db.bloom_stats[:stale]
+
+    db["kept"] = "c"
+    assert_true db.bloom_stats[:stale]
+    env.transaction { |txn| MDB.put(txn, db.dbi, "raw3", "d") }
+    assert_equal "d", db["raw3"]
+
+    db.rebuild_bloom(10)
+    assert_false db.bloom_stats[:stale]
+    db["kept2"] = "e"
+    db.del("k0")
+    assert_false db.bloom_stats[:stale]
+    assert_equal "e", db["kept2"]
+    negatives = db.bloom_stats[:negatives]
+    20.times { |i| db["absent#{i}"] }
+    assert_true db.bloom_stats[:negatives] > negatives
+  end
+end
+
+assert('Database: the Bloom filter survives kept writes elsewhere but not a raw put and del') do
+  with_test_db(maxdbs: 4) do |env|
+    db = env.database(MDB::CREATE, "bloom_pd")
+    db.batch_put((0...100).map { |i| ["k#{i}", "v#{i}"] })
+    db.rebuild_bloom(10)
+    other = env.database(MDB::CREATE, "other")
+    other["x"] = "1"
+    db["k100"] = "v100"
+    assert_false db.bloom_stats[:stale]
+
+    before = db.bloom_stats
+    20.times { |i| assert_equal "v#{i}", db["k#{i}"] }
+    20.times { |i| assert_nil db["absent#{i}"] }
+    after = db.bloom_stats
+    assert_equal 20, after[:negatives] + after[:false_positives] - before[:negatives] - before[:false_positives]
+    assert_true after[:negatives] > before[:negatives]
+
+    db.transaction { |txn, dbi| MDB.put(txn, dbi, "raw", "a"); MDB.del(txn, dbi, "k0") }
+    assert_equal "a", db["raw"]
+    assert_true db.bloom_stats[:stale]
+    fp = db.bloom_stats[:false_positives]
+    5.times { |i| assert_nil db["absent#{i}"] }
+    assert_equal fp, db.bloom_stats[:false_positives]
+    db["k1"] = "w"
+    assert_equal "a", db["raw"]
+    assert_true db.bloom_stats[:stale]
+
+    dups = env.database(MDB::CREATE | MDB::DUPSORT, "dups")
+    assert_raise(ArgumentError) { dups.rebuild_bloom }
+  end
+end
+
+assert('Database#key?, #keys? and #bytesize') do
+  with_test_db do |env|
+    db = env.database(MDB::CREATE, "sizes", compress: :lz4)
+    big = "abc" * 1000
+    db["big"] = big
+    db["small"] = "xy"
+    db["empty"] = ""
+    assert_true db.key?("big")
+    assert_true db.has_key?("empty")
+    assert_false db.key?("nope")
+    assert_equal [true, false, true], db.keys?(%w(small nope empty))
+    assert_equal 3000, db.bytesize("big")
+    assert_equal 2, db.bytesize("small")
+    assert_equal 0, db.bytesize("empty")
+    assert_nil db.bytesize("nope")
+    assert_true env.database(0, "sizes", compress: nil).bytesize("big") < 3000
+
+    db.transaction(MDB::RDONLY) do |txn, dbi|
+      assert_true MDB.exists?(txn, dbi, "small")
+      assert_false MDB.exists?(txn, dbi, "nope")
+    end
+  end
+end
+
+assert('Database#read_at and MDB.read_at return a slice of the value') do
+  with_test_db do |env|
+    db = env.database(MDB::CREATE, "blobs")
+    blob = (0...20000).map { |i| (i % 251).chr }.join
+    db["b"] = blob
+    assert_equal blob.byteslice(0, 64), db.read_at("b", 0, 64)
+    assert_equal blob.byteslice(12345, 100), db.read_at("b", 12345, 100)
+    assert_equal blob.byteslice(19990, 10), db.read_at("b", 19990, 100)
+    assert_equal "", db.read_at("b", 30000, 10)
+    assert_nil db.read_at("nope", 0, 10)
+    assert_raise(ArgumentError) { db.read_at("b", -1, 10) }
+
+    packed = env.database(MDB::CREATE, "packed", compress: :lz4)
+    text = "header:v1;" + "row data " * 2000
+    packed["t"] = text
+    assert_equal "header:v1;", packed.read_at("t", 0, 10)
+    assert_equal text.byteslice(5000, 50), packed.read_at("t", 5000, 50)
+
+    db.transaction(MDB::RDONLY) do |txn, dbi|
+      assert_equal blob.byteslice(100, 5), MDB.read_at(txn, dbi, "b", 100, 5)
+      assert_nil MDB.read_at(txn, dbi, "nope", 0, 1)
+    end
+  end
+end
+
+assert('MDB::Blob streams a value through fixed-size chunks') do
+  with_test_db do |env|
+    db = env.database(MDB::CREATE, "blobs")
+    data = (0...5000).map { |i| (i % 251).chr }.join
+    MDB::Blob.open(db, "art", "w", chunk_size: 64) do |b|
+      i = 0
+      while i < data.bytesize
+        b.write(data.byteslice(i, 37))
+        i += 37
+      end
+    end
+    assert_true MDB::Blob.exist?(db, "art")
+    assert_equal 80, db.length
+
+    MDB::Blob.open(db, "art") do |b|
+      assert_equal 5000, b.size
+      out = ""
+      while (s = b.read(100))
+        out << s
+      end
+      assert_equal data, out
+      assert_true b.eof?
+      b.seek(-10, MDB::Blob::SEEK_END)
+      assert_equal data.byteslice(4990, 10), b.read
+      assert_raise(IOError) { b.write("x") }
+    end
+
+    MDB::Blob.open(db, "art", "r+") do |b|
+      b.seek(60)
+      b.write("X" * 10)
+      b.seek(6000)
+      b.write("end")
+    end
+    b = MDB::Blob.new(db, "art")
+    assert_equal 6003, b.size
+    assert_equal "X" * 10, (b.seek(60); b.read(10))
+    assert_equal "\0" * 5, (b.seek(5500); b.read(5))
+    assert_equal "end", (b.seek(6000); b.read)
+
+    assert_true MDB::Blob.delete(db, "art")
+    assert_false MDB::Blob.exist?(db, "art")
+    assert_equal 0, db.length
+    assert_raise(KeyError) { MDB::Blob.new(db, "art") }
+  end
+end
+
+assert('MDB::Blob "w" replaces an existing blob; codec: :native is refused') do
+  with_test_db do |env|
+    db = env.database(MDB::CREATE, "blobs", compress: :lz4)
+    assert_equal :raw, db.codec
+    MDB::Blob.open(db, "doc", "w", chunk_size: 16) { |b| b.write("a" * 100) }
+    assert_equal 8, db.length
+
+    b = MDB::Blob.new(db, "doc", "w+", chunk_size: 32)
+    assert_equal 0, b.size
+    assert_equal 1, db.length
+    b.write("short")
+    b.close
+    assert_equal 2, db.length
+    MDB::Blob.open(db, "doc") do |r|
+      assert_equal 32, r.chunk_size
+      assert_equal "short", r.read
+    end
+    assert_false MDB::Blob.delete(db, "nope")
+
+    coded = env.database(MDB::CREATE, "coded", codec: :native)
+    assert_raise(ArgumentError) { MDB::Blob.new(coded, "doc", "w") }
+  end
+end
+
+assert('MDB::Blob refuses DUPSORT, indexed and Bloom databases and raises for a missing chunk') do
+  with_test_db(maxdbs: 8) do |env|
+    dups     = env.database(MDB::CREATE | MDB::DUPSORT, "dups")
+    users    = env.database(MDB::CREATE, "users")
+    by_city  = env.database(MDB::CREATE | MDB::DUPSORT, "by_city")
+    filtered = env.database(MDB::CREATE, "filtered")
+    MDB::Index.new(users, by_city) { |id, v| v }
+    filtered["k"] = "v"
+    filtered.rebuild_bloom(10)
+    [dups, users, filtered].each do |db|
+      assert_raise(ArgumentError) { MDB::Blob.new(db, "doc", "w") }
+    end
+
+    db = env.database(MDB::CREATE, "blobs")
+    MDB::Blob.open(db, "doc", "w", chunk_size: 16) do |b|
+      b.write("a" * 20)
+      b.seek(100)
+      b.write("z")
+    end
+    assert_equal 8, db.length
+    b = MDB::Blob.new(db, "doc")
+    assert_equal "\0" * 4, (b.seek(60); b.read(4))
+    db.transaction(MDB::RDONLY) do |txn, dbi|
+      assert_equal "aaaa", db.read_at(MDB::Key.pack("doc", 1), 0, 8, txn)
+      assert_equal "", db.read_at(MDB::Key.pack("doc", 3), 0, 8, txn)
+    end
+
+    db.del(MDB::Key.pack("doc", 2))
+    b.seek(40)
+    assert_raise(MDB::CORRUPTED) { b.read(4) }
+    assert_equal 40, b.pos
+    assert_true MDB::Blob.delete(db, "doc")
+    assert_raise(MDB::NOTFOUND) { b.rewind; b.read(1) }
+  end
+end
+
 assert('Database#batch commits on success') do
   with_test_db do |env|
     db = env.database
@@ -710,6 +1867,20 @@ assert('Txn#reset and renew on RDONLY txn') do
   end
 end
 
+assert('Txn#renew hands back the parked read txn first') do
+  with_test_db do |env|
+    env.max_staleness = 60
+    db = env.database
+    db["k"] = "v"
+    txn = MDB::Txn.new(env, MDB::RDONLY)
+    txn.reset
+    assert_equal "v", db["k"]
+    txn.renew
+    assert_equal "v", MDB.get(txn, db.dbi, "k")
+    txn.abort
+  end
+end
+
 assert('Txn#reset on write txn does not raise') do
   with_test_db do |env|
     txn = MDB::Txn.new(env)
@@ -718,6 +1889,66 @@ assert('Txn#reset on write txn does not raise') do
   end
 end
 
+assert('MDB.get_view returns a zero-copy view or nil') do
+  with_test_db do |env|
+    db = env.database
+    db["k"] = "hello world"
+    env.transaction(MDB::RDONLY) do |txn|
+      v = MDB.get_view(txn, db.dbi, "k")
+      assert_true v.is_a?(MDB::View)
+      assert_equal 11, v.bytesize
+      assert_equal "hello world", v.to_s
+      assert_equal "world", v.byteslice(6, 5)
+      assert_equal "d", v.byteslice(-1)
+      assert_equal 104, v.getbyte(0)
+      assert_true v.start_with?("hello")
+      assert_true v == "hello world"
+      assert_nil MDB.get_view(txn, db.dbi, "missing")
+    end
+  end
+end
+
+assert('MDB::View is invalidated when its txn ends or resets') do
+  with_test_db do |env|
+    db = env.database
+    db["k"] = "v"
+    txn = MDB::Txn.new(env, MDB::RDONLY)
+    v = MDB.get_view(txn, db.dbi, "k")
+    assert_true v.valid?
+    txn.reset
+    assert_false v.valid?
+    assert_raise(RuntimeError) { v.to_s }
+    txn.renew
+    v = MDB.get_view(txn, db.dbi, "k")
+    txn.abort
+    assert_false v.valid?
+    assert_raise(RuntimeError) { v.bytesize }
+  end
+end
+
+assert('MDB.get_view requires a read-only txn') do
+  with_test_db do |env|
+    db = env.database
+    env.transaction { |txn| assert_raise(ArgumentError) { MDB.get_view(txn, db.dbi, "k") } }
+  end
+end
+
+assert('Cursor#get_view and Database#each_view yield views') do
+  with_test_db do |env|
+    db = env.database
+    db["a"] = "1"; db["b"] = "2"
+    db.cursor(MDB::RDONLY) do |c|
+      k, v = c.get_view(MDB::Cursor::FIRST)
+      assert_equal "a", k
+      assert_equal "1", v.to_s
+    end
+    views = []
+    db.each_view { |k, v| views << v; assert_true v.valid? }
+    assert_equal 2, views.size
+    assert_false views[0].valid?
+  end
+end
+
 assert('MDB.get returns value or nil') do
   with_test_db do |env|
     db = env.database
@@ -756,6 +1987,17 @@ assert('MDB.put NOOVERWRITE raises MDB::KEYEXIST') do
   end
 end
 
+assert('MDB errors map to MDB::Error subclasses') do
+  MDB::Error::Error2Class.each_value { |cls| assert_true cls < MDB::Error }
+  with_test_db do |env|
+    db = env.database
+    db["k"] = "v1"
+    assert_raise(MDB::KEYEXIST) do
+      db.transaction { |txn, dbi| MDB.put(txn, dbi, "k", "v2", MDB::NOOVERWRITE) }
+    end
+  end
+end
+
 assert('MDB.del missing key returns nil') do
   with_test_db do |env|
     db = env.database
@@ -1278,3 +2520,42 @@ assert('Cursor iteration block raise cleans up cursor') do
     assert_raise(RuntimeError) { cursor_ref.next }
   end
 end
+
+assert('C++ API: txn, cursor and scans through <mruby/lmdb.hpp>') do
+  with_test_db do |env|
+    all, bytes, prefix, range, stopped, first, copied, missing, deleted, int_range, int_sum = MDBHppTest.scan(env)
+    assert_equal 3, all
+    assert_equal 6, bytes
+    assert_equal 2, prefix
+    assert_equal 2, range
+    assert_equal 2, stopped
+    assert_equal "a:1", first
+    assert_equal "zzz", copied
+    assert_false missing
+    assert_true deleted
+    assert_equal 4, int_range
+    assert_equal 180, int_sum
+
+    db = env.database(0, "hpp_strs")
+    assert_equal "yy", db["a:2"]
+    db.transaction(MDB::RDONLY) { |txn, _| assert_equal 3, MDBHppTest.count(txn, db) }
+  end
+end
+
+assert('C++ API: protect raises MDB::Error after unwinding') do
+  with_test_db do |env|
+    assert_raise(MDB::NOTFOUND) { MDBHppTest.open_missing(env) }
+    env.database["k"] = "v"
+    assert_equal "v", env.database["k"]
+  end
+end
+
+assert('C++ API: txn hands back the parked read txn first') do
+  with_test_db do |env|
+    env.max_staleness = 60
+    env.database["k"] = "v"
+    assert_equal "v", env.database["k"]
+    assert_raise(MDB::NOTFOUND) { MDBHppTest.open_missing(env) }
+    assert_equal "v", env.database["k"]
+  end
+end